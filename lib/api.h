@@ -29,4 +29,5 @@
 #include "cfg.h"
 #include "cmdline.h"
 #include "config.h"
+#include "metrics.h"
 #include "session.h"
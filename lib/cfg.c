@@ -101,6 +101,8 @@ void rm_cfg_set_default(RmCfg *cfg) {
     cfg->skip_start_offset = 0;
     cfg->skip_end_offset = 0;
     cfg->mtime_window = -1;
+    cfg->metrics_interval = 10;
+    cfg->metrics_stream_fd = -1;
 
     rm_trie_init(&cfg->file_trie);
 }
@@ -80,12 +80,14 @@ typedef struct RmCfg {
     gboolean match_without_extension;
     gboolean merge_directories;
     gboolean honour_dir_layout;
+    gboolean snapshots;
     gboolean write_cksum_to_xattr;
     gboolean read_cksum_from_xattr;
     gboolean clear_xattr_fields;
     gboolean write_unfinished;
     gboolean build_fiemap;
     gboolean use_buffered_read;
+    gboolean use_direct_read;
     gboolean fake_fiemap;
     gboolean progress_enabled;
     gboolean list_mounts;
@@ -151,12 +153,20 @@ typedef struct RmCfg {
     guint threads_per_disk;
     RmDigestType checksum_type;
 
+    /* with paranoid checksum_type: hash normally, then verify candidate groups
+     * by comparing them byte-by-byte (see lockstep.h) */
+    gboolean paranoid_lockstep;
+
     /* total number of bytes we are allowed to use (target only) */
     RmOff total_mem;
 
     /* length of read buffers */
     RmOff read_buf_len;
 
+    /* st_dev's of devices to read with O_DIRECT if use_direct_read is set;
+     * NULL means all devices */
+    GHashTable *direct_read_devs;
+
     /* number of bytes to read before going back to start of disk
      * (too big a sweep risks metadata getting pushed out of ram)*/
     RmOff sweep_size;
@@ -166,6 +176,7 @@ typedef struct RmCfg {
     gboolean shred_never_wait;
     gboolean fake_pathindex_as_disk;
     gboolean fake_abort;
+    gboolean fake_lockstep_collisions;
 
     /* If true, files are hold back to
      * the end of the program run and printed then.
@@ -188,6 +199,14 @@ typedef struct RmCfg {
     /* don't use sse accelerations */
     bool no_sse;
 
+    /* --metrics: json file with timings and counters (or NULL), rewritten
+     * every metrics_interval seconds while running */
+    char *metrics_path;
+    gdouble metrics_interval;
+
+    /* --metrics-stream: fd that gets one json line per metrics_interval (or -1) */
+    int metrics_stream_fd;
+
 } RmCfg;
 
 /**
@@ -41,12 +41,15 @@
 #include "checksum.h"
 
 #include "checksums/blake2/blake2.h"
+#include "checksums/blake3/blake3.h"
 #include "checksums/highwayhash.h"
 #include "checksums/metrohash.h"
 #include "checksums/murmur3.h"
+#include "checksums/sha/sha.h"
 #include "checksums/sha3/sha3.h"
 #include "checksums/xxhash/xxhash.h"
 
+#include "metrics.h"
 #include "utilities.h"
 
 #define _RM_CHECKSUM_DEBUG 0
@@ -57,42 +60,213 @@ static int RM_DIGEST_USE_SSE = 0;
 //    BUFFER IMPLEMENTATION     //
 //////////////////////////////////
 
-RmSemaphore *rm_semaphore_new(int n) {
-    RmSemaphore *self = g_malloc0(sizeof(RmSemaphore));
-    g_mutex_init(&self->sem_lock);
-    g_cond_init(&self->sem_cond);
-    self->n = n;
-    return self;
+/* Buffer data is carved out of slabs of this size; with transparent hugepages
+ * enabled one slab maps onto a single 2M page */
+#define RM_BUFFER_SLAB_SIZE (2 * 1024 * 1024)
+
+/* Data blocks are aligned (and padded) to this so they can be used with O_DIRECT */
+#define RM_BUFFER_ALIGN (4096)
+
+/* Max. number of free buffers each thread keeps for itself */
+#define RM_BUFFER_CACHE_SIZE (32)
+
+typedef struct RmBufferSlab {
+    /* mmap()'d memory holding the data blocks */
+    guint8 *data;
+    gsize data_size;
+
+    /* the RmBuffer headers pointing into data */
+    RmBuffer *buffers;
+} RmBufferSlab;
+
+struct RmBufferPool {
+    /* unique id of this pool; used to tell if a thread's cache is stale */
+    gint id;
+
+    /* size of a buffer as seen by the user */
+    gsize buffer_size;
+
+    /* distance between two data blocks in a slab; multiple of RM_BUFFER_ALIGN */
+    gsize stride;
+
+    /* buffers which may still be handed out before rm_buffer_new() blocks;
+     * only used if max_buffers is > 0 */
+    gsize max_buffers;
+    volatile gint quota;
+
+    /* number of threads sleeping in rm_buffer_pool_acquire() */
+    volatile gint waiting;
+
+    /* one reference for the owner plus one for each buffer handed out;
+     * the pool is freed when this drops to zero */
+    volatile gint ref_count;
+
+    /* protects the fields below and is used for sleeping on quota */
+    GMutex lock;
+    GCond cond;
+
+    /* shared stack of free buffers, linked via RmBuffer.user_data */
+    RmBuffer *free_list;
+
+    /* list of RmBufferSlab's */
+    GSList *slabs;
+};
+
+/* Per-thread stash of free buffers, so most rm_buffer_new/rm_buffer_free
+ * calls never touch the pool's lock */
+typedef struct RmBufferCache {
+    /* id of the pool the buffers belong to */
+    gint pool_id;
+    guint n_buffers;
+    RmBuffer *buffers[RM_BUFFER_CACHE_SIZE];
+} RmBufferCache;
+
+static volatile gint RM_BUFFER_POOL_ID = 0;
+
+/* Pools which are still alive, by id; a thread cache only holds the id of its
+ * pool, so this is how it finds its way back (see rm_buffer_cache_flush) */
+static GHashTable *RM_BUFFER_POOLS = NULL;
+static GMutex RM_BUFFER_POOLS_LOCK;
+
+/* Give the cached buffers back to their pool's free list, unless the pool is
+ * gone already (in which case the buffers went with its slabs) */
+static void rm_buffer_cache_flush(RmBufferCache *cache) {
+    if(cache->n_buffers == 0) {
+        return;
+    }
+
+    g_mutex_lock(&RM_BUFFER_POOLS_LOCK);
+    {
+        RmBufferPool *pool =
+            RM_BUFFER_POOLS ? g_hash_table_lookup(RM_BUFFER_POOLS,
+                                                  GINT_TO_POINTER(cache->pool_id))
+                            : NULL;
+        if(pool) {
+            g_mutex_lock(&pool->lock);
+            while(cache->n_buffers > 0) {
+                RmBuffer *buffer = cache->buffers[--cache->n_buffers];
+                buffer->user_data = pool->free_list;
+                pool->free_list = buffer;
+            }
+            g_mutex_unlock(&pool->lock);
+        }
+    }
+    g_mutex_unlock(&RM_BUFFER_POOLS_LOCK);
+
+    cache->n_buffers = 0;
 }
 
-void rm_semaphore_destroy(RmSemaphore *sem) {
-    g_cond_clear(&sem->sem_cond);
-    g_mutex_clear(&sem->sem_lock);
-    g_free(sem);
+static void rm_buffer_cache_free(RmBufferCache *cache) {
+    rm_buffer_cache_flush(cache);
+    g_slice_free(RmBufferCache, cache);
 }
 
-void rm_semaphore_acquire(RmSemaphore *sem) {
-   g_mutex_lock(&sem->sem_lock);
-   while(sem->n == 0) {
-        g_cond_wait(&sem->sem_cond, &sem->sem_lock);
-   }
-   --sem->n;
-   g_mutex_unlock(&sem->sem_lock);
+static GPrivate RM_BUFFER_CACHE = G_PRIVATE_INIT((GDestroyNotify)rm_buffer_cache_free);
+
+static RmBufferCache *rm_buffer_cache_get(RmBufferPool *pool) {
+    RmBufferCache *cache = g_private_get(&RM_BUFFER_CACHE);
+    if(cache == NULL) {
+        cache = g_slice_new0(RmBufferCache);
+        g_private_set(&RM_BUFFER_CACHE, cache);
+    }
+
+    if(cache->pool_id != pool->id) {
+        /* this thread switched pools; the old one gets its buffers back */
+        rm_buffer_cache_flush(cache);
+        cache->pool_id = pool->id;
+    }
+    return cache;
 }
 
-void rm_semaphore_release(RmSemaphore *sem) {
-   g_mutex_lock(&sem->sem_lock);
-   ++sem->n;
-   g_mutex_unlock(&sem->sem_lock);
-   g_cond_signal(&sem->sem_cond);
+/* Allocate a new slab and push its buffers on the free list; pool->lock must be held */
+static void rm_buffer_pool_add_slab(RmBufferPool *pool) {
+    gsize n_buffers = MAX(1, RM_BUFFER_SLAB_SIZE / pool->stride);
+    gsize data_size = n_buffers * pool->stride;
+
+    RmBufferSlab *slab = g_slice_new0(RmBufferSlab);
+    slab->data_size = data_size;
+    slab->data = mmap(NULL, data_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(slab->data == MAP_FAILED) {
+        rm_log_perror("mmap of buffer slab failed");
+        g_error("out of memory");
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(data_size >= RM_BUFFER_SLAB_SIZE) {
+        /* Just a hint; fails silently when THP is disabled */
+        madvise(slab->data, data_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    slab->buffers = g_new0(RmBuffer, n_buffers);
+    for(gsize i = 0; i < n_buffers; i++) {
+        RmBuffer *buffer = &slab->buffers[i];
+        buffer->pool = pool;
+        buffer->buf_size = pool->buffer_size;
+        buffer->data = slab->data + i * pool->stride;
+        buffer->user_data = pool->free_list;
+        pool->free_list = buffer;
+    }
+
+    pool->slabs = g_slist_prepend(pool->slabs, slab);
+}
+
+static void rm_buffer_slab_free(RmBufferSlab *slab) {
+    munmap(slab->data, slab->data_size);
+    g_free(slab->buffers);
+    g_slice_free(RmBufferSlab, slab);
+}
+
+static void rm_buffer_pool_free(RmBufferPool *pool) {
+    /* waits for any rm_buffer_cache_flush() that is just returning buffers */
+    g_mutex_lock(&RM_BUFFER_POOLS_LOCK);
+    g_hash_table_remove(RM_BUFFER_POOLS, GINT_TO_POINTER(pool->id));
+    g_mutex_unlock(&RM_BUFFER_POOLS_LOCK);
+
+    g_slist_free_full(pool->slabs, (GDestroyNotify)rm_buffer_slab_free);
+    g_cond_clear(&pool->cond);
+    g_mutex_clear(&pool->lock);
+    g_slice_free(RmBufferPool, pool);
 }
 
-////////////////////
+RmBufferPool *rm_buffer_pool_new(gsize buffer_size, gsize max_buffers) {
+    g_assert(buffer_size > 0);
+
+    RmBufferPool *self = g_slice_new0(RmBufferPool);
+    self->id = g_atomic_int_add(&RM_BUFFER_POOL_ID, 1) + 1;
+    self->buffer_size = buffer_size;
+    self->stride = (buffer_size + RM_BUFFER_ALIGN - 1) & ~((gsize)RM_BUFFER_ALIGN - 1);
+    self->max_buffers = max_buffers;
+    self->quota = max_buffers;
+    self->ref_count = 1;
+    g_mutex_init(&self->lock);
+    g_cond_init(&self->cond);
+
+    g_mutex_lock(&RM_BUFFER_POOLS_LOCK);
+    {
+        if(RM_BUFFER_POOLS == NULL) {
+            RM_BUFFER_POOLS = g_hash_table_new(NULL, NULL);
+        }
+        g_hash_table_insert(RM_BUFFER_POOLS, GINT_TO_POINTER(self->id), self);
+    }
+    g_mutex_unlock(&RM_BUFFER_POOLS_LOCK);
+    return self;
+}
+
+void rm_buffer_pool_destroy(RmBufferPool *pool) {
+    if(g_atomic_int_dec_and_test(&pool->ref_count)) {
+        rm_buffer_pool_free(pool);
+    }
+    /* else: buffers are still held somewhere (usually by paranoid digests);
+     * the last rm_buffer_free() will clean up */
+}
 
-RmBuffer *rm_buffer_new(RmSemaphore *sem, gsize buf_size) {
+static void rm_buffer_pool_acquire(RmBufferPool *pool) {
     /* NOTE: Here is a catch:
      *
-     * We should only allocate a buffer if we do not surpass
+     * We should only hand out a buffer if we do not surpass
      * a certain number of buffers in memory. If the filesystem
      * is faster than the CPU is able to hash the input, we might
      * slowly allocate too many buffers, causing memory issues.
@@ -106,26 +280,103 @@ RmBuffer *rm_buffer_new(RmSemaphore *sem, gsize buf_size) {
      *
      *  https://github.com/sahib/rmlint/issues/309
      *
-     * The semaphore is not used in paranoia mode.
+     * The quota is not used in paranoia mode (max_buffers == 0).
      */
-    if(sem != NULL) {
-        rm_semaphore_acquire(sem);
+    if(pool->max_buffers == 0) {
+        return;
+    }
+
+    while(TRUE) {
+        gint quota = g_atomic_int_get(&pool->quota);
+        if(quota > 0) {
+            if(g_atomic_int_compare_and_exchange(&pool->quota, quota, quota - 1)) {
+                return;
+            }
+            continue;
+        }
+
+        /* out of quota; sleep until rm_buffer_pool_release() wakes us */
+        g_mutex_lock(&pool->lock);
+        {
+            g_atomic_int_inc(&pool->waiting);
+            while(g_atomic_int_get(&pool->quota) <= 0) {
+                g_cond_wait(&pool->cond, &pool->lock);
+            }
+            g_atomic_int_add(&pool->waiting, -1);
+        }
+        g_mutex_unlock(&pool->lock);
     }
+}
+
+static void rm_buffer_pool_release(RmBufferPool *pool) {
+    if(pool->max_buffers == 0) {
+        return;
+    }
+
+    g_atomic_int_inc(&pool->quota);
 
-    RmBuffer *self = g_slice_new0(RmBuffer);
-    self->data = g_slice_alloc(buf_size);
-    self->buf_size = buf_size;
+    /* waiters increment pool->waiting before checking the quota,
+     * so either they see our increment or we see theirs */
+    if(g_atomic_int_get(&pool->waiting) > 0) {
+        g_mutex_lock(&pool->lock);
+        g_cond_signal(&pool->cond);
+        g_mutex_unlock(&pool->lock);
+    }
+}
+
+RmBuffer *rm_buffer_new(RmBufferPool *pool) {
+    rm_buffer_pool_acquire(pool);
+
+    RmBufferCache *cache = rm_buffer_cache_get(pool);
+    if(cache->n_buffers == 0) {
+        /* refill half of the cache from the shared stack */
+        g_mutex_lock(&pool->lock);
+        {
+            while(cache->n_buffers < RM_BUFFER_CACHE_SIZE / 2) {
+                if(pool->free_list == NULL) {
+                    rm_buffer_pool_add_slab(pool);
+                }
+                RmBuffer *buffer = pool->free_list;
+                pool->free_list = buffer->user_data;
+                cache->buffers[cache->n_buffers++] = buffer;
+            }
+        }
+        g_mutex_unlock(&pool->lock);
+    }
+
+    RmBuffer *self = cache->buffers[--cache->n_buffers];
+    self->digest = NULL;
+    self->user_data = NULL;
+    self->len = 0;
+
+    g_atomic_int_inc(&pool->ref_count);
     return self;
 }
 
-void rm_buffer_free(RmSemaphore *sem, RmBuffer *buf) {
-    /*  See the explanation in rm_buffer_new */
-    if(sem != NULL) {
-        rm_semaphore_release(sem);
+void rm_buffer_free(RmBuffer *buf) {
+    RmBufferPool *pool = buf->pool;
+
+    RmBufferCache *cache = rm_buffer_cache_get(pool);
+    if(cache->n_buffers == RM_BUFFER_CACHE_SIZE) {
+        /* give half of the cache back, so other threads can use them */
+        g_mutex_lock(&pool->lock);
+        {
+            while(cache->n_buffers > RM_BUFFER_CACHE_SIZE / 2) {
+                RmBuffer *buffer = cache->buffers[--cache->n_buffers];
+                buffer->user_data = pool->free_list;
+                pool->free_list = buffer;
+            }
+        }
+        g_mutex_unlock(&pool->lock);
     }
+    cache->buffers[cache->n_buffers++] = buf;
+
+    /*  See the explanation in rm_buffer_pool_acquire */
+    rm_buffer_pool_release(pool);
 
-    g_slice_free1(buf->buf_size, buf->data);
-    g_slice_free(RmBuffer, buf);
+    if(g_atomic_int_dec_and_test(&pool->ref_count)) {
+        rm_buffer_pool_free(pool);
+    }
 }
 
 static gboolean rm_buffer_equal(RmBuffer *a, RmBuffer *b) {
@@ -153,8 +404,65 @@ typedef struct RmDigestInterface {
     RmDigestUpdateFunc update;  // hashes data into state
     RmDigestCopyFunc copy;      // allocates and returns a copy of passed state
     RmDigestStealFunc steal;    // writes checksum (as binary) to *result
+    gsize state_size;           // size of a flat state that can be recycled (or 0)
 } RmDigestInterface;
 
+///////////////////////////
+//   state free lists    //
+///////////////////////////
+
+/* Progressive hashing gives every file of a group a copy of the group digest
+ * (or a new digest in the first generation), and paranoid mode gives every
+ * file a new digest.  Instead of allocating and freeing a state per file,
+ * flat states (see state_size) and paranoid states are recycled through a
+ * free list per digest type. */
+#define RM_DIGEST_STATE_CACHE_LEN (256)
+
+typedef struct RmDigestStateCache {
+    GMutex lock;
+
+    /* recycled states, linked via their first pointer */
+    gpointer head;
+    guint len;
+
+    /* result of interface->new(); new flat states are copies of it */
+    gpointer fresh;
+} RmDigestStateCache;
+
+static RmDigestStateCache RM_DIGEST_STATE_CACHES[RM_DIGEST_SENTINEL];
+
+/* Take a recycled state of type; NULL if there is none */
+static gpointer rm_digest_state_pop(RmDigestType type) {
+    RmDigestStateCache *cache = &RM_DIGEST_STATE_CACHES[type];
+    g_mutex_lock(&cache->lock);
+    gpointer state = cache->head;
+    if(state) {
+        cache->head = *(gpointer *)state;
+        cache->len--;
+    }
+    g_mutex_unlock(&cache->lock);
+
+    if(state) {
+        rm_metrics_count(RM_METRICS_DIGEST_STATES_REUSED, 1);
+    }
+    return state;
+}
+
+/* Keep state for reuse; false if the free list of type is full */
+static bool rm_digest_state_push(RmDigestType type, gpointer state) {
+    RmDigestStateCache *cache = &RM_DIGEST_STATE_CACHES[type];
+    bool kept = false;
+    g_mutex_lock(&cache->lock);
+    if(cache->len < RM_DIGEST_STATE_CACHE_LEN) {
+        *(gpointer *)state = cache->head;
+        cache->head = state;
+        cache->len++;
+        kept = true;
+    }
+    g_mutex_unlock(&cache->lock);
+    return kept;
+}
+
 ///////////////////////////
 //   xxhash interface    //
 ///////////////////////////
@@ -183,7 +491,8 @@ static const RmDigestInterface xxhash_interface = {
     .free = (RmDigestFreeFunc)XXH64_freeState,
     .update = (RmDigestUpdateFunc)XXH64_update,
     .copy = (RmDigestCopyFunc)rm_digest_xxhash_copy,
-    .steal = rm_digest_xxhash_steal};
+    .steal = rm_digest_xxhash_steal,
+    .state_size = sizeof(XXH64_state_t)};
 
 ///////////////////////////
 //        murmur         //
@@ -422,7 +731,8 @@ static const RmDigestInterface highway64_interface = {
     .free = (RmDigestFreeFunc)rm_digest_highway_free,
     .update = (RmDigestUpdateFunc)rm_digest_highway_update,
     .copy = (RmDigestCopyFunc)rm_digest_highway_copy,
-    .steal = (RmDigestStealFunc)rm_digest_highway64_steal};
+    .steal = (RmDigestStealFunc)rm_digest_highway64_steal,
+    .state_size = sizeof(HighwayHashCat)};
 
 static const RmDigestInterface highway128_interface = {
     .name = "highway128",
@@ -432,7 +742,8 @@ static const RmDigestInterface highway128_interface = {
     .free = (RmDigestFreeFunc)rm_digest_highway_free,
     .update = (RmDigestUpdateFunc)rm_digest_highway_update,
     .copy = (RmDigestCopyFunc)rm_digest_highway_copy,
-    .steal = (RmDigestStealFunc)HighwayHashCatFinish128};
+    .steal = (RmDigestStealFunc)HighwayHashCatFinish128,
+    .state_size = sizeof(HighwayHashCat)};
 
 static const RmDigestInterface highway256_interface = {
     .name = "highway256",
@@ -442,7 +753,8 @@ static const RmDigestInterface highway256_interface = {
     .free = (RmDigestFreeFunc)rm_digest_highway_free,
     .update = (RmDigestUpdateFunc)rm_digest_highway_update,
     .copy = (RmDigestCopyFunc)rm_digest_highway_copy,
-    .steal = (RmDigestStealFunc)HighwayHashCatFinish256};
+    .steal = (RmDigestStealFunc)HighwayHashCatFinish256,
+    .state_size = sizeof(HighwayHashCat)};
 
 ///////////////////////////
 //      glib hashes      //
@@ -476,30 +788,6 @@ static void rm_digest_md5_steal(GChecksum *state, guint8 *result) {
 }
 RM_DIGEST_DEFINE_GLIB(md5, 128);
 
-/* sha1 */
-static GChecksum *rm_digest_sha1_new(void) {
-    return g_checksum_new(G_CHECKSUM_SHA1);
-}
-
-static void rm_digest_sha1_steal(GChecksum *state, guint8 *result) {
-    gsize len = 20;
-    rm_digest_glib_steal(state, result, &len);
-}
-
-RM_DIGEST_DEFINE_GLIB(sha1, 160);
-
-/* sha256 */
-static GChecksum *rm_digest_sha256_new(void) {
-    return g_checksum_new(G_CHECKSUM_SHA256);
-}
-
-static void rm_digest_sha256_steal(GChecksum *state, guint8 *result) {
-    gsize len = 32;
-    rm_digest_glib_steal(state, result, &len);
-}
-
-RM_DIGEST_DEFINE_GLIB(sha256, 256);
-
 #if HAVE_SHA512
 
 /* sha512 */
@@ -515,6 +803,47 @@ RM_DIGEST_DEFINE_GLIB(sha512, 512);
 
 #endif
 
+///////////////////////////
+//    sha1 and sha256    //
+///////////////////////////
+
+/* Native implementations (using SHA-NI where available) instead of
+ * GChecksum; their state is a flat struct, so copy and steal are cheap. */
+
+#define RM_DIGEST_DEFINE_SHA(NAME, BIG)                                                 \
+    static NAME##_state *rm_digest_##NAME##_new(void) {                                 \
+        NAME##_state *state = g_slice_new(NAME##_state);                                \
+        NAME##_init(state);                                                             \
+        return state;                                                                   \
+    }                                                                                   \
+                                                                                        \
+    static void rm_digest_##NAME##_free(NAME##_state *state) {                          \
+        g_slice_free(NAME##_state, state);                                              \
+    }                                                                                   \
+                                                                                        \
+    static NAME##_state *rm_digest_##NAME##_copy(NAME##_state *state) {                 \
+        return g_slice_copy(sizeof(NAME##_state), state);                               \
+    }                                                                                   \
+                                                                                        \
+    static void rm_digest_##NAME##_steal(NAME##_state *state, guint8 *result) {         \
+        NAME##_state copy = *state;                                                     \
+        NAME##_final(&copy, result);                                                    \
+    }                                                                                   \
+                                                                                        \
+    static const RmDigestInterface NAME##_interface = {                                 \
+        .name = #NAME,                                                                  \
+        .bits = 8 * BIG##_OUTBYTES,                                                     \
+        .len = NULL,                                                                    \
+        .new = (RmDigestNewFunc)rm_digest_##NAME##_new,                                 \
+        .free = (RmDigestFreeFunc)rm_digest_##NAME##_free,                              \
+        .update = (RmDigestUpdateFunc)NAME##_update,                                    \
+        .copy = (RmDigestCopyFunc)rm_digest_##NAME##_copy,                              \
+        .steal = (RmDigestStealFunc)rm_digest_##NAME##_steal,                           \
+        .state_size = sizeof(NAME##_state)};
+
+RM_DIGEST_DEFINE_SHA(sha1, SHA1);
+RM_DIGEST_DEFINE_SHA(sha256, SHA256);
+
 ///////////////////////////
 //      sha3 hashes      //
 ///////////////////////////
@@ -572,7 +901,8 @@ static void rm_digest_sha3_512_steal(sha3_context *state, guint8 *result) {
         .free = (RmDigestFreeFunc)rm_digest_sha3_free,         \
         .update = (RmDigestUpdateFunc)sha3_Update,             \
         .copy = (RmDigestCopyFunc)rm_digest_sha3_copy,         \
-        .steal = (RmDigestStealFunc)rm_digest_sha3_##BITS##_steal};
+        .steal = (RmDigestStealFunc)rm_digest_sha3_##BITS##_steal, \
+        .state_size = sizeof(sha3_context)};
 
 RM_DIGEST_DEFINE_SHA3(256)
 RM_DIGEST_DEFINE_SHA3(384)
@@ -614,13 +944,297 @@ RM_DIGEST_DEFINE_SHA3(512)
         .free = (RmDigestFreeFunc)rm_digest_##ALGO##_free,                      \
         .update = (RmDigestUpdateFunc)ALGO##_update,                            \
         .copy = (RmDigestCopyFunc)rm_digest_##ALGO##_copy,                      \
-        .steal = (RmDigestStealFunc)rm_digest_##ALGO##_steal};
+        .steal = (RmDigestStealFunc)rm_digest_##ALGO##_steal,                   \
+        .state_size = sizeof(ALGO##_state)};
 
 CREATE_BLAKE_INTERFACE(blake2b, BLAKE2B);
 CREATE_BLAKE_INTERFACE(blake2bp, BLAKE2B);
 CREATE_BLAKE_INTERFACE(blake2s, BLAKE2S);
 CREATE_BLAKE_INTERFACE(blake2sp, BLAKE2S);
 
+///////////////////////////
+//        blake3         //
+///////////////////////////
+
+/* BLAKE3 is a tree hash, so big updates can be split into subtrees which are
+ * hashed on several threads.  Input is collected until RM_BLAKE3_BATCH_LEN
+ * bytes are pending; each batch is then hashed by the caller and the helper
+ * threads of a process-wide pool.  Batches stay aligned in the tree since
+ * only whole batches are passed to the hasher; the (unaligned) rest is added
+ * to a copy of the state when the checksum is stolen. */
+#define RM_BLAKE3_BATCH_LEN (1024 * 1024)
+
+/* smaller jobs are not worth waking another thread for */
+#define RM_BLAKE3_MIN_JOB_LEN (64 * 1024)
+
+/* initial size of the pending buffer; it grows up to RM_BLAKE3_BATCH_LEN */
+#define RM_BLAKE3_MIN_PENDING_SIZE (16 * 1024)
+
+/* default for RM_BLAKE3_PENDING_LIMIT */
+#define RM_BLAKE3_DEFAULT_PENDING_LIMIT (64 * 1024 * 1024)
+
+/* set by rm_digest_set_blake3_limits(): threads one digest may use (0: one per
+ * cpu) and the bytes all pending buffers together may take */
+static gint RM_BLAKE3_THREADS = 0;
+static gint64 RM_BLAKE3_PENDING_LIMIT = RM_BLAKE3_DEFAULT_PENDING_LIMIT;
+
+/* bytes currently allocated for pending buffers */
+static gint64 RM_BLAKE3_PENDING_TOTAL = 0;
+
+typedef struct RmDigestBlake3 {
+    blake3_hasher hasher;
+    /* pending_size bytes; NULL until needed */
+    guint8 *pending;
+    gsize pending_len;
+    gsize pending_size;
+} RmDigestBlake3;
+
+/* one call of the subtree runner */
+typedef struct RmBlake3Batch {
+    blake3_subtree_job *jobs;
+    gint n_jobs;
+    gint next_job;
+    gint jobs_left;
+
+    /* caller + each queued helper */
+    gint ref_count;
+
+    GMutex lock;
+    GCond done;
+} RmBlake3Batch;
+
+static void rm_blake3_batch_unref(RmBlake3Batch *batch) {
+    if(g_atomic_int_dec_and_test(&batch->ref_count)) {
+        g_mutex_clear(&batch->lock);
+        g_cond_clear(&batch->done);
+        g_slice_free(RmBlake3Batch, batch);
+    }
+}
+
+/* Claim and run jobs until none are left.  Once all jobs are claimed this no
+ * longer touches batch->jobs, which belong to the caller's stack. */
+static void rm_blake3_batch_work(RmBlake3Batch *batch) {
+    gint index = 0;
+    while((index = g_atomic_int_add(&batch->next_job, 1)) < batch->n_jobs) {
+        blake3_subtree_job_run(&batch->jobs[index]);
+        if(g_atomic_int_dec_and_test(&batch->jobs_left)) {
+            g_mutex_lock(&batch->lock);
+            g_cond_signal(&batch->done);
+            g_mutex_unlock(&batch->lock);
+        }
+    }
+}
+
+static void rm_blake3_helper(RmBlake3Batch *batch, _UNUSED gpointer user_data) {
+    rm_blake3_batch_work(batch);
+    rm_blake3_batch_unref(batch);
+}
+
+static gint rm_blake3_n_helpers(void) {
+    gint n_threads = (gint)g_get_num_processors();
+    gint max_threads = g_atomic_int_get(&RM_BLAKE3_THREADS);
+    if(max_threads > 0) {
+        n_threads = MIN(n_threads, max_threads);
+    }
+    return n_threads - 1;
+}
+
+static gpointer rm_blake3_pool_new(_UNUSED gpointer data) {
+    gint n_helpers = rm_blake3_n_helpers();
+    if(n_helpers < 1) {
+        return NULL;
+    }
+    return rm_util_thread_pool_new((GFunc)rm_blake3_helper, NULL, n_helpers);
+}
+
+/* helper threads shared by all blake3 digests; NULL on single cpu machines */
+static GThreadPool *rm_blake3_pool(void) {
+    static GOnce pool_once = G_ONCE_INIT;
+    return g_once(&pool_once, rm_blake3_pool_new, NULL);
+}
+
+static void rm_blake3_run_jobs(blake3_subtree_job *jobs, size_t n_jobs,
+                               GThreadPool *pool) {
+    RmBlake3Batch *batch = g_slice_new(RmBlake3Batch);
+    batch->jobs = jobs;
+    batch->n_jobs = n_jobs;
+    batch->next_job = 0;
+    batch->jobs_left = n_jobs;
+    g_mutex_init(&batch->lock);
+    g_cond_init(&batch->done);
+
+    /* the calling thread does its share too */
+    gint n_helpers = MIN((gint)n_jobs - 1, g_thread_pool_get_max_threads(pool));
+    batch->ref_count = 1 + n_helpers;
+    for(gint i = 0; i < n_helpers; i++) {
+        g_thread_pool_push(pool, batch, NULL);
+    }
+
+    rm_blake3_batch_work(batch);
+
+    /* helpers that start late find nothing left to do; no need to wait for them */
+    g_mutex_lock(&batch->lock);
+    while(g_atomic_int_get(&batch->jobs_left) > 0) {
+        g_cond_wait(&batch->done, &batch->lock);
+    }
+    g_mutex_unlock(&batch->lock);
+
+    rm_blake3_batch_unref(batch);
+}
+
+static void rm_digest_blake3_hash_batches(RmDigestBlake3 *state, const guint8 *data,
+                                          gsize size) {
+    GThreadPool *pool = rm_blake3_pool();
+    blake3_hasher_update_parallel(&state->hasher, data, size,
+                                  g_thread_pool_get_max_threads(pool) + 1,
+                                  RM_BLAKE3_MIN_JOB_LEN,
+                                  (blake3_subtree_runner)rm_blake3_run_jobs, pool);
+}
+
+static RmDigestBlake3 *rm_digest_blake3_new(void) {
+    RmDigestBlake3 *state = g_slice_new0(RmDigestBlake3);
+    blake3_hasher_init(&state->hasher);
+    return state;
+}
+
+/* free the pending buffer (which must be empty by now) */
+static void rm_digest_blake3_release(RmDigestBlake3 *state) {
+    __atomic_fetch_sub(&RM_BLAKE3_PENDING_TOTAL, (gint64)state->pending_size,
+                       __ATOMIC_RELAXED);
+    g_free(state->pending);
+    state->pending = NULL;
+    state->pending_size = 0;
+}
+
+static void rm_digest_blake3_free(RmDigestBlake3 *state) {
+    rm_digest_blake3_release(state);
+    g_slice_free(RmDigestBlake3, state);
+}
+
+/* Make room for len pending bytes.  Many digests are in flight at once and
+ * most of them only ever see a few kilobytes, so don't go for a whole batch
+ * straight away.  Returns false if that would exceed RM_BLAKE3_PENDING_LIMIT;
+ * the caller has to hash serially then */
+static bool rm_digest_blake3_reserve(RmDigestBlake3 *state, gsize len) {
+    if(len <= state->pending_size) {
+        return true;
+    }
+
+    gsize size = MAX(state->pending_size, RM_BLAKE3_MIN_PENDING_SIZE);
+    while(size < len) {
+        size *= 2;
+    }
+    size = MIN(size, RM_BLAKE3_BATCH_LEN);
+
+    gint64 grow = size - state->pending_size;
+    gint64 total = __atomic_add_fetch(&RM_BLAKE3_PENDING_TOTAL, grow, __ATOMIC_RELAXED);
+    if(total > __atomic_load_n(&RM_BLAKE3_PENDING_LIMIT, __ATOMIC_RELAXED)) {
+        __atomic_fetch_sub(&RM_BLAKE3_PENDING_TOTAL, grow, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    state->pending_size = size;
+    state->pending = g_realloc(state->pending, state->pending_size);
+    return true;
+}
+
+/* hash the pending bytes without helpers and give the buffer back */
+static void rm_digest_blake3_flush(RmDigestBlake3 *state) {
+    blake3_hasher_update(&state->hasher, state->pending, state->pending_len);
+    state->pending_len = 0;
+    rm_digest_blake3_release(state);
+}
+
+static void rm_digest_blake3_update(RmDigestBlake3 *state, const unsigned char *data,
+                                    size_t size) {
+    if(!rm_blake3_pool()) {
+        blake3_hasher_update(&state->hasher, data, size);
+        return;
+    }
+
+    if(state->pending_len > 0) {
+        /* top up the pending batch first */
+        gsize take = MIN(size, RM_BLAKE3_BATCH_LEN - state->pending_len);
+        if(rm_digest_blake3_reserve(state, state->pending_len + take)) {
+            memcpy(state->pending + state->pending_len, data, take);
+            state->pending_len += take;
+            data += take;
+            size -= take;
+        } else {
+            /* out of pending memory */
+            rm_digest_blake3_flush(state);
+        }
+
+        if(state->pending_len == RM_BLAKE3_BATCH_LEN) {
+            rm_digest_blake3_hash_batches(state, state->pending, RM_BLAKE3_BATCH_LEN);
+            state->pending_len = 0;
+        } else if(size == 0) {
+            return;
+        }
+    }
+
+    /* whole batches can be hashed straight from the caller's buffer */
+    gsize direct_len = size - size % RM_BLAKE3_BATCH_LEN;
+    if(direct_len > 0) {
+        rm_digest_blake3_hash_batches(state, data, direct_len);
+        data += direct_len;
+        size -= direct_len;
+    }
+
+    if(size == 0) {
+        return;
+    } else if(rm_digest_blake3_reserve(state, size)) {
+        memcpy(state->pending, data, size);
+        state->pending_len = size;
+    } else {
+        blake3_hasher_update(&state->hasher, data, size);
+    }
+}
+
+static RmDigestBlake3 *rm_digest_blake3_copy(RmDigestBlake3 *state) {
+    RmDigestBlake3 *copy = g_slice_copy(sizeof(RmDigestBlake3), state);
+    copy->pending = NULL;
+    copy->pending_size = 0;
+    if(state->pending_len == 0) {
+        /* nothing to copy */
+    } else if(rm_digest_blake3_reserve(copy, state->pending_len)) {
+        /* sized for the pending bytes only; grows again if the copy is updated */
+        memcpy(copy->pending, state->pending, state->pending_len);
+    } else {
+        blake3_hasher_update(&copy->hasher, state->pending, state->pending_len);
+        copy->pending_len = 0;
+    }
+    return copy;
+}
+
+static void rm_digest_blake3_steal(RmDigestBlake3 *state, guint8 *result) {
+    if(state->pending_len == 0) {
+        blake3_hasher_finalize(&state->hasher, result, BLAKE3_OUT_LEN);
+        return;
+    }
+
+    /* less than a batch left; not worth the threads */
+    blake3_hasher *copy = g_slice_copy(sizeof(blake3_hasher), &state->hasher);
+    blake3_hasher_update(copy, state->pending, state->pending_len);
+    blake3_hasher_finalize(copy, result, BLAKE3_OUT_LEN);
+    g_slice_free(blake3_hasher, copy);
+}
+
+void rm_digest_set_blake3_limits(guint threads, gsize pending_mem) {
+    g_atomic_int_set(&RM_BLAKE3_THREADS, threads);
+    __atomic_store_n(&RM_BLAKE3_PENDING_LIMIT, (gint64)pending_mem, __ATOMIC_RELAXED);
+}
+
+static const RmDigestInterface blake3_interface = {
+    .name = "blake3",
+    .bits = 8 * BLAKE3_OUT_LEN,
+    .len = NULL,
+    .new = (RmDigestNewFunc)rm_digest_blake3_new,
+    .free = (RmDigestFreeFunc)rm_digest_blake3_free,
+    .update = (RmDigestUpdateFunc)rm_digest_blake3_update,
+    .copy = (RmDigestCopyFunc)rm_digest_blake3_copy,
+    .steal = (RmDigestStealFunc)rm_digest_blake3_steal};
+
 ///////////////////////////
 //      ext  hash        //
 ///////////////////////////
@@ -690,19 +1304,51 @@ static const RmDigestInterface ext_interface = {
     .copy = (RmDigestCopyFunc)rm_digest_ext_copy,
     .steal = (RmDigestStealFunc)rm_digest_ext_steal};
 
+///////////////////////////
+//      inode 'hash'     //
+///////////////////////////
+
+/* Stands for the data of an inode that was not read (--snapshots).  The
+ * bytes are taken as they are; being of its own type, it never compares
+ * equal to a digest of real data even if the bytes happen to match */
+static void rm_digest_inode_update(RmDigestExt *state, const unsigned char *data,
+                                   RmOff size) {
+    rm_digest_ext_free_data(state);
+    state->len = size;
+    state->data = g_slice_copy(size, data);
+}
+
+static const RmDigestInterface inode_interface = {
+    .name = "inode",
+    .bits = 0,
+    .len = (RmDigestLenFunc)rm_digest_ext_len,
+    .new = (RmDigestNewFunc)rm_digest_ext_new,
+    .free = (RmDigestFreeFunc)rm_digest_ext_free,
+    .update = (RmDigestUpdateFunc)rm_digest_inode_update,
+    .copy = (RmDigestCopyFunc)rm_digest_ext_copy,
+    .steal = (RmDigestStealFunc)rm_digest_ext_steal};
+
 ///////////////////////////
 //     paranoid 'hash'   //
 ///////////////////////////
 
 static RmParanoid *rm_digest_paranoid_new(void) {
-    RmParanoid *paranoid = g_slice_new0(RmParanoid);
-    paranoid->incoming_twin_candidates = g_async_queue_new();
+    RmParanoid *paranoid = rm_digest_state_pop(RM_DIGEST_PARANOID);
+    if(paranoid) {
+        /* keep the (drained) queue of the recycled state */
+        GAsyncQueue *incoming = paranoid->incoming_twin_candidates;
+        memset(paranoid, 0, sizeof(RmParanoid));
+        paranoid->incoming_twin_candidates = incoming;
+    } else {
+        paranoid = g_slice_new0(RmParanoid);
+        paranoid->incoming_twin_candidates = g_async_queue_new();
+    }
     paranoid->shadow_hash = rm_digest_new(RM_DIGEST_XXHASH, 0);
     return paranoid;
 }
 
 static void rm_buffer_destroy_notify_func(gpointer data) {
-    rm_buffer_free(NULL, data);
+    rm_buffer_free(data);
 }
 
 static void rm_digest_paranoid_release_buffers(RmParanoid *paranoid) {
@@ -721,8 +1367,19 @@ static RmParanoid *rm_digest_paranoid_copy(RmParanoid *paranoid) {
 static void rm_digest_paranoid_free(RmParanoid *paranoid) {
     rm_digest_free(paranoid->shadow_hash);
     rm_digest_paranoid_release_buffers(paranoid);
-    g_async_queue_unref(paranoid->incoming_twin_candidates);
     g_slist_free(paranoid->rejects);
+
+    GAsyncQueue *incoming = paranoid->incoming_twin_candidates;
+    if(incoming) {
+        /* candidates are not owned by the queue */
+        while(g_async_queue_try_pop(incoming)) {
+        }
+        if(rm_digest_state_push(RM_DIGEST_PARANOID, paranoid)) {
+            return;
+        }
+    }
+
+    g_async_queue_unref(incoming);
     g_slice_free(RmParanoid, paranoid);
 }
 
@@ -844,7 +1501,9 @@ static const RmDigestInterface *rm_digest_get_interface(RmDigestType type) {
         [RM_DIGEST_BLAKE2B] = &blake2b_interface,
         [RM_DIGEST_BLAKE2SP] = &blake2sp_interface,
         [RM_DIGEST_BLAKE2BP] = &blake2bp_interface,
+        [RM_DIGEST_BLAKE3] = &blake3_interface,
         [RM_DIGEST_EXT] = &ext_interface,
+        [RM_DIGEST_INODE] = &inode_interface,
         [RM_DIGEST_CUMULATIVE] = &cumulative_interface,
         [RM_DIGEST_PARANOID] = &paranoid_interface,
         [RM_DIGEST_XXHASH] = &xxhash_interface,
@@ -869,6 +1528,10 @@ static void rm_digest_table_insert(GHashTable *code_table, char *name,
 static gpointer rm_init_digest_type_table(GHashTable **code_table) {
     *code_table = g_hash_table_new(g_str_hash, g_str_equal);
     for(RmDigestType type = 1; type < RM_DIGEST_SENTINEL; type++) {
+        if(type == RM_DIGEST_INODE) {
+            /* no algorithm to choose */
+            continue;
+        }
         rm_digest_table_insert(*code_table, (char *)rm_digest_get_interface(type)->name,
                                type);
     }
@@ -880,6 +1543,154 @@ static gpointer rm_init_digest_type_table(GHashTable **code_table) {
     return NULL;
 }
 
+///////////////////////////////////////
+//     SHARED (COPY-ON-WRITE) STATE  //
+///////////////////////////////////////
+
+/* Largest result that is cached in RmDigestShare; covers all built-in
+ * algorithms (ext digests may be longer and are stolen every time) */
+#define RM_DIGEST_RESULT_CACHE_LEN 64
+
+typedef enum RmDigestResultStatus {
+    RM_DIGEST_RESULT_NONE = 0,
+    RM_DIGEST_RESULT_BUSY,
+    RM_DIGEST_RESULT_DONE
+} RmDigestResultStatus;
+
+/* Copies share the state until one of them is updated, and the stolen result
+ * is computed once per state for hashing and comparing.  Copies that stay
+ * read-only (rejects groups, replay, rm_file_copy) never clone the state.
+ * Progressive hashing updates its copies straight away, so these are cloned
+ * on their first update (into a recycled state, see above); the share is only
+ * allocated on demand so that this path does not pay for it. */
+typedef struct RmDigestShare {
+    /* number of RmDigests pointing to this state */
+    gint ref_count;
+
+    /* RmDigestResultStatus of result[] */
+    gint result_status;
+    guint8 result[RM_DIGEST_RESULT_CACHE_LEN];
+} RmDigestShare;
+
+static RmDigestShare *rm_digest_share_new(void) {
+    RmDigestShare *share = g_slice_new0(RmDigestShare);
+    share->ref_count = 1;
+    return share;
+}
+
+/* Get the share of digest, creating it if needed (digest may be copied or
+ * peeked by several threads at once); NULL for paranoid digests */
+static RmDigestShare *rm_digest_get_share(RmDigest *digest) {
+    RmDigestShare *share = g_atomic_pointer_get(&digest->share);
+    if(share != NULL || digest->type == RM_DIGEST_PARANOID) {
+        return share;
+    }
+
+    RmDigestShare *new_share = rm_digest_share_new();
+    if(g_atomic_pointer_compare_and_exchange(&digest->share, NULL, new_share)) {
+        return new_share;
+    }
+
+    /* somebody else beat us to it */
+    g_slice_free(RmDigestShare, new_share);
+    return g_atomic_pointer_get(&digest->share);
+}
+
+/* Allocate a copy of state, reusing a recycled flat state if possible */
+static gpointer rm_digest_state_copy(RmDigestType type,
+                                     const RmDigestInterface *interface,
+                                     gpointer state) {
+    rm_metrics_count(RM_METRICS_DIGEST_STATES, 1);
+    gpointer copy = interface->state_size ? rm_digest_state_pop(type) : NULL;
+    if(copy == NULL) {
+        return interface->copy(state);
+    }
+
+    memcpy(copy, state, interface->state_size);
+    return copy;
+}
+
+static gpointer rm_digest_state_new(RmDigestType type,
+                                    const RmDigestInterface *interface) {
+    if(interface->state_size == 0) {
+        rm_metrics_count(RM_METRICS_DIGEST_STATES, 1);
+        return interface->new();
+    }
+
+    /* the fresh state is created once per type and never modified */
+    RmDigestStateCache *cache = &RM_DIGEST_STATE_CACHES[type];
+    gpointer fresh = g_atomic_pointer_get(&cache->fresh);
+    if(fresh == NULL) {
+        fresh = interface->new();
+        if(!g_atomic_pointer_compare_and_exchange(&cache->fresh, NULL, fresh)) {
+            interface->free(fresh);
+            fresh = g_atomic_pointer_get(&cache->fresh);
+        }
+    }
+    return rm_digest_state_copy(type, interface, fresh);
+}
+
+static void rm_digest_state_free(RmDigestType type, const RmDigestInterface *interface,
+                                 gpointer state) {
+    if(interface->state_size == 0 || !rm_digest_state_push(type, state)) {
+        interface->free(state);
+    }
+}
+
+static void rm_digest_share_unref(RmDigest *digest,
+                                  const RmDigestInterface *interface) {
+    if(g_atomic_int_dec_and_test(&digest->share->ref_count)) {
+        rm_digest_state_free(digest->type, interface, digest->state);
+        g_slice_free(RmDigestShare, digest->share);
+    }
+    digest->share = NULL;
+    digest->state = NULL;
+}
+
+/* Make digest the only owner of its state before it gets modified */
+static void rm_digest_unshare(RmDigest *digest, const RmDigestInterface *interface) {
+    if(digest->share == NULL) {
+        return;
+    }
+
+    if(g_atomic_int_get(&digest->share->ref_count) == 1) {
+        /* nobody else sees the state; just forget the old result */
+        g_atomic_int_set(&digest->share->result_status, RM_DIGEST_RESULT_NONE);
+        return;
+    }
+
+    gpointer state = rm_digest_state_copy(digest->type, interface, digest->state);
+    rm_digest_share_unref(digest, interface);
+    digest->state = state;
+}
+
+/* Return the cached result of digest (computing it if needed) or NULL if it
+ * can't be cached right now; the result must not be modified */
+static const guint8 *rm_digest_peek(RmDigest *digest) {
+    if(digest->bytes == 0 || digest->bytes > RM_DIGEST_RESULT_CACHE_LEN) {
+        return NULL;
+    }
+
+    RmDigestShare *share = rm_digest_get_share(digest);
+    if(share == NULL) {
+        return NULL;
+    }
+
+    if(g_atomic_int_get(&share->result_status) == RM_DIGEST_RESULT_DONE) {
+        return share->result;
+    }
+
+    if(g_atomic_int_compare_and_exchange(&share->result_status, RM_DIGEST_RESULT_NONE,
+                                         RM_DIGEST_RESULT_BUSY)) {
+        rm_digest_get_interface(digest->type)->steal(digest->state, share->result);
+        g_atomic_int_set(&share->result_status, RM_DIGEST_RESULT_DONE);
+        return share->result;
+    }
+
+    /* another thread is filling in the result */
+    return NULL;
+}
+
 ///////////////////////////////////////
 //           RMDIGEST API            //
 ///////////////////////////////////////
@@ -912,7 +1723,7 @@ RmDigest *rm_digest_new(RmDigestType type, RmOff seed) {
     RmDigest *digest = g_slice_new0(RmDigest);
     digest->type = type;
     digest->bytes = interface->bits / 8;
-    digest->state = interface->new();
+    digest->state = rm_digest_state_new(type, interface);
     if(seed) {
         interface->update(digest->state, (const unsigned char *)&seed, sizeof(seed));
     }
@@ -927,24 +1738,29 @@ void rm_digest_release_buffers(RmDigest *digest) {
 
 void rm_digest_free(RmDigest *digest) {
     const RmDigestInterface *interface = rm_digest_get_interface(digest->type);
-    interface->free(digest->state);
+    if(digest->share) {
+        rm_digest_share_unref(digest, interface);
+    } else {
+        rm_digest_state_free(digest->type, interface, digest->state);
+    }
     g_slice_free(RmDigest, digest);
 }
 
 void rm_digest_update(RmDigest *digest, const unsigned char *data, RmOff size) {
     const RmDigestInterface *interface = rm_digest_get_interface(digest->type);
+    rm_digest_unshare(digest, interface);
     interface->update(digest->state, data, size);
     if(digest->bytes == 0) {
         digest->bytes = interface->len(digest->state);
     }
 }
 
-void rm_digest_buffered_update(RmSemaphore *sem, RmBuffer *buffer) {
+void rm_digest_buffered_update(RmBuffer *buffer) {
     g_assert(buffer);
     RmDigest *digest = buffer->digest;
     if(digest->type != RM_DIGEST_PARANOID) {
         rm_digest_update(digest, buffer->data, buffer->len);
-        rm_buffer_free(sem, buffer);
+        rm_buffer_free(buffer);
     } else {
         RmParanoid *paranoid = digest->state;
         rm_digest_paranoid_buffered_update(paranoid, buffer);
@@ -954,22 +1770,34 @@ void rm_digest_buffered_update(RmSemaphore *sem, RmBuffer *buffer) {
 RmDigest *rm_digest_copy(RmDigest *digest) {
     g_assert(digest);
 
-    RmDigest *copy = g_slice_copy(sizeof(RmDigest), digest);
-
     const RmDigestInterface *interface = rm_digest_get_interface(digest->type);
     if(interface->copy == NULL) {
         return NULL;
     }
 
-    copy->state = interface->copy(digest->state);
+    RmDigestShare *share = rm_digest_get_share(digest);
+    if(share) {
+        g_atomic_int_inc(&share->ref_count);
+    }
+
+    RmDigest *copy = g_slice_copy(sizeof(RmDigest), digest);
+    copy->share = share;
+    if(!share) {
+        copy->state = rm_digest_state_copy(digest->type, interface, digest->state);
+    }
     return copy;
 }
 
 guint8 *rm_digest_steal(RmDigest *digest) {
     const RmDigestInterface *interface = rm_digest_get_interface(digest->type);
+    const guint8 *cached = rm_digest_peek(digest);
+    if(cached) {
+        return g_slice_copy(digest->bytes, cached);
+    }
+
     guint8 *result = g_slice_alloc0(digest->bytes);
     interface->steal(digest->state, result);
-    
+
     return result;
 }
 
@@ -978,6 +1806,13 @@ guint rm_digest_hash(RmDigest *digest) {
     gsize bytes = 0;
     guint hash = 0;
 
+    const guint8 *cached = rm_digest_peek(digest);
+    if(cached) {
+        g_assert(digest->bytes >= sizeof(guint));
+        memcpy(&hash, cached, sizeof(guint));
+        return hash;
+    }
+
     buf = rm_digest_steal(digest);
     bytes = digest->bytes;
 
@@ -1034,6 +1869,17 @@ gboolean rm_digest_equal(RmDigest *a, RmDigest *b) {
 
         return (!a_iter && !b_iter);
     } else {
+        if(a->share && a->share == b->share) {
+            /* copies that were never updated since */
+            return true;
+        }
+
+        const guint8 *cached_a = rm_digest_peek(a);
+        const guint8 *cached_b = rm_digest_peek(b);
+        if(cached_a && cached_b) {
+            return !memcmp(cached_a, cached_b, a->bytes);
+        }
+
         guint8 *buf_a = rm_digest_steal(a);
         guint8 *buf_b = rm_digest_steal(b);
         gboolean result = !memcmp(buf_a, buf_b, a->bytes);
@@ -1051,7 +1897,9 @@ int rm_digest_hexstring(RmDigest *digest, char *buffer) {
         return 0;
     }
 
-    guint8 *input = rm_digest_steal(digest);
+    const guint8 *cached = rm_digest_peek(digest);
+    guint8 *stolen = cached ? NULL : rm_digest_steal(digest);
+    const guint8 *input = cached ? cached : stolen;
     gsize bytes = digest->bytes;
     gsize out = 0;
 
@@ -1061,7 +1909,9 @@ int rm_digest_hexstring(RmDigest *digest, char *buffer) {
     }
     buffer[out++] = '\0';
 
-    g_slice_free1(bytes, input);
+    if(stolen) {
+        g_slice_free1(bytes, stolen);
+    }
     return out;
 }
 
@@ -1092,6 +1942,12 @@ guint8 *rm_digest_sum(RmDigestType algo, const guint8 *data, gsize len, gsize *o
 }
 
 void rm_digest_enable_sse(gboolean use_sse) {
+    /* these pick their SIMD kernels themselves; this only decides if they may */
+    rm_log_debug_line("blake2bp implementation: %s", blake2b_use_simd(use_sse));
+    rm_log_debug_line("sha1 implementation: %s", sha1_use_simd(use_sse));
+    rm_log_debug_line("sha256 implementation: %s", sha256_use_simd(use_sse));
+    rm_log_debug_line("highway implementation: %s", HighwayHashUseSimd(use_sse));
+
 #if HAVE_MM_CRC32_U64 && HAVE_BUILTIN_CPU_SUPPORTS
     if (use_sse && __builtin_cpu_supports("sse4.2")) {
         g_atomic_int_set(&RM_DIGEST_USE_SSE, TRUE);
@@ -60,9 +60,11 @@ typedef enum RmDigestType {
     RM_DIGEST_HIGHWAY64,
     RM_DIGEST_HIGHWAY128,
     RM_DIGEST_HIGHWAY256,
+    RM_DIGEST_BLAKE3 /*  Tree hash; big updates use several threads */,
     /* special kids in town */
     RM_DIGEST_CUMULATIVE, /* hash([a, b]) = hash([b, a]) */
     RM_DIGEST_EXT,        /* read hash as string         */
+    RM_DIGEST_INODE,      /* stands for an unread inode  */
     RM_DIGEST_PARANOID,   /* direct block comparisons    */
     /* sentinel */
     RM_DIGEST_SENTINEL,
@@ -103,6 +105,11 @@ typedef struct RmDigest {
     /* Different storage structures are used depending on digest type: */
     gpointer state;
 
+    /* Copies made by rm_digest_copy() share their state (and its cached result)
+     * until one of them is updated; created on demand, NULL for
+     * RM_DIGEST_PARANOID */
+    struct RmDigestShare *share;
+
     /* digest type */
     RmDigestType type;
 
@@ -111,46 +118,10 @@ typedef struct RmDigest {
 
 } RmDigest;
 
-typedef struct RmSemaphore {
-    volatile int n;
-    GMutex sem_lock;
-    GCond sem_cond;
-} RmSemaphore;
-
-/**
- * @brief Allocate a new RmSemaphore.
- *
- * @param n: The number of acquire operations before the semaphore blocks.
- */
-RmSemaphore *rm_semaphore_new(int n);
-
-/**
- * @brief Allocate a new RmSemaphore.
- *
- * @param n: The number of acquire operations before the semaphore blocks.
- */
-void rm_semaphore_destroy(RmSemaphore *sem);
-
-/**
- * @brief Acquire a share of the semaphore.
- *
- * This call will block if already too may acquires happened.
- */
-void rm_semaphore_acquire(RmSemaphore *sem);
-
-/**
- * @brief Release one share of the semaphore.
- */
-void rm_semaphore_release(RmSemaphore *sem);
-
 /////////// RmBuffer ////////////////
 
 /* Represents one block of read data */
 typedef struct RmBuffer {
-    /* note that first (sizeof(pointer)) bytes of this structure get overwritten
-     * when it gets pushed to the RmBufferPool stack, so first couple of
-     * elements can't be reused */
-
     /* checksum the data belongs to */
     struct RmDigest *digest;
 
@@ -160,16 +131,53 @@ typedef struct RmBuffer {
     /* len of the data actually filled */
     guint32 len;
 
-    /* user utility data field */
+    /* user utility data field; also links free buffers inside the RmBufferPool */
     gpointer user_data;
 
-    /* pointer to the data block */
+    /* pointer to the data block (aligned for O_DIRECT) */
     unsigned char *data;
+
+    /* pool the buffer was taken from */
+    struct RmBufferPool *pool;
 } RmBuffer;
 
-RmBuffer *rm_buffer_new(RmSemaphore *sem, gsize buf_size);
+/////////// RmBufferPool ////////////////
+
+typedef struct RmBufferPool RmBufferPool;
+
+/**
+ * @brief Allocate a new pool of recycled read buffers.
+ *
+ * Buffer data is carved out of big mmap()'d slabs which are never given back
+ * before the pool is destroyed; if available, transparent hugepages are
+ * requested for them. Every data block starts at a 4K boundary, so it can be
+ * used for O_DIRECT reads.
+ *
+ * @param buffer_size size of each buffer's data block.
+ * @param max_buffers How many buffers may be out at the same time before
+ * rm_buffer_new() blocks. Pass 0 for no limit.
+ */
+RmBufferPool *rm_buffer_pool_new(gsize buffer_size, gsize max_buffers);
 
-void rm_buffer_free(RmSemaphore *sem, RmBuffer *buf);
+/**
+ * @brief Destroy the pool.
+ *
+ * Buffers that are still held (e.g. by paranoid digests) stay valid; the
+ * memory is freed once the last of them is passed to rm_buffer_free().
+ */
+void rm_buffer_pool_destroy(RmBufferPool *pool);
+
+/**
+ * @brief Get an empty buffer from the pool.
+ *
+ * This call will block if already max_buffers buffers are in use.
+ */
+RmBuffer *rm_buffer_new(RmBufferPool *pool);
+
+/**
+ * @brief Give a buffer back to the pool it came from.
+ */
+void rm_buffer_free(RmBuffer *buf);
 
 /**
  * @brief Convert a string like "md5" to a RmDigestType member.
@@ -217,7 +225,7 @@ void rm_digest_update(RmDigest *digest, const unsigned char *data, RmOff size);
  * @param digest a pointer to a RmDigest
  * @param buffer a RmBuffer of data.
  */
-void rm_digest_buffered_update(RmSemaphore *sem, RmBuffer *buffer);
+void rm_digest_buffered_update(RmBuffer *buffer);
 
 /**
  * @brief Convert the checksum to a hexstring (like `md5sum`)
@@ -282,6 +290,10 @@ gboolean rm_digest_equal(RmDigest *a, RmDigest *b);
  *
  * @param digest a pointer to a RmDigest
  *
+ * Except for RM_DIGEST_PARANOID the copy shares the internal state with
+ * digest; it is only duplicated when either of them is updated.
+ * As before, digest must not be updated while it is being copied.
+ *
  * @return copy of digest
  */
 RmDigest *rm_digest_copy(RmDigest *digest);
@@ -306,8 +318,25 @@ void rm_digest_send_match_candidate(RmDigest *target, RmDigest *candidate);
 
 /**
  * @brief Enable or disable SSE optimisations.
- * @note will also check __builtin_cpu_supports("sse4.2") before enabling
+ * @note will also check __builtin_cpu_supports("sse4.2") before enabling;
+ * also allows the SIMD kernels of blake2bp, sha1/sha256 (SHA-NI) and
+ * highway (SSE4.1/AVX2) where supported.
  */
 void rm_digest_enable_sse(gboolean use_sse);
 
+/**
+ * @brief Limit the resources of blake3 digests.
+ *
+ * blake3 digests collect their input in batches of up to 1 MiB, which are
+ * hashed on a shared pool of helper threads.
+ *
+ * @param threads How many threads one digest may use, including the caller
+ * (0: one per cpu).
+ * @param pending_mem How many bytes all blake3 digests together may buffer for
+ * the next batch; digests that would exceed it hash serially instead.
+ *
+ * The thread count only takes effect before the first blake3 digest is updated.
+ */
+void rm_digest_set_blake3_limits(guint threads, gsize pending_mem);
+
 #endif /* end of include guard */
@@ -143,6 +143,14 @@ int blake2b_init_param(blake2b_state *S, const blake2b_param *P);
 int blake2b_update(blake2b_state *S, const void *in, size_t inlen);
 int blake2b_final(blake2b_state *S, void *out, size_t outlen);
 
+/* rmlint: use the fastest SIMD kernel the CPU supports for the blake2bp leaves
+ * (enable != 0) or the portable code (enable == 0).  Returns the name of the
+ * selected implementation. */
+const char *blake2b_use_simd(int enable);
+
+/* rmlint: update the four blake2bp leaves with n_stripes * 4 blocks (see blake2bp-ref.c) */
+void blake2b_update4(blake2b_state *S[4], const uint8_t *in, size_t n_stripes);
+
 int blake2sp_init(blake2sp_state *S, size_t outlen);
 int blake2sp_init_key(blake2sp_state *S, size_t outlen, const void *key, size_t keylen);
 int blake2sp_update(blake2sp_state *S, const void *in, size_t inlen);
@@ -19,6 +19,7 @@
 
 #include "blake2-impl.h"
 #include "blake2.h"
+#include "blake2b-simd.h"
 
 static const uint64_t blake2b_IV[8] = {0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
                                        0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
@@ -206,6 +207,91 @@ static void blake2b_compress(blake2b_state *S, const uint8_t block[BLAKE2B_BLOCK
 #undef G
 #undef ROUND
 
+/* rmlint: runtime dispatch to the SIMD kernels in blake2b-simd.c;
+ * blake2b_use_simd() is called once at startup, but blake2b_compress4_auto
+ * picks one on first use otherwise.  Hashing threads may get there at the
+ * same time, so the pointer is only accessed atomically. */
+static void blake2b_compress4_auto(blake2b_state *S[4], const uint8_t *block[4]);
+
+static blake2b_compress4_func blake2b_compress4 = blake2b_compress4_auto;
+
+const char *blake2b_use_simd(int enable) {
+    const char *name = "ref";
+    blake2b_compress4_func best = enable ? blake2b_simd_best4(&name) : NULL;
+    __atomic_store_n(&blake2b_compress4, best, __ATOMIC_RELEASE);
+    return name;
+}
+
+static void blake2b_compress4_auto(blake2b_state *S[4], const uint8_t *block[4]) {
+    blake2b_use_simd(1);
+    blake2b_compress4_func compress4 =
+        __atomic_load_n(&blake2b_compress4, __ATOMIC_ACQUIRE);
+    if(compress4) {
+        compress4(S, block);
+    } else {
+        for(size_t i = 0; i < 4; ++i) {
+            blake2b_compress(S[i], block[i]);
+        }
+    }
+}
+
+/* rmlint: equivalent to blake2b_update(S[i], in + k * 4 * BLOCKBYTES + i * BLOCKBYTES,
+ * BLOCKBYTES) for all k < n_stripes and i < 4, i.e. the blake2bp leaf update */
+void blake2b_update4(blake2b_state *S[4], const uint8_t *in, size_t n_stripes) {
+    const size_t stripe = 4 * BLAKE2B_BLOCKBYTES;
+    size_t buflen = S[0]->buflen;
+    size_t i, k;
+
+    /* leaves only ever see whole blocks, so they are always in lockstep */
+    int lockstep = (buflen == 0 || buflen == BLAKE2B_BLOCKBYTES);
+    for(i = 1; i < 4; ++i) {
+        lockstep &= (S[i]->buflen == buflen);
+    }
+
+    blake2b_compress4_func compress4 =
+        __atomic_load_n(&blake2b_compress4, __ATOMIC_ACQUIRE);
+    if(compress4 == NULL || !lockstep) {
+        for(k = 0; k < n_stripes; ++k) {
+            for(i = 0; i < 4; ++i) {
+                blake2b_update(S[i], in + k * stripe + i * BLAKE2B_BLOCKBYTES,
+                               BLAKE2B_BLOCKBYTES);
+            }
+        }
+        return;
+    }
+
+    for(k = 0; k < n_stripes; ++k) {
+        const uint8_t *blocks[4];
+
+        if(S[0]->buflen == BLAKE2B_BLOCKBYTES) {
+            /* more data follows, so the buffered blocks can go */
+            for(i = 0; i < 4; ++i) {
+                blake2b_increment_counter(S[i], BLAKE2B_BLOCKBYTES);
+                blocks[i] = S[i]->buf;
+                S[i]->buflen = 0;
+            }
+            compress4(S, blocks);
+        }
+
+        for(i = 0; i < 4; ++i) {
+            blocks[i] = in + k * stripe + i * BLAKE2B_BLOCKBYTES;
+        }
+
+        if(k + 1 < n_stripes) {
+            for(i = 0; i < 4; ++i) {
+                blake2b_increment_counter(S[i], BLAKE2B_BLOCKBYTES);
+            }
+            compress4(S, blocks);
+        } else {
+            /* keep the last block buffered, as blake2b_update() does */
+            for(i = 0; i < 4; ++i) {
+                memcpy(S[i]->buf, blocks[i], BLAKE2B_BLOCKBYTES);
+                S[i]->buflen = BLAKE2B_BLOCKBYTES;
+            }
+        }
+    }
+}
+
 int blake2b_update(blake2b_state *S, const void *pin, size_t inlen) {
     const unsigned char *in = (const unsigned char *)pin;
     if(inlen > 0) {
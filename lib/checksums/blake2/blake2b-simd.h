@@ -0,0 +1,24 @@
+/*
+   SIMD implementations of the BLAKE2b compression function for rmlint,
+   selected at runtime.  Output is identical to blake2b-ref.c.
+
+   You may use this under the terms of the CC0, the OpenSSL Licence, or the
+   Apache Public License 2.0, at your option (same as the BLAKE2 reference
+   code).
+*/
+
+#ifndef BLAKE2B_SIMD_H
+#define BLAKE2B_SIMD_H
+
+#include <stdint.h>
+
+#include "blake2.h"
+
+/* Compress block[i] into S[i] for four independent states (blake2bp leaves) */
+typedef void (*blake2b_compress4_func)(blake2b_state *S[4], const uint8_t *block[4]);
+
+/* Return the fastest kernel supported by this CPU and build, or NULL if there
+ * is none; *name is set to the instruction set used. */
+blake2b_compress4_func blake2b_simd_best4(const char **name);
+
+#endif
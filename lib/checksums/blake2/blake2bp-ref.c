@@ -137,12 +137,14 @@ int blake2bp_update(blake2bp_state *S, const void *pin, size_t inlen) {
     size_t left = S->buflen;
     size_t fill = sizeof(S->buf) - left;
     size_t i;
+    blake2b_state *leaves[PARALLELISM_DEGREE];
 
     if(left && inlen >= fill) {
         memcpy(S->buf + left, in, fill);
 
         for(i = 0; i < PARALLELISM_DEGREE; ++i)
-            blake2b_update(S->S[i], S->buf + i * BLAKE2B_BLOCKBYTES, BLAKE2B_BLOCKBYTES);
+            leaves[i] = S->S[i];
+        blake2b_update4(leaves, S->buf, 1);
 
         in += fill;
         inlen -= fill;
@@ -151,14 +153,8 @@ int blake2bp_update(blake2bp_state *S, const void *pin, size_t inlen) {
 
 #if defined(_OPENMP)
 #pragma omp parallel shared(S), num_threads(PARALLELISM_DEGREE)
-#else
-
-    for(i = 0; i < PARALLELISM_DEGREE; ++i)
-#endif
     {
-#if defined(_OPENMP)
         size_t i = omp_get_thread_num();
-#endif
         size_t inlen__ = inlen;
         const unsigned char *in__ = (const unsigned char *)in;
         in__ += i * BLAKE2B_BLOCKBYTES;
@@ -169,6 +165,12 @@ int blake2bp_update(blake2bp_state *S, const void *pin, size_t inlen) {
             inlen__ -= PARALLELISM_DEGREE * BLAKE2B_BLOCKBYTES;
         }
     }
+#else
+    /* rmlint: all four leaves at once (SIMD if available) */
+    for(i = 0; i < PARALLELISM_DEGREE; ++i)
+        leaves[i] = S->S[i];
+    blake2b_update4(leaves, in, inlen / (PARALLELISM_DEGREE * BLAKE2B_BLOCKBYTES));
+#endif
 
     in += inlen - inlen % (PARALLELISM_DEGREE * BLAKE2B_BLOCKBYTES);
     inlen %= PARALLELISM_DEGREE * BLAKE2B_BLOCKBYTES;
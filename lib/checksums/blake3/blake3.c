@@ -0,0 +1,485 @@
+/*
+ * Portable BLAKE3 hash, following the structure of the official C
+ * implementation (https://github.com/BLAKE3-team/BLAKE3), which is released
+ * into the public domain (CC0 1.0) and under the Apache License 2.0.
+ *
+ * The SIMD "hash many chunks at once" kernels of the official code are not
+ * included; instead blake3_hasher_update_parallel() lets the caller compute
+ * independent subtrees on several threads.
+ */
+
+#include <string.h>
+
+#include "blake3.h"
+
+enum blake3_flags {
+    CHUNK_START = 1 << 0,
+    CHUNK_END = 1 << 1,
+    PARENT = 1 << 2,
+    ROOT = 1 << 3,
+};
+
+/* upper bound for the number of jobs a single subtree is split into */
+#define BLAKE3_MAX_JOBS 64
+
+static const uint32_t IV[8] = {0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL,
+                               0xA54FF53AUL, 0x510E527FUL, 0x9B05688CUL,
+                               0x1F83D9ABUL, 0x5BE0CD19UL};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static inline uint32_t load32(const uint8_t *src) {
+    return ((uint32_t)src[0] << 0) | ((uint32_t)src[1] << 8) |
+           ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static inline void store32(uint8_t *dst, uint32_t w) {
+    dst[0] = (uint8_t)(w >> 0);
+    dst[1] = (uint8_t)(w >> 8);
+    dst[2] = (uint8_t)(w >> 16);
+    dst[3] = (uint8_t)(w >> 24);
+}
+
+static inline uint32_t rotr32(uint32_t w, uint32_t c) {
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline unsigned popcnt(uint64_t x) {
+    unsigned count = 0;
+    while(x != 0) {
+        count += 1;
+        x &= x - 1;
+    }
+    return count;
+}
+
+/* largest power of two <= x (x > 0) */
+static inline uint64_t round_down_to_power_of_2(uint64_t x) {
+    uint64_t result = 1;
+    while((result << 1) != 0 && (result << 1) <= x) {
+        result <<= 1;
+    }
+    return result;
+}
+
+///////////////////////////
+//   compression core    //
+///////////////////////////
+
+static inline void g(uint32_t *state, size_t a, size_t b, size_t c, size_t d, uint32_t x,
+                     uint32_t y) {
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotr32(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotr32(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+static inline void round_fn(uint32_t state[16], const uint32_t *msg, size_t round) {
+    const uint8_t *schedule = MSG_SCHEDULE[round];
+
+    /* mix the columns */
+    g(state, 0, 4, 8, 12, msg[schedule[0]], msg[schedule[1]]);
+    g(state, 1, 5, 9, 13, msg[schedule[2]], msg[schedule[3]]);
+    g(state, 2, 6, 10, 14, msg[schedule[4]], msg[schedule[5]]);
+    g(state, 3, 7, 11, 15, msg[schedule[6]], msg[schedule[7]]);
+
+    /* mix the diagonals */
+    g(state, 0, 5, 10, 15, msg[schedule[8]], msg[schedule[9]]);
+    g(state, 1, 6, 11, 12, msg[schedule[10]], msg[schedule[11]]);
+    g(state, 2, 7, 8, 13, msg[schedule[12]], msg[schedule[13]]);
+    g(state, 3, 4, 9, 14, msg[schedule[14]], msg[schedule[15]]);
+}
+
+static void compress_pre(uint32_t state[16], const uint32_t cv[8], const uint32_t msg[16],
+                         uint8_t block_len, uint64_t counter, uint8_t flags) {
+    memcpy(state, cv, 8 * sizeof(uint32_t));
+    memcpy(state + 8, IV, 4 * sizeof(uint32_t));
+    state[12] = (uint32_t)counter;
+    state[13] = (uint32_t)(counter >> 32);
+    state[14] = (uint32_t)block_len;
+    state[15] = (uint32_t)flags;
+
+    for(size_t round = 0; round < 7; round++) {
+        round_fn(state, msg, round);
+    }
+}
+
+static void compress_in_place(uint32_t cv[8], const uint32_t msg[16], uint8_t block_len,
+                              uint64_t counter, uint8_t flags) {
+    uint32_t state[16];
+    compress_pre(state, cv, msg, block_len, counter, flags);
+    for(size_t i = 0; i < 8; i++) {
+        cv[i] = state[i] ^ state[i + 8];
+    }
+}
+
+static void load_block(uint32_t msg[16], const uint8_t block[BLAKE3_BLOCK_LEN]) {
+    for(size_t i = 0; i < 16; i++) {
+        msg[i] = load32(block + 4 * i);
+    }
+}
+
+static void parent_cv(const uint32_t left[8], const uint32_t right[8], const uint32_t key[8],
+                      uint8_t flags, uint32_t out[8]) {
+    uint32_t msg[16];
+    memcpy(msg, left, 8 * sizeof(uint32_t));
+    memcpy(msg + 8, right, 8 * sizeof(uint32_t));
+    memcpy(out, key, 8 * sizeof(uint32_t));
+    compress_in_place(out, msg, BLAKE3_BLOCK_LEN, 0, flags | PARENT);
+}
+
+///////////////////////////
+//     output nodes      //
+///////////////////////////
+
+/* a node whose final compression has not been done yet; it may turn out to
+ * be the root */
+typedef struct output_t {
+    uint32_t input_cv[8];
+    uint32_t msg[16];
+    uint64_t counter;
+    uint8_t block_len;
+    uint8_t flags;
+} output_t;
+
+static void output_chaining_value(const output_t *self, uint32_t cv[8]) {
+    memcpy(cv, self->input_cv, 8 * sizeof(uint32_t));
+    compress_in_place(cv, self->msg, self->block_len, self->counter, self->flags);
+}
+
+static void output_root_bytes(const output_t *self, uint8_t *out, size_t out_len) {
+    uint64_t output_block_counter = 0;
+    while(out_len > 0) {
+        uint32_t state[16];
+        compress_pre(state, self->input_cv, self->msg, self->block_len,
+                     output_block_counter, self->flags | ROOT);
+
+        uint8_t block[BLAKE3_BLOCK_LEN];
+        for(size_t i = 0; i < 8; i++) {
+            store32(block + 4 * i, state[i] ^ state[i + 8]);
+            store32(block + 4 * (i + 8), state[i + 8] ^ self->input_cv[i]);
+        }
+
+        size_t take = out_len < BLAKE3_BLOCK_LEN ? out_len : BLAKE3_BLOCK_LEN;
+        memcpy(out, block, take);
+        out += take;
+        out_len -= take;
+        output_block_counter++;
+    }
+}
+
+static output_t parent_output(const uint32_t left[8], const uint32_t right[8],
+                              const uint32_t key[8], uint8_t flags) {
+    output_t output;
+    memcpy(output.input_cv, key, 8 * sizeof(uint32_t));
+    memcpy(output.msg, left, 8 * sizeof(uint32_t));
+    memcpy(output.msg + 8, right, 8 * sizeof(uint32_t));
+    output.counter = 0;
+    output.block_len = BLAKE3_BLOCK_LEN;
+    output.flags = flags | PARENT;
+    return output;
+}
+
+///////////////////////////
+//      chunk state      //
+///////////////////////////
+
+static void chunk_state_init(blake3_chunk_state *self, const uint32_t key[8],
+                             uint64_t chunk_counter, uint8_t flags) {
+    memcpy(self->cv, key, 8 * sizeof(uint32_t));
+    self->chunk_counter = chunk_counter;
+    memset(self->buf, 0, BLAKE3_BLOCK_LEN);
+    self->buf_len = 0;
+    self->blocks_compressed = 0;
+    self->flags = flags;
+}
+
+static inline size_t chunk_state_len(const blake3_chunk_state *self) {
+    return (BLAKE3_BLOCK_LEN * (size_t)self->blocks_compressed) + self->buf_len;
+}
+
+static inline uint8_t chunk_state_start_flag(const blake3_chunk_state *self) {
+    return self->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+static void chunk_state_compress_block(blake3_chunk_state *self, const uint8_t *block) {
+    uint32_t msg[16];
+    load_block(msg, block);
+    compress_in_place(self->cv, msg, BLAKE3_BLOCK_LEN, self->chunk_counter,
+                      self->flags | chunk_state_start_flag(self));
+    self->blocks_compressed++;
+}
+
+/* the last block of a chunk always stays in buf, so it can get CHUNK_END */
+static void chunk_state_update(blake3_chunk_state *self, const uint8_t *input,
+                               size_t input_len) {
+    if(self->buf_len > 0) {
+        size_t take = BLAKE3_BLOCK_LEN - self->buf_len;
+        if(take > input_len) {
+            take = input_len;
+        }
+        memcpy(self->buf + self->buf_len, input, take);
+        self->buf_len += (uint8_t)take;
+        input += take;
+        input_len -= take;
+        if(input_len > 0) {
+            chunk_state_compress_block(self, self->buf);
+            self->buf_len = 0;
+            memset(self->buf, 0, BLAKE3_BLOCK_LEN);
+        }
+    }
+
+    while(input_len > BLAKE3_BLOCK_LEN) {
+        chunk_state_compress_block(self, input);
+        input += BLAKE3_BLOCK_LEN;
+        input_len -= BLAKE3_BLOCK_LEN;
+    }
+
+    memcpy(self->buf + self->buf_len, input, input_len);
+    self->buf_len += (uint8_t)input_len;
+}
+
+static output_t chunk_state_output(const blake3_chunk_state *self) {
+    output_t output;
+    memcpy(output.input_cv, self->cv, 8 * sizeof(uint32_t));
+    load_block(output.msg, self->buf);
+    output.counter = self->chunk_counter;
+    output.block_len = self->buf_len;
+    output.flags = self->flags | chunk_state_start_flag(self) | CHUNK_END;
+    return output;
+}
+
+///////////////////////////
+//       subtrees        //
+///////////////////////////
+
+static void subtree_cv(const uint8_t *input, size_t len, uint64_t chunk_counter,
+                       const uint32_t key[8], uint8_t flags, uint32_t out[8]) {
+    if(len <= BLAKE3_CHUNK_LEN) {
+        blake3_chunk_state chunk;
+        chunk_state_init(&chunk, key, chunk_counter, flags);
+        chunk_state_update(&chunk, input, len);
+        output_t output = chunk_state_output(&chunk);
+        output_chaining_value(&output, out);
+        return;
+    }
+
+    uint32_t left[8], right[8];
+    size_t half = len / 2;
+    subtree_cv(input, half, chunk_counter, key, flags, left);
+    subtree_cv(input + half, half, chunk_counter + half / BLAKE3_CHUNK_LEN, key, flags,
+               right);
+    parent_cv(left, right, key, flags, out);
+}
+
+void blake3_subtree_job_run(blake3_subtree_job *job) {
+    subtree_cv(job->input, job->len, job->chunk_counter, job->key, job->flags, job->cv);
+}
+
+/* Compute the two children of the (complete, non-root) subtree in
+ * input[0..len); len is a power of two multiple of two chunks */
+static void subtree_children(const blake3_hasher *self, const uint8_t *input, size_t len,
+                             size_t max_jobs, size_t min_job_len,
+                             blake3_subtree_runner runner, void *user_data,
+                             uint32_t left[8], uint32_t right[8]) {
+    uint64_t chunk_counter = self->chunk.chunk_counter;
+    uint8_t flags = self->chunk.flags;
+
+    size_t n_jobs = 0;
+    if(runner && max_jobs >= 2) {
+        if(min_job_len < BLAKE3_CHUNK_LEN) {
+            min_job_len = BLAKE3_CHUNK_LEN;
+        }
+        n_jobs = (size_t)round_down_to_power_of_2(
+            max_jobs < BLAKE3_MAX_JOBS ? max_jobs : BLAKE3_MAX_JOBS);
+        while(n_jobs > 2 && len / n_jobs < min_job_len) {
+            n_jobs /= 2;
+        }
+        if(len / n_jobs < min_job_len) {
+            n_jobs = 0;
+        }
+    }
+
+    if(n_jobs == 0) {
+        size_t half = len / 2;
+        subtree_cv(input, half, chunk_counter, self->key, flags, left);
+        subtree_cv(input + half, half, chunk_counter + half / BLAKE3_CHUNK_LEN, self->key,
+                   flags, right);
+        return;
+    }
+
+    blake3_subtree_job jobs[BLAKE3_MAX_JOBS];
+    size_t job_len = len / n_jobs;
+    for(size_t i = 0; i < n_jobs; i++) {
+        jobs[i].input = input + i * job_len;
+        jobs[i].len = job_len;
+        jobs[i].chunk_counter = chunk_counter + i * (job_len / BLAKE3_CHUNK_LEN);
+        jobs[i].key = self->key;
+        jobs[i].flags = flags;
+    }
+
+    runner(jobs, n_jobs, user_data);
+
+    /* fold the job results pairwise until only the two children are left */
+    while(n_jobs > 2) {
+        for(size_t i = 0; i < n_jobs / 2; i++) {
+            parent_cv(jobs[2 * i].cv, jobs[2 * i + 1].cv, self->key, flags, jobs[i].cv);
+        }
+        n_jobs /= 2;
+    }
+    memcpy(left, jobs[0].cv, 8 * sizeof(uint32_t));
+    memcpy(right, jobs[1].cv, 8 * sizeof(uint32_t));
+}
+
+///////////////////////////
+//        hasher         //
+///////////////////////////
+
+void blake3_hasher_init(blake3_hasher *self) {
+    memcpy(self->key, IV, sizeof(self->key));
+    chunk_state_init(&self->chunk, self->key, 0, 0);
+    self->cv_stack_len = 0;
+}
+
+/* Merge subtrees as long as the stack holds more entries than there are set
+ * bits in total_chunks.  Merging is done lazily (before pushing the next cv)
+ * because the last subtree on the stack might turn out to be the root. */
+static void hasher_merge_cv_stack(blake3_hasher *self, uint64_t total_chunks) {
+    size_t post_merge_stack_len = (size_t)popcnt(total_chunks);
+    while(self->cv_stack_len > post_merge_stack_len) {
+        uint32_t *left = self->cv_stack[self->cv_stack_len - 2];
+        uint32_t *right = self->cv_stack[self->cv_stack_len - 1];
+        parent_cv(left, right, self->key, self->chunk.flags, left);
+        self->cv_stack_len--;
+    }
+}
+
+static void hasher_push_cv(blake3_hasher *self, const uint32_t cv[8],
+                           uint64_t chunk_counter) {
+    hasher_merge_cv_stack(self, chunk_counter);
+    memcpy(self->cv_stack[self->cv_stack_len], cv, 8 * sizeof(uint32_t));
+    self->cv_stack_len++;
+}
+
+static void hasher_update(blake3_hasher *self, const uint8_t *input, size_t input_len,
+                          size_t max_jobs, size_t min_job_len,
+                          blake3_subtree_runner runner, void *user_data) {
+    /* finish a partial chunk first */
+    if(chunk_state_len(&self->chunk) > 0) {
+        size_t take = BLAKE3_CHUNK_LEN - chunk_state_len(&self->chunk);
+        if(take > input_len) {
+            take = input_len;
+        }
+        chunk_state_update(&self->chunk, input, take);
+        input += take;
+        input_len -= take;
+
+        if(input_len == 0) {
+            return;
+        }
+
+        /* more input follows, so this chunk is not the root */
+        uint32_t chunk_cv[8];
+        output_t output = chunk_state_output(&self->chunk);
+        output_chaining_value(&output, chunk_cv);
+        hasher_push_cv(self, chunk_cv, self->chunk.chunk_counter);
+        chunk_state_init(&self->chunk, self->key, self->chunk.chunk_counter + 1,
+                         self->chunk.flags);
+    }
+
+    /* Hash as many whole subtrees as possible.  Each subtree must be aligned
+     * to its own size in the tree, and at least one byte has to be left for
+     * the chunk state so the root is never compressed here. */
+    while(input_len > BLAKE3_CHUNK_LEN) {
+        uint64_t subtree_len = round_down_to_power_of_2(input_len);
+        uint64_t count_so_far = self->chunk.chunk_counter * BLAKE3_CHUNK_LEN;
+        while(((subtree_len - 1) & count_so_far) != 0) {
+            subtree_len /= 2;
+        }
+        uint64_t subtree_chunks = subtree_len / BLAKE3_CHUNK_LEN;
+
+        if(subtree_len <= BLAKE3_CHUNK_LEN) {
+            uint32_t chunk_cv[8];
+            subtree_cv(input, (size_t)subtree_len, self->chunk.chunk_counter, self->key,
+                       self->chunk.flags, chunk_cv);
+            hasher_push_cv(self, chunk_cv, self->chunk.chunk_counter);
+        } else {
+            /* push both children; their parent may still become the root */
+            uint32_t left[8], right[8];
+            subtree_children(self, input, (size_t)subtree_len, max_jobs, min_job_len,
+                             runner, user_data, left, right);
+            hasher_push_cv(self, left, self->chunk.chunk_counter);
+            hasher_push_cv(self, right, self->chunk.chunk_counter + subtree_chunks / 2);
+        }
+
+        self->chunk.chunk_counter += subtree_chunks;
+        input += subtree_len;
+        input_len -= (size_t)subtree_len;
+    }
+
+    if(input_len > 0) {
+        chunk_state_update(&self->chunk, input, input_len);
+        /* leave no unmerged pairs for blake3_hasher_finalize() */
+        hasher_merge_cv_stack(self, self->chunk.chunk_counter);
+    }
+}
+
+void blake3_hasher_update(blake3_hasher *self, const void *input, size_t input_len) {
+    hasher_update(self, input, input_len, 0, 0, NULL, NULL);
+}
+
+void blake3_hasher_update_parallel(blake3_hasher *self, const void *input,
+                                   size_t input_len, size_t max_jobs,
+                                   size_t min_job_len, blake3_subtree_runner runner,
+                                   void *user_data) {
+    hasher_update(self, input, input_len, max_jobs, min_job_len, runner, user_data);
+}
+
+void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out, size_t out_len) {
+    if(out_len == 0) {
+        return;
+    }
+
+    /* no subtrees at all: the current chunk is the root */
+    if(self->cv_stack_len == 0) {
+        output_t output = chunk_state_output(&self->chunk);
+        output_root_bytes(&output, out, out_len);
+        return;
+    }
+
+    /* Roll up from the top of the stack.  If the chunk state is empty, the
+     * last update ended on a subtree boundary and the top two entries are the
+     * children of the last subtree. */
+    output_t output;
+    size_t cvs_remaining;
+    if(chunk_state_len(&self->chunk) > 0) {
+        cvs_remaining = self->cv_stack_len;
+        output = chunk_state_output(&self->chunk);
+    } else {
+        cvs_remaining = self->cv_stack_len - 2;
+        output = parent_output(self->cv_stack[cvs_remaining],
+                               self->cv_stack[cvs_remaining + 1], self->key,
+                               self->chunk.flags);
+    }
+
+    while(cvs_remaining > 0) {
+        cvs_remaining--;
+        uint32_t right[8];
+        output_chaining_value(&output, right);
+        output = parent_output(self->cv_stack[cvs_remaining], right, self->key,
+                               self->chunk.flags);
+    }
+    output_root_bytes(&output, out, out_len);
+}
@@ -0,0 +1,81 @@
+/*
+ * Portable BLAKE3 hash (https://github.com/BLAKE3-team/BLAKE3).
+ *
+ * Only the default (unkeyed) hash mode is implemented.  Besides the usual
+ * init/update/finalize API there is blake3_hasher_update_parallel(), which
+ * hands complete, aligned subtrees of the input to a caller supplied runner so
+ * that big updates can be spread over several threads.  The result is
+ * identical to blake3_hasher_update() on the same data.
+ */
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum blake3_constant {
+    BLAKE3_OUT_LEN = 32,
+    BLAKE3_KEY_LEN = 32,
+    BLAKE3_BLOCK_LEN = 64,
+    BLAKE3_CHUNK_LEN = 1024,
+    BLAKE3_MAX_DEPTH = 54
+};
+
+typedef struct blake3_chunk_state {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t buf[BLAKE3_BLOCK_LEN];
+    uint8_t buf_len;
+    uint8_t blocks_compressed;
+    uint8_t flags;
+} blake3_chunk_state;
+
+typedef struct blake3_hasher {
+    uint32_t key[8];
+    blake3_chunk_state chunk;
+    uint8_t cv_stack_len;
+    /* one more entry than the depth; the lazy merge may leave one extra cv */
+    uint32_t cv_stack[BLAKE3_MAX_DEPTH + 1][8];
+} blake3_hasher;
+
+/* One complete subtree whose chaining value is computed by
+ * blake3_subtree_job_run(); the job does not touch the hasher */
+typedef struct blake3_subtree_job {
+    const uint8_t *input;
+    size_t len; /* power of two multiple of BLAKE3_CHUNK_LEN */
+    uint64_t chunk_counter;
+    const uint32_t *key;
+    uint8_t flags;
+    uint32_t cv[8]; /* output */
+} blake3_subtree_job;
+
+/* Must run every job in jobs[0..n_jobs) (in any order, on any thread) and
+ * return only when all of them are done */
+typedef void (*blake3_subtree_runner)(blake3_subtree_job *jobs, size_t n_jobs,
+                                      void *user_data);
+
+void blake3_hasher_init(blake3_hasher *self);
+void blake3_hasher_update(blake3_hasher *self, const void *input, size_t input_len);
+
+/* Like blake3_hasher_update(), but subtrees of at least min_job_len bytes
+ * each are split into up to max_jobs jobs which are passed to runner */
+void blake3_hasher_update_parallel(blake3_hasher *self, const void *input,
+                                   size_t input_len, size_t max_jobs,
+                                   size_t min_job_len, blake3_subtree_runner runner,
+                                   void *user_data);
+
+/* Does not modify self, so hashing may continue afterwards */
+void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out, size_t out_len);
+
+void blake3_subtree_job_run(blake3_subtree_job *job);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
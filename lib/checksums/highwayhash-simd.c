@@ -0,0 +1,126 @@
+/*
+SSE4.1 and AVX2 versions of the HighwayHash packet update, selected at
+runtime by highwayhash.c.  Output is identical to the portable code; the
+layout follows the reference implementation (hh_sse41.h / hh_avx2.h in
+https://github.com/google/highwayhash).
+
+Only the bulk packet loop is vectorised; the remainder and finalization run
+once per hash and stay portable.
+*/
+
+#include "../config.h"
+#include "highwayhash.h"
+
+#if HAVE_BUILTIN_CPU_SUPPORTS && (defined(__x86_64__) || defined(__i386__))
+#define HIGHWAY_SIMD_X86 (HAVE_SSE41 || HAVE_AVX2)
+#else
+#define HIGHWAY_SIMD_X86 0
+#endif
+
+#if HIGHWAY_SIMD_X86
+
+#include <immintrin.h>
+
+/* Byte shuffle of ZipperMergeAndAdd for one pair of lanes */
+#define ZIPPER_HI 0x070806090D0A040Bull
+#define ZIPPER_LO 0x000F010E05020C03ull
+
+#if HAVE_SSE41
+
+/* The state is kept in two halves of two lanes each */
+__attribute__((target("sse4.1"))) static void UpdatePacketsSSE41(
+    const uint8_t* packets, size_t num_packets, HighwayHashState* state) {
+    const __m128i zipper = _mm_set_epi64x(ZIPPER_HI, ZIPPER_LO);
+
+    __m128i v0L = _mm_loadu_si128((const __m128i*)&state->v0[0]);
+    __m128i v0H = _mm_loadu_si128((const __m128i*)&state->v0[2]);
+    __m128i v1L = _mm_loadu_si128((const __m128i*)&state->v1[0]);
+    __m128i v1H = _mm_loadu_si128((const __m128i*)&state->v1[2]);
+    __m128i mul0L = _mm_loadu_si128((const __m128i*)&state->mul0[0]);
+    __m128i mul0H = _mm_loadu_si128((const __m128i*)&state->mul0[2]);
+    __m128i mul1L = _mm_loadu_si128((const __m128i*)&state->mul1[0]);
+    __m128i mul1H = _mm_loadu_si128((const __m128i*)&state->mul1[2]);
+    size_t i;
+
+    for(i = 0; i < num_packets; i++) {
+        const __m128i packetL = _mm_loadu_si128((const __m128i*)(packets + 32 * i));
+        const __m128i packetH = _mm_loadu_si128((const __m128i*)(packets + 32 * i + 16));
+
+        v1L = _mm_add_epi64(v1L, _mm_add_epi64(mul0L, packetL));
+        v1H = _mm_add_epi64(v1H, _mm_add_epi64(mul0H, packetH));
+        mul0L = _mm_xor_si128(mul0L, _mm_mul_epu32(v1L, _mm_srli_epi64(v0L, 32)));
+        mul0H = _mm_xor_si128(mul0H, _mm_mul_epu32(v1H, _mm_srli_epi64(v0H, 32)));
+        v0L = _mm_add_epi64(v0L, mul1L);
+        v0H = _mm_add_epi64(v0H, mul1H);
+        mul1L = _mm_xor_si128(mul1L, _mm_mul_epu32(v0L, _mm_srli_epi64(v1L, 32)));
+        mul1H = _mm_xor_si128(mul1H, _mm_mul_epu32(v0H, _mm_srli_epi64(v1H, 32)));
+        v0L = _mm_add_epi64(v0L, _mm_shuffle_epi8(v1L, zipper));
+        v0H = _mm_add_epi64(v0H, _mm_shuffle_epi8(v1H, zipper));
+        v1L = _mm_add_epi64(v1L, _mm_shuffle_epi8(v0L, zipper));
+        v1H = _mm_add_epi64(v1H, _mm_shuffle_epi8(v0H, zipper));
+    }
+
+    _mm_storeu_si128((__m128i*)&state->v0[0], v0L);
+    _mm_storeu_si128((__m128i*)&state->v0[2], v0H);
+    _mm_storeu_si128((__m128i*)&state->v1[0], v1L);
+    _mm_storeu_si128((__m128i*)&state->v1[2], v1H);
+    _mm_storeu_si128((__m128i*)&state->mul0[0], mul0L);
+    _mm_storeu_si128((__m128i*)&state->mul0[2], mul0H);
+    _mm_storeu_si128((__m128i*)&state->mul1[0], mul1L);
+    _mm_storeu_si128((__m128i*)&state->mul1[2], mul1H);
+}
+
+#endif
+
+#if HAVE_AVX2
+
+__attribute__((target("avx2"))) static void UpdatePacketsAVX2(
+    const uint8_t* packets, size_t num_packets, HighwayHashState* state) {
+    const __m256i zipper = _mm256_set_epi64x(ZIPPER_HI, ZIPPER_LO, ZIPPER_HI, ZIPPER_LO);
+
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)state->v0);
+    __m256i v1 = _mm256_loadu_si256((const __m256i*)state->v1);
+    __m256i mul0 = _mm256_loadu_si256((const __m256i*)state->mul0);
+    __m256i mul1 = _mm256_loadu_si256((const __m256i*)state->mul1);
+    size_t i;
+
+    for(i = 0; i < num_packets; i++) {
+        const __m256i packet = _mm256_loadu_si256((const __m256i*)(packets + 32 * i));
+
+        v1 = _mm256_add_epi64(v1, _mm256_add_epi64(mul0, packet));
+        mul0 = _mm256_xor_si256(mul0, _mm256_mul_epu32(v1, _mm256_srli_epi64(v0, 32)));
+        v0 = _mm256_add_epi64(v0, mul1);
+        mul1 = _mm256_xor_si256(mul1, _mm256_mul_epu32(v0, _mm256_srli_epi64(v1, 32)));
+        v0 = _mm256_add_epi64(v0, _mm256_shuffle_epi8(v1, zipper));
+        v1 = _mm256_add_epi64(v1, _mm256_shuffle_epi8(v0, zipper));
+    }
+
+    _mm256_storeu_si256((__m256i*)state->v0, v0);
+    _mm256_storeu_si256((__m256i*)state->v1, v1);
+    _mm256_storeu_si256((__m256i*)state->mul0, mul0);
+    _mm256_storeu_si256((__m256i*)state->mul1, mul1);
+}
+
+#endif
+
+#endif
+
+HighwayHashPacketsFunc HighwayHashSimdBest(const char** name) {
+#if HIGHWAY_SIMD_X86
+    __builtin_cpu_init();
+#if HAVE_AVX2
+    if(__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return UpdatePacketsAVX2;
+    }
+#endif
+#if HAVE_SSE41
+    if(__builtin_cpu_supports("sse4.1")) {
+        *name = "sse4.1";
+        return UpdatePacketsSSE41;
+    }
+#endif
+#endif
+    *name = "portable";
+    return NULL;
+}
@@ -73,6 +73,41 @@ void HighwayHashUpdatePacket(const uint8_t* packet, HighwayHashState* state) {
     Update(lanes, state);
 }
 
+static void UpdatePacketsPortable(const uint8_t* packets, size_t num_packets,
+                                  HighwayHashState* state) {
+    size_t i;
+    for(i = 0; i < num_packets; i++) {
+        HighwayHashUpdatePacket(packets + 32 * i, state);
+    }
+}
+
+/* UpdatePackets is either UpdatePacketsPortable or one of the kernels in
+ * highwayhash-simd.c; UpdatePacketsAuto picks one on first use.  Several
+ * threads may do so at once, so the pointer is only accessed atomically. */
+static void UpdatePacketsAuto(const uint8_t* packets, size_t num_packets,
+                              HighwayHashState* state);
+
+static HighwayHashPacketsFunc UpdatePackets = UpdatePacketsAuto;
+
+const char* HighwayHashUseSimd(int enable) {
+    const char* name = "portable";
+    HighwayHashPacketsFunc best = enable ? HighwayHashSimdBest(&name) : NULL;
+    __atomic_store_n(&UpdatePackets, best ? best : UpdatePacketsPortable,
+                     __ATOMIC_RELEASE);
+    return name;
+}
+
+static void UpdatePacketsAuto(const uint8_t* packets, size_t num_packets,
+                              HighwayHashState* state) {
+    HighwayHashUseSimd(1);
+    __atomic_load_n(&UpdatePackets, __ATOMIC_ACQUIRE)(packets, num_packets, state);
+}
+
+void HighwayHashUpdatePackets(const uint8_t* packets, size_t num_packets,
+                              HighwayHashState* state) {
+    __atomic_load_n(&UpdatePackets, __ATOMIC_ACQUIRE)(packets, num_packets, state);
+}
+
 static void Rotate32By(uint64_t count, uint64_t lanes[4]) {
     int i;
     for(i = 0; i < 4; ++i) {
@@ -166,9 +201,8 @@ static void ProcessAll(const uint8_t* data, size_t size, const uint64_t key[4],
                        HighwayHashState* state) {
     size_t i;
     HighwayHashReset(key, state);
-    for(i = 0; i + 32 <= size; i += 32) {
-        HighwayHashUpdatePacket(data + i, state);
-    }
+    i = size & ~(size_t)31;
+    HighwayHashUpdatePackets(data, size / 32, state);
     if((size & 31) != 0)
         HighwayHashUpdateRemainder(data + i, size & 31, state);
 }
@@ -217,10 +251,10 @@ void HighwayHashCatAppend(const uint8_t* bytes, size_t num, HighwayHashCat* stat
             state->num = 0;
         }
     }
-    while(num >= 32) {
-        HighwayHashUpdatePacket(bytes, &state->state);
-        num -= 32;
-        bytes += 32;
+    if(num >= 32) {
+        HighwayHashUpdatePackets(bytes, num / 32, &state->state);
+        bytes += num & ~(size_t)31;
+        num &= 31;
     }
     for(i = 0; i < num; i++) {
         state->packet[state->num] = bytes[i];
@@ -23,6 +23,24 @@ typedef struct {
 void HighwayHashReset(const uint64_t key[4], HighwayHashState* state);
 /* Takes a packet of 32 bytes */
 void HighwayHashUpdatePacket(const uint8_t* packet, HighwayHashState* state);
+
+/* Takes num_packets consecutive packets of 32 bytes; uses the fastest
+ * implementation this CPU supports (see HighwayHashUseSimd) */
+void HighwayHashUpdatePackets(const uint8_t* packets, size_t num_packets,
+                              HighwayHashState* state);
+
+typedef void (*HighwayHashPacketsFunc)(const uint8_t* packets, size_t num_packets,
+                                       HighwayHashState* state);
+
+/* Allow (enable != 0) or forbid SIMD for HighwayHashUpdatePackets; returns
+ * the name of the implementation used from now on.  Without a call the best
+ * one is picked on first use. */
+const char* HighwayHashUseSimd(int enable);
+
+/* Return the fastest SIMD implementation supported by this CPU and build, or
+ * NULL if there is none; *name is set to the instruction set used.  Output
+ * is identical to the portable code. */
+HighwayHashPacketsFunc HighwayHashSimdBest(const char** name);
 /* Adds the final 1..31 bytes, do not use if 0 remain */
 void HighwayHashUpdateRemainder(const uint8_t* bytes, const size_t size_mod32,
                                 HighwayHashState* state);
@@ -0,0 +1,83 @@
+/*
+   Merkle-Damgard buffering and padding shared by sha1.c and sha256.c.
+*/
+
+#ifndef RM_CHECKSUM_SHA_IMPL_H
+#define RM_CHECKSUM_SHA_IMPL_H
+
+#include <string.h>
+
+#include "sha.h"
+
+static inline uint32_t sha_load32_be(const uint8_t *src) {
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+           ((uint32_t)src[2] << 8) | ((uint32_t)src[3] << 0);
+}
+
+static inline void sha_store32_be(uint8_t *dst, uint32_t w) {
+    dst[0] = (uint8_t)(w >> 24);
+    dst[1] = (uint8_t)(w >> 16);
+    dst[2] = (uint8_t)(w >> 8);
+    dst[3] = (uint8_t)(w >> 0);
+}
+
+static inline uint32_t sha_rotl32(uint32_t w, unsigned c) {
+    return (w << c) | (w >> (32 - c));
+}
+
+static inline uint32_t sha_rotr32(uint32_t w, unsigned c) {
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline void sha_md_update(uint32_t *h, uint8_t *buf, size_t *buflen,
+                                 uint64_t *length, sha_blocks_func blocks,
+                                 const uint8_t *in, size_t inlen) {
+    *length += inlen;
+
+    if(*buflen > 0) {
+        size_t take = SHA_BLOCKBYTES - *buflen;
+        if(take > inlen) {
+            take = inlen;
+        }
+        memcpy(buf + *buflen, in, take);
+        *buflen += take;
+        in += take;
+        inlen -= take;
+
+        if(*buflen < SHA_BLOCKBYTES) {
+            return;
+        }
+        blocks(h, buf, 1);
+        *buflen = 0;
+    }
+
+    /* whole blocks straight from the input */
+    size_t n_blocks = inlen / SHA_BLOCKBYTES;
+    if(n_blocks > 0) {
+        blocks(h, in, n_blocks);
+        in += n_blocks * SHA_BLOCKBYTES;
+        inlen -= n_blocks * SHA_BLOCKBYTES;
+    }
+
+    memcpy(buf, in, inlen);
+    *buflen = inlen;
+}
+
+/* append 0x80, zeros and the big endian bit length */
+static inline void sha_md_pad(uint32_t *h, uint8_t *buf, size_t buflen, uint64_t length,
+                              sha_blocks_func blocks) {
+    buf[buflen++] = 0x80;
+    if(buflen > SHA_BLOCKBYTES - 8) {
+        memset(buf + buflen, 0, SHA_BLOCKBYTES - buflen);
+        blocks(h, buf, 1);
+        buflen = 0;
+    }
+    memset(buf + buflen, 0, SHA_BLOCKBYTES - 8 - buflen);
+
+    uint64_t bits = length * 8;
+    sha_store32_be(buf + SHA_BLOCKBYTES - 8, (uint32_t)(bits >> 32));
+    sha_store32_be(buf + SHA_BLOCKBYTES - 4, (uint32_t)bits);
+    blocks(h, buf, 1);
+}
+
+#endif
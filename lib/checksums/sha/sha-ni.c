@@ -0,0 +1,201 @@
+/*
+   SHA-NI kernels for sha1.c and sha256.c, selected at runtime.  Output is
+   identical to the portable block functions.
+
+   The instruction sequences follow the Intel SHA extensions white paper
+   ("Intel SHA Extensions", Gulley et al., 2013).
+*/
+
+#include "../../config.h"
+#include "sha.h"
+
+#if HAVE_BUILTIN_CPU_SUPPORTS && HAVE_SHA_NI && (defined(__x86_64__) || defined(__i386__))
+#define SHA_NI_X86 1
+#else
+#define SHA_NI_X86 0
+#endif
+
+#if SHA_NI_X86
+
+#include <immintrin.h>
+
+#define SHA_NI_TARGET __attribute__((target("sha,sse4.1")))
+
+static const uint32_t sha256_ni_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+/* Four rounds of SHA-256.  CUR holds the message words of this group, PREV
+ * those of the last one, NEXT (which is also the group three back) gets the
+ * words of the next group.  The ifs only depend on the constant i. */
+#define SHA256_ROUNDS4(i, CUR, PREV, NEXT)                                              \
+    do {                                                                                \
+        msg = _mm_add_epi32(CUR, _mm_loadu_si128((const __m128i *)&sha256_ni_K[4 * (i)])); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                            \
+        if((i) >= 3 && (i) <= 14) {                                                     \
+            NEXT = _mm_add_epi32(NEXT, _mm_alignr_epi8(CUR, PREV, 4));                  \
+            NEXT = _mm_sha256msg2_epu32(NEXT, CUR);                                     \
+        }                                                                               \
+        msg = _mm_shuffle_epi32(msg, 0x0E);                                             \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                            \
+        if((i) >= 1 && (i) <= 12) {                                                     \
+            PREV = _mm_sha256msg1_epu32(PREV, CUR);                                     \
+        }                                                                               \
+    } while(0)
+
+SHA_NI_TARGET
+static void sha256_blocks_ni(uint32_t *h, const uint8_t *in, size_t n_blocks) {
+    const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* the round instructions want the state as ABEF / CDGH */
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while(n_blocks-- > 0) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msg;
+
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 0)), byteswap);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16)), byteswap);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 32)), byteswap);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 48)), byteswap);
+
+        SHA256_ROUNDS4(0, m0, m3, m1);
+        SHA256_ROUNDS4(1, m1, m0, m2);
+        SHA256_ROUNDS4(2, m2, m1, m3);
+        SHA256_ROUNDS4(3, m3, m2, m0);
+        SHA256_ROUNDS4(4, m0, m3, m1);
+        SHA256_ROUNDS4(5, m1, m0, m2);
+        SHA256_ROUNDS4(6, m2, m1, m3);
+        SHA256_ROUNDS4(7, m3, m2, m0);
+        SHA256_ROUNDS4(8, m0, m3, m1);
+        SHA256_ROUNDS4(9, m1, m0, m2);
+        SHA256_ROUNDS4(10, m2, m1, m3);
+        SHA256_ROUNDS4(11, m3, m2, m0);
+        SHA256_ROUNDS4(12, m0, m3, m1);
+        SHA256_ROUNDS4(13, m1, m0, m2);
+        SHA256_ROUNDS4(14, m2, m1, m3);
+        SHA256_ROUNDS4(15, m3, m2, m0);
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        in += SHA_BLOCKBYTES;
+    }
+
+    /* back to ABCD / EFGH */
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i *)&h[0], state0);
+    _mm_storeu_si128((__m128i *)&h[4], state1);
+}
+
+/* Four rounds of SHA-1 (group i of 20).  E is the E value of this group,
+ * E_NEXT receives the one for the next group; CUR, PREV, PREV2 and NEXT are
+ * the message words of groups i, i-1, i-2 and i+1 (NEXT shares its register
+ * with group i-3). */
+#define SHA1_ROUNDS4(i, E, E_NEXT, CUR, PREV, PREV2, NEXT)     \
+    do {                                                       \
+        if((i) == 0) {                                         \
+            E = _mm_add_epi32(E, CUR);                         \
+        } else {                                               \
+            E = _mm_sha1nexte_epu32(E, CUR);                   \
+        }                                                      \
+        E_NEXT = abcd;                                         \
+        if((i) >= 3 && (i) <= 18) {                            \
+            NEXT = _mm_sha1msg2_epu32(NEXT, CUR);              \
+        }                                                      \
+        abcd = _mm_sha1rnds4_epu32(abcd, E, (i) / 5);          \
+        if((i) >= 1 && (i) <= 16) {                            \
+            PREV = _mm_sha1msg1_epu32(PREV, CUR);              \
+        }                                                      \
+        if((i) >= 2 && (i) <= 17) {                            \
+            PREV2 = _mm_xor_si128(PREV2, CUR);                 \
+        }                                                      \
+    } while(0)
+
+SHA_NI_TARGET
+static void sha1_blocks_ni(uint32_t *h, const uint8_t *in, size_t n_blocks) {
+    const __m128i byteswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)h[4], 0, 0, 0);
+
+    while(n_blocks-- > 0) {
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+        __m128i e1;
+
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 0)), byteswap);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16)), byteswap);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 32)), byteswap);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 48)), byteswap);
+
+        SHA1_ROUNDS4(0, e0, e1, m0, m3, m2, m1);
+        SHA1_ROUNDS4(1, e1, e0, m1, m0, m3, m2);
+        SHA1_ROUNDS4(2, e0, e1, m2, m1, m0, m3);
+        SHA1_ROUNDS4(3, e1, e0, m3, m2, m1, m0);
+        SHA1_ROUNDS4(4, e0, e1, m0, m3, m2, m1);
+        SHA1_ROUNDS4(5, e1, e0, m1, m0, m3, m2);
+        SHA1_ROUNDS4(6, e0, e1, m2, m1, m0, m3);
+        SHA1_ROUNDS4(7, e1, e0, m3, m2, m1, m0);
+        SHA1_ROUNDS4(8, e0, e1, m0, m3, m2, m1);
+        SHA1_ROUNDS4(9, e1, e0, m1, m0, m3, m2);
+        SHA1_ROUNDS4(10, e0, e1, m2, m1, m0, m3);
+        SHA1_ROUNDS4(11, e1, e0, m3, m2, m1, m0);
+        SHA1_ROUNDS4(12, e0, e1, m0, m3, m2, m1);
+        SHA1_ROUNDS4(13, e1, e0, m1, m0, m3, m2);
+        SHA1_ROUNDS4(14, e0, e1, m2, m1, m0, m3);
+        SHA1_ROUNDS4(15, e1, e0, m3, m2, m1, m0);
+        SHA1_ROUNDS4(16, e0, e1, m0, m3, m2, m1);
+        SHA1_ROUNDS4(17, e1, e0, m1, m0, m3, m2);
+        SHA1_ROUNDS4(18, e0, e1, m2, m1, m0, m3);
+        SHA1_ROUNDS4(19, e1, e0, m3, m2, m1, m0);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+        in += SHA_BLOCKBYTES;
+    }
+
+    _mm_storeu_si128((__m128i *)h, _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#endif
+
+sha_blocks_func sha256_simd_best(const char **name) {
+#if SHA_NI_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        *name = "sha-ni";
+        return sha256_blocks_ni;
+    }
+#endif
+    *name = "ref";
+    return NULL;
+}
+
+sha_blocks_func sha1_simd_best(const char **name) {
+#if SHA_NI_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        *name = "sha-ni";
+        return sha1_blocks_ni;
+    }
+#endif
+    *name = "ref";
+    return NULL;
+}
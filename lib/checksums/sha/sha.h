@@ -0,0 +1,57 @@
+/*
+   SHA-1 and SHA-256 (FIPS 180-4) for rmlint, with optional SHA-NI kernels
+   which are selected at runtime.
+
+   The states are plain structs, so copying them (for progressive hashing)
+   is a memcpy.
+*/
+
+#ifndef RM_CHECKSUM_SHA_H
+#define RM_CHECKSUM_SHA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA_BLOCKBYTES 64
+#define SHA1_OUTBYTES 20
+#define SHA256_OUTBYTES 32
+
+typedef struct sha1_state {
+    uint32_t h[5];
+    uint64_t length; /* bytes hashed so far */
+    uint8_t buf[SHA_BLOCKBYTES];
+    size_t buflen;
+} sha1_state;
+
+typedef struct sha256_state {
+    uint32_t h[8];
+    uint64_t length;
+    uint8_t buf[SHA_BLOCKBYTES];
+    size_t buflen;
+} sha256_state;
+
+/* Hash n_blocks consecutive 64 byte blocks of in into h */
+typedef void (*sha_blocks_func)(uint32_t *h, const uint8_t *in, size_t n_blocks);
+
+void sha1_init(sha1_state *S);
+void sha1_update(sha1_state *S, const void *in, size_t inlen);
+/* writes SHA1_OUTBYTES to out; S can't be updated afterwards */
+void sha1_final(sha1_state *S, uint8_t *out);
+
+void sha256_init(sha256_state *S);
+void sha256_update(sha256_state *S, const void *in, size_t inlen);
+/* writes SHA256_OUTBYTES to out; S can't be updated afterwards */
+void sha256_final(sha256_state *S, uint8_t *out);
+
+/* Allow (enable != 0) or forbid the SHA-NI kernels; returns the name of the
+ * implementation that is used from now on.  Without a call the best one is
+ * picked on first use. */
+const char *sha1_use_simd(int enable);
+const char *sha256_use_simd(int enable);
+
+/* Return the SHA-NI kernel if this CPU and build support it, or NULL; *name
+ * is set to the instruction set used. */
+sha_blocks_func sha1_simd_best(const char **name);
+sha_blocks_func sha256_simd_best(const char **name);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+   SHA-1 (FIPS 180-4) for rmlint.  The portable block function is used
+   unless sha-ni.c provides a faster one for this CPU.
+*/
+
+#include "sha-impl.h"
+
+static void sha1_blocks_ref(uint32_t *h, const uint8_t *in, size_t n_blocks) {
+    while(n_blocks-- > 0) {
+        uint32_t w[80];
+        for(size_t i = 0; i < 16; i++) {
+            w[i] = sha_load32_be(in + 4 * i);
+        }
+        for(size_t i = 16; i < 80; i++) {
+            w[i] = sha_rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+        for(size_t i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if(i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if(i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if(i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+
+            uint32_t t = sha_rotl32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = sha_rotl32(b, 30);
+            b = a;
+            a = t;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        in += SHA_BLOCKBYTES;
+    }
+}
+
+/* sha1_blocks is either the portable function or a sha-ni.c kernel;
+ * sha1_blocks_auto picks one on first use.  Several threads may do so at
+ * once, so the pointer is only accessed atomically. */
+static void sha1_blocks_auto(uint32_t *h, const uint8_t *in, size_t n_blocks);
+
+static sha_blocks_func sha1_blocks = sha1_blocks_auto;
+
+const char *sha1_use_simd(int enable) {
+    const char *name = "ref";
+    sha_blocks_func best = enable ? sha1_simd_best(&name) : NULL;
+    __atomic_store_n(&sha1_blocks, best ? best : sha1_blocks_ref, __ATOMIC_RELEASE);
+    return name;
+}
+
+static void sha1_blocks_auto(uint32_t *h, const uint8_t *in, size_t n_blocks) {
+    sha1_use_simd(1);
+    __atomic_load_n(&sha1_blocks, __ATOMIC_ACQUIRE)(h, in, n_blocks);
+}
+
+void sha1_init(sha1_state *S) {
+    static const uint32_t iv[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                                   0xc3d2e1f0};
+    memcpy(S->h, iv, sizeof(iv));
+    S->length = 0;
+    S->buflen = 0;
+}
+
+void sha1_update(sha1_state *S, const void *in, size_t inlen) {
+    sha_md_update(S->h, S->buf, &S->buflen, &S->length,
+                  __atomic_load_n(&sha1_blocks, __ATOMIC_ACQUIRE), in, inlen);
+}
+
+void sha1_final(sha1_state *S, uint8_t *out) {
+    sha_md_pad(S->h, S->buf, S->buflen, S->length, sha1_blocks);
+    for(size_t i = 0; i < 5; i++) {
+        sha_store32_be(out + 4 * i, S->h[i]);
+    }
+}
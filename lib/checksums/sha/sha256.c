@@ -0,0 +1,104 @@
+/*
+   SHA-256 (FIPS 180-4) for rmlint.  The portable block function is used
+   unless sha-ni.c provides a faster one for this CPU.
+*/
+
+#include "sha-impl.h"
+
+static const uint32_t sha256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2};
+
+static void sha256_blocks_ref(uint32_t *h, const uint8_t *in, size_t n_blocks) {
+    while(n_blocks-- > 0) {
+        uint32_t w[64];
+        for(size_t i = 0; i < 16; i++) {
+            w[i] = sha_load32_be(in + 4 * i);
+        }
+        for(size_t i = 16; i < 64; i++) {
+            uint32_t s0 =
+                sha_rotr32(w[i - 15], 7) ^ sha_rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 =
+                sha_rotr32(w[i - 2], 17) ^ sha_rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+
+        for(size_t i = 0; i < 64; i++) {
+            uint32_t S1 = sha_rotr32(e, 6) ^ sha_rotr32(e, 11) ^ sha_rotr32(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = hh + S1 + ch + sha256_K[i] + w[i];
+            uint32_t S0 = sha_rotr32(a, 2) ^ sha_rotr32(a, 13) ^ sha_rotr32(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = S0 + maj;
+
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+        in += SHA_BLOCKBYTES;
+    }
+}
+
+/* sha256_blocks is either the portable function or a sha-ni.c kernel;
+ * sha256_blocks_auto picks one on first use.  Several threads may do so at
+ * once, so the pointer is only accessed atomically. */
+static void sha256_blocks_auto(uint32_t *h, const uint8_t *in, size_t n_blocks);
+
+static sha_blocks_func sha256_blocks = sha256_blocks_auto;
+
+const char *sha256_use_simd(int enable) {
+    const char *name = "ref";
+    sha_blocks_func best = enable ? sha256_simd_best(&name) : NULL;
+    __atomic_store_n(&sha256_blocks, best ? best : sha256_blocks_ref, __ATOMIC_RELEASE);
+    return name;
+}
+
+static void sha256_blocks_auto(uint32_t *h, const uint8_t *in, size_t n_blocks) {
+    sha256_use_simd(1);
+    __atomic_load_n(&sha256_blocks, __ATOMIC_ACQUIRE)(h, in, n_blocks);
+}
+
+void sha256_init(sha256_state *S) {
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(S->h, iv, sizeof(iv));
+    S->length = 0;
+    S->buflen = 0;
+}
+
+void sha256_update(sha256_state *S, const void *in, size_t inlen) {
+    sha_md_update(S->h, S->buf, &S->buflen, &S->length,
+                  __atomic_load_n(&sha256_blocks, __ATOMIC_ACQUIRE), in, inlen);
+}
+
+void sha256_final(sha256_state *S, uint8_t *out) {
+    sha_md_pad(S->h, S->buf, S->buflen, S->length, sha256_blocks);
+    for(size_t i = 0; i < 8; i++) {
+        sha_store32_be(out + 4 * i, S->h[i]);
+    }
+}
@@ -43,6 +43,7 @@
 #include "formats.h"
 #include "hash-utility.h"
 #include "md-scheduler.h"
+#include "metrics.h"
 #include "preprocess.h"
 #include "replay.h"
 #include "shredder.h"
@@ -271,7 +272,7 @@ static int rm_cmd_compare_spec_elem(const void *fmt_a, const void *fmt_b) {
     return strcasecmp(((FormatSpec *)fmt_a)->id, ((FormatSpec *)fmt_b)->id);
 }
 
-static RmOff rm_cmd_size_string_to_bytes(const char *size_spec, GError **error) {
+RmOff rm_cmd_size_string_to_bytes(const char *size_spec, GError **error) {
     if(size_spec == NULL) {
         g_set_error(error, RM_ERROR_QUARK, 0, _("Input size is empty"));
         return 0;
@@ -989,6 +990,50 @@ static gboolean rm_cmd_parse_read_buf_len(_UNUSED const char *option_name,
     return (rm_cmd_parse_mem(size_spec, error, &session->cfg->read_buf_len));
 }
 
+static gboolean rm_cmd_parse_direct_read(_UNUSED const char *option_name,
+                                         const gchar *paths, RmSession *session,
+                                         GError **error) {
+    RmCfg *cfg = session->cfg;
+    cfg->use_direct_read = true;
+
+    if(paths == NULL) {
+        /* no argument: use it for all devices */
+        return true;
+    }
+
+    if(cfg->direct_read_devs == NULL) {
+        cfg->direct_read_devs = g_hash_table_new(NULL, NULL);
+    }
+
+    bool success = true;
+    char **path_vec = g_strsplit(paths, ",", -1);
+    for(int i = 0; path_vec[i] && success; i++) {
+        RmStat stat_buf;
+        if(rm_sys_stat(path_vec[i], &stat_buf) == -1) {
+            g_set_error(error, RM_ERROR_QUARK, 0, _("--direct-read: cannot stat %s: %s"),
+                        path_vec[i], g_strerror(errno));
+            success = false;
+        } else {
+            g_hash_table_add(cfg->direct_read_devs, GUINT_TO_POINTER(stat_buf.st_dev));
+        }
+    }
+
+    g_strfreev(path_vec);
+    return success;
+}
+
+static gboolean rm_cmd_parse_metrics_stream(_UNUSED const char *option_name,
+                                            const gchar *spec, RmSession *session,
+                                            GError **error) {
+    RmCfg *cfg = session->cfg;
+    if(cfg->metrics_stream_fd != -1) {
+        close(cfg->metrics_stream_fd);
+    }
+
+    cfg->metrics_stream_fd = rm_metrics_stream_open(spec, error);
+    return cfg->metrics_stream_fd != -1;
+}
+
 static gboolean rm_cmd_parse_sweep_size(_UNUSED const char *option_name,
                                         const gchar *size_spec, RmSession *session,
                                         GError **error) {
@@ -1432,6 +1477,7 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"match-without-extension"  , 'i'  , 0         , G_OPTION_ARG_NONE      , &cfg->match_without_extension  , _("Only find twins with same basename minus extension")                   , NULL}     ,
         {"merge-directories"        , 'D'  , EMPTY     , G_OPTION_ARG_CALLBACK  , FUNC(merge_directories)        , _("Find duplicate directories")                                           , NULL}     ,
         {"honour-dir-layout"        , 'j'  , EMPTY     , G_OPTION_ARG_CALLBACK  , FUNC(honour_dir_layout)        , _("Only find directories with same file layout")                          , NULL}     ,
+        {"snapshots"                , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->snapshots                , _("Do not read hardlinks that have no other file of their size with -D")  , NULL}     ,
         {"perms"                    , 'z'  , OPTIONAL  , G_OPTION_ARG_CALLBACK  , FUNC(permissions)              , _("Only use files with certain permissions")                              , "[RWX]+"} ,
         {"no-hardlinked"            , 'L'  , DISABLE   , G_OPTION_ARG_NONE      , &cfg->find_hardlinked_dupes    , _("Ignore hardlink twins")                                                , NULL}     ,
         {"keep-hardlinked"          , 0    , 0         , G_OPTION_ARG_NONE      , &cfg->keep_hardlinked_dupes    , _("Keep hardlink that are linked to any original")                        , NULL}     ,
@@ -1481,8 +1527,12 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"clamp-top"              , 'Q' , 0                , G_OPTION_ARG_CALLBACK , FUNC(clamp_top)              , "Limit upper reading barrier"                                 , "P"}    ,
         {"limit-mem"              , 'u' , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(limit_mem)              , "Specify max. memory usage target"                            , "S"}    ,
         {"read-buffer-len"        , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(read_buf_len)           , "Specify read buffer length in bytes"                         , "S"}    ,
+        {"direct-read"            , 0   , OPTIONAL         , G_OPTION_ARG_CALLBACK , FUNC(direct_read)            , "Read with O_DIRECT, bypassing the page cache"                , "PATHS"},
         {"sweep-size"             , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(sweep_size)             , "Specify max. bytes per pass when scanning disks"             , "S"}    ,
         {"sweep-files"            , 0   , HIDDEN           , G_OPTION_ARG_CALLBACK , FUNC(sweep_count)            , "Specify max. file count per pass when scanning disks"        , "S"}    ,
+        {"metrics"                , 0   , 0                , G_OPTION_ARG_FILENAME , &cfg->metrics_path           , "Write timings and counters as json to PATH"                  , "PATH"} ,
+        {"metrics-interval"       , 0   , 0                , G_OPTION_ARG_DOUBLE   , &cfg->metrics_interval       , "Update --metrics and --metrics-stream every T seconds (0: at exit)", "T"}    ,
+        {"metrics-stream"         , 0   , 0                , G_OPTION_ARG_CALLBACK , FUNC(metrics_stream)         , "Write progress as json lines to FD or unix:PATH"             , "FD|unix:PATH"} ,
         {"threads"                , 't' , HIDDEN           , G_OPTION_ARG_INT64    , &cfg->threads                , "Specify max. number of hasher threads"                       , "N"}    ,
         {"threads-per-disk"       , 0   , HIDDEN           , G_OPTION_ARG_INT      , &cfg->threads_per_disk       , "Specify number of reader threads per physical disk"          , NULL}   ,
         {"write-unfinished"       , 'U' , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->write_unfinished       , "Output unfinished checksums"                                 , NULL}   ,
@@ -1496,7 +1546,9 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         {"fake-holdback"          , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->cache_file_structs     , "Hold back all files to the end before outputting."           , NULL}   ,
         {"fake-fiemap"            , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->fake_fiemap            , "Create faked fiemap data for all files"                      , NULL}   ,
         {"fake-abort"             , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->fake_abort             , "Simulate interrupt after 10% shredder progress"              , NULL}   ,
+        {"fake-lockstep-collisions", 0  , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->fake_lockstep_collisions, "Find --paranoid-lockstep candidates with a weak hash"      , NULL}   ,
         {"buffered-read"          , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->use_buffered_read      , "Default to buffered reading calls (fread) during reading."   , NULL}   ,
+        {"paranoid-lockstep"      , 0   , 0                , G_OPTION_ARG_NONE     , &cfg->paranoid_lockstep      , "With --paranoid: verify hashed candidates byte-by-byte"      , NULL}   ,
         {"shred-never-wait"       , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->shred_never_wait       , "Never waits for file increment to finish hashing"            , NULL}   ,
         {"no-sse"                 , 0   , HIDDEN           , G_OPTION_ARG_NONE     , &cfg->no_sse                 , "Don't use SSE accelerations"                                 , NULL}   ,
         {"no-mount-table"         , 0   , DISABLE | HIDDEN , G_OPTION_ARG_NONE     , &cfg->list_mounts            , "Do not try to optimize by listing mounted volumes"           , NULL}   ,
@@ -1624,6 +1676,10 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
         rm_log_warning_line(_("will also disable --merge-directories and trigger this warning."));
     }
 
+    if(cfg->snapshots && !cfg->merge_directories) {
+        rm_log_warning_line(_("--snapshots makes no sense without --merge-directories (-D)"));
+    }
+
     if(cfg->progress_enabled) {
         if(!rm_fmt_has_formatter(session->formats, "sh")) {
             rm_fmt_add(session->formats, "sh", "rmlint.sh");
@@ -1676,6 +1732,10 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session) {
 
 #if HAVE_BUILTIN_CPU_SUPPORTS && HAVE_MM_CRC32_U64
     rm_digest_enable_sse(!cfg->no_sse && __builtin_cpu_supports("sse4.2"));
+#else
+    if(cfg->no_sse) {
+        rm_digest_enable_sse(FALSE);
+    }
 #endif
 
 cleanup:
@@ -43,4 +43,11 @@ bool rm_cmd_parse_args(int argc, char **argv, RmSession *session);
  */
 int rm_cmd_main(RmSession *session);
 
+/**
+ * @brief Parse a size like "1.5M", "64KB" or "1024".
+ *
+ * @return the size in bytes, or 0 with error set if size_spec is invalid.
+ */
+RmOff rm_cmd_size_string_to_bytes(const char *size_spec, GError **error);
+
 #endif
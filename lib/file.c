@@ -31,6 +31,15 @@
 #include <sys/file.h>
 #include <unistd.h>
 
+/* where reading starts for a file of actual_file_size bytes (see --clamp-low) */
+static RmOff rm_file_start_seek(RmCfg *cfg, RmOff actual_file_size) {
+    if(cfg->use_absolute_start_offset) {
+        return cfg->skip_start_offset;
+    } else {
+        return cfg->skip_start_factor * actual_file_size;
+    }
+}
+
 RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
                     RmLintType type, bool is_ppath, unsigned path_index, short depth) {
     RmCfg *cfg = session->cfg;
@@ -39,20 +48,14 @@ RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
 
     /* Allow an actual file size of 0 for empty files */
     if(actual_file_size != 0) {
-        if(cfg->use_absolute_start_offset) {
-            start_seek = cfg->skip_start_offset;
-            if(cfg->skip_start_offset >= actual_file_size) {
-                return NULL;
-            }
-        } else {
-            start_seek = cfg->skip_start_factor * actual_file_size;
-            if((int)(actual_file_size * cfg->skip_end_factor) == 0) {
-                return NULL;
-            }
-
-            if(start_seek >= actual_file_size) {
-                return NULL;
-            }
+        start_seek = rm_file_start_seek(cfg, actual_file_size);
+        if(!cfg->use_absolute_start_offset &&
+           (int)(actual_file_size * cfg->skip_end_factor) == 0) {
+            return NULL;
+        }
+
+        if(start_seek >= actual_file_size) {
+            return NULL;
         }
     }
 
@@ -99,6 +102,13 @@ RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
     return self;
 }
 
+RmOff rm_file_start_offset(RmFile *file) {
+    if(file->actual_file_size == 0) {
+        return 0;
+    }
+    return rm_file_start_seek(file->session->cfg, file->actual_file_size);
+}
+
 void rm_file_set_path(RmFile *file, char *path) {
     file->folder = rm_trie_insert(&file->session->cfg->file_trie, path, file);
 }
@@ -307,6 +307,11 @@ typedef struct RmFile {
 RmFile *rm_file_new(struct RmSession *session, const char *path, RmStat *statp,
                     RmLintType type, bool is_ppath, unsigned pnum, short depth);
 
+/**
+ * @brief Offset at which hashing of file started (non-zero when using --clamp-low).
+ */
+RmOff rm_file_start_offset(RmFile *file);
+
 /**
  * @brief Deallocate the memory allocated by rm_file_new.
  * @note does not deallocate file->digest since this is handled by shredder.c
@@ -30,6 +30,7 @@
 
 #include "file.h"
 #include "formats.h"
+#include "metrics.h"
 
 /* A group of output files.
  * These are only created when caching to the end of the run is requested.
@@ -83,6 +84,7 @@ RmFmtTable *rm_fmt_open(RmSession *session) {
     self->session = session;
     g_queue_init(&self->groups);
     g_rec_mutex_init(&self->state_mtx);
+    self->state = RM_PROGRESS_STATE_N;
 
     extern RmFmtHandler *PROGRESS_HANDLER;
     rm_fmt_register(self, PROGRESS_HANDLER);
@@ -344,10 +346,13 @@ bool rm_fmt_add(RmFmtTable *self, const char *handler_name, const char *path) {
 }
 
 static void rm_fmt_write_impl(RmFile *result, RmFmtTable *self) {
+    gint64 start = rm_metrics_now();
     RM_FMT_FOR_EACH_HANDLER_BEGIN(self) {
         RM_FMT_CALLBACK(handler->elem, result);
     }
     RM_FMT_FOR_EACH_HANDLER_END
+    rm_metrics_count(RM_METRICS_OUTPUT_FILES, 1);
+    rm_metrics_time(RM_METRICS_OUTPUT_WRITE, start);
 }
 
 static gint rm_fmt_rank_size(const RmFmtGroup *ga, const RmFmtGroup *gb) {
@@ -490,6 +495,13 @@ void rm_fmt_unlock_state(RmFmtTable *self) {
 void rm_fmt_set_state(RmFmtTable *self, RmFmtProgressState state) {
     rm_fmt_lock_state(self);
     {
+        /* traversal repeats its state for every file; only phase changes
+         * are worth the metrics lock */
+        if(state != self->state) {
+            self->state = state;
+            rm_metrics_set_phase(state);
+        }
+
         RM_FMT_FOR_EACH_HANDLER_BEGIN(self) {
             RM_FMT_CALLBACK(handler->prog, state);
         }
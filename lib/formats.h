@@ -58,6 +58,10 @@ typedef struct RmFmtTable {
     GHashTable *config;
     GQueue *handler_order;
     GRecMutex state_mtx;
+
+    /* last state passed to rm_fmt_set_state; protected by state_mtx */
+    RmFmtProgressState state;
+
     RmSession *session;
     GDateTime *first_backup_timestamp;
 
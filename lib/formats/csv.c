@@ -73,7 +73,7 @@ static void rm_fmt_elem(_UNUSED RmSession *session, _UNUSED RmFmtHandler *parent
     char *checksum_str = NULL;
     size_t checksum_size = 0;
 
-    if(file->digest != NULL) {
+    if(file->digest != NULL && file->digest->type != RM_DIGEST_INODE) {
         checksum_size = rm_digest_get_bytes(file->digest) * 2 + 1;
         checksum_str = g_malloc0(checksum_size);
         checksum_str[checksum_size - 1] = 0;
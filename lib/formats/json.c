@@ -316,7 +316,8 @@ static void rm_fmt_elem(RmSession *session, _UNUSED RmFmtHandler *parent, FILE *
         rm_fmt_json_key_int(out, "progress", progress);
         rm_fmt_json_sep(self, out);
 
-        if(file->digest) {
+        if(file->digest && file->digest->type != RM_DIGEST_INODE) {
+            /* inode digests (--snapshots) are not checksums of the data */
             rm_fmt_json_key(out, "checksum", checksum_str);
             rm_fmt_json_sep(self, out);
         }
@@ -30,15 +30,47 @@
 
 #include "../lib/config.h"
 #include "../lib/hasher.h"
+#include "../lib/md-scheduler.h"
 #include "../lib/utilities.h"
 
+/* Upper limit for paths that were read but not printed yet; bounds memory
+ * when millions of paths are piped in */
+#define RM_HASHER_MAX_PENDING (16 * 1024)
+
+/* Upper limit for reader threads over all devices */
+#define RM_HASHER_MAX_READERS 64
+
+typedef struct RmHasherEntry {
+    char *path;
+    RmOff size;
+    RmMDSDevice *disk;
+
+    /* Set by the hasher callback */
+    RmDigest *digest;
+    gboolean read_successful;
+    gboolean done;
+} RmHasherEntry;
+
 typedef struct RmHasherSession {
     /* Internal */
-    char **paths;
-    gint path_index;
+    RmHasher *hasher;
+    RmMDS *mds;
+
+    /* Devices we keep a reference on until all paths are pushed, so that
+     * idle devices are not freed while input is still coming in */
+    GHashTable *disks;
+
+    /* Entries in input order, waiting to be printed (print_in_order only) */
+    GQueue *pending;
+
+    /* Number of entries read but not printed yet */
+    guint n_pending;
+
+    /* Number of entries pushed so far (only used by the main thread) */
+    guint64 n_pushed;
+
     GMutex lock;
-    RmDigest **completed_digests_buffer;
-    bool *read_succesful;
+    GCond cond;
 
     /* Options */
     RmDigestType digest_type;
@@ -70,48 +102,110 @@ static void rm_hasher_print(RmDigest *digest, char *path) {
     g_print("%s  %s\n", checksum_str, path);
 }
 
+/* Print (if hashed successfully) and free entry; session->lock must be held */
+static void rm_hasher_entry_finish(RmHasherSession *session, RmHasherEntry *entry) {
+    if(entry->read_successful && entry->digest) {
+        rm_hasher_print(entry->digest, entry->path);
+    }
+    if(entry->digest) {
+        rm_digest_free(entry->digest);
+    }
+    g_free(entry->path);
+    g_slice_free(RmHasherEntry, entry);
+
+    session->n_pending--;
+    g_cond_signal(&session->cond);
+}
+
 static int rm_hasher_callback(_UNUSED RmHasher *hasher,
                               RmDigest *digest,
                               RmHasherSession *session,
-                              gpointer index_ptr) {
-    gint index = GPOINTER_TO_INT(index_ptr);
-
+                              RmHasherEntry *entry) {
     g_mutex_lock(&session->lock);
     {
-        if(session->print_in_order && digest) {
-            /* add digest in buffer array */
-            session->completed_digests_buffer[index] = digest;
-
-            /* check if the next due digest has been completed; if yes then print
-             * it (and possibly any following digests) */
-            while(session->completed_digests_buffer[session->path_index]) {
-                if(session->paths[session->path_index]) {
-                    if(session->read_succesful[session->path_index]) {
-                        rm_hasher_print(
-                            session->completed_digests_buffer[session->path_index],
-                            session->paths[session->path_index]);
-                    }
-                    rm_digest_free(
-                        session->completed_digests_buffer[session->path_index]);
-                }
-                session->completed_digests_buffer[session->path_index] = NULL;
-                session->path_index++;
-            }
-        } else if(digest) {
-            if(session->read_succesful[session->path_index]) {
-                rm_hasher_print(digest, session->paths[index]);
+        entry->digest = digest;
+        entry->done = TRUE;
+
+        if(session->print_in_order) {
+            /* print the entries at the head of the queue which are done */
+            RmHasherEntry *head = NULL;
+            while((head = g_queue_peek_head(session->pending)) && head->done) {
+                g_queue_pop_head(session->pending);
+                rm_hasher_entry_finish(session, head);
             }
+        } else {
+            rm_hasher_entry_finish(session, entry);
         }
     }
     g_mutex_unlock(&session->lock);
     return 0;
 }
 
+/* RmMDSFunc; runs in the device's reader thread(s) */
+static gint rm_hasher_process_entry(RmHasherEntry *entry, RmHasherSession *session) {
+    /* entry may be freed by the callback as soon as the task is finished */
+    RmMDSDevice *disk = entry->disk;
+
+    RmHasherTask *task = rm_hasher_task_new(session->hasher, NULL, entry);
+    entry->read_successful =
+        rm_hasher_task_hash(task, entry->path, 0, entry->size, FALSE, FALSE, NULL);
+    rm_hasher_task_finish(task);
+
+    rm_mds_device_ref(disk, -1);
+    return 1;
+}
+
+/* Check path and send it to its device's readers; takes ownership of path */
+static void rm_hasher_push_path(RmHasherSession *session, char *path) {
+    RmStat stat_buf;
+    if(rm_sys_stat(path, &stat_buf) == -1) {
+        rm_log_warning_line(_("Can't open directory or file \"%s\": %s"), path,
+                            strerror(errno));
+    } else if(S_ISDIR(stat_buf.st_mode)) {
+        rm_log_warning_line(_("Directories are not supported: %s"), path);
+    } else if(!S_ISREG(stat_buf.st_mode)) {
+        rm_log_warning_line(_("%s: Unknown file type"), path);
+    } else {
+        RmHasherEntry *entry = g_slice_new0(RmHasherEntry);
+        entry->path = path;
+        entry->size = stat_buf.st_size;
+
+        /* one reference for the session (kept until all paths are pushed)
+         * and one for the entry (dropped by rm_hasher_process_entry) */
+        entry->disk = rm_mds_device_get_ref(session->mds, path, stat_buf.st_dev);
+        if(!g_hash_table_contains(session->disks, entry->disk)) {
+            g_hash_table_add(session->disks, entry->disk);
+            rm_mds_device_ref(entry->disk, 1);
+        }
+
+        g_mutex_lock(&session->lock);
+        {
+            while(session->n_pending >= RM_HASHER_MAX_PENDING) {
+                g_cond_wait(&session->cond, &session->lock);
+            }
+            session->n_pending++;
+            if(session->print_in_order) {
+                g_queue_push_tail(session->pending, entry);
+            }
+        }
+        g_mutex_unlock(&session->lock);
+
+        /* rotational disks read in disk order, others in input order which
+         * keeps the in-order output moving */
+        gint64 offset =
+            rm_mds_device_is_rotational(entry->disk) ? -1 : (gint64)session->n_pushed;
+        session->n_pushed++;
+        rm_mds_push_task(entry->disk, stat_buf.st_dev, offset, path, entry);
+        return;
+    }
+    g_free(path);
+}
+
 int rm_hasher_main(int argc, const char **argv) {
     RmHasherSession tag;
 
     /* List of paths we got passed (or NULL)   */
-    tag.paths = NULL;
+    char **paths = NULL;
 
     /* Print hashes in the same order as files in command line args */
     tag.print_in_order = TRUE;
@@ -119,6 +213,7 @@ int rm_hasher_main(int argc, const char **argv) {
     /* Digest type */
     tag.digest_type = RM_DEFAULT_DIGEST;
     gint threads = 8;
+    gint readers = 4;
     gint64 buffer_mbytes = 256;
     guint64 increment = 4096;
 
@@ -129,10 +224,11 @@ int rm_hasher_main(int argc, const char **argv) {
     const GOptionEntry entries[] = {
         {"algorithm"      , 'a'  , 0                      , G_OPTION_ARG_CALLBACK        , (GOptionArgFunc)rm_hasher_parse_type  , _("Digest type [BLAKE2B]")                                                        , "[TYPE]"}   ,
         {"num-threads"    , 't'  , 0                      , G_OPTION_ARG_INT             , &threads                              , _("Number of hashing threads [8]")                                                 , "N"}        ,
+        {"readers"        , 'r'  , 0                      , G_OPTION_ARG_INT             , &readers                              , _("Reader threads per non-rotational disk [4]")                                    , "N"}        ,
         {"buffer-mbytes"  , 'b'  , 0                      , G_OPTION_ARG_INT64           , &buffer_mbytes                        , _("Megabytes read buffer [256 MB]")                                                , "MB"}       ,
         {"increment"      , 'x'  , G_OPTION_FLAG_HIDDEN   , G_OPTION_ARG_INT64           , &increment                            , _("bytes to hash at a time [4096]")                                                , "MB"}       ,
         {"ignore-order"   , 'i'  , G_OPTION_FLAG_REVERSE  , G_OPTION_ARG_NONE            , &tag.print_in_order                   , _("Print hashes in order completed, not in order entered (reduces memory usage)")  , NULL}       ,
-        {""               , 0    , 0                      , G_OPTION_ARG_FILENAME_ARRAY  , &tag.paths                            , _("Space-separated list of files")                                                 , "[FILE…]"}  ,
+        {""               , 0    , 0                      , G_OPTION_ARG_FILENAME_ARRAY  , &paths                                , _("Space-separated list of files")                                                 , "[FILE…]"}  ,
         {NULL             , 0    , 0                      , 0                            , NULL                                  , NULL                                                                               , NULL}};
 
     /* clang-format on */
@@ -154,7 +250,7 @@ int rm_hasher_main(int argc, const char **argv) {
                  "\n    %s\n"
                  "\n  Supported, but not useful:"
                  "\n    %s\n"),
-               "sha{1,256,512}, sha3-{256,384,512}, blake{2s,2b,2sp,2bp}, highway{64,128,256}",
+               "sha{1,256,512}, sha3-{256,384,512}, blake{2s,2b,2sp,2bp,3}, highway{64,128,256}",
 #if HAVE_MM_CRC32_U64
                "metrocrc, metrocrc256, "
 #endif
@@ -171,25 +267,6 @@ int rm_hasher_main(int argc, const char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    if(tag.paths == NULL) {
-        /* read paths from stdin */
-        char path_buf[PATH_MAX];
-        char *tokbuf = NULL;
-        GPtrArray *paths = g_ptr_array_new();
-
-        while(fgets(path_buf, PATH_MAX, stdin)) {
-            char *abs_path = realpath(strtok_r(path_buf, "\n", &tokbuf), NULL);
-            g_ptr_array_add(paths, abs_path);
-        }
-
-        tag.paths = (char **)g_ptr_array_free(paths, FALSE);
-    }
-
-    if(tag.paths == NULL || tag.paths[0] == NULL) {
-        rm_log_error_line(_("No valid paths given"));
-        exit(EXIT_FAILURE);
-    }
-
     g_option_context_free(context);
 
     ////////// Implementation //////
@@ -198,62 +275,86 @@ int rm_hasher_main(int argc, const char **argv) {
     rm_digest_enable_sse(TRUE);
 #endif
 
-    int buf_size = (g_strv_length(tag.paths) + 1) * sizeof(RmDigest *);
-    tag.read_succesful = g_slice_alloc0(buf_size);
-
-    if(tag.print_in_order) {
-        /* allocate buffer to collect results */
-        tag.completed_digests_buffer = g_slice_alloc0(buf_size);
-        tag.path_index = 0;
-    }
-
     /* initialise structures */
     g_mutex_init(&tag.lock);
-    RmHasher *hasher = rm_hasher_new(tag.digest_type,
-                                     threads,
-                                     FALSE,
-                                     increment,
-                                     1024 * 1024 * buffer_mbytes,
-                                     (RmHasherCallback)rm_hasher_callback,
-                                     &tag);
-
-    /* Iterate over paths, pushing to hasher threads */
-    for(int i = 0; tag.paths && tag.paths[i]; ++i) {
-        /* check it is a regular file */
-
-        RmStat stat_buf;
-        if(rm_sys_stat(tag.paths[i], &stat_buf) == -1) {
-            rm_log_warning_line(_("Can't open directory or file \"%s\": %s"),
-                                tag.paths[i], strerror(errno));
-        } else if(S_ISDIR(stat_buf.st_mode)) {
-            rm_log_warning_line(_("Directories are not supported: %s"), tag.paths[i]);
-        } else if(S_ISREG(stat_buf.st_mode)) {
-            RmHasherTask *task = rm_hasher_task_new(hasher, NULL, GINT_TO_POINTER(i));
-            tag.read_succesful[i] =
-                rm_hasher_task_hash(task, tag.paths[i], 0, stat_buf.st_size, FALSE, NULL);
-
-            rm_hasher_task_finish(task);
-            continue;
-        } else {
-            rm_log_warning_line(_("%s: Unknown file type"), tag.paths[i]);
+    g_cond_init(&tag.cond);
+    tag.pending = g_queue_new();
+    tag.n_pending = 0;
+    tag.n_pushed = 0;
+    tag.disks = g_hash_table_new(NULL, NULL);
+
+    tag.hasher = rm_hasher_new(tag.digest_type,
+                               threads,
+                               FALSE,
+                               increment,
+                               1024 * 1024 * buffer_mbytes,
+                               (RmHasherCallback)rm_hasher_callback,
+                               &tag);
+
+    /* paths are read per physical disk: one reader for rotational disks
+     * (in disk offset order), `readers` for the others */
+    tag.mds = rm_mds_new(RM_HASHER_MAX_READERS, NULL, FALSE);
+    rm_mds_configure(tag.mds,
+                     (RmMDSFunc)rm_hasher_process_entry,
+                     &tag,
+                     0,
+                     1,
+                     (RmMDSSortFunc)rm_mds_elevator_cmp);
+    /* later batches must not overtake earlier paths of the same disk */
+    rm_mds_configure_ordered(tag.mds);
+    rm_mds_configure_nonrotational(tag.mds, CLAMP(readers, 1, RM_HASHER_MAX_READERS));
+    rm_mds_start(tag.mds);
+
+    /* Stream paths to the readers as we get them */
+    if(paths) {
+        for(int i = 0; paths[i]; ++i) {
+            rm_hasher_push_path(&tag, paths[i]);
+        }
+        g_free(paths);
+    } else {
+        char path_buf[PATH_MAX];
+        char *tokbuf = NULL;
+
+        while(fgets(path_buf, PATH_MAX, stdin)) {
+            char *path = strtok_r(path_buf, "\n", &tokbuf);
+            if(path == NULL) {
+                continue;
+            }
+
+            char *abs_path = realpath(path, NULL);
+            if(abs_path == NULL) {
+                rm_log_warning_line(_("Can't open directory or file \"%s\": %s"), path,
+                                    strerror(errno));
+                continue;
+            }
+            rm_hasher_push_path(&tag, abs_path);
         }
+    }
 
-        /* dummy callback for failed paths */
-        g_free(tag.paths[i]);
-        tag.paths[i] = NULL;
-        rm_hasher_callback(hasher, NULL, &tag, GINT_TO_POINTER(i));
+    /* drop the session's device references; each device finishes its queue */
+    GHashTableIter iter;
+    gpointer disk = NULL;
+    g_hash_table_iter_init(&iter, tag.disks);
+    while(g_hash_table_iter_next(&iter, &disk, NULL)) {
+        rm_mds_device_ref(disk, -1);
     }
 
-    /* wait for all hasher threads to finish... */
-    rm_hasher_free(hasher, TRUE);
+    /* wait for all reader and hasher threads to finish... */
+    rm_mds_free(tag.mds, TRUE);
+    rm_hasher_free(tag.hasher, TRUE);
 
     /* tidy up */
-    g_slice_free1(buf_size, tag.read_succesful);
-    if(tag.print_in_order) {
-        g_slice_free1(buf_size, tag.completed_digests_buffer);
+    g_assert(g_queue_is_empty(tag.pending));
+    g_queue_free(tag.pending);
+    g_hash_table_destroy(tag.disks);
+    g_mutex_clear(&tag.lock);
+    g_cond_clear(&tag.cond);
+
+    if(tag.n_pushed == 0) {
+        /* all paths (if any) were rejected by rm_hasher_push_path() */
+        rm_log_error_line(_("No valid paths given"));
+        return EXIT_FAILURE;
     }
 
-    g_strfreev(tag.paths);
-
     return EXIT_SUCCESS;
 }
@@ -28,8 +28,10 @@
 #include <string.h>
 
 #include <fcntl.h>
+#include <sys/resource.h>
 
 #include "hasher.h"
+#include "metrics.h"
 #include "utilities.h"
 
 /* Flags for the fadvise() call that tells the kernel
@@ -52,6 +54,20 @@ const int HASHER_FADVISE_FLAGS = 0
 /* how many buffers to read? */
 const guint16 N_PREADV_BUFFERS = 4;
 
+/* O_DIRECT wants file offsets, lengths and memory aligned to the logical block
+ * size of the device; 4K covers all common devices */
+#define HASHER_DIRECT_ALIGN (4096)
+
+/* Reads smaller than this bypass O_DIRECT; their effect on the page cache is
+ * negligible and they would only suffer from the missing readahead */
+#define HASHER_DIRECT_MIN_BYTES (256 * 1024)
+
+/* how many buffers can be queued in one hashpipe; must be a power of 2 */
+#define HASHPIPE_RING_SIZE (256)
+
+/* how often to re-check an empty/full hashpipe ring before going to sleep */
+#define HASHPIPE_SPIN_COUNT (64)
+
 struct _RmHasher {
     RmDigestType digest_type;
     gboolean use_buffered_read;
@@ -68,15 +84,66 @@ struct _RmHasher {
     gsize buf_size;
     guint active_tasks;
 
-    RmSemaphore *buf_sem;
+    /* recycled read buffers; also limits how many are in flight */
+    RmBufferPool *buf_pool;
+
+    /* descriptors kept open between increments (or NULL) */
+    RmFdCache *fd_cache;
+
+    /* opens task files instead of open(2) on the path (or NULL) */
+    RmHasherOpenFunc open_func;
+};
+
+struct _RmFdCache {
+    /* task_user_data -> link in lru */
+    GHashTable *links;
+
+    /* RmFdCacheEntry's, most recently used first */
+    GQueue lru;
+
+    guint max_fds;
+    GMutex lock;
 };
 
+typedef struct RmFdCacheEntry {
+    gconstpointer key;
+    int fd;
+
+    /* threads currently using fd; such entries are never evicted */
+    gint refs;
+} RmFdCacheEntry;
+
+/* A hashpipe is a dedicated hashing thread fed via a lock-free single-producer
+ * single-consumer ring of RmBuffers.  A hashpipe is owned by exactly one
+ * RmHasherTask at a time (see rm_hasher_task_new()) so the only producer is
+ * the thread reading for that task, and buffers are hashed in the order they
+ * were read.  lock and cond are only used when one side has to sleep. */
+typedef struct RmHashPipe {
+    RmBuffer *ring[HASHPIPE_RING_SIZE];
+
+    /* read position; only written by the hashpipe thread */
+    volatile gint head;
+
+    /* write position; only written by the producer */
+    volatile gint tail;
+
+    /* set while either side sleeps on cond */
+    volatile gint consumer_waiting;
+    volatile gint producer_waiting;
+
+    GMutex lock;
+    GCond cond;
+
+    GThread *thread;
+    RmHasher *hasher;
+} RmHashPipe;
+
 struct _RmHasherTask {
     /* pointer back to hasher main */
     RmHasher *hasher;
 
-    /* single-thread threadpool to send buffers to */
-    GThreadPool *hashpipe;
+    /* hashpipe to send buffers to */
+    RmHashPipe *hashpipe;
 
     /* checksum to update with read data */
     RmDigest *digest;
@@ -84,6 +151,9 @@ struct _RmHasherTask {
     /* user data associated with this specific task */
     gpointer task_user_data;
 
+    /* device to account the reads to (or NULL) */
+    RmMetricsDevice *metrics;
+
     /* if true then hasher->callback will be called by rm_hashpipe_worker() */
     gboolean finalise;
 };
@@ -93,13 +163,17 @@ static void rm_hasher_task_free(RmHasherTask *self) {
     g_slice_free(RmHasherTask, self);
 }
 
-/* GThreadPool Worker for hashing */
+/* RmHashPipe worker for hashing */
 static void rm_hasher_hashpipe_worker(RmBuffer *buffer, RmHasher *hasher) {
     g_assert(buffer);
     if(buffer->len > 0) {
         /* Update digest with buffer->data */
         g_assert(buffer->user_data == NULL);
-        rm_digest_buffered_update(hasher->buf_sem, buffer);
+        RmDigestType type = buffer->digest->type;
+        guint32 len = buffer->len;
+        gint64 start = rm_metrics_now();
+        rm_digest_buffered_update(buffer);
+        rm_metrics_hash(type, len, start);
     } else if(buffer->user_data) {
         /* finalise via callback */
         RmHasherTask *task = buffer->user_data;
@@ -109,7 +183,7 @@ static void rm_hasher_hashpipe_worker(RmBuffer *buffer, RmHasher *hasher) {
         hasher->callback(hasher, task->digest, hasher->session_user_data,
                          task->task_user_data);
         rm_hasher_task_free(task);
-        rm_buffer_free(hasher->buf_sem, buffer);
+        rm_buffer_free(buffer);
 
         g_mutex_lock(&hasher->lock);
         {
@@ -121,10 +195,353 @@ static void rm_hasher_hashpipe_worker(RmBuffer *buffer, RmHasher *hasher) {
     }
 }
 
+//////////////////////////////////////
+//  RmHashPipe                      //
+//////////////////////////////////////
+
+static guint rm_hashpipe_used(RmHashPipe *pipe) {
+    return (guint)g_atomic_int_get(&pipe->tail) - (guint)g_atomic_int_get(&pipe->head);
+}
+
+static void rm_hashpipe_wake(RmHashPipe *pipe, volatile gint *waiting) {
+    if(g_atomic_int_get(waiting)) {
+        g_mutex_lock(&pipe->lock);
+        { g_cond_broadcast(&pipe->cond); }
+        g_mutex_unlock(&pipe->lock);
+    }
+}
+
+/* Block until condition(pipe) is false; spins for a while before sleeping */
+static void rm_hashpipe_wait_while(RmHashPipe *pipe, gboolean (*condition)(RmHashPipe *),
+                                   volatile gint *waiting) {
+    for(int i = 0; i < HASHPIPE_SPIN_COUNT; i++) {
+        if(!condition(pipe)) {
+            return;
+        }
+    }
+
+    /* Set the flag before re-checking so the other side either sees the flag
+     * or we see its update (g_atomic implies a full barrier) */
+    g_atomic_int_set(waiting, 1);
+    g_mutex_lock(&pipe->lock);
+    {
+        while(condition(pipe)) {
+            g_cond_wait(&pipe->cond, &pipe->lock);
+        }
+    }
+    g_mutex_unlock(&pipe->lock);
+    g_atomic_int_set(waiting, 0);
+}
+
+static gboolean rm_hashpipe_is_empty(RmHashPipe *pipe) {
+    return rm_hashpipe_used(pipe) == 0;
+}
+
+static gboolean rm_hashpipe_is_full(RmHashPipe *pipe) {
+    return rm_hashpipe_used(pipe) >= HASHPIPE_RING_SIZE;
+}
+
+/* Only to be called by the owner of the hashpipe's current task */
+static void rm_hashpipe_push(RmHashPipe *pipe, RmBuffer *buffer) {
+    rm_hashpipe_wait_while(pipe, rm_hashpipe_is_full, &pipe->producer_waiting);
+
+    guint tail = (guint)g_atomic_int_get(&pipe->tail);
+    pipe->ring[tail & (HASHPIPE_RING_SIZE - 1)] = buffer;
+    g_atomic_int_set(&pipe->tail, (gint)(tail + 1));
+
+    rm_hashpipe_wake(pipe, &pipe->consumer_waiting);
+}
+
+/* Only to be called by the hashpipe's own thread */
+static RmBuffer *rm_hashpipe_pop(RmHashPipe *pipe) {
+    rm_hashpipe_wait_while(pipe, rm_hashpipe_is_empty, &pipe->consumer_waiting);
+
+    guint head = (guint)g_atomic_int_get(&pipe->head);
+    RmBuffer *buffer = pipe->ring[head & (HASHPIPE_RING_SIZE - 1)];
+    g_atomic_int_set(&pipe->head, (gint)(head + 1));
+
+    rm_hashpipe_wake(pipe, &pipe->producer_waiting);
+    return buffer;
+}
+
+static void rm_hasher_hashpipe_worker(RmBuffer *buffer, RmHasher *hasher);
+
+static gpointer rm_hashpipe_thread(RmHashPipe *pipe) {
+    RmBuffer *buffer = NULL;
+    /* a NULL buffer tells us to quit */
+    while((buffer = rm_hashpipe_pop(pipe))) {
+        rm_hasher_hashpipe_worker(buffer, pipe->hasher);
+    }
+    return NULL;
+}
+
+static RmHashPipe *rm_hashpipe_new(RmHasher *hasher) {
+    RmHashPipe *self = g_slice_new0(RmHashPipe);
+    self->hasher = hasher;
+    g_mutex_init(&self->lock);
+    g_cond_init(&self->cond);
+    self->thread = g_thread_new("rm-hashpipe", (GThreadFunc)rm_hashpipe_thread, self);
+    return self;
+}
+
+static void rm_hashpipe_free(RmHashPipe *self) {
+    /* wait for any in-progress jobs to finish */
+    rm_hashpipe_push(self, NULL);
+    g_thread_join(self->thread);
+
+    g_cond_clear(&self->cond);
+    g_mutex_clear(&self->lock);
+    g_slice_free(RmHashPipe, self);
+}
+
+//////////////////////////////////////
+//  RmFdCache                       //
+//////////////////////////////////////
+
+/* Directories are only used as openat(2) anchors */
+#ifdef O_PATH
+#define RM_FD_CACHE_DIR_FLAGS (O_PATH | O_DIRECTORY)
+#else
+#define RM_FD_CACHE_DIR_FLAGS (O_RDONLY | O_DIRECTORY)
+#endif
+
+RmFdCache *rm_fd_cache_new(guint max_fds) {
+    /* leave most of the descriptor limit to everybody else */
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        max_fds = MIN(max_fds, limit.rlim_cur / 4);
+    }
+
+    RmFdCache *self = g_slice_new0(RmFdCache);
+    self->links = g_hash_table_new(NULL, NULL);
+    g_queue_init(&self->lru);
+    self->max_fds = max_fds;
+    g_mutex_init(&self->lock);
+    return self;
+}
+
+/* Unlink the least recently used idle entries while there are too many;
+ * must be called with the lock held.  Close the result via
+ * rm_fd_cache_close_evicted() once the lock is dropped */
+static GSList *rm_fd_cache_trim(RmFdCache *self) {
+    GSList *evicted = NULL;
+    GList *link = self->lru.tail;
+    while(link && self->lru.length > self->max_fds) {
+        GList *prev = link->prev;
+        RmFdCacheEntry *entry = link->data;
+        if(entry->refs == 0) {
+            g_hash_table_remove(self->links, entry->key);
+            g_queue_delete_link(&self->lru, link);
+            evicted = g_slist_prepend(evicted, entry);
+        }
+        link = prev;
+    }
+    return evicted;
+}
+
+/* close outside the lock; close(2) may be slow on network filesystems */
+static void rm_fd_cache_close_evicted(GSList *evicted) {
+    for(GSList *iter = evicted; iter; iter = iter->next) {
+        RmFdCacheEntry *oldest = iter->data;
+        rm_sys_close(oldest->fd);
+        g_slice_free(RmFdCacheEntry, oldest);
+    }
+    g_slist_free(evicted);
+}
+
+/* Remove the descriptor of key from the cache and return it (or -1 if none or
+ * if it is borrowed); while taken it can't be closed by eviction */
+static int rm_fd_cache_take(RmFdCache *self, gconstpointer key) {
+    int fd = -1;
+    g_mutex_lock(&self->lock);
+    {
+        GList *link = g_hash_table_lookup(self->links, key);
+        if(link && ((RmFdCacheEntry *)link->data)->refs == 0) {
+            RmFdCacheEntry *entry = link->data;
+            fd = entry->fd;
+            g_hash_table_remove(self->links, key);
+            g_queue_delete_link(&self->lru, link);
+            g_slice_free(RmFdCacheEntry, entry);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+    return fd;
+}
+
+/* Give fd (of key) back to the cache; closes the least recently used
+ * descriptor(s) if there are too many */
+static void rm_fd_cache_put(RmFdCache *self, gconstpointer key, int fd) {
+    GSList *evicted = NULL;
+    g_mutex_lock(&self->lock);
+    if(g_hash_table_contains(self->links, key)) {
+        /* another thread opened the same file meanwhile; keep theirs */
+        g_mutex_unlock(&self->lock);
+        rm_sys_close(fd);
+        return;
+    }
+    {
+        RmFdCacheEntry *entry = g_slice_new0(RmFdCacheEntry);
+        entry->key = key;
+        entry->fd = fd;
+        g_queue_push_head(&self->lru, entry);
+        g_hash_table_insert(self->links, (gpointer)key, self->lru.head);
+        evicted = rm_fd_cache_trim(self);
+    }
+    g_mutex_unlock(&self->lock);
+
+    rm_fd_cache_close_evicted(evicted);
+}
+
+/* Return the cached descriptor of key (or -1 if none) without removing it, so
+ * other threads can use it at the same time; it stays open until given back
+ * via rm_fd_cache_release() */
+static int rm_fd_cache_borrow(RmFdCache *self, gconstpointer key) {
+    int fd = -1;
+    g_mutex_lock(&self->lock);
+    {
+        GList *link = g_hash_table_lookup(self->links, key);
+        if(link) {
+            RmFdCacheEntry *entry = link->data;
+            entry->refs++;
+            fd = entry->fd;
+            g_queue_unlink(&self->lru, link);
+            g_queue_push_head_link(&self->lru, link);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+    return fd;
+}
+
+/* Add the freshly opened fd of key to the cache, borrowed by the caller;
+ * returns the descriptor to use, which is another thread's if it was first */
+static int rm_fd_cache_add_borrowed(RmFdCache *self, gconstpointer key, int fd) {
+    GSList *evicted = NULL;
+    int duplicate = -1;
+    g_mutex_lock(&self->lock);
+    {
+        GList *link = g_hash_table_lookup(self->links, key);
+        if(link) {
+            RmFdCacheEntry *entry = link->data;
+            entry->refs++;
+            duplicate = fd;
+            fd = entry->fd;
+        } else {
+            RmFdCacheEntry *entry = g_slice_new0(RmFdCacheEntry);
+            entry->key = key;
+            entry->fd = fd;
+            entry->refs = 1;
+            g_queue_push_head(&self->lru, entry);
+            g_hash_table_insert(self->links, (gpointer)key, self->lru.head);
+            evicted = rm_fd_cache_trim(self);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+
+    if(duplicate != -1) {
+        rm_sys_close(duplicate);
+    }
+    rm_fd_cache_close_evicted(evicted);
+    return fd;
+}
+
+/* Give back a descriptor from rm_fd_cache_borrow() */
+static void rm_fd_cache_release(RmFdCache *self, gconstpointer key) {
+    GSList *evicted = NULL;
+    g_mutex_lock(&self->lock);
+    {
+        GList *link = g_hash_table_lookup(self->links, key);
+        g_assert(link);
+        RmFdCacheEntry *entry = link->data;
+        if(--entry->refs == 0) {
+            /* may have been kept over the limit while in use */
+            evicted = rm_fd_cache_trim(self);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+
+    rm_fd_cache_close_evicted(evicted);
+}
+
+void rm_fd_cache_forget(RmFdCache *self, gconstpointer key) {
+    int fd = rm_fd_cache_take(self, key);
+    if(fd != -1) {
+        rm_sys_close(fd);
+    }
+}
+
+/* Borrow a descriptor for the directory at dir, opening it relative to its
+ * parent if it is not cached; the caller has to give it back via
+ * rm_fd_cache_release() */
+static int rm_fd_cache_borrow_dir(RmFdCache *self, RmNode *dir) {
+    int fd = rm_fd_cache_borrow(self, dir);
+    if(fd != -1) {
+        return fd;
+    }
+
+    if(dir->parent == NULL) {
+        /* the trie root stands for "/" */
+        fd = rm_sys_open("/", RM_FD_CACHE_DIR_FLAGS);
+    } else {
+        int parent_fd = rm_fd_cache_borrow_dir(self, dir->parent);
+        if(parent_fd == -1) {
+            return -1;
+        }
+
+        fd = rm_sys_openat(parent_fd, dir->basename, RM_FD_CACHE_DIR_FLAGS);
+        int saved_errno = errno;
+        rm_fd_cache_release(self, dir->parent);
+        errno = saved_errno;
+    }
+
+    if(fd == -1) {
+        return -1;
+    }
+    return rm_fd_cache_add_borrowed(self, dir, fd);
+}
+
+int rm_fd_cache_open_node(RmFdCache *self, RmNode *node, int flags) {
+    g_assert(node->parent);
+
+    int dir_fd = rm_fd_cache_borrow_dir(self, node->parent);
+    if(dir_fd == -1) {
+        return -1;
+    }
+
+    int fd = rm_sys_openat(dir_fd, node->basename, flags);
+    int saved_errno = errno;
+    rm_fd_cache_release(self, node->parent);
+    errno = saved_errno;
+    return fd;
+}
+
+void rm_fd_cache_free(RmFdCache *self) {
+    RmFdCacheEntry *entry = NULL;
+    while((entry = g_queue_pop_head(&self->lru))) {
+        rm_sys_close(entry->fd);
+        g_slice_free(RmFdCacheEntry, entry);
+    }
+    g_hash_table_destroy(self->links);
+    g_mutex_clear(&self->lock);
+    g_slice_free(RmFdCache, self);
+}
+
 //////////////////////////////////////
 //  File Reading Utilities          //
 //////////////////////////////////////
 
+/* open(2) the file of a task, via hasher->open_func if there is one */
+static int rm_hasher_open(RmHasher *hasher, gpointer task_user_data, char *path,
+                          int flags) {
+    if(hasher->open_func) {
+        int fd = hasher->open_func(task_user_data, path, flags, hasher->session_user_data);
+        if(fd != -1) {
+            return fd;
+        }
+        /* try the plain path before giving up */
+    }
+    return rm_sys_open(path, flags);
+}
+
 static void rm_hasher_request_readahead(int fd, RmOff seek_offset, RmOff bytes_to_read) {
 /* Give the kernel scheduler some hints */
 #if HAVE_POSIX_FADVISE && HASHER_FADVISE_FLAGS
@@ -137,17 +554,17 @@ static void rm_hasher_request_readahead(int fd, RmOff seek_offset, RmOff bytes_t
 #endif
 }
 
-static gboolean rm_hasher_symlink_read(RmHasher *hasher, GThreadPool *hashpipe,
+static gboolean rm_hasher_symlink_read(RmHasher *hasher, RmHashPipe *hashpipe,
                                        RmDigest *digest, char *path,
                                        gsize *bytes_actually_read) {
     /* Read contents of symlink (i.e. path of symlink's target).  */
 
-    RmBuffer *buffer = rm_buffer_new(hasher->buf_sem, hasher->buf_size);
+    RmBuffer *buffer = rm_buffer_new(hasher->buf_pool);
     gint len = readlink(path, (char *)buffer->data, hasher->buf_size);
 
     if (len < 0) {
         rm_log_perror("Cannot read symbolic link");
-        rm_buffer_free(hasher->buf_sem, buffer);
+        rm_buffer_free(buffer);
         return FALSE;
     }
 
@@ -155,18 +572,19 @@ static gboolean rm_hasher_symlink_read(RmHasher *hasher, GThreadPool *hashpipe,
     buffer->len = len;
     buffer->digest = digest;
     buffer->user_data = NULL;
-    rm_util_thread_pool_push(hashpipe, buffer);
+    rm_hashpipe_push(hashpipe, buffer);
 
     return TRUE;
 }
 
-/* Reads data from file and sends to hasher threadpool;
+/* Reads data from file and sends to hashpipe;
  * returns true if no errors encountered;
  * increments *bytes_read by the actual bytes read */
 
-static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
+static gboolean rm_hasher_buffered_read(RmHasher *hasher, RmHashPipe *hashpipe,
                                         RmDigest *digest, char *path, gsize start_offset,
-                                        gsize bytes_to_read, gsize *bytes_actually_read) {
+                                        gsize bytes_to_read, gsize *bytes_actually_read,
+                                        RmMetricsDevice *metrics) {
     FILE *fd = NULL;
     fd = fopen(path, "rb");
     if(fd == NULL) {
@@ -188,13 +606,15 @@ static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
     gsize bytes_remaining = bytes_to_read;
 
     while(TRUE) {
-        RmBuffer *buffer = rm_buffer_new(hasher->buf_sem, hasher->buf_size);
+        RmBuffer *buffer = rm_buffer_new(hasher->buf_pool);
         gsize want_bytes = MIN(bytes_remaining, hasher->buf_size);
+        gint64 read_start = rm_metrics_now();
         gsize bytes_read = fread(buffer->data, 1, want_bytes, fd);
+        rm_metrics_device_read(metrics, bytes_read, read_start);
 
         if(ferror(fd) != 0) {
             rm_log_perror("fread(3) failed");
-            rm_buffer_free(hasher->buf_sem, buffer);
+            rm_buffer_free(buffer);
             break;
         }
 
@@ -204,7 +624,7 @@ static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
         buffer->len = bytes_read;
         buffer->digest = digest;
         buffer->user_data = NULL;
-        rm_util_thread_pool_push(hashpipe, buffer);
+        rm_hashpipe_push(hashpipe, buffer);
 
         if(read_to_eof && feof(fd)) {
             success = TRUE;
@@ -227,20 +647,26 @@ static gboolean rm_hasher_buffered_read(RmHasher *hasher, GThreadPool *hashpipe,
     return success;
 }
 
-/* Reads data from file and sends to hasher threadpool
+/* Reads data from file and sends to hashpipe
  * returns true if no errors encountered;
  * increments *bytes_read by the actual bytes read */
 
-static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpipe,
+static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, RmHashPipe *hashpipe,
                                           RmDigest *digest, char *path,
                                           gint64 start_offset, gint64 bytes_to_read,
-                                          gsize *bytes_actually_read) {
+                                          gsize *bytes_actually_read,
+                                          gpointer task_user_data,
+                                          RmMetricsDevice *metrics) {
     gint32 bytes_read = 0;
     guint64 file_offset = start_offset;
 
     gboolean read_to_eof = (bytes_to_read == 0);
 
-    int fd = rm_sys_open(path, O_RDONLY);
+    /* reuse the descriptor of the previous increment if we kept it */
+    int fd = hasher->fd_cache ? rm_fd_cache_take(hasher->fd_cache, task_user_data) : -1;
+    if(fd == -1) {
+        fd = rm_hasher_open(hasher, task_user_data, path, O_RDONLY);
+    }
     if(fd == -1) {
         rm_log_info("open(2) failed for %s: %s\n", path, g_strerror(errno));
         return FALSE;
@@ -278,19 +704,21 @@ static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpip
     while(TRUE) {
         /* allocate buffers for preadv */
         for(int i = 0; i < n_preadv_buffers; ++i) {
-            buffers[i] = rm_buffer_new(hasher->buf_sem, hasher->buf_size);
+            buffers[i] = rm_buffer_new(hasher->buf_pool);
             readvec[i].iov_base = buffers[i]->data;
             readvec[i].iov_len = hasher->buf_size;
         }
 
+        gint64 read_start = rm_metrics_now();
         bytes_read = rm_sys_preadv(fd, readvec, n_preadv_buffers, file_offset);
+        rm_metrics_device_read(metrics, MAX(bytes_read, 0), read_start);
 
         if(bytes_read == -1) {
             /* error occurred */
             rm_log_perror("preadv failed");
             /* Release the buffers and give up*/
             for(int i = 0; i < n_preadv_buffers; ++i) {
-                rm_buffer_free(hasher->buf_sem, buffers[i]);
+                rm_buffer_free(buffers[i]);
             }
             break;
         }
@@ -313,9 +741,9 @@ static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpip
                 /* Send it to the hasher */
                 buffer->digest = digest;
                 buffer->user_data = NULL;
-                rm_util_thread_pool_push(hashpipe, buffer);
+                rm_hashpipe_push(hashpipe, buffer);
             } else {
-                rm_buffer_free(hasher->buf_sem,  buffer);
+                rm_buffer_free(buffer);
             }
         }
 
@@ -335,20 +763,175 @@ static gboolean rm_hasher_unbuffered_read(RmHasher *hasher, GThreadPool *hashpip
     }
 
     g_slice_free1(sizeof(*buffers) * n_preadv_buffers, buffers);
-    rm_sys_close(fd);
+    if(hasher->fd_cache && success && !read_to_eof) {
+        /* probably more increments to come */
+        rm_fd_cache_put(hasher->fd_cache, task_user_data, fd);
+    } else {
+        rm_sys_close(fd);
+    }
+
+    return success;
+}
+
+#ifdef O_DIRECT
+
+/* Reads data from file with O_DIRECT and sends to hashpipe; the page cache is
+ * bypassed, so huge scans don't push other processes' data out of it.
+ * Offsets and lengths are rounded to HASHER_DIRECT_ALIGN.  If start_offset is
+ * unaligned, the data is copied into buffers that start at
+ * start_offset + k * buf_size, like those of rm_hasher_unbuffered_read():
+ * paranoid digests compare buffer by buffer, so all read paths have to cut
+ * the data the same way.
+ * returns true if no errors encountered;
+ * increments *bytes_read by the actual bytes read (always a multiple of the
+ * buffer size unless the end was reached);
+ * sets *fallback if the file or filesystem does not support O_DIRECT, in which
+ * case the rest should be read via rm_hasher_unbuffered_read() */
+
+static gboolean rm_hasher_direct_read(RmHasher *hasher, RmHashPipe *hashpipe,
+                                      RmDigest *digest, char *path, guint64 start_offset,
+                                      guint64 bytes_to_read, gsize *bytes_actually_read,
+                                      gboolean *fallback, gpointer task_user_data,
+                                      RmMetricsDevice *metrics) {
+    gsize buf_size = hasher->buf_size;
+    if(buf_size % HASHER_DIRECT_ALIGN != 0) {
+        *fallback = TRUE;
+        return FALSE;
+    }
+
+    int fd = rm_hasher_open(hasher, task_user_data, path, O_RDONLY | O_DIRECT);
+    if(fd == -1) {
+        if(errno == EINVAL) {
+            /* filesystem does not do O_DIRECT (e.g. tmpfs) */
+            *fallback = TRUE;
+        } else {
+            rm_log_info("open(2) failed for %s: %s\n", path, g_strerror(errno));
+        }
+        return FALSE;
+    }
+
+    gboolean read_to_eof = (bytes_to_read == 0);
+    guint64 file_offset = start_offset - (start_offset % HASHER_DIRECT_ALIGN);
+    gsize skip = start_offset - file_offset;
+    guint64 bytes_remaining = read_to_eof ? G_MAXUINT64 : bytes_to_read;
+
+    /* buffer being filled if the data needs to be re-cut */
+    gboolean recut = (skip > 0);
+    RmBuffer *out = NULL;
+
+    RmBuffer *buffers[N_PREADV_BUFFERS];
+    struct iovec readvec[N_PREADV_BUFFERS];
+    gboolean success = FALSE;
 
+    while(TRUE) {
+        /* don't read past bytes_to_read by more than the alignment needs */
+        guint64 bytes_wanted = buf_size * N_PREADV_BUFFERS;
+        if(!read_to_eof) {
+            guint64 needed = skip + bytes_remaining;
+            needed = DIVIDE_CEIL(needed, HASHER_DIRECT_ALIGN) * HASHER_DIRECT_ALIGN;
+            bytes_wanted = MIN(bytes_wanted, needed);
+        }
+
+        int n_buffers = DIVIDE_CEIL(bytes_wanted, buf_size);
+        for(int i = 0; i < n_buffers; ++i) {
+            buffers[i] = rm_buffer_new(hasher->buf_pool);
+            readvec[i].iov_base = buffers[i]->data;
+            readvec[i].iov_len = MIN(buf_size, bytes_wanted - i * buf_size);
+        }
+
+        gint64 read_start = rm_metrics_now();
+        gint64 bytes_read = rm_sys_preadv(fd, readvec, n_buffers, file_offset);
+        int saved_errno = errno;
+        rm_metrics_device_read(metrics, MAX(bytes_read, 0), read_start);
+
+        if(bytes_read == -1) {
+            for(int i = 0; i < n_buffers; ++i) {
+                rm_buffer_free(buffers[i]);
+            }
+            if(saved_errno == EINVAL) {
+                /* alignment not accepted after all; let the caller do the rest */
+                *fallback = TRUE;
+            } else {
+                rm_log_perror("preadv failed");
+            }
+            break;
+        }
+
+        file_offset += bytes_read;
+
+        /* send buffers, dropping the leading skip bytes and any over-read */
+        for(int i = 0; i < n_buffers; ++i) {
+            RmBuffer *buffer = buffers[i];
+            gint64 len = CLAMP(bytes_read - i * (gint64)buf_size, 0, (gint64)buf_size);
+            gsize cut = MIN(skip, (gsize)len);
+            skip -= cut;
+            len = MIN((guint64)(len - cut), bytes_remaining);
+            bytes_remaining -= len;
+
+            if(len > 0 && !recut) {
+                buffer->len = len;
+                buffer->digest = digest;
+                *bytes_actually_read += len;
+                rm_hashpipe_push(hashpipe, buffer);
+                continue;
+            }
+
+            for(unsigned char *data = buffer->data + cut; len > 0;) {
+                if(out == NULL) {
+                    out = rm_buffer_new(hasher->buf_pool);
+                }
+                gsize chunk = MIN((gsize)len, buf_size - out->len);
+                memcpy(out->data + out->len, data, chunk);
+                out->len += chunk;
+                data += chunk;
+                len -= chunk;
+                if(out->len == buf_size) {
+                    out->digest = digest;
+                    *bytes_actually_read += buf_size;
+                    rm_hashpipe_push(hashpipe, out);
+                    out = NULL;
+                }
+            }
+            rm_buffer_free(buffer);
+        }
+
+        if(bytes_remaining == 0) {
+            success = TRUE;
+            break;
+        } else if((guint64)bytes_read < bytes_wanted) {
+            /* short read means EOF; the next offset would be unaligned anyway */
+            if(read_to_eof) {
+                success = TRUE;
+            } else {
+                rm_log_error_line(_("Something went wrong reading %s; expected %li bytes, "
+                                    "got %li; ignoring"),
+                                  path, (long int)bytes_to_read,
+                                  (long int)*bytes_actually_read);
+            }
+            break;
+        }
+    }
+
+    if(out && success) {
+        /* the short last buffer */
+        out->digest = digest;
+        *bytes_actually_read += out->len;
+        rm_hashpipe_push(hashpipe, out);
+    } else if(out) {
+        /* not counted, so a fallback reads it again */
+        rm_buffer_free(out);
+    }
+
+    rm_sys_close(fd);
     return success;
 }
 
+#endif
+
 //////////////////////////////////////
 //  RmHasher                        //
 //////////////////////////////////////
 
-static void rm_hasher_hashpipe_free(GThreadPool *hashpipe) {
-    /* free the GThreadPool; wait for any in-progress jobs to finish */
-    g_thread_pool_free(hashpipe, FALSE, TRUE);
-}
-
 /* local joiner if user provides no joiner to rm_hasher_new() */
 static RmHasherCallback *rm_hasher_joiner(RmHasher *hasher, RmDigest *digest,
                                           _UNUSED gpointer session_user_data,
@@ -371,19 +954,19 @@ RmHasher *rm_hasher_new(RmDigestType digest_type,
     RmHasher *self = g_slice_new0(RmHasher);
     self->digest_type = digest_type;
 
+    /* paranoid digests hold on to their buffers; the paranoid memory manager
+     * limits those, so no quota is needed there */
+    gsize max_buffers = 0;
     if(digest_type != RM_DIGEST_PARANOID) {
-        int max_buffers = num_threads * 64;
+        max_buffers = num_threads * 64;
         if(!use_buffered_read) {
             /*  preadv() uses N_PREADV_BUFFERS in parallel.
              *  Need at least this many for one operation.
              *  */
             max_buffers *= N_PREADV_BUFFERS;
         }
-
-        self->buf_sem = rm_semaphore_new(max_buffers);
-    } else {
-        self->buf_sem = NULL;
     }
+    self->buf_pool = rm_buffer_pool_new(buf_size, max_buffers);
 
     self->use_buffered_read = use_buffered_read;
     self->buf_size = buf_size;
@@ -402,14 +985,22 @@ RmHasher *rm_hasher_new(RmDigestType digest_type,
     g_mutex_init(&self->lock);
     g_cond_init(&self->cond);
 
-    /* Create a pool of hashing thread "pools" - each "pool" can only have
-     * one thread because hashing must be done in order */
-    self->hashpipe_pool = g_async_queue_new_full((GDestroyNotify)rm_hasher_hashpipe_free);
+    /* Create a pool of hashpipes - each hashpipe has exactly one thread
+     * because hashing must be done in order; they are created on demand */
+    self->hashpipe_pool = g_async_queue_new_full((GDestroyNotify)rm_hashpipe_free);
     g_assert(num_threads > 0);
     self->unalloc_hashpipes = num_threads;
     return self;
 }
 
+void rm_hasher_set_fd_cache(RmHasher *hasher, RmFdCache *fd_cache) {
+    hasher->fd_cache = fd_cache;
+}
+
+void rm_hasher_set_open_func(RmHasher *hasher, RmHasherOpenFunc open_func) {
+    hasher->open_func = open_func;
+}
+
 void rm_hasher_free(RmHasher *hasher, gboolean wait) {
     /* Note that hasher may be multi-threaded, both at the reader level and at
      * the hashpipe level.  To ensure graceful exit, the hasher is reference counted
@@ -430,9 +1021,7 @@ void rm_hasher_free(RmHasher *hasher, gboolean wait) {
     g_cond_clear(&hasher->cond);
     g_mutex_clear(&hasher->lock);
 
-    if(hasher->buf_sem) {
-        rm_semaphore_destroy(hasher->buf_sem);
-    }
+    rm_buffer_pool_destroy(hasher->buf_pool);
 
     g_slice_free(RmHasher, hasher);
 }
@@ -457,8 +1046,7 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher, RmDigest *digest,
         if(g_atomic_int_get(&hasher->unalloc_hashpipes) > 0) {
             /* create a new hashpipe */
             g_atomic_int_dec_and_test(&hasher->unalloc_hashpipes);
-            self->hashpipe =
-                rm_util_thread_pool_new((GFunc)rm_hasher_hashpipe_worker, hasher, 1);
+            self->hashpipe = rm_hashpipe_new(hasher);
 
         } else {
             /* already at thread limit - wait for a hashpipe to come available */
@@ -471,22 +1059,52 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher, RmDigest *digest,
     return self;
 }
 
+void rm_hasher_task_set_metrics(RmHasherTask *task, RmMetricsDevice *device) {
+    task->metrics = device;
+}
+
 gboolean rm_hasher_task_hash(RmHasherTask *task, char *path, guint64 start_offset,
                              gsize bytes_to_read, gboolean is_symlink,
-                             gsize *bytes_read_out) {
+                             gboolean use_direct_read, gsize *bytes_read_out) {
     gsize bytes_read = 0;
     gboolean success = false;
+    gboolean done = FALSE;
+
+#ifdef O_DIRECT
+    if(use_direct_read && !is_symlink &&
+       (bytes_to_read == 0 || bytes_to_read >= HASHER_DIRECT_MIN_BYTES)) {
+        gboolean fallback = FALSE;
+        success = rm_hasher_direct_read(task->hasher, task->hashpipe, task->digest, path,
+                                        start_offset, bytes_to_read, &bytes_read,
+                                        &fallback, task->task_user_data, task->metrics);
+        if(fallback) {
+            /* continue normally where O_DIRECT gave up */
+            rm_log_debug_line("O_DIRECT not usable for %s; falling back", path);
+            start_offset += bytes_read;
+            if(bytes_to_read > 0) {
+                bytes_to_read -= bytes_read;
+            }
+        }
+        done = !fallback;
+    }
+#else
+    (void)use_direct_read;
+#endif
 
-    if(is_symlink) {
+    if(done) {
+        /* already read via O_DIRECT */
+    } else if(is_symlink) {
         success = rm_hasher_symlink_read(task->hasher, task->hashpipe, task->digest,
                                          path, &bytes_read);
     } else if(task->hasher->use_buffered_read) {
         success = rm_hasher_buffered_read(task->hasher, task->hashpipe, task->digest,
-                                          path, start_offset, bytes_to_read, &bytes_read);
+                                          path, start_offset, bytes_to_read, &bytes_read,
+                                          task->metrics);
     } else {
         success =
             rm_hasher_unbuffered_read(task->hasher, task->hashpipe, task->digest, path,
-                                      start_offset, bytes_to_read, &bytes_read);
+                                      start_offset, bytes_to_read, &bytes_read,
+                                      task->task_user_data, task->metrics);
     }
 
     if(bytes_read_out != NULL) {
@@ -501,11 +1119,11 @@ RmDigest *rm_hasher_task_finish(RmHasherTask *task) {
     /* get a dummy buffer to use to signal the hasher thread that this increment is
      * finished */
     RmHasher *hasher = task->hasher;
-    RmBuffer *finisher = rm_buffer_new(hasher->buf_sem, hasher->buf_size);
+    RmBuffer *finisher = rm_buffer_new(hasher->buf_pool);
     finisher->digest = task->digest;
     finisher->len = 0;
     finisher->user_data = task;
-    rm_util_thread_pool_push(task->hashpipe, finisher);
+    rm_hashpipe_push(task->hashpipe, finisher);
 
     if(hasher->return_queue) {
         return g_async_queue_pop(hasher->return_queue);
@@ -29,6 +29,8 @@
 #include <glib.h>
 #include "checksum.h"
 #include "config.h"
+#include "metrics.h"
+#include "pathtricia.h"
 
 /**
  * @file hasher.h
@@ -106,6 +108,76 @@ RmHasher *rm_hasher_new(RmDigestType digest_type,
                         RmHasherCallback joiner,
                         gpointer session_user_data);
 
+/**
+ * @struct RmFdCache
+ * RmFdCache keeps the descriptors of partly read files open so that the next
+ * increment does not need to look up and open the path again.  The least
+ * recently used descriptors are closed once more than max_fds are kept.
+ **/
+typedef struct _RmFdCache RmFdCache;
+
+/**
+ * @brief Allocate a new descriptor cache
+ *
+ * @param max_fds Maximum number of descriptors to keep open; at most a quarter of
+ *RLIMIT_NOFILE is used.
+ **/
+RmFdCache *rm_fd_cache_new(guint max_fds);
+
+/**
+ * @brief Close the descriptor kept for key, if any
+ *
+ * Must be called before the key (a task_user_data) is freed or reused.
+ **/
+void rm_fd_cache_forget(RmFdCache *fd_cache, gconstpointer key);
+
+/**
+ * @brief Open the file at a trie node relative to its directory
+ *
+ * Descriptors of the directories on the way are kept in fd_cache (keyed by
+ * their RmNode), so files in a known directory are opened with a single
+ * openat(2) instead of resolving every path component again.  Directory
+ * descriptors stay in the cache while in use, so concurrent callers share them.
+ *
+ * @retval file descriptor or -1 (errno is set)
+ **/
+int rm_fd_cache_open_node(RmFdCache *fd_cache, RmNode *node, int flags);
+
+/**
+ * @brief Close all kept descriptors and free the cache
+ **/
+void rm_fd_cache_free(RmFdCache *fd_cache);
+
+/**
+ * @brief Keep descriptors open between increments
+ *
+ * Descriptors of unbuffered reads which did not read to EOF are kept in
+ * fd_cache, keyed by the task_user_data passed to rm_hasher_task_new().  The
+ * cache is not owned by the hasher and may outlive it.
+ **/
+void rm_hasher_set_fd_cache(RmHasher *hasher, RmFdCache *fd_cache);
+
+/**
+ * @brief RmHasherOpenFunc prototype; opens the file of a task
+ *
+ * @param task_user_data User data passed to rm_hasher_task_new()
+ * @param path The path passed to rm_hasher_task_hash()
+ * @param flags open(2) flags
+ * @param session_user_data User data passed to rm_hasher_new()
+ * @retval file descriptor, or -1 to fall back to open(2) on path
+ **/
+typedef int (*RmHasherOpenFunc)(gpointer task_user_data,
+                                const char *path,
+                                int flags,
+                                gpointer session_user_data);
+
+/**
+ * @brief Open task files via open_func instead of open(2) on their path
+ *
+ * Used for unbuffered and O_DIRECT reads.
+ **/
+void rm_hasher_set_open_func(RmHasher *hasher, RmHasherOpenFunc open_func);
+
 /**
  * @brief Free a hashing object
  *
@@ -126,6 +198,14 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher,
                                  RmDigest *digest,
                                  gpointer task_user_data);
 
+/**
+ * @brief Account the task's reads to device in --metrics
+ *
+ * Each read syscall is timed on its own, so the numbers do not include the
+ * time spent waiting for free buffers or hashpipes.
+ **/
+void rm_hasher_task_set_metrics(RmHasherTask *task, RmMetricsDevice *device);
+
 /**
  * @brief Read data from a file and send it for hashing in separate thread
  *
@@ -134,8 +214,10 @@ RmHasherTask *rm_hasher_task_new(RmHasher *hasher,
  * @param start_offset  Where to start reading the file (number of bytes from start)
  * @param bytes_to_read  How many bytes to read (pass 0 to read whole file)
  * @param is_symlink  If path is a symlink, pass TRUE to read the symlink itself rather
- * @param bytes_read_out Out parameter for the number of bytes physically read.
  *than the linked file
+ * @param use_direct_read  Read with O_DIRECT (bypassing the page cache) if possible;
+ *small reads and filesystems without O_DIRECT support silently use the normal path
+ * @param bytes_read_out Out parameter for the number of bytes physically read.
  * @retval FALSE if read errors occurred
  **/
 gboolean rm_hasher_task_hash(RmHasherTask *task,
@@ -143,6 +225,7 @@ gboolean rm_hasher_task_hash(RmHasherTask *task,
                              guint64 start_offset,
                              size_t bytes_to_read,
                              gboolean is_symlink,
+                             gboolean use_direct_read,
                              gsize *bytes_read_out);
 
 /**
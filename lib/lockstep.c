@@ -0,0 +1,197 @@
+/**
+* This file is part of rmlint.
+*
+*  rmlint is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  rmlint is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Authors:
+*
+*  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+*  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+*
+* Hosted on http://github.com/sahib/rmlint
+*
+**/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "config.h"
+#include "lockstep.h"
+#include "utilities.h"
+
+/* One file taking part in a lockstep comparison */
+typedef struct RmLockstepFile {
+    RmFile *file;
+    int fd;
+    guint8 *buffer;
+} RmLockstepFile;
+
+static bool rm_lockstep_open(RmLockstepFile *self, RmFile *file, RmOff start_offset,
+                             gsize block_size) {
+    RM_DEFINE_PATH(file);
+
+    self->fd = rm_sys_open(file_path, O_RDONLY);
+    if(self->fd == -1) {
+        rm_log_perrorf("lockstep: cannot open %s", file_path);
+        self->file = NULL;
+        return false;
+    }
+
+#if HAVE_POSIX_FADVISE
+    posix_fadvise(self->fd, start_offset, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    (void)start_offset;
+#endif
+
+    self->file = file;
+    self->buffer = g_slice_alloc(block_size);
+    return true;
+}
+
+static void rm_lockstep_close(RmLockstepFile *self, gsize block_size) {
+    rm_sys_close(self->fd);
+    g_slice_free1(block_size, self->buffer);
+    self->file = NULL;
+    self->buffer = NULL;
+    self->fd = -1;
+}
+
+/* read exactly len bytes at offset into self->buffer */
+static bool rm_lockstep_read(RmLockstepFile *self, RmOff offset, gsize len) {
+    gsize bytes_read = 0;
+    while(bytes_read < len) {
+        struct iovec vec = {self->buffer + bytes_read, len - bytes_read};
+        gint64 n = rm_sys_preadv(self->fd, &vec, 1, offset + bytes_read);
+        if(n <= 0) {
+            /* error, or file shrunk since we looked at it */
+            return false;
+        }
+        bytes_read += n;
+    }
+    return true;
+}
+
+/* Compare batch[0..n_batch) against reference; returns false if the reference
+ * itself could not be read (in which case the unfinished files stay in batch) */
+static bool rm_lockstep_compare_batch(RmLockstepFile *reference, RmLockstepFile *batch,
+                                      guint n_batch, RmOff start_offset,
+                                      gsize block_size, GQueue *rejects,
+                                      GQueue *failed) {
+    RmOff end_offset = reference->file->file_size;
+    guint n_active = n_batch;
+
+    for(RmOff offset = start_offset; offset < end_offset && n_active > 0;) {
+        gsize len = MIN(block_size, end_offset - offset);
+        if(!rm_lockstep_read(reference, offset, len)) {
+            return false;
+        }
+
+        for(guint i = 0; i < n_batch; i++) {
+            RmLockstepFile *candidate = &batch[i];
+            if(!candidate->file) {
+                continue;
+            }
+
+            GQueue *target = NULL;
+            if(!rm_lockstep_read(candidate, offset, len)) {
+                target = failed;
+            } else if(memcmp(reference->buffer, candidate->buffer, len) != 0) {
+                /* first differing block; stop reading this one */
+                target = rejects;
+            }
+
+            if(target) {
+                g_queue_push_tail(target, candidate->file);
+                rm_lockstep_close(candidate, block_size);
+                n_active--;
+            }
+        }
+        offset += len;
+    }
+    return true;
+}
+
+void rm_lockstep_compare(GQueue *files, RmOff start_offset, gsize block_size,
+                         GQueue *rejects, GQueue *failed) {
+    g_assert(files);
+    g_assert(rejects);
+    g_assert(failed);
+
+    if(g_queue_get_length(files) < 2) {
+        /* nothing to compare */
+        return;
+    }
+
+    GQueue identical = G_QUEUE_INIT;
+    RmLockstepFile reference = {NULL, -1, NULL};
+
+    /* first readable file becomes the reference */
+    while(!reference.file && !g_queue_is_empty(files)) {
+        RmFile *file = g_queue_pop_head(files);
+        if(!rm_lockstep_open(&reference, file, start_offset, block_size)) {
+            g_queue_push_tail(failed, file);
+        }
+    }
+
+    if(!reference.file) {
+        return;
+    }
+
+    RmLockstepFile batch[RM_LOCKSTEP_MAX_OPEN];
+    bool reference_ok = true;
+
+    while(reference_ok && !g_queue_is_empty(files)) {
+        guint n_batch = 0;
+        while(n_batch < RM_LOCKSTEP_MAX_OPEN - 1 && !g_queue_is_empty(files)) {
+            RmFile *file = g_queue_pop_head(files);
+            if(rm_lockstep_open(&batch[n_batch], file, start_offset, block_size)) {
+                n_batch++;
+            } else {
+                g_queue_push_tail(failed, file);
+            }
+        }
+
+        reference_ok = rm_lockstep_compare_batch(&reference, batch, n_batch, start_offset,
+                                                 block_size, rejects, failed);
+
+        for(guint i = 0; i < n_batch; i++) {
+            if(batch[i].file) {
+                /* if the reference failed halfway we don't know anything about the
+                 * survivors yet; pass them on for another go */
+                g_queue_push_tail(reference_ok ? &identical : rejects, batch[i].file);
+                rm_lockstep_close(&batch[i], block_size);
+            }
+        }
+    }
+
+    /* anything left over was never compared */
+    while(!g_queue_is_empty(files)) {
+        g_queue_push_tail(rejects, g_queue_pop_head(files));
+    }
+
+    if(reference_ok) {
+        g_queue_push_head(&identical, reference.file);
+    } else {
+        rm_log_warning_line("lockstep: read failed on reference file; dropping it");
+        g_queue_push_tail(failed, reference.file);
+    }
+    rm_lockstep_close(&reference, block_size);
+
+    /* hand back the identical files */
+    for(GList *iter = identical.head; iter; iter = iter->next) {
+        g_queue_push_tail(files, iter->data);
+    }
+    g_queue_clear(&identical);
+}
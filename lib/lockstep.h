@@ -0,0 +1,62 @@
+/**
+* This file is part of rmlint.
+*
+*  rmlint is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  rmlint is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Authors:
+*
+*  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+*  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+*
+* Hosted on http://github.com/sahib/rmlint
+**/
+
+#ifndef RM_LOCKSTEP_H
+#define RM_LOCKSTEP_H
+
+#include <glib.h>
+
+#include "file.h"
+
+/* Maximum number of files which are held open (and compared) at once */
+#define RM_LOCKSTEP_MAX_OPEN (64)
+
+/**
+ * @brief Byte-by-byte comparison of a group of candidate files.
+ *
+ * The files are read in lockstep, one block at a time, starting at start_offset
+ * and up to their file_size.  Each block is compared against the same block of a
+ * reference file (the first readable file in files).  As soon as a file
+ * differs from the reference it is closed and moved to rejects, so no more of
+ * its data is read.  Only one block per open file is held in memory.
+ *
+ * Bigger groups are compared in several passes of at most RM_LOCKSTEP_MAX_OPEN
+ * files against the same reference.
+ *
+ * Note: only the RmFile's in files are read; any hardlinks or other files
+ * bundled with them are assumed to be identical.
+ *
+ * @param files Queue of RmFile's with the same file_size; on return it only
+ * contains the files that are identical to the reference (including the
+ * reference itself).
+ * @param start_offset Where to start comparing.
+ * @param block_size How many bytes to compare in one step.
+ * @param rejects Files that differ from the reference are appended here.  This
+ * might contain duplicates of each other which still need to be compared.
+ * @param failed Files that could not be opened or read are appended here.
+ */
+void rm_lockstep_compare(GQueue *files, RmOff start_offset, gsize block_size,
+                         GQueue *rejects, GQueue *failed);
+
+#endif /* end of include guard */
@@ -77,6 +77,16 @@ struct _RmMDS {
     gint max_threads;
     gint threads_per_disk;
 
+    /* threads per non-rotational disk (if more than threads_per_disk) */
+    gint threads_per_nonrotational;
+
+    /* threads requested by all devices started so far; the pool grows with
+     * this (up to max_threads) but never shrinks */
+    gint device_threads;
+
+    /* merge new tasks into the sorted queue instead of putting them first */
+    gboolean ordered;
+
     /* pointer to user data to be passed to func */
     gpointer user_data;
 };
@@ -112,6 +122,9 @@ struct _RmMDSDevice {
 
     /* is disk rotational? */
     gboolean is_rotational;
+
+    /* read statistics for --metrics */
+    RmMetricsDevice *metrics;
 };
 
 //////////////////////////////////////////////
@@ -125,6 +138,7 @@ static RmMDSTask *rm_mds_task_new(const dev_t dev, const guint64 offset,
     self->dev = dev;
     self->offset = offset;
     self->task_data = task_data;
+    self->queued_at = rm_metrics_now();
     return self;
 }
 
@@ -143,6 +157,7 @@ static RmMDSDevice *rm_mds_device_new(RmMDS *mds, const dev_t disk) {
     self->ref_count = 0;
     self->threads = 0;
     self->disk = disk;
+    self->metrics = rm_metrics_device(disk);
 
     if(mds->fake_disk) {
         self->is_rotational = (disk % 2 == 0);
@@ -173,6 +188,8 @@ static void rm_mds_device_free(RmMDSDevice *self) {
 static void rm_mds_push_task_impl(RmMDSDevice *device, RmMDSTask *task) {
     g_mutex_lock(&device->lock);
     {
+        /* count the task before a worker can pop (and uncount) it */
+        rm_metrics_device_queue(device->metrics, 1);
         device->unsorted_tasks = g_slist_prepend(device->unsorted_tasks, task);
         g_cond_signal(&device->cond);
     }
@@ -187,6 +204,23 @@ static gint rm_mds_compare(const RmMDSTask *a, const RmMDSTask *b,
     return result;
 }
 
+/** @brief Merge two lists sorted by prioritiser; on ties old tasks go first
+ **/
+static GSList *rm_mds_merge(GSList *old_tasks, GSList *new_tasks,
+                            RmMDSSortFunc prioritiser) {
+    GSList *result = NULL;
+    GSList **tail = &result;
+    while(old_tasks && new_tasks) {
+        GSList **source =
+            (prioritiser(new_tasks->data, old_tasks->data) < 0) ? &new_tasks : &old_tasks;
+        *tail = *source;
+        *source = (*source)->next;
+        tail = &(*tail)->next;
+    }
+    *tail = old_tasks ? old_tasks : new_tasks;
+    return result;
+}
+
 /** @brief RmMDSDevice worker thread
  **/
 static void rm_mds_factory(RmMDSDevice *device, RmMDS *mds) {
@@ -206,11 +240,15 @@ static void rm_mds_factory(RmMDSDevice *device, RmMDS *mds) {
         /* sort and merge task lists */
         if(device->unsorted_tasks) {
             if(mds->prioritiser) {
-                device->sorted_tasks = g_slist_concat(
-                    g_slist_sort_with_data(device->unsorted_tasks,
-                                           (GCompareDataFunc)rm_mds_compare,
-                                           (RmMDSSortFunc)mds->prioritiser),
-                    device->sorted_tasks);
+                GSList *new_tasks = g_slist_sort_with_data(
+                    device->unsorted_tasks, (GCompareDataFunc)rm_mds_compare,
+                    (RmMDSSortFunc)mds->prioritiser);
+                if(mds->ordered) {
+                    device->sorted_tasks =
+                        rm_mds_merge(device->sorted_tasks, new_tasks, mds->prioritiser);
+                } else {
+                    device->sorted_tasks = g_slist_concat(new_tasks, device->sorted_tasks);
+                }
             } else {
                 device->sorted_tasks =
                     g_slist_concat(device->unsorted_tasks, device->sorted_tasks);
@@ -224,6 +262,8 @@ static void rm_mds_factory(RmMDSDevice *device, RmMDS *mds) {
     RmMDSTask *task = NULL;
     while(processed < mds->pass_quota &&
           (task = rm_util_slist_pop(&device->sorted_tasks, &device->lock))) {
+        rm_metrics_device_queue(device->metrics, -1);
+        rm_metrics_device_wait(device->metrics, task->queued_at);
         if(mds->func(task->task_data, mds->user_data)) {
             /* task succeeded; update counters */
             ++processed;
@@ -259,10 +299,22 @@ void rm_mds_device_start(RmMDSDevice *device, RmMDS *mds) {
     g_assert(device->threads == 0);
 
     g_assert(mds);
-    device->threads = mds->threads_per_disk;
+    gint threads = mds->threads_per_disk;
+    if(!device->is_rotational) {
+        threads = MAX(threads, mds->threads_per_nonrotational);
+    }
+
+    mds->device_threads += threads;
+    if(mds->pool) {
+        /* devices may be added while running */
+        g_thread_pool_set_max_threads(
+            mds->pool, CLAMP(mds->device_threads, 1, mds->max_threads), NULL);
+    }
+
+    device->threads = threads;
     g_mutex_lock(&device->lock);
     {
-        for(int i = 0; i < mds->threads_per_disk; ++i) {
+        for(int i = 0; i < threads; ++i) {
             rm_log_debug_line("Starting disk %" LLU " (pointer %p) thread #%i",
                               (RmOff)device->disk, device, i + 1);
             rm_util_thread_pool_push(mds->pool, device);
@@ -283,7 +335,8 @@ void rm_mds_start(RmMDS *mds) {
     g_list_free(disks);
 }
 
-static RmMDSDevice *rm_mds_device_get_by_disk(RmMDS *mds, const dev_t disk) {
+static RmMDSDevice *rm_mds_device_get_by_disk(RmMDS *mds, const dev_t disk,
+                                              const gint ref_count) {
     RmMDSDevice *result = NULL;
     g_assert(mds);
     g_mutex_lock(&mds->lock);
@@ -291,8 +344,12 @@ static RmMDSDevice *rm_mds_device_get_by_disk(RmMDS *mds, const dev_t disk) {
         g_assert(mds->disks);
 
         result = g_hash_table_lookup(mds->disks, GINT_TO_POINTER(disk));
-        if(!result) {
+        if(result) {
+            rm_mds_device_ref(result, ref_count);
+        } else {
             result = rm_mds_device_new(mds, disk);
+            /* take the reference before any worker can see the device */
+            result->ref_count = ref_count;
             g_hash_table_insert(mds->disks, GINT_TO_POINTER(disk), result);
             if(g_atomic_int_get(&mds->running) == TRUE) {
                 rm_mds_device_start(result, mds);
@@ -343,6 +400,18 @@ void rm_mds_configure(RmMDS *self,
     self->prioritiser = prioritiser;
 }
 
+void rm_mds_configure_nonrotational(RmMDS *self, const gint threads_per_disk) {
+    g_assert(self);
+    g_assert(self->running == FALSE);
+    self->threads_per_nonrotational = threads_per_disk;
+}
+
+void rm_mds_configure_ordered(RmMDS *self) {
+    g_assert(self);
+    g_assert(self->running == FALSE);
+    self->ordered = TRUE;
+}
+
 void rm_mds_finish(RmMDS *mds) {
     g_mutex_lock(&mds->lock);
     /* wait for any pending threads to finish */
@@ -352,11 +421,14 @@ void rm_mds_finish(RmMDS *mds) {
             { g_cond_wait(&mds->cond, &mds->lock); }
         }
     }
+    /* all devices are released; a later rm_mds_start() begins from scratch */
+    mds->device_threads = 0;
     g_mutex_unlock(&mds->lock);
 
     mds->running = FALSE;
     if(mds->pool) {
         g_thread_pool_free(mds->pool, false, true);
+        mds->pool = NULL;
     }
 }
 
@@ -384,23 +456,32 @@ gint rm_mds_device_ref(RmMDSDevice *device, const gint ref_count) {
     return result;
 }
 
-RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev) {
-    dev_t disk = 0;
+static dev_t rm_mds_disk_of(RmMDS *mds, const char *path, dev_t dev) {
     if(dev == 0) {
         dev = rm_mounts_get_disk_id_by_path(mds->mount_table, path);
     }
     if(mds->fake_disk) {
-        disk = dev;
-    } else {
-        disk = rm_mounts_get_disk_id(mds->mount_table, dev, path);
+        return dev;
     }
-    return rm_mds_device_get_by_disk(mds, disk);
+    return rm_mounts_get_disk_id(mds->mount_table, dev, path);
+}
+
+RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev) {
+    return rm_mds_device_get_by_disk(mds, rm_mds_disk_of(mds, path, dev), 0);
+}
+
+RmMDSDevice *rm_mds_device_get_ref(RmMDS *mds, const char *path, dev_t dev) {
+    return rm_mds_device_get_by_disk(mds, rm_mds_disk_of(mds, path, dev), 1);
 }
 
 gboolean rm_mds_device_is_rotational(RmMDSDevice *device) {
     return device->is_rotational;
 }
 
+RmMetricsDevice *rm_mds_device_metrics(RmMDSDevice *device) {
+    return device->metrics;
+}
+
 void rm_mds_push_task(RmMDSDevice *device, dev_t dev, gint64 offset, const char *path,
                       const gpointer task_data) {
     if(device->is_rotational && offset == -1) {
@@ -28,6 +28,7 @@
 
 #include <glib.h>
 #include "config.h"
+#include "metrics.h"
 #include "session.h"
 #include "utilities.h"
 
@@ -92,6 +93,8 @@ typedef struct RmMDSTask {
     dev_t dev;
     guint64 offset;
     gpointer task_data;
+    /* rm_metrics_now() when the task was queued */
+    gint64 queued_at;
 } RmMDSTask;
 
 /**
@@ -152,6 +155,21 @@ void rm_mds_configure(RmMDS *self,
                       const gint threads_per_disk,
                       RmMDSSortFunc prioritiser);
 
+/**
+ * @brief Give non-rotational disks more worker threads than rotational ones
+ *
+ * @param threads_per_disk Threads per non-rotational disk; values below the
+ * threads_per_disk passed to rm_mds_configure() have no effect.
+ **/
+void rm_mds_configure_nonrotational(RmMDS *self, const gint threads_per_disk);
+
+/**
+ * @brief Keep each device's whole queue in prioritiser order.  By default
+ * each newly pushed batch of tasks is sorted on its own and processed before
+ * the older tasks.
+ **/
+void rm_mds_configure_ordered(RmMDS *self);
+
 /**
  * @brief start a paused MDS scheduler
  **/
@@ -181,11 +199,25 @@ void rm_mds_free(RmMDS *mds, const gboolean free_mount_table);
  **/
 RmMDSDevice *rm_mds_device_get(RmMDS *mds, const char *path, dev_t dev);
 
+/**
+ * @brief like rm_mds_device_get() but also takes one reference on the device
+ *
+ * A device is freed once its reference count drops to zero while the
+ * scheduler is running, so this is the only safe way to get new devices
+ * after rm_mds_start().
+ **/
+RmMDSDevice *rm_mds_device_get_ref(RmMDS *mds, const char *path, dev_t dev);
+
 /**
  * @brief return rotationality of device
  * */
 gboolean rm_mds_device_is_rotational(RmMDSDevice *device);
 
+/**
+ * @brief return the read statistics of device's disk
+ * */
+RmMetricsDevice *rm_mds_device_metrics(RmMDSDevice *device);
+
 /**
  * @brief increase or decrease MDS reference count for an RmMDSDevice
  *
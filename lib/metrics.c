@@ -0,0 +1,842 @@
+/**
+* This file is part of rmlint.
+*
+*  rmlint is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  rmlint is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Authors:
+*
+*  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+*  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+*
+* Hosted on http://github.com/sahib/rmlint
+*
+**/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "metrics.h"
+#include "utilities.h"
+
+#if HAVE_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+
+/* Threads are spread over this many shards of counters */
+#define RM_METRICS_SHARDS (32)
+
+/* Histogram bucket i counts durations of less than 2^i microseconds */
+#define RM_METRICS_BUCKETS (40)
+
+/* How long the stream waits for a stalled reader per write */
+#define RM_METRICS_STREAM_TIMEOUT_MS (100)
+
+/* The last line is worth waiting a little longer for */
+#define RM_METRICS_STREAM_DONE_TRIES (10)
+
+#define RM_METRICS_ADD(ptr, value) __atomic_fetch_add((ptr), (value), __ATOMIC_RELAXED)
+#define RM_METRICS_GET(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+//////////////////////////
+//  STRUCTURES & STATE  //
+//////////////////////////
+
+typedef struct RmMetricsHistogram {
+    gint64 count;
+    gint64 total_us;
+    gint64 max_us;
+    gint64 buckets[RM_METRICS_BUCKETS];
+} RmMetricsHistogram;
+
+typedef struct RmMetricsShard {
+    gint64 counters[RM_METRICS_COUNTER_N];
+    RmMetricsHistogram timings[RM_METRICS_TIMING_N];
+    gint64 hash_bytes[RM_DIGEST_SENTINEL];
+    gint64 hash_us[RM_DIGEST_SENTINEL];
+} __attribute__((aligned(64))) RmMetricsShard;
+
+struct RmMetricsDevice {
+    gint64 key; /* disk as key of RM_METRICS.devices */
+    dev_t disk;
+    gint64 bytes_read;
+    gint64 first_read_us;
+    gint64 last_read_us;
+    gint64 queue_depth;
+    gint64 max_queue_depth;
+    RmMetricsHistogram reads;
+    RmMetricsHistogram waits;
+
+    /* bytes_read when the last stream line was written */
+    gint64 streamed_bytes;
+};
+
+static struct {
+    volatile gint enabled;
+    gint64 start_us;
+
+    RmMetricsShard shards[RM_METRICS_SHARDS];
+    volatile gint next_shard;
+
+    /* when each RmFmtProgressState was first entered and left (0 if not) */
+    gint64 phase_start[RM_PROGRESS_STATE_N];
+    gint64 phase_end[RM_PROGRESS_STATE_N];
+    volatile gint phase;
+
+    /* dev_t => RmMetricsDevice; protected by lock */
+    GHashTable *devices;
+    GMutex lock;
+
+    /* periodic writer */
+    GThread *writer;
+    GCond writer_cond;
+    bool writer_stop;
+
+    /* --metrics-stream; only used by the writer thread */
+    int stream_fd;
+    gint64 stream_last_us;
+    RmOff stream_last_bytes;
+    RmRunningMean stream_speed;
+
+    /* the part of the last line the reader did not take yet */
+    GString *stream_pending;
+
+    /* lines dropped because the reader was still behind */
+    gint64 stream_dropped;
+} RM_METRICS = {.stream_fd = -1};
+
+static const char *RM_METRICS_PHASE_NAMES[RM_PROGRESS_STATE_N] = {
+        [RM_PROGRESS_STATE_INIT] = "init",
+        [RM_PROGRESS_STATE_TRAVERSE] = "traverse",
+        [RM_PROGRESS_STATE_PREPROCESS] = "preprocess",
+        [RM_PROGRESS_STATE_SHREDDER] = "shredder",
+        [RM_PROGRESS_STATE_MERGE] = "merge",
+        [RM_PROGRESS_STATE_PRE_SHUTDOWN] = "output",
+        [RM_PROGRESS_STATE_SUMMARY] = "summary"};
+
+static const char *RM_METRICS_COUNTER_NAMES[RM_METRICS_COUNTER_N] = {
+        [RM_METRICS_TRAVERSE_DIRS] = "traverse_dirs",
+        [RM_METRICS_TRAVERSE_ENTRIES] = "traverse_entries",
+        [RM_METRICS_SIFT_LOCKS] = "sift_locks",
+        [RM_METRICS_SIFT_CONTENDED] = "sift_locks_contended",
+        [RM_METRICS_OUTPUT_FILES] = "output_files",
+        [RM_METRICS_DIGEST_STATES] = "digest_states",
+        [RM_METRICS_DIGEST_STATES_REUSED] = "digest_states_reused"};
+
+static const char *RM_METRICS_TIMING_NAMES[RM_METRICS_TIMING_N] = {
+        [RM_METRICS_TRAVERSE_STAT] = "traverse_stat",
+        [RM_METRICS_SIFT_WAIT] = "sift_lock_wait",
+        [RM_METRICS_OUTPUT_WRITE] = "output_write"};
+
+static GPrivate RM_METRICS_SHARD;
+
+static RmMetricsShard *rm_metrics_shard(void) {
+    RmMetricsShard *shard = g_private_get(&RM_METRICS_SHARD);
+    if(shard == NULL) {
+        guint index = g_atomic_int_add(&RM_METRICS.next_shard, 1);
+        shard = &RM_METRICS.shards[index % RM_METRICS_SHARDS];
+        g_private_set(&RM_METRICS_SHARD, shard);
+    }
+    return shard;
+}
+
+static bool rm_metrics_enabled(void) {
+    return g_atomic_int_get(&RM_METRICS.enabled);
+}
+
+//////////////////////////
+//     HISTOGRAMS       //
+//////////////////////////
+
+static void rm_metrics_max(gint64 *max, gint64 value) {
+    gint64 current = RM_METRICS_GET(max);
+    while(value > current &&
+          !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED)) {
+        /* current was updated; try again */
+    }
+}
+
+static void rm_metrics_histogram_add(RmMetricsHistogram *self, gint64 us) {
+    us = MAX(us, 0);
+    guint bucket = 0;
+    while(bucket < RM_METRICS_BUCKETS - 1 && us >= ((gint64)1 << bucket)) {
+        bucket++;
+    }
+
+    RM_METRICS_ADD(&self->count, 1);
+    RM_METRICS_ADD(&self->total_us, us);
+    RM_METRICS_ADD(&self->buckets[bucket], 1);
+    rm_metrics_max(&self->max_us, us);
+}
+
+static void rm_metrics_histogram_sum(RmMetricsHistogram *sum, RmMetricsHistogram *self) {
+    sum->count += RM_METRICS_GET(&self->count);
+    sum->total_us += RM_METRICS_GET(&self->total_us);
+    sum->max_us = MAX(sum->max_us, RM_METRICS_GET(&self->max_us));
+    for(int i = 0; i < RM_METRICS_BUCKETS; ++i) {
+        sum->buckets[i] += RM_METRICS_GET(&self->buckets[i]);
+    }
+}
+
+/* Upper bound of the bucket that holds the given fraction of durations */
+static gint64 rm_metrics_histogram_percentile(RmMetricsHistogram *self, gdouble fraction) {
+    gint64 seen = 0;
+    for(int i = 0; i < RM_METRICS_BUCKETS; ++i) {
+        seen += self->buckets[i];
+        if(seen > 0 && seen >= fraction * self->count) {
+            return MIN((gint64)1 << i, self->max_us);
+        }
+    }
+    return self->max_us;
+}
+
+static void rm_metrics_histogram_write(RmMetricsHistogram *self, FILE *out) {
+    fprintf(out,
+            "{\"count\": %" G_GINT64_FORMAT ", \"total_us\": %" G_GINT64_FORMAT
+            ", \"max_us\": %" G_GINT64_FORMAT ", \"p50_us\": %" G_GINT64_FORMAT
+            ", \"p90_us\": %" G_GINT64_FORMAT ", \"p99_us\": %" G_GINT64_FORMAT "}",
+            self->count, self->total_us, self->max_us,
+            rm_metrics_histogram_percentile(self, 0.5),
+            rm_metrics_histogram_percentile(self, 0.9),
+            rm_metrics_histogram_percentile(self, 0.99));
+}
+
+//////////////////////////
+//       HOOKS          //
+//////////////////////////
+
+gint64 rm_metrics_now(void) {
+    if(!rm_metrics_enabled()) {
+        return 0;
+    }
+    return g_get_monotonic_time();
+}
+
+void rm_metrics_count(RmMetricsCounter counter, gint64 value) {
+    if(rm_metrics_enabled()) {
+        RM_METRICS_ADD(&rm_metrics_shard()->counters[counter], value);
+    }
+}
+
+void rm_metrics_time(RmMetricsTiming timing, gint64 start) {
+    if(start != 0) {
+        rm_metrics_histogram_add(&rm_metrics_shard()->timings[timing],
+                                 g_get_monotonic_time() - start);
+    }
+}
+
+void rm_metrics_hash(RmDigestType type, gsize bytes, gint64 start) {
+    if(start != 0 && type < RM_DIGEST_SENTINEL) {
+        RmMetricsShard *shard = rm_metrics_shard();
+        RM_METRICS_ADD(&shard->hash_bytes[type], bytes);
+        RM_METRICS_ADD(&shard->hash_us[type], g_get_monotonic_time() - start);
+    }
+}
+
+void rm_metrics_sift_lock(GMutex *lock) {
+    if(!rm_metrics_enabled()) {
+        g_mutex_lock(lock);
+        return;
+    }
+
+    RmMetricsShard *shard = rm_metrics_shard();
+    RM_METRICS_ADD(&shard->counters[RM_METRICS_SIFT_LOCKS], 1);
+    if(!g_mutex_trylock(lock)) {
+        gint64 start = g_get_monotonic_time();
+        g_mutex_lock(lock);
+        RM_METRICS_ADD(&shard->counters[RM_METRICS_SIFT_CONTENDED], 1);
+        rm_metrics_histogram_add(&shard->timings[RM_METRICS_SIFT_WAIT],
+                                 g_get_monotonic_time() - start);
+    }
+}
+
+void rm_metrics_set_phase(RmFmtProgressState state) {
+    if(!rm_metrics_enabled() || state >= RM_PROGRESS_STATE_N) {
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    g_mutex_lock(&RM_METRICS.lock);
+    {
+        RmFmtProgressState prev = g_atomic_int_get(&RM_METRICS.phase);
+        if(prev != state) {
+            RM_METRICS.phase_end[prev] = now;
+        }
+        if(RM_METRICS.phase_start[state] == 0) {
+            RM_METRICS.phase_start[state] = now;
+        }
+        /* re-entered (the shredder sets its state more than once) */
+        RM_METRICS.phase_end[state] = 0;
+        g_atomic_int_set(&RM_METRICS.phase, state);
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+}
+
+RmMetricsDevice *rm_metrics_device(dev_t disk) {
+    RmMetricsDevice *device = NULL;
+    g_mutex_lock(&RM_METRICS.lock);
+    {
+        if(RM_METRICS.devices == NULL) {
+            RM_METRICS.devices =
+                g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+        }
+
+        gint64 key = disk;
+        device = g_hash_table_lookup(RM_METRICS.devices, &key);
+        if(device == NULL) {
+            device = g_new0(RmMetricsDevice, 1);
+            device->key = key;
+            device->disk = disk;
+            g_hash_table_insert(RM_METRICS.devices, &device->key, device);
+        }
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+    return device;
+}
+
+void rm_metrics_device_read(RmMetricsDevice *device, gsize bytes, gint64 start) {
+    if(device == NULL || start == 0) {
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    RM_METRICS_ADD(&device->bytes_read, bytes);
+    rm_metrics_histogram_add(&device->reads, now - start);
+
+    gint64 unset = 0;
+    __atomic_compare_exchange_n(&device->first_read_us, &unset, start, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    rm_metrics_max(&device->last_read_us, now);
+}
+
+void rm_metrics_device_queue(RmMetricsDevice *device, gint delta) {
+    if(device == NULL || !rm_metrics_enabled()) {
+        return;
+    }
+
+    gint64 depth = RM_METRICS_ADD(&device->queue_depth, delta) + delta;
+    rm_metrics_max(&device->max_queue_depth, depth);
+}
+
+void rm_metrics_device_wait(RmMetricsDevice *device, gint64 queued_at) {
+    if(device != NULL && queued_at != 0) {
+        rm_metrics_histogram_add(&device->waits, g_get_monotonic_time() - queued_at);
+    }
+}
+
+//////////////////////////
+//       EXPORT         //
+//////////////////////////
+
+static gdouble rm_metrics_rate(gint64 amount, gint64 us) {
+    return (us > 0) ? amount / (us / (gdouble)G_USEC_PER_SEC) : 0;
+}
+
+static gint64 rm_metrics_phase_us(RmFmtProgressState state, gint64 now) {
+    gint64 start = RM_METRICS.phase_start[state];
+    gint64 end = RM_METRICS.phase_end[state];
+    if(start == 0) {
+        return 0;
+    }
+    return (end ? end : now) - start;
+}
+
+static gint rm_metrics_device_cmp(const RmMetricsDevice *a, const RmMetricsDevice *b) {
+    return SIGN_DIFF(a->disk, b->disk);
+}
+
+static void rm_metrics_write_device(RmMetricsDevice *device, FILE *out) {
+    gint64 bytes = RM_METRICS_GET(&device->bytes_read);
+    gint64 active_us =
+        RM_METRICS_GET(&device->last_read_us) - RM_METRICS_GET(&device->first_read_us);
+
+    RmMetricsHistogram reads = {0};
+    RmMetricsHistogram waits = {0};
+    rm_metrics_histogram_sum(&reads, &device->reads);
+    rm_metrics_histogram_sum(&waits, &device->waits);
+
+    fprintf(out, "    {\"disk\": \"%u:%u\", \"bytes_read\": %" G_GINT64_FORMAT,
+            major(device->disk), minor(device->disk), bytes);
+    fprintf(out, ", \"bytes_per_second\": %.0f, \"iops\": %.1f",
+            rm_metrics_rate(bytes, active_us), rm_metrics_rate(reads.count, active_us));
+    fprintf(out,
+            ", \"queue_depth\": %" G_GINT64_FORMAT ", \"max_queue_depth\": %" G_GINT64_FORMAT,
+            RM_METRICS_GET(&device->queue_depth), RM_METRICS_GET(&device->max_queue_depth));
+    fprintf(out, ",\n     \"read\": ");
+    rm_metrics_histogram_write(&reads, out);
+    fprintf(out, ",\n     \"wait\": ");
+    rm_metrics_histogram_write(&waits, out);
+    fprintf(out, "}");
+}
+
+void rm_metrics_write_json(RmSession *session, FILE *out) {
+    gint64 now = g_get_monotonic_time();
+
+    /* sum up the shards */
+    gint64 counters[RM_METRICS_COUNTER_N] = {0};
+    RmMetricsHistogram timings[RM_METRICS_TIMING_N];
+    gint64 hash_bytes[RM_DIGEST_SENTINEL] = {0};
+    gint64 hash_us[RM_DIGEST_SENTINEL] = {0};
+    memset(timings, 0, sizeof(timings));
+
+    for(int s = 0; s < RM_METRICS_SHARDS; ++s) {
+        RmMetricsShard *shard = &RM_METRICS.shards[s];
+        for(int i = 0; i < RM_METRICS_COUNTER_N; ++i) {
+            counters[i] += RM_METRICS_GET(&shard->counters[i]);
+        }
+        for(int i = 0; i < RM_METRICS_TIMING_N; ++i) {
+            rm_metrics_histogram_sum(&timings[i], &shard->timings[i]);
+        }
+        for(int i = 0; i < RM_DIGEST_SENTINEL; ++i) {
+            hash_bytes[i] += RM_METRICS_GET(&shard->hash_bytes[i]);
+            hash_us[i] += RM_METRICS_GET(&shard->hash_us[i]);
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"elapsed\": %.3f,\n",
+            g_timer_elapsed(session->timer_since_proc_start, NULL));
+    fprintf(out, "  \"phase\": \"%s\",\n",
+            RM_METRICS_PHASE_NAMES[g_atomic_int_get(&RM_METRICS.phase)]);
+
+    g_mutex_lock(&RM_METRICS.lock);
+    {
+        fprintf(out, "  \"phases\": {");
+        bool first = true;
+        for(int i = 0; i < RM_PROGRESS_STATE_N; ++i) {
+            if(RM_METRICS.phase_start[i] != 0) {
+                fprintf(out, "%s\"%s\": %.3f", first ? "" : ", ", RM_METRICS_PHASE_NAMES[i],
+                        rm_metrics_phase_us(i, now) / (gdouble)G_USEC_PER_SEC);
+                first = false;
+            }
+        }
+        fprintf(out, "},\n");
+
+        fprintf(out, "  \"traverse\": {\"files\": %d, \"dirs_per_second\": %.1f},\n",
+                g_atomic_int_get(&session->total_files),
+                rm_metrics_rate(counters[RM_METRICS_TRAVERSE_DIRS],
+                                rm_metrics_phase_us(RM_PROGRESS_STATE_TRAVERSE, now)));
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+
+    fprintf(out,
+            "  \"preprocess\": {\"files_in\": %d, \"files_out\": %" LLU "},\n",
+            g_atomic_int_get(&session->total_files), session->total_filtered_files);
+    fprintf(out,
+            "  \"shredder\": {\"bytes_read\": %" LLU ", \"bytes_total\": %" LLU
+            ", \"bytes_remaining\": %" LLU ", \"files_remaining\": %" LLU "},\n",
+            RM_METRICS_GET(&session->shred_bytes_read), session->shred_bytes_total,
+            session->shred_bytes_remaining, session->shred_files_remaining);
+
+    fprintf(out, "  \"counters\": {");
+    for(int i = 0; i < RM_METRICS_COUNTER_N; ++i) {
+        fprintf(out, "%s\"%s\": %" G_GINT64_FORMAT, i ? ", " : "",
+                RM_METRICS_COUNTER_NAMES[i], counters[i]);
+    }
+    fprintf(out, "},\n");
+
+    fprintf(out, "  \"timings\": {\n");
+    for(int i = 0; i < RM_METRICS_TIMING_N; ++i) {
+        fprintf(out, "    \"%s\": ", RM_METRICS_TIMING_NAMES[i]);
+        rm_metrics_histogram_write(&timings[i], out);
+        fprintf(out, "%s\n", (i + 1 < RM_METRICS_TIMING_N) ? "," : "");
+    }
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"hashing\": {");
+    bool first = true;
+    for(int i = 0; i < RM_DIGEST_SENTINEL; ++i) {
+        if(hash_bytes[i] == 0) {
+            continue;
+        }
+        fprintf(out,
+                "%s\n    \"%s\": {\"bytes\": %" G_GINT64_FORMAT
+                ", \"seconds\": %.3f, \"bytes_per_second\": %.0f}",
+                first ? "" : ",", rm_digest_type_to_string(i), hash_bytes[i],
+                hash_us[i] / (gdouble)G_USEC_PER_SEC, rm_metrics_rate(hash_bytes[i], hash_us[i]));
+        first = false;
+    }
+    fprintf(out, "%s},\n", first ? "" : "\n  ");
+
+    fprintf(out, "  \"devices\": [");
+    g_mutex_lock(&RM_METRICS.lock);
+    {
+        GList *devices =
+            RM_METRICS.devices ? g_hash_table_get_values(RM_METRICS.devices) : NULL;
+        devices = g_list_sort(devices, (GCompareFunc)rm_metrics_device_cmp);
+        for(GList *iter = devices; iter; iter = iter->next) {
+            fprintf(out, "\n");
+            rm_metrics_write_device(iter->data, out);
+            fprintf(out, "%s", iter->next ? "," : "\n  ");
+        }
+        g_list_free(devices);
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+    fprintf(out, "]\n}\n");
+}
+
+//////////////////////////
+//       STREAM         //
+//////////////////////////
+
+int rm_metrics_stream_open(const char *spec, GError **error) {
+    if(g_str_has_prefix(spec, "unix:")) {
+        const char *path = spec + strlen("unix:");
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(*path == 0 || strlen(path) >= sizeof(addr.sun_path)) {
+            g_set_error(error, RM_ERROR_QUARK, 0, _("--metrics-stream: bad socket path: %s"),
+                        path);
+            return -1;
+        }
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            g_set_error(error, RM_ERROR_QUARK, 0, _("--metrics-stream: cannot connect to %s: %s"),
+                        path, g_strerror(errno));
+            if(fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+    }
+
+    char *end = NULL;
+    gint64 user_fd = g_ascii_strtoll(spec, &end, 10);
+    if(end == spec || *end != 0 || user_fd < 0 || user_fd > G_MAXINT) {
+        g_set_error(error, RM_ERROR_QUARK, 0,
+                    _("--metrics-stream: expected FD or unix:PATH, not %s"), spec);
+        return -1;
+    }
+
+    /* Use a copy, so closing the stream does not close e.g. stdout */
+    int fd = fcntl(user_fd, F_DUPFD_CLOEXEC, 0);
+    if(fd == -1) {
+        g_set_error(error, RM_ERROR_QUARK, 0, _("--metrics-stream: bad fd %s: %s"), spec,
+                    g_strerror(errno));
+    }
+    return fd;
+}
+
+/* Current and peak resident set size in bytes, or -1 if unknown */
+static void rm_metrics_memory(gint64 *rss, gint64 *max_rss) {
+    *rss = -1;
+    *max_rss = -1;
+
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        /* kilobytes on linux and the BSDs */
+        *max_rss = (gint64)usage.ru_maxrss * 1024;
+    }
+
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm != NULL) {
+        long size = 0, resident = 0;
+        if(fscanf(statm, "%ld %ld", &size, &resident) == 2) {
+            *rss = (gint64)resident * sysconf(_SC_PAGESIZE);
+        }
+        fclose(statm);
+    }
+}
+
+static void rm_metrics_append_bytes(GString *line, const char *key, gint64 bytes) {
+    if(bytes < 0) {
+        g_string_append_printf(line, "\"%s\":null", key);
+    } else {
+        g_string_append_printf(line, "\"%s\":%" G_GINT64_FORMAT, key, bytes);
+    }
+}
+
+/* One compact json object per line.  Only counters that are updated without
+ * the formatter lock are read, so the stream never slows down the run. */
+static void rm_metrics_build_line(RmSession *session, GString *line, bool done) {
+    gint64 now = g_get_monotonic_time();
+    gdouble took = (now - RM_METRICS.stream_last_us) / (gdouble)G_USEC_PER_SEC;
+    RmFmtProgressState phase = g_atomic_int_get(&RM_METRICS.phase);
+
+    RmOff bytes_read = RM_METRICS_GET(&session->shred_bytes_read);
+    RmOff bytes_remaining = RM_METRICS_GET(&session->shred_bytes_remaining);
+    gdouble speed = (took > 0) ? (bytes_read - RM_METRICS.stream_last_bytes) / took : 0;
+
+    /* Same estimate as the progressbar: remaining bytes by the mean speed */
+    gdouble eta = -1;
+    if(done) {
+        eta = 0;
+    } else if(phase == RM_PROGRESS_STATE_SHREDDER) {
+        /* stalls count too (with a speed of 0), so the eta grows while they last */
+        rm_running_mean_add(&RM_METRICS.stream_speed, speed);
+        gdouble mean_speed = rm_running_mean_get(&RM_METRICS.stream_speed);
+        if(mean_speed > 0) {
+            eta = bytes_remaining / mean_speed;
+        }
+    }
+
+    g_string_append_printf(line, "{\"time\":%.3f,\"elapsed\":%.3f,\"phase\":\"%s\",\"done\":%s",
+                           g_get_real_time() / (gdouble)G_USEC_PER_SEC,
+                           g_timer_elapsed(session->timer_since_proc_start, NULL),
+                           RM_METRICS_PHASE_NAMES[phase], done ? "true" : "false");
+    g_string_append_printf(line, ",\"files\":%d", g_atomic_int_get(&session->total_files));
+    g_string_append_printf(line, ",\"dropped\":%" G_GINT64_FORMAT, RM_METRICS.stream_dropped);
+
+    g_string_append_printf(line,
+                           ",\"shredder\":{\"bytes_read\":%" LLU ",\"bytes_remaining\":%" LLU
+                           ",\"files_remaining\":%" LLU ",\"bytes_per_second\":%.0f",
+                           bytes_read, bytes_remaining,
+                           (RmOff)RM_METRICS_GET(&session->shred_files_remaining), speed);
+    if(eta < 0) {
+        g_string_append(line, ",\"eta\":null}");
+    } else {
+        g_string_append_printf(line, ",\"eta\":%.1f}", eta);
+    }
+
+    gint64 rss = 0, max_rss = 0;
+    rm_metrics_memory(&rss, &max_rss);
+    g_string_append(line, ",\"memory\":{");
+    rm_metrics_append_bytes(line, "rss", rss);
+    g_string_append(line, ",");
+    rm_metrics_append_bytes(line, "max_rss", max_rss);
+    g_string_append(line, "}");
+
+    g_string_append(line, ",\"devices\":[");
+    g_mutex_lock(&RM_METRICS.lock);
+    {
+        GList *devices =
+            RM_METRICS.devices ? g_hash_table_get_values(RM_METRICS.devices) : NULL;
+        devices = g_list_sort(devices, (GCompareFunc)rm_metrics_device_cmp);
+        for(GList *iter = devices; iter; iter = iter->next) {
+            RmMetricsDevice *device = iter->data;
+            gint64 bytes = RM_METRICS_GET(&device->bytes_read);
+            gint64 last_read_us = RM_METRICS_GET(&device->last_read_us);
+
+            /* a device that is not read from while it has work queued is stalled */
+            g_string_append_printf(
+                line,
+                "%s{\"disk\":\"%u:%u\",\"bytes_read\":%" G_GINT64_FORMAT
+                ",\"bytes_per_second\":%.0f,\"queue_depth\":%" G_GINT64_FORMAT
+                ",\"idle\":%.1f}",
+                (iter == devices) ? "" : ",", major(device->disk), minor(device->disk),
+                bytes, (took > 0) ? (bytes - device->streamed_bytes) / took : 0,
+                RM_METRICS_GET(&device->queue_depth),
+                (now - MAX(last_read_us, RM_METRICS.start_us)) / (gdouble)G_USEC_PER_SEC);
+            device->streamed_bytes = bytes;
+        }
+        g_list_free(devices);
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+    g_string_append(line, "]}\n");
+
+    RM_METRICS.stream_last_us = now;
+    RM_METRICS.stream_last_bytes = bytes_read;
+}
+
+/* Write some of data to fd, waiting at most RM_METRICS_STREAM_TIMEOUT_MS for the
+ * reader to make room (-1 with errno EAGAIN otherwise).  The descriptor may be
+ * shared with the user, so it is left blocking: sockets are written with
+ * MSG_DONTWAIT and everything else in pieces that fit once poll(2) says so. */
+static ssize_t rm_metrics_stream_write(int fd, const char *data, gsize len) {
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int ready = poll(&pfd, 1, RM_METRICS_STREAM_TIMEOUT_MS);
+    if(ready == 0) {
+        errno = EAGAIN;
+        return -1;
+    } else if(ready == -1) {
+        return -1;
+    }
+
+    /* a pipe that polls writable takes PIPE_BUF bytes without blocking */
+    len = MIN(len, PIPE_BUF);
+    ssize_t n = send(fd, data, len, MSG_DONTWAIT);
+    if(n == -1 && errno == ENOTSOCK) {
+        n = write(fd, data, len);
+    }
+    return n;
+}
+
+/* Write as much of stream_pending as the reader takes without keeping us
+ * waiting; closes the stream if the reader went away */
+static void rm_metrics_stream_flush(void) {
+    GString *pending = RM_METRICS.stream_pending;
+    gsize written = 0;
+    while(written < pending->len) {
+        ssize_t n = rm_metrics_stream_write(RM_METRICS.stream_fd, pending->str + written,
+                                            pending->len - written);
+        if(n == -1 && errno == EINTR) {
+            continue;
+        }
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* stalled reader; try again with the next line */
+            break;
+        }
+        if(n <= 0) {
+            /* the reader went away; carry on without the stream */
+            rm_log_warning_line(_("Unable to write metrics stream: %s"), g_strerror(errno));
+            close(RM_METRICS.stream_fd);
+            RM_METRICS.stream_fd = -1;
+            written = pending->len;
+            break;
+        }
+        written += n;
+    }
+    g_string_erase(pending, 0, written);
+}
+
+static void rm_metrics_write_line(RmSession *session, bool done) {
+    if(RM_METRICS.stream_fd == -1) {
+        return;
+    }
+
+    GString *line = g_string_new(NULL);
+    rm_metrics_build_line(session, line, done);
+
+    /* finish an earlier line first, so the reader only ever sees whole lines */
+    int tries = done ? RM_METRICS_STREAM_DONE_TRIES : 1;
+    for(int i = 0; i < tries && RM_METRICS.stream_pending->len > 0; i++) {
+        rm_metrics_stream_flush();
+    }
+
+    if(RM_METRICS.stream_fd != -1 && RM_METRICS.stream_pending->len > 0) {
+        /* still behind; rather lose this line than wait for the reader */
+        RM_METRICS.stream_dropped++;
+    } else if(RM_METRICS.stream_fd != -1) {
+        g_string_append_len(RM_METRICS.stream_pending, line->str, line->len);
+        for(int i = 0; i < tries && RM_METRICS.stream_pending->len > 0; i++) {
+            rm_metrics_stream_flush();
+        }
+    }
+
+    g_string_free(line, true);
+}
+
+//////////////////////////
+//    FILE & WRITER     //
+//////////////////////////
+
+/* Write to a temporary file first, so readers never see half a file */
+static void rm_metrics_write_file(RmSession *session) {
+    const char *path = session->cfg->metrics_path;
+    char *tmp_path = g_strdup_printf("%s.tmp", path);
+
+    FILE *out = fopen(tmp_path, "w");
+    if(out == NULL) {
+        rm_log_perrorf("Unable to write metrics to %s", tmp_path);
+    } else {
+        rm_metrics_write_json(session, out);
+        fclose(out);
+        if(rename(tmp_path, path) == -1) {
+            rm_log_perrorf("Unable to rename %s", tmp_path);
+        }
+    }
+
+    g_free(tmp_path);
+}
+
+static gpointer rm_metrics_writer(RmSession *session) {
+    gint64 interval_us = session->cfg->metrics_interval * G_USEC_PER_SEC;
+
+    /* a closed stream should fail the write, not kill the process */
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+    g_mutex_lock(&RM_METRICS.lock);
+    while(!RM_METRICS.writer_stop) {
+        if(interval_us <= 0) {
+            /* only write at exit */
+            g_cond_wait(&RM_METRICS.writer_cond, &RM_METRICS.lock);
+            continue;
+        }
+
+        gint64 end_time = g_get_monotonic_time() + interval_us;
+        if(g_cond_wait_until(&RM_METRICS.writer_cond, &RM_METRICS.lock, end_time)) {
+            continue;
+        }
+
+        /* the exports take the lock themselves */
+        g_mutex_unlock(&RM_METRICS.lock);
+        if(session->cfg->metrics_path) {
+            rm_metrics_write_file(session);
+        }
+        rm_metrics_write_line(session, false);
+        g_mutex_lock(&RM_METRICS.lock);
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+
+    if(session->cfg->metrics_path) {
+        rm_metrics_write_file(session);
+    }
+    rm_metrics_write_line(session, true);
+    return NULL;
+}
+
+void rm_metrics_start(RmSession *session) {
+    RmCfg *cfg = session->cfg;
+    if(cfg->metrics_path == NULL && cfg->metrics_stream_fd == -1) {
+        return;
+    }
+
+    RM_METRICS.start_us = g_get_monotonic_time();
+    g_atomic_int_set(&RM_METRICS.enabled, true);
+    rm_metrics_set_phase(RM_PROGRESS_STATE_INIT);
+
+    RM_METRICS.stream_fd = cfg->metrics_stream_fd;
+    RM_METRICS.stream_last_us = RM_METRICS.start_us;
+    rm_running_mean_init(&RM_METRICS.stream_speed, 10);
+    RM_METRICS.stream_pending = g_string_new(NULL);
+    RM_METRICS.stream_dropped = 0;
+
+    RM_METRICS.writer_stop = false;
+    RM_METRICS.writer = g_thread_new("rm-metrics", (GThreadFunc)rm_metrics_writer, session);
+}
+
+void rm_metrics_stop(RmSession *session) {
+    if(!rm_metrics_enabled()) {
+        return;
+    }
+
+    /* the writer does the final export itself */
+    g_mutex_lock(&RM_METRICS.lock);
+    {
+        RM_METRICS.writer_stop = true;
+        g_cond_signal(&RM_METRICS.writer_cond);
+    }
+    g_mutex_unlock(&RM_METRICS.lock);
+    g_thread_join(RM_METRICS.writer);
+    RM_METRICS.writer = NULL;
+
+    if(RM_METRICS.stream_fd != -1) {
+        close(RM_METRICS.stream_fd);
+        RM_METRICS.stream_fd = -1;
+    }
+    session->cfg->metrics_stream_fd = -1;
+    rm_running_mean_unref(&RM_METRICS.stream_speed);
+    g_string_free(RM_METRICS.stream_pending, true);
+    RM_METRICS.stream_pending = NULL;
+}
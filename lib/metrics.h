@@ -0,0 +1,134 @@
+/**
+* This file is part of rmlint.
+*
+*  rmlint is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  rmlint is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+*
+* Authors:
+*
+*  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+*  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+*
+* Hosted on http://github.com/sahib/rmlint
+**/
+
+#ifndef RM_METRICS_H
+#define RM_METRICS_H
+
+#include <glib.h>
+#include <stdio.h>
+
+#include "checksum.h"
+#include "formats.h"
+#include "session.h"
+
+/* Everything here is a no-op until rm_metrics_start() enabled it, so the
+ * hooks may stay in hot paths.  Counters and histograms are kept per thread
+ * (or rather, per one of a few shards that threads are spread over) and only
+ * summed up when they are exported. */
+
+typedef enum RmMetricsCounter {
+    RM_METRICS_TRAVERSE_DIRS,        /* directories that were entered */
+    RM_METRICS_TRAVERSE_ENTRIES,     /* entries returned by fts_read() */
+    RM_METRICS_SIFT_LOCKS,           /* group locks taken while sifting */
+    RM_METRICS_SIFT_CONTENDED,       /* ...of which had to wait for another thread */
+    RM_METRICS_OUTPUT_FILES,         /* files passed to the formatters */
+    RM_METRICS_DIGEST_STATES,        /* digest states created by new or copy */
+    RM_METRICS_DIGEST_STATES_REUSED, /* ...of which came from a free list */
+    RM_METRICS_COUNTER_N
+} RmMetricsCounter;
+
+typedef enum RmMetricsTiming {
+    RM_METRICS_TRAVERSE_STAT, /* one fts_read(), ie. readdir and stat(2) */
+    RM_METRICS_SIFT_WAIT,     /* waiting for a contended group lock */
+    RM_METRICS_OUTPUT_WRITE,  /* passing one file to all formatters */
+    RM_METRICS_TIMING_N
+} RmMetricsTiming;
+
+/* Read statistics of one physical disk (see md-scheduler.h) */
+typedef struct RmMetricsDevice RmMetricsDevice;
+
+/**
+ * @brief Enable metrics if cfg->metrics_path or cfg->metrics_stream_fd is
+ * set; the file is then rewritten and a line is added to the stream every
+ * cfg->metrics_interval seconds (if > 0) until rm_metrics_stop().
+ */
+void rm_metrics_start(RmSession *session);
+
+/**
+ * @brief Write the metrics file and stream a last time and stop updating them.
+ */
+void rm_metrics_stop(RmSession *session);
+
+/**
+ * @brief Write all metrics as one json object to out.
+ */
+void rm_metrics_write_json(RmSession *session, FILE *out);
+
+/**
+ * @brief Open the target of --metrics-stream: a file descriptor number (which
+ * is duplicated) or "unix:" followed by the path of a listening socket.
+ *
+ * @return the fd to write to, or -1 with error set.
+ */
+int rm_metrics_stream_open(const char *spec, GError **error);
+
+/**
+ * @brief Remember when state was entered; called by rm_fmt_set_state().
+ */
+void rm_metrics_set_phase(RmFmtProgressState state);
+
+/**
+ * @brief Start time for rm_metrics_time() and friends, or 0 if disabled.
+ */
+gint64 rm_metrics_now(void);
+
+void rm_metrics_count(RmMetricsCounter counter, gint64 value);
+
+/**
+ * @brief Add the time since start (from rm_metrics_now()) to timing.
+ */
+void rm_metrics_time(RmMetricsTiming timing, gint64 start);
+
+/**
+ * @brief Add bytes hashed with type in the time since start.
+ */
+void rm_metrics_hash(RmDigestType type, gsize bytes, gint64 start);
+
+/**
+ * @brief g_mutex_lock() for the shredder's group locks, which counts the
+ * locks and how long they were waited for.
+ */
+void rm_metrics_sift_lock(GMutex *lock);
+
+/**
+ * @brief Get the statistics of disk; the result lives until exit.
+ */
+RmMetricsDevice *rm_metrics_device(dev_t disk);
+
+/**
+ * @brief Account for one read syscall of bytes from device that began at start.
+ */
+void rm_metrics_device_read(RmMetricsDevice *device, gsize bytes, gint64 start);
+
+/**
+ * @brief Change the number of queued tasks of device by delta.
+ */
+void rm_metrics_device_queue(RmMetricsDevice *device, gint delta);
+
+/**
+ * @brief Account for a task that waited in device's queue since queued_at.
+ */
+void rm_metrics_device_wait(RmMetricsDevice *device, gint64 queued_at);
+
+#endif /* end of include guard */
@@ -119,22 +119,27 @@ char *rm_path_iter_next(RmPathIter *iter) {
     return elem_begin;
 }
 
-RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value) {
-    g_assert(self);
-    g_assert(path);
-
+/* create the nodes of path as needed; must be called with the lock held */
+static RmNode *rm_trie_make_path(RmTrie *self, const char *path) {
     RmPathIter iter;
     rm_path_iter_init(&iter, path);
 
-    g_mutex_lock(&self->lock);
-
     char *path_elem = NULL;
     RmNode *curr_node = self->root;
 
     while((path_elem = rm_path_iter_next(&iter))) {
         curr_node = rm_node_insert(self, curr_node, path_elem);
     }
+    return curr_node;
+}
+
+RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value) {
+    g_assert(self);
+    g_assert(path);
+
+    g_mutex_lock(&self->lock);
 
+    RmNode *curr_node = rm_trie_make_path(self, path);
     if(curr_node != NULL) {
         curr_node->has_value = true;
         curr_node->data = value;
@@ -146,6 +151,17 @@ RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value) {
     return curr_node;
 }
 
+RmNode *rm_trie_get_node(RmTrie *self, const char *path) {
+    g_assert(self);
+    g_assert(path);
+
+    g_mutex_lock(&self->lock);
+    RmNode *node = rm_trie_make_path(self, path);
+    g_mutex_unlock(&self->lock);
+
+    return node;
+}
+
 RmNode *rm_trie_search_node(RmTrie *self, const char *path) {
     g_assert(self);
     g_assert(path);
@@ -83,6 +83,13 @@ void rm_trie_destroy(RmTrie *self);
 RmNode *rm_trie_insert(RmTrie *self, const char *path, void *value);
 RmNode *rm_trie_insert_unlocked(RmTrie *self, const char *path, void *value);
 
+/**
+ * rm_trie_get_node:
+ * Like rm_trie_insert, but leave the node's value alone: it only counts as
+ * inserted if it was (or will be) inserted with a value explicitly.
+ */
+RmNode *rm_trie_get_node(RmTrie *self, const char *path);
+
 /**
  * rm_trie_search_node:
  * Search a node in the trie by path.
@@ -132,8 +132,8 @@ static gboolean rm_node_equal(const RmFile *file_a, const RmFile *file_b) {
  * also point to the real path
  */
 typedef struct RmPathDoubleKey {
-    /* stat(dirname(file->path)).st_ino */
-    ino_t parent_inode;
+    /* stat(dirname(file->path)) */
+    RmDirId parent;
 
     /* File the key points to */
     RmFile *file;
@@ -141,19 +141,35 @@ typedef struct RmPathDoubleKey {
 } RmPathDoubleKey;
 
 static guint rm_path_double_hash(const RmPathDoubleKey *key) {
-    /* depend only on the always set components, never change the hash duringthe run
-     */
-    return rm_node_hash(key->file);
+    /* All members of an inode cluster share rm_node_hash(); mix in the
+     * parent and name so that they do not all land in one bucket */
+    return rm_node_hash(key->file) ^ key->parent.ino ^
+           g_str_hash(key->file->folder->basename);
 }
 
-static ino_t rm_path_parent_inode(RmFile *file) {
+static RmDirId rm_path_parent_id(RmFile *file) {
+    RmFileTables *tables = file->session->tables;
+    RmDirId *known = NULL;
+
+    g_mutex_lock(&tables->lock);
+    { known = g_hash_table_lookup(tables->dir_ids, file->folder->parent); }
+    g_mutex_unlock(&tables->lock);
+
+    if(known != NULL) {
+        return *known;
+    }
+
+    /* Not traversed (e.g. given as file or replayed); stat it once */
+    RmDirId id = {0, 0};
     char parent_path[PATH_MAX];
-    rm_trie_build_path(
+    if(rm_trie_build_path(
         (RmTrie *)&file->session->cfg->file_trie,
         file->folder->parent,
         parent_path,
         PATH_MAX
-    );
+    ) == NULL) {
+        strcpy(parent_path, "/");
+    }
 
     RmStat stat_buf;
     int retval = rm_sys_stat(parent_path, &stat_buf);
@@ -164,16 +180,20 @@ static ino_t rm_path_parent_inode(RmFile *file) {
             file_path,
             g_strerror(errno)
         );
-        return 0;
+    } else {
+        id.dev = stat_buf.st_dev;
+        id.ino = stat_buf.st_ino;
     }
 
-    return stat_buf.st_ino;
+    rm_file_tables_add_dir_id(tables, file->folder->parent, id.dev, id.ino);
+    return id;
 }
 
 static bool rm_path_have_same_parent(RmPathDoubleKey *key_a, RmPathDoubleKey *key_b) {
     RmFile *file_a = key_a->file, *file_b = key_b->file;
     return (file_a->folder->parent == file_b->folder->parent ||
-            rm_path_parent_inode(file_a) == rm_path_parent_inode(file_b));
+            (key_a->parent.ino == key_b->parent.ino &&
+             key_a->parent.dev == key_b->parent.dev));
 }
 
 static gboolean rm_path_double_equal(RmPathDoubleKey *key_a, RmPathDoubleKey *key_b) {
@@ -198,6 +218,7 @@ static gboolean rm_path_double_equal(RmPathDoubleKey *key_a, RmPathDoubleKey *ke
 static RmPathDoubleKey *rm_path_double_new(RmFile *file) {
     RmPathDoubleKey *key = g_malloc0(sizeof(RmPathDoubleKey));
     key->file = file;
+    key->parent = rm_path_parent_id(file);
     return key;
 }
 
@@ -218,6 +239,8 @@ RmFileTables *rm_file_tables_new(_UNUSED const RmSession *session) {
                               (GDestroyNotify)rm_path_double_free,
                               NULL);
 
+    rm_trie_init(&tables->dir_counts);
+    tables->dir_ids = g_hash_table_new_full(NULL, NULL, NULL, g_free);
     g_mutex_init(&tables->lock);
     return tables;
 }
@@ -235,6 +258,8 @@ void rm_file_tables_destroy(RmFileTables *tables) {
     }
 
     g_hash_table_unref(tables->unique_paths_table);
+    rm_trie_destroy(&tables->dir_counts);
+    g_hash_table_unref(tables->dir_ids);
 
     g_mutex_clear(&tables->lock);
     g_slice_free(RmFileTables, tables);
@@ -452,6 +477,16 @@ int rm_pp_cmp_orig_criteria(const RmFile *a, const RmFile *b, const RmSession *s
     return 0;
 }
 
+void rm_file_tables_add_dir_id(RmFileTables *tables, RmNode *dir, dev_t dev, ino_t ino) {
+    RmDirId *id = g_new(RmDirId, 1);
+    id->dev = dev;
+    id->ino = ino;
+
+    g_mutex_lock(&tables->lock);
+    { g_hash_table_replace(tables->dir_ids, dir, id); }
+    g_mutex_unlock(&tables->lock);
+}
+
 void rm_file_list_insert_file(RmFile *file, const RmSession *session) {
     g_mutex_lock(&session->tables->lock);
     { g_queue_push_tail(session->tables->all_files, file); }
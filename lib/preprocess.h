@@ -48,6 +48,12 @@ RmFileTables *rm_file_tables_new(const RmSession *session);
 */
 void rm_file_tables_destroy(RmFileTables *list);
 
+/**
+ * @brief Remember the device and inode of a traversed directory.
+ * @param dir The directory's node in cfg->file_trie.
+ */
+void rm_file_tables_add_dir_id(RmFileTables *tables, RmNode *dir, dev_t dev, ino_t ino);
+
 /**
  * @brief Appends a file in RmFileTables->all_files.
  * @param file The file to insert; ownership is taken.
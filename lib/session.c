@@ -125,6 +125,16 @@ void rm_session_clear(RmSession *session) {
 
     g_timer_destroy(session->timer_since_proc_start);
     g_free(cfg->sort_criteria);
+    g_free(cfg->metrics_path);
+
+    if(cfg->metrics_stream_fd != -1) {
+        /* parsed, but never handed to rm_metrics_start() */
+        close(cfg->metrics_stream_fd);
+    }
+
+    if(cfg->direct_read_devs) {
+        g_hash_table_unref(cfg->direct_read_devs);
+    }
 
     g_timer_destroy(session->timer);
     rm_file_tables_destroy(session->tables);
@@ -32,8 +32,15 @@
 #include <stdlib.h>
 
 #include "config.h"     // INLINE
+#include "pathtricia.h" // RmTrie
 #include "treemerge.h"  // RmTreeMerger
 
+/* Identity of a directory, as given by stat(2) */
+typedef struct RmDirId {
+    dev_t dev;
+    ino_t ino;
+} RmDirId;
+
 typedef struct RmFileTables {
     /* List of all files found during traversal */
     GQueue *all_files;
@@ -47,6 +54,15 @@ typedef struct RmFileTables {
     /* Used for finding path doubles */
     GHashTable *unique_paths_table;
 
+    /* {RmNode => RmDirId} for directory nodes of cfg->file_trie; recorded
+     * during traversal, so path doubles can be found without stat(2) */
+    GHashTable *dir_ids;
+
+    /* Recursive count of files below each traversed directory, or -1 if
+     * traversal could not see all of them; only filled for -D */
+    RmTrie dir_counts;
+    bool have_dir_counts;
+
     /*array of lists, one for each "other lint" type */
     GList *other_lint[RM_LINT_TYPE_DUPE_CANDIDATE];
 
@@ -98,7 +114,7 @@ typedef struct RmSession {
     RmOff duplicate_bytes;
     RmOff unique_bytes;
     RmOff original_bytes;
-    RmOff shred_bytes_read;
+    RmOff shred_bytes_read; /* added to atomically by the shredder */
 
     GTimer *timer_since_proc_start;
 
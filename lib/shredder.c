@@ -32,12 +32,14 @@
 
 #include "checksum.h"
 #include "hasher.h"
+#include "lockstep.h"
 
 #include "formats.h"
 #include "preprocess.h"
 #include "utilities.h"
 
 #include "md-scheduler.h"
+#include "metrics.h"
 #include "shredder.h"
 #include "xattr.h"
 
@@ -298,6 +300,28 @@
 /* Maximum number of bytes before worth_waiting becomes false */
 #define SHRED_TOO_MANY_BYTES_TO_WAIT (64 * 1024 * 1024)
 
+/* Block size for --paranoid-lockstep comparisons; RM_LOCKSTEP_MAX_OPEN blocks of
+ * this size are held in memory per verifying thread */
+#define SHRED_LOCKSTEP_BLOCK_SIZE (64 * 1024)
+
+/* The child group table of a RmShredGroup is split into shards so that
+ * concurrent hash callbacks for the same (big) parent group don't serialise
+ * on a single lock.  Small groups get a single shard; big groups get one
+ * shard per SHRED_FILES_PER_CHILD_SHARD files, up to SHRED_MAX_CHILD_SHARDS
+ * (must be a power of 2).
+ * */
+#define SHRED_FILES_PER_CHILD_SHARD (256)
+#define SHRED_MAX_CHILD_SHARDS (64)
+
+/* Maximum number of partly hashed files kept open between increments; saves a
+ * path lookup and open/close round trip per increment (noticeable on network
+ * filesystems) */
+#define SHRED_MAX_CACHED_FDS (1024)
+
+/* Maximum number of directory descriptors kept for opening files with
+ * openat(2) relative to their directory */
+#define SHRED_MAX_CACHED_DIRS (256)
+
 ///////////////////////////////////////////////////////////////////////
 //    INTERNAL STRUCTURES, WITH THEIR INITIALISERS AND DESTROYERS    //
 ///////////////////////////////////////////////////////////////////////
@@ -310,6 +334,15 @@ typedef struct RmShredTag {
     gint64 paranoid_mem_alloc; /* how much memory to allocate for paranoid checks */
     gint32 active_groups; /* how many shred groups active (only used with paranoid) */
     RmHasher *hasher;
+    /* descriptors of partly hashed files, keyed by RmFile */
+    RmFdCache *fd_cache;
+    /* descriptors of directories, keyed by their trie RmNode */
+    RmFdCache *dir_cache;
+    /* digest type used for hashing; differs from cfg->checksum_type with
+     * --paranoid-lockstep */
+    RmDigestType digest_type;
+    /* verify finished groups byte-by-byte (--paranoid-lockstep) */
+    bool verify;
     GThreadPool *result_pool;
     /* threadpool for progress counters to avoid blocking delays in
      * rm_shred_adjust_counters */
@@ -342,8 +375,14 @@ typedef struct RmShredGroup {
     GQueue *held_files;
 
     /* link(s) to next generation of RmShredGroups(s) which have this RmShredGroup as
-     * parent*/
-    GHashTable *children;
+     * parent; created lazily by rm_shred_group_get_children() */
+    struct RmShredChildTable *children;
+
+    /* next sibling in the same child table bucket (ie same digest_hash) */
+    struct RmShredGroup *next_sibling;
+
+    /* rm_digest_hash() of digest, cached for the parent's child table */
+    guint digest_hash;
 
     /* RmShredGroup of the same size files but with lower RmFile->hash_offset;
      * getsset to null when parent dies
@@ -378,6 +417,19 @@ typedef struct RmShredGroup {
     /* set if group has been greenlighted by paranoid mem manager */
     bool is_active : 1;
 
+    /* set if the digest stands for the group's single inode (--snapshots)
+     * rather than for the data; never written to xattrs */
+    bool has_inode_digest : 1;
+
+    /* set if the group holds clusters of files that show one stored object
+     * (see rm_shred_cluster_objects); such a cluster alone still has dupes */
+    bool has_object_clusters : 1;
+
+    /* set once a finished group is queued for --paranoid-lockstep
+     * verification; not a bitfield since the device workers read it for
+     * every file while other flags may change */
+    bool is_verifying;
+
     /* if whole group has same basename, pointer to first file, else null */
     RmFile *unique_basename;
 
@@ -416,6 +468,23 @@ typedef struct RmShredGroup {
     const RmSession *session;
 } RmShredGroup;
 
+/* One shard of a RmShredGroup's child table.  Maps rm_digest_hash() values to
+ * the first RmShredGroup with that hash; hash collisions are chained via
+ * RmShredGroup->next_sibling.  Groups are never removed from the table until
+ * the parent dies, so lookups only need the (shared) reader lock.
+ * */
+typedef struct RmShredChildShard {
+    GRWLock lock;
+    GHashTable *groups;
+} RmShredChildShard;
+
+typedef struct RmShredChildTable {
+    /* number of shards (power of 2) */
+    guint n_shards;
+
+    RmShredChildShard shards[];
+} RmShredChildTable;
+
 typedef struct RmSignal {
     GMutex lock;
     GCond cond;
@@ -469,6 +538,7 @@ static RmShredGroup *rm_shred_group_new(RmFile *file) {
 
     if(self->parent) {
         self->offset_factor = MIN(self->parent->offset_factor * 8, SHRED_MAX_READ_FACTOR);
+        self->has_object_clusters = self->parent->has_object_clusters;
     } else {
         self->offset_factor = 1;
     }
@@ -484,6 +554,149 @@ static RmShredGroup *rm_shred_group_new(RmFile *file) {
     return self;
 }
 
+/////////// RmShredChildTable ////////////////
+
+static RmShredChildTable *rm_shred_child_table_new(gsize n_files) {
+    guint n_shards = 1;
+    while(n_shards < SHRED_MAX_CHILD_SHARDS &&
+          n_shards * SHRED_FILES_PER_CHILD_SHARD < n_files) {
+        n_shards <<= 1;
+    }
+
+    RmShredChildTable *self = g_slice_alloc0(sizeof(RmShredChildTable) +
+                                             n_shards * sizeof(RmShredChildShard));
+    self->n_shards = n_shards;
+    for(guint i = 0; i < n_shards; i++) {
+        g_rw_lock_init(&self->shards[i].lock);
+        self->shards[i].groups = g_hash_table_new(NULL, NULL);
+    }
+    return self;
+}
+
+static void rm_shred_group_make_orphan(RmShredGroup *self);
+
+/* Free table; if orphan_children is set then rm_shred_group_make_orphan() is
+ * called for each child group */
+static void rm_shred_child_table_free(RmShredChildTable *self, bool orphan_children) {
+    for(guint i = 0; i < self->n_shards; i++) {
+        RmShredChildShard *shard = &self->shards[i];
+        if(orphan_children) {
+            GHashTableIter iter;
+            gpointer value = NULL;
+            g_hash_table_iter_init(&iter, shard->groups);
+            while(g_hash_table_iter_next(&iter, NULL, &value)) {
+                RmShredGroup *child = value;
+                while(child) {
+                    /* child may be freed by rm_shred_group_make_orphan() */
+                    RmShredGroup *next = child->next_sibling;
+                    rm_shred_group_make_orphan(child);
+                    child = next;
+                }
+            }
+        }
+        g_hash_table_unref(shard->groups);
+        g_rw_lock_clear(&shard->lock);
+    }
+    g_slice_free1(sizeof(RmShredChildTable) + self->n_shards * sizeof(RmShredChildShard),
+                  self);
+}
+
+static RmShredChildShard *rm_shred_child_table_shard(RmShredChildTable *self,
+                                                     guint hash) {
+    return &self->shards[(hash ^ (hash >> 16)) & (self->n_shards - 1)];
+}
+
+/* Call with shard locked (either reader or writer lock) */
+static RmShredGroup *rm_shred_child_shard_lookup(RmShredChildShard *shard, guint hash,
+                                                 RmDigest *digest) {
+    RmShredGroup *child = g_hash_table_lookup(shard->groups, GUINT_TO_POINTER(hash));
+    while(child && !rm_digest_equal(child->digest, digest)) {
+        child = child->next_sibling;
+    }
+    return child;
+}
+
+/* Call func for each child group; takes the reader lock of each shard in turn */
+static void rm_shred_child_table_foreach(RmShredChildTable *self, GFunc func,
+                                         gpointer user_data) {
+    for(guint i = 0; i < self->n_shards; i++) {
+        RmShredChildShard *shard = &self->shards[i];
+        g_rw_lock_reader_lock(&shard->lock);
+        {
+            GHashTableIter iter;
+            gpointer value = NULL;
+            g_hash_table_iter_init(&iter, shard->groups);
+            while(g_hash_table_iter_next(&iter, NULL, &value)) {
+                for(RmShredGroup *child = value; child; child = child->next_sibling) {
+                    func(child, user_data);
+                }
+            }
+        }
+        g_rw_lock_reader_unlock(&shard->lock);
+    }
+}
+
+/* Get group's child table, creating it if needed.  Can be called with group
+ * unlocked. */
+static RmShredChildTable *rm_shred_group_get_children(RmShredGroup *group) {
+    RmShredChildTable *table = g_atomic_pointer_get(&group->children);
+    if(table == NULL) {
+        /* num_files is only used as a sizing hint so doesn't need the lock */
+        RmShredChildTable *new_table = rm_shred_child_table_new(group->num_files);
+        if(g_atomic_pointer_compare_and_exchange(&group->children, NULL, new_table)) {
+            table = new_table;
+        } else {
+            /* somebody else beat us to it */
+            rm_shred_child_table_free(new_table, false);
+            table = g_atomic_pointer_get(&group->children);
+        }
+    }
+    return table;
+}
+
+/* Find the child group of parent which matches file->digest, creating a new one
+ * if none exists yet (in which case *created is set).  The common case of an
+ * existing child only takes the reader lock of a single shard; group->lock is
+ * not needed.
+ * */
+static RmShredGroup *rm_shred_group_find_child(RmShredGroup *parent, RmFile *file,
+                                               bool *created) {
+    g_assert(file->digest);
+
+    RmShredChildTable *table = rm_shred_group_get_children(parent);
+
+    /* computing the hash is the expensive part; do it before locking */
+    guint hash = rm_digest_hash(file->digest);
+    RmShredChildShard *shard = rm_shred_child_table_shard(table, hash);
+
+    g_rw_lock_reader_lock(&shard->lock);
+    RmShredGroup *child = rm_shred_child_shard_lookup(shard, hash, file->digest);
+    g_rw_lock_reader_unlock(&shard->lock);
+
+    if(child) {
+        return child;
+    }
+
+    g_rw_lock_writer_lock(&shard->lock);
+    {
+        /* check again since somebody may have added it in the meantime */
+        child = rm_shred_child_shard_lookup(shard, hash, file->digest);
+        if(!child) {
+            child = rm_shred_group_new(file);
+            child->digest_hash = hash;
+            child->next_sibling =
+                g_hash_table_lookup(shard->groups, GUINT_TO_POINTER(hash));
+            g_hash_table_insert(shard->groups, GUINT_TO_POINTER(hash), child);
+            if(created) {
+                *created = true;
+            }
+        }
+    }
+    g_rw_lock_writer_unlock(&shard->lock);
+
+    return child;
+}
+
 //////////////////////////////////
 // OPTIMISATION AND MEMORY      //
 // MANAGEMENT ALGORITHMS        //
@@ -709,6 +922,8 @@ static void rm_shred_discard_file(RmFile *file, bool free_file) {
     const RmSession *session = file->session;
     RmShredTag *tag = session->shredder;
 
+    rm_fd_cache_forget(tag->fd_cache, file);
+
     /* update device counters (unless this file was a bundled hardlink) */
     if(file->disk) {
         rm_mds_device_ref(file->disk, -1);
@@ -775,9 +990,10 @@ static void rm_shred_group_free(RmShredGroup *self, bool force_free) {
     }
 
     if(self->children) {
-        /* note: calls GDestroyNotify function rm_shred_group_make_orphan()
-         * for each RmShredGroup member of self->children: */
-        g_hash_table_unref(self->children);
+        /* note: calls rm_shred_group_make_orphan() for each RmShredGroup member
+         * of self->children: */
+        rm_shred_child_table_free(self->children, true);
+        self->children = NULL;
     }
 
     g_assert(!self->in_progress_digests);
@@ -800,6 +1016,23 @@ static gboolean rm_shred_group_qualifies(RmShredGroup *group) {
     /* we have more than one unique basename, or we don't care */
 }
 
+/* Push finished group to the result_pool.  With --paranoid-lockstep a
+ * duplicate group is verified first; that reads the files again, so it is
+ * queued on the head file's device like any other read (see
+ * rm_shred_process_file).  The files' device references keep the device
+ * alive until then. */
+static void rm_shred_group_send_to_results(RmShredGroup *self) {
+    RmShredTag *tag = self->session->shredder;
+    RmFile *headfile = self->held_files->head->data;
+    if(tag->verify && self->status == RM_SHRED_GROUP_FINISHING && headfile->disk) {
+        self->is_verifying = true;
+        rm_mds_push_task(headfile->disk, headfile->dev, headfile->disk_offset, NULL,
+                         headfile);
+    } else {
+        rm_util_thread_pool_push(tag->result_pool, self);
+    }
+}
+
 /* call unlocked; should be no contention issues since group is finished */
 static void rm_shred_group_finalise(RmShredGroup *self) {
     /* return any paranoid mem allocation */
@@ -813,7 +1046,7 @@ static void rm_shred_group_finalise(RmShredGroup *self) {
             /* upgrade status */
             self->status = RM_SHRED_GROUP_FINISHING;
         }
-        rm_util_thread_pool_push(self->session->shredder->result_pool, self);
+        rm_shred_group_send_to_results(self);
         break;
     case RM_SHRED_GROUP_START_HASHING:
     case RM_SHRED_GROUP_HASHING:
@@ -828,7 +1061,7 @@ static void rm_shred_group_finalise(RmShredGroup *self) {
         }
         /* send it to finisher (which takes responsibility for calling
          * rm_shred_group_free())*/
-        rm_util_thread_pool_push(self->session->shredder->result_pool, self);
+        rm_shred_group_send_to_results(self);
         break;
     case RM_SHRED_GROUP_FINISHED:
     default:
@@ -836,6 +1069,17 @@ static void rm_shred_group_finalise(RmShredGroup *self) {
     }
 }
 
+/* With --snapshots a size group of hardlinks to one inode is not read for
+ * -D; nothing else has its size, so a digest of the inode can stand in for
+ * the data (see rm_shred_result_factory) */
+static gboolean rm_shred_group_is_inode_family(RmShredGroup *group) {
+    const RmCfg *cfg = group->session->cfg;
+    /* cfg, not the shredder: --paranoid-lockstep hashes with another type */
+    return group->n_inodes == 1 && cfg->merge_directories && cfg->snapshots &&
+           group->parent == NULL && group->digest == NULL && group->file_size > 0 &&
+           cfg->checksum_type != RM_DIGEST_PARANOID;
+}
+
 /* Checks whether group qualifies as duplicate candidate (ie more than
  * two members and meets has_pref and NEEDS_PREF criteria).
  * Assume group already protected by group_lock.
@@ -844,13 +1088,15 @@ static void rm_shred_group_update_status(RmShredGroup *group) {
     if(group->status == RM_SHRED_GROUP_DORMANT && rm_shred_group_qualifies(group) &&
        group->hash_offset < group->file_size &&
        (group->n_clusters > 1 ||
-        (group->n_inodes == 1 && group->session->cfg->merge_directories))) {
+        (group->has_object_clusters && group->n_inodes > group->n_clusters) ||
+        (group->n_inodes == 1 && group->session->cfg->merge_directories &&
+         !rm_shred_group_is_inode_family(group)))) {
         /* group can go active */
         group->status = RM_SHRED_GROUP_START_HASHING;
     }
 }
 
-/* Only called by rm_shred_group_free (via GDestroyNotify of group->children).
+/* Only called by rm_shred_group_free (via rm_shred_child_table_free).
  * Call with group->lock unlocked.
  */
 static void rm_shred_group_make_orphan(RmShredGroup *self) {
@@ -880,7 +1126,7 @@ static RmFile *rm_shred_group_push_file(RmShredGroup *shred_group, RmFile *file,
         file->digest = NULL;
     }
 
-    g_mutex_lock(&shred_group->lock);
+    rm_metrics_sift_lock(&shred_group->lock);
     {
         if(cfg->unmatched_basenames) {
             /* do some fancy footwork for cfg->unmatched_basenames criterion */
@@ -966,44 +1212,47 @@ static RmFile *rm_shred_sift(RmFile *file) {
     RmShredGroup *current_group = file->shred_group;
     g_assert(current_group);
 
-    g_mutex_lock(&current_group->lock);
+    bool is_ignored = (file->status == RM_FILE_STATE_IGNORE);
+    bool is_paranoid = file->digest && file->digest->type == RM_DIGEST_PARANOID;
+
+    if(!is_ignored && !is_paranoid) {
+        /* Fast path: move the file into its child group without holding
+         * current_group->lock.  Note that the file still counts towards
+         * current_group->num_pending until below, so current_group (and its
+         * child table) can't be finalised under our feet */
+        RmShredGroup *child_group = rm_shred_group_find_child(current_group, file, NULL);
+        result = rm_shred_group_push_file(child_group, file, FALSE);
+    }
+
+    rm_metrics_sift_lock(&current_group->lock);
     {
         current_group->num_pending--;
-        if(current_group->in_progress_digests) {
-            /* remove this file from current_group's pending digests list */
-            current_group->in_progress_digests =
-                g_list_remove(current_group->in_progress_digests, file->digest);
-        }
 
-        if(file->status == RM_FILE_STATE_IGNORE) {
+        if(is_ignored) {
+            if(current_group->in_progress_digests) {
+                current_group->in_progress_digests =
+                    g_list_remove(current_group->in_progress_digests, file->digest);
+            }
             /* reading/hashing failed somewhere */
             if(file->digest) {
                 rm_digest_free(file->digest);
             }
             rm_shred_discard_file(file, true);
 
-        } else {
-            g_assert(file->digest);
-
-            /* check is child group hashtable has been created yet */
-            if(current_group->children == NULL) {
-                current_group->children =
-                    g_hash_table_new_full((GHashFunc)rm_digest_hash,
-                                          (GEqualFunc)rm_digest_equal,
-                                          NULL,
-                                          (GDestroyNotify)rm_shred_group_make_orphan);
-            }
+        } else if(is_paranoid) {
+            /* remove this file from current_group's pending digests list */
+            current_group->in_progress_digests =
+                g_list_remove(current_group->in_progress_digests, file->digest);
 
             /* check if there is already a descendent of current_group which
              * matches snap... if yes then move this file into it; if not then
-             * create a new group ... */
+             * create a new group ... Paranoid digests stay under
+             * current_group->lock here since new children need to be broadcast
+             * atomically with respect to rm_shred_reassign_checksum() */
+            bool created = false;
             RmShredGroup *child_group =
-                g_hash_table_lookup(current_group->children, file->digest);
-            if(!child_group) {
-                child_group = rm_shred_group_new(file);
-                g_hash_table_insert(current_group->children, child_group->digest,
-                                    child_group);
-
+                rm_shred_group_find_child(current_group, file, &created);
+            if(created) {
                 /* signal any pending (paranoid) digests that there is a new match
                  * candidate digest */
                 g_list_foreach(current_group->in_progress_digests,
@@ -1077,13 +1326,13 @@ static void rm_shred_file_preprocess(RmFile *file, RmShredGroup **group) {
 
     /* Create an empty checksum for empty files */
     if(file->file_size == 0) {
-        file->digest = rm_digest_new(cfg->checksum_type, 0);
+        file->digest = rm_digest_new(shredder->digest_type, 0);
     }
 
     if(!(*group)) {
         /* create RmShredGroup using first file in size group as template*/
         *group = rm_shred_group_new(file);
-        (*group)->digest_type = cfg->checksum_type;
+        (*group)->digest_type = shredder->digest_type;
     }
 
     RM_DEFINE_PATH(file);
@@ -1125,6 +1374,175 @@ static gint rm_shred_cluster_ext(RmFile *file, RmFile *prev) {
     return FALSE;
 }
 
+/* The stored object behind a file: overlay mounts show the inode of a layer
+ * file; snapshots and subvolumes on reflink capable filesystems share extents
+ * but not inodes, so there the first extent stands in */
+typedef struct RmShredObject {
+    RmFile *file;
+    /* the mapped path if the object is an extent, else NULL */
+    char *path;
+    dev_t dev;
+    RmOff id;
+    bool is_extent;
+} RmShredObject;
+
+/* Cheap check whether file may show an object that other inodes show too;
+ * only then its path is built and looked up */
+static bool rm_shred_object_may_be_shared(RmFile *file) {
+    const RmSession *session = file->session;
+    RmMountTable *mounts = session->mounts;
+    if(mounts == NULL) {
+        return false;
+    }
+    if(mounts->overlays) {
+        return true;
+    }
+    /* unknown devices are probably btrfs subvolumes; rm_mounts_get_disk_id()
+     * registers them on first sight */
+    return session->cfg->build_fiemap &&
+           (rm_mounts_can_reflink(mounts, file->dev, file->dev) ||
+            !rm_mounts_has_partition(mounts, file->dev));
+}
+
+static void rm_shred_object_init(RmShredObject *self, RmFile *file) {
+    const RmSession *session = file->session;
+
+    self->file = file;
+    self->path = NULL;
+    self->dev = file->dev;
+    self->id = file->inode;
+    self->is_extent = false;
+
+    if(!rm_shred_object_may_be_shared(file)) {
+        return;
+    }
+
+    RM_DEFINE_PATH(file);
+    RmStat backing;
+    char *backing_path =
+        rm_mounts_get_overlay_backing(session->mounts, file_path, &backing);
+    if(backing_path) {
+        if((RmOff)backing.st_size == file->actual_file_size &&
+           rm_sys_stat_mtime_float(&backing) == file->mtime) {
+            self->dev = backing.st_dev;
+            self->id = backing.st_ino;
+        } else {
+            /* changed since traversal, or not the layer file that is shown */
+            g_free(backing_path);
+            backing_path = NULL;
+        }
+    }
+
+    const char *mapped_path = backing_path ? backing_path : file_path;
+    if(session->cfg->build_fiemap) {
+        /* also registers btrfs subvolumes as reflink capable */
+        dev_t disk = rm_mounts_get_disk_id(session->mounts, self->dev, mapped_path);
+        RmOff physical = 0;
+        if(rm_mounts_can_reflink(session->mounts, self->dev, self->dev)) {
+            physical = rm_offset_get_from_path(mapped_path, 0, NULL);
+        }
+        if(physical != 0) {
+            self->path = g_strdup(mapped_path);
+            self->dev = disk;
+            self->id = physical;
+            self->is_extent = true;
+        }
+    }
+    g_free(backing_path);
+}
+
+static gint rm_shred_object_cmp(const RmShredObject *a, const RmShredObject *b) {
+    RETURN_IF_NONZERO(a->is_extent - b->is_extent);
+    RETURN_IF_NONZERO(SIGN_DIFF(a->dev, b->dev));
+    return SIGN_DIFF(a->id, b->id);
+}
+
+static bool rm_shred_object_equal(const RmShredObject *a, const RmShredObject *b) {
+    if(rm_shred_object_cmp(a, b) != 0) {
+        return false;
+    }
+
+    /* a shared first extent may be a partial clone; compare all of them */
+    return !a->is_extent || rm_util_link_type(a->path, b->path) == RM_LINK_REFLINK;
+}
+
+/* Cluster files that show the same stored object (an image layer seen
+ * through several overlay mounts, or a file and its snapshots) so that the
+ * object is read once; returns the files that are left and sets
+ * *has_clusters if any cluster was formed */
+static GSList *rm_shred_cluster_objects(GSList *files, gboolean *has_clusters) {
+    guint n_files = g_slist_length(files);
+    if(n_files < 2) {
+        return files;
+    }
+
+    guint n_shared = 0;
+    for(GSList *iter = files; iter && n_shared < 2; iter = iter->next) {
+        n_shared += rm_shred_object_may_be_shared(iter->data);
+    }
+    if(n_shared < 2) {
+        /* plain filesystems: inodes are objects already */
+        return files;
+    }
+
+    RmShredObject *objects = g_new(RmShredObject, n_files);
+    guint n_objects = 0;
+    for(GSList *iter = files; iter; iter = iter->next) {
+        rm_shred_object_init(&objects[n_objects++], iter->data);
+    }
+    g_slist_free(files);
+    files = NULL;
+
+    qsort(objects, n_objects, sizeof(RmShredObject),
+          (int (*)(const void *, const void *))rm_shred_object_cmp);
+
+    /* hosts with the same key as the current object; a partial clone sorts
+     * like the full ones, so each object is checked against all of them */
+    GPtrArray *hosts = g_ptr_array_new();
+    for(guint i = 0; i < n_objects; ++i) {
+        RmShredObject *object = &objects[i];
+        RmFile *file = object->file;
+
+        if(hosts->len > 0 && rm_shred_object_cmp(hosts->pdata[0], object) != 0) {
+            g_ptr_array_set_size(hosts, 0);
+        }
+
+        /* ext_cksum clusters stay as they are; a cluster of just the file
+         * itself only counts its hardlinks */
+        bool can_join = !file->cluster || file->cluster->length == 1;
+        RmShredObject *host = NULL;
+        for(guint j = 0; can_join && !host && j < hosts->len; ++j) {
+            if(rm_shred_object_equal(hosts->pdata[j], object)) {
+                host = hosts->pdata[j];
+            }
+        }
+
+        if(host) {
+#if _RM_SHRED_DEBUG
+            RmFile *host_file = host->file;
+            RM_DEFINE_PATH(host_file);
+            RM_DEFINE_PATH(file);
+            rm_log_debug_line("object cluster %s <-- %s", host_file_path, file_path);
+#endif
+            if(file->cluster) {
+                rm_file_cluster_remove(file);
+            }
+            rm_file_cluster_add(host->file, file);
+            *has_clusters = TRUE;
+        } else {
+            g_ptr_array_add(hosts, object);
+            files = g_slist_prepend(files, file);
+        }
+    }
+    g_ptr_array_free(hosts, TRUE);
+
+    for(guint i = 0; i < n_objects; ++i) {
+        g_free(objects[i].path);
+    }
+    g_free(objects);
+    return g_slist_reverse(files);
+}
+
 /* sorting function to sort by external checksums */
 static gint rm_shred_cmp_ext_cksum(RmFile *a, RmFile *b) {
     if(!a->ext_cksum && !b->ext_cksum) {
@@ -1136,7 +1554,7 @@ static gint rm_shred_cmp_ext_cksum(RmFile *a, RmFile *b) {
     return strcmp(a->ext_cksum, b->ext_cksum);
 }
 
-static void rm_shred_process_group(GSList *files, _UNUSED RmShredTag *main) {
+static void rm_shred_process_group(GSList *files, RmShredTag *main) {
     g_assert(files);
     g_assert(files->data);
 
@@ -1174,6 +1592,17 @@ static void rm_shred_process_group(GSList *files, _UNUSED RmShredTag *main) {
 
     /* push files to shred group */
     RmShredGroup *group = NULL;
+
+    /* empty files have nothing to read */
+    gboolean has_object_clusters = FALSE;
+    if(!all_have_ext_cksums && ((RmFile *)files->data)->file_size > 0) {
+        files = rm_shred_cluster_objects(files, &has_object_clusters);
+    }
+    if(has_object_clusters) {
+        group = rm_shred_group_new(files->data);
+        group->digest_type = main->digest_type;
+        group->has_object_clusters = true;
+    }
     RmFile *file = NULL;
     while((file = rm_util_slist_pop(&files, NULL))) {
         rm_shred_file_preprocess(file, &group);
@@ -1346,6 +1775,7 @@ static RmShredGroup *rm_shred_create_rejects(RmShredGroup *group, RmFile *file)
     RmShredGroup *rejects = rm_shred_group_new(file);
     rejects->status = group->status;
     rejects->parent = group->parent;
+    rejects->has_inode_digest = group->has_inode_digest;
     return rejects;
 }
 
@@ -1495,7 +1925,9 @@ static void rm_shred_group_postprocess(RmShredGroup *group, RmShredTag *tag) {
         rm_shred_forward_to_output(tag->session, group->held_files);
     }
 
-    rm_shred_write_group_to_xattr(tag->session, group->held_files);
+    if(!group->has_inode_digest) {
+        rm_shred_write_group_to_xattr(tag->session, group->held_files);
+    }
 
     if(group->status == RM_SHRED_GROUP_FINISHING) {
         group->status = RM_SHRED_GROUP_FINISHED;
@@ -1518,6 +1950,19 @@ static void rm_shred_result_factory(RmShredGroup *group, RmShredTag *tag) {
         rm_digest_update(group->digest, (unsigned char *)cksum, strlen(cksum));
     }
 
+    if(!group->digest && rm_shred_group_is_inode_family(group)) {
+        /* Same length as real digests, so treemerge can mix them in one
+         * directory; the type keeps them from ever matching real data */
+        guint64 identity[2] = {headfile->dev, headfile->inode};
+        gsize len = 0;
+        guint8 *bytes = rm_digest_sum(tag->digest_type, (const guint8 *)identity,
+                                      sizeof(identity), &len);
+        group->digest = rm_digest_new(RM_DIGEST_INODE, 0);
+        rm_digest_update(group->digest, bytes, len);
+        g_slice_free1(len, bytes);
+        group->has_inode_digest = true;
+    }
+
     /* Unbundle the hardlinks and clusters of each file to a flattened list of files */
     for(GList *iter = group->held_files->head; iter; iter = iter->next) {
         RmFile *file = iter->data;
@@ -1553,10 +1998,91 @@ static void rm_shred_result_factory(RmShredGroup *group, RmShredTag *tag) {
     rm_shred_group_postprocess(group, tag);
 }
 
+/* Remove file (and any bundled files) from group's counters; the file must
+ * already have been removed from group->held_files */
+static void rm_shred_group_remove_counts(RmShredGroup *group, RmFile *file) {
+    group->num_files -= rm_file_n_files(file);
+    group->n_pref -= rm_file_n_prefd(file);
+    group->n_npref -= rm_file_n_nprefd(file);
+    group->n_new -= rm_file_n_new(file);
+    group->n_clusters--;
+    group->n_inodes -= RM_FILE_INODE_COUNT(file);
+}
+
+/* Compares the files of a finished group byte-by-byte and passes it on to the
+ * result_pool.  Files that differ are split off into the returned group (NULL if
+ * none did), which still needs to be verified in turn */
+static RmShredGroup *rm_shred_verify_group(RmShredGroup *group, RmShredTag *tag) {
+    RmFile *headfile = group->held_files->head->data;
+
+    if(headfile->is_symlink) {
+        /* symlinks are hashed by their target path; nothing to read here */
+        rm_util_thread_pool_push(tag->result_pool, group);
+        return NULL;
+    }
+
+    GQueue rejects = G_QUEUE_INIT;
+    GQueue failed = G_QUEUE_INIT;
+    rm_lockstep_compare(group->held_files, rm_file_start_offset(headfile),
+                        SHRED_LOCKSTEP_BLOCK_SIZE, &rejects, &failed);
+
+    for(GList *iter = failed.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        rm_shred_group_remove_counts(group, file);
+        rm_shred_discard_file(file, true);
+    }
+    g_queue_clear(&failed);
+
+    RmShredGroup *rejects_group = NULL;
+    if(!g_queue_is_empty(&rejects)) {
+        rejects_group = rm_shred_create_rejects(group, rejects.head->data);
+        for(GList *iter = rejects.head; iter; iter = iter->next) {
+            RmFile *file = iter->data;
+            rm_shred_group_remove_counts(group, file);
+            rm_shred_group_push_file(rejects_group, file, FALSE);
+        }
+        g_queue_clear(&rejects);
+
+        /* rejects might still contain duplicates of each other */
+        rejects_group->status = rm_shred_group_qualifies(rejects_group)
+                                    ? RM_SHRED_GROUP_FINISHING
+                                    : RM_SHRED_GROUP_DORMANT;
+    }
+
+    if(g_queue_is_empty(group->held_files)) {
+        /* nothing readable left */
+        rm_shred_group_free(group, true);
+        return rejects_group;
+    }
+
+    if(!rm_shred_group_qualifies(group)) {
+        group->status = RM_SHRED_GROUP_DORMANT;
+    }
+    rm_util_thread_pool_push(tag->result_pool, group);
+    return rejects_group;
+}
+
+/* Verifies group for --paranoid-lockstep on its device worker.  Rejects are
+ * verified right here too; their files are on the same device mostly */
+static void rm_shred_verify_factory(RmShredGroup *group, RmShredTag *tag) {
+    while(group) {
+        if(group->status != RM_SHRED_GROUP_FINISHING) {
+            /* no duplicates left to verify */
+            rm_util_thread_pool_push(tag->result_pool, group);
+            break;
+        }
+        group = rm_shred_verify_group(group, tag);
+    }
+}
+
 /////////////////////////////////
 //    ACTUAL IMPLEMENTATION    //
 /////////////////////////////////
 
+static void rm_shred_send_match_candidate(RmShredGroup *child, RmDigest *digest) {
+    rm_digest_send_match_candidate(digest, child->digest);
+}
+
 static bool rm_shred_reassign_checksum(RmShredTag *main, RmFile *file) {
     RmCfg *cfg = main->session->cfg;
     RmShredGroup *group = file->shred_group;
@@ -1586,12 +2112,9 @@ static bool rm_shred_reassign_checksum(RmShredTag *main, RmFile *file) {
             g_mutex_lock(&group->lock);
             {
                 if(group->children) {
-                    GList *children = g_hash_table_get_values(group->children);
-                    while(children) {
-                        RmShredGroup *child = children->data;
-                        rm_digest_send_match_candidate(file->digest, child->digest);
-                        children = g_list_delete_link(children, children);
-                    }
+                    rm_shred_child_table_foreach(
+                        group->children, (GFunc)rm_shred_send_match_candidate,
+                        file->digest);
                 }
                 /* store a reference so the shred group knows where to send any future
                  * twin candidate digests */
@@ -1605,7 +2128,7 @@ static bool rm_shred_reassign_checksum(RmShredTag *main, RmFile *file) {
         file->digest = rm_digest_copy(group->digest);
     } else {
         /* this is first generation of RMGroups, so there is no progressive hash yet */
-        file->digest = rm_digest_new(cfg->checksum_type,
+        file->digest = rm_digest_new(main->digest_type,
                                      main->session->hash_seed);
     }
     return true;
@@ -1620,6 +2143,22 @@ static bool rm_shred_can_process(RmFile *file, RmShredTag *main) {
     }
 }
 
+/* check if file's device was selected for O_DIRECT reading */
+static gboolean rm_shred_use_direct_read(RmCfg *cfg, RmFile *file) {
+    if(!cfg->use_direct_read) {
+        return FALSE;
+    }
+    return (cfg->direct_read_devs == NULL ||
+            g_hash_table_contains(cfg->direct_read_devs, GUINT_TO_POINTER(file->dev)));
+}
+
+/* RmHasherOpenFunc; open relative to the file's directory instead of
+ * resolving the whole path again */
+static int rm_shred_open_file(RmFile *file, _UNUSED const char *path, int flags,
+                              RmShredTag *tag) {
+    return rm_fd_cache_open_node(tag->dir_cache, file->folder, flags);
+}
+
 /* Callback for RmMDS
  * Return value of 1 tells md-scheduler that we have processed the file and either
  * disposed of it or pushed it back to the scheduler queue.
@@ -1629,6 +2168,13 @@ static bool rm_shred_can_process(RmFile *file, RmShredTag *main) {
 static gint rm_shred_process_file(RmFile *file, RmSession *session) {
     RmShredTag *tag = session->shredder;
 
+    if(file->shred_group->is_verifying) {
+        /* not a hash increment but the verification of file's finished group
+         * (see rm_shred_group_send_to_results) */
+        rm_shred_verify_factory(file->shred_group, tag);
+        return 1;
+    }
+
     if(rm_session_was_aborted()) {
         file->status = RM_FILE_STATE_IGNORE;
         rm_shred_sift(file);
@@ -1652,18 +2198,24 @@ static gint rm_shred_process_file(RmFile *file, RmSession *session) {
 
         gsize bytes_read = 0;
         RmHasherTask *task = rm_hasher_task_new(tag->hasher, file->digest, file);
+        rm_hasher_task_set_metrics(task, rm_mds_device_metrics(file->disk));
         if(!rm_hasher_task_hash(task, file_path, file->hash_offset, bytes_to_read,
-                                file->is_symlink, &bytes_read)) {
+                                file->is_symlink, rm_shred_use_direct_read(cfg, file),
+                                &bytes_read)) {
             /* rm_hasher_start_increment failed somewhere */
             file->status = RM_FILE_STATE_IGNORE;
             shredder_waiting = FALSE;
         }
 
-        /* TODO: make this threadsafe: */
-        session->shred_bytes_read += bytes_read;
+        /* shared by the readers of all devices */
+        __atomic_fetch_add(&session->shred_bytes_read, bytes_read, __ATOMIC_RELAXED);
 
         /* Update totals for file, device and session*/
         file->hash_offset += bytes_to_read;
+        if(file->hash_offset >= file->file_size || file->status == RM_FILE_STATE_IGNORE) {
+            /* no more increments to read */
+            rm_fd_cache_forget(tag->fd_cache, file);
+        }
         if(file->is_symlink) {
             rm_shred_adjust_counters(tag, 0, -(gint64)file->file_size);
         } else {
@@ -1675,7 +2227,7 @@ static gint rm_shred_process_file(RmFile *file, RmSession *session) {
             shredder_waiting =
                 shredder_waiting &&
                 /* no point waiting if we have no siblings */
-                file->shred_group->children &&
+                g_atomic_pointer_get(&file->shred_group->children) &&
                 /* no point waiting if paranoid digest with no twin candidates */
                 (file->digest->type != RM_DIGEST_PARANOID ||
                  ((RmParanoid*)file->digest->state)->twin_candidate);
@@ -1735,6 +2287,9 @@ void rm_shred_run(RmSession *session) {
 
     g_mutex_init(&tag.lock);
 
+    /* only now that the size groups are known are cached checksums worth reading */
+    rm_xattr_read_hashes(session, session->tables->size_groups);
+
     rm_mds_configure(session->mds,
                      (RmMDSFunc)rm_shred_process_file,
                      session,
@@ -1748,6 +2303,26 @@ void rm_shred_run(RmSession *session) {
     /* Create a pool for results processing */
     tag.result_pool = rm_util_thread_pool_new((GFunc)rm_shred_result_factory, &tag, 1);
 
+    tag.digest_type = cfg->checksum_type;
+    tag.fd_cache = rm_fd_cache_new(SHRED_MAX_CACHED_FDS);
+    tag.dir_cache = rm_fd_cache_new(SHRED_MAX_CACHED_DIRS);
+    tag.verify = false;
+    if(cfg->checksum_type == RM_DIGEST_PARANOID && cfg->paranoid_lockstep) {
+        /* Find candidates using a regular hash and verify them afterwards by
+         * byte-by-byte comparison.  This avoids holding paranoid digest buffers
+         * in memory.  Files of duplicate groups are read twice this way, but
+         * the hash can't be skipped: it is what narrows the candidates down
+         * before a comparison that holds a block of every file, and it still
+         * provides the group checksums for the output, --xattr-write and -D.
+         * Both reads are sequential, so this still beats the paranoid memory
+         * manager on big files.  The comparison runs on the device workers of
+         * the md-scheduler, so it does not compete with hashing reads of the
+         * same disk. */
+        tag.digest_type = (cfg->fake_lockstep_collisions) ? RM_DIGEST_CUMULATIVE
+                                                          : RM_DEFAULT_DIGEST;
+        tag.verify = true;
+    }
+
     rm_shred_preprocess_input(&tag);
     rm_log_debug_line("Done shred preprocessing");
 
@@ -1765,25 +2340,33 @@ void rm_shred_run(RmSession *session) {
     RmOff mem_used = SHRED_AVERAGE_MEM_PER_FILE * session->shred_files_remaining;
     RmOff read_buffer_mem = MAX(1024 * 1024, (gint64)cfg->total_mem - (gint64)mem_used);
 
-    if(cfg->checksum_type == RM_DIGEST_PARANOID) {
+    if(tag.digest_type == RM_DIGEST_PARANOID) {
         /* allocate any spare mem for paranoid hashing */
         tag.paranoid_mem_alloc = (gint64)cfg->total_mem - (gint64)mem_used;
         tag.paranoid_mem_alloc = MAX(0, tag.paranoid_mem_alloc);
         rm_log_debug_line("Paranoid Mem: %" LLU, tag.paranoid_mem_alloc);
         /* paranoid memory manager takes care of memory load; */
         read_buffer_mem = 0;
+    } else if(tag.digest_type == RM_DIGEST_BLAKE3) {
+        /* blake3 buffers up to a batch of input per file for its helper threads */
+        RmOff blake3_mem = read_buffer_mem / 4;
+        read_buffer_mem -= blake3_mem;
+        rm_digest_set_blake3_limits(cfg->threads, blake3_mem);
+        rm_log_debug_line("Blake3 pending Mem: %" LLU, blake3_mem);
     }
     rm_log_debug_line("Read buffer Mem: %" LLU, read_buffer_mem);
 
     /* Initialise hasher */
 
-    tag.hasher = rm_hasher_new(cfg->checksum_type,
+    tag.hasher = rm_hasher_new(tag.digest_type,
                                cfg->threads,
                                cfg->use_buffered_read,
                                cfg->read_buf_len,
                                read_buffer_mem,
                                (RmHasherCallback)rm_shred_hash_callback,
                                &tag);
+    rm_hasher_set_fd_cache(tag.hasher, tag.fd_cache);
+    rm_hasher_set_open_func(tag.hasher, (RmHasherOpenFunc)rm_shred_open_file);
 
     rm_fmt_set_state(session->formats, RM_PROGRESS_STATE_SHREDDER);
 
@@ -1804,6 +2387,10 @@ void rm_shred_run(RmSession *session) {
     g_thread_pool_free(tag.counter_pool, FALSE, TRUE);
     rm_log_debug(BLUE "Done\n" RESET);
 
+    /* files still in groups are done; close what is left */
+    rm_fd_cache_free(tag.fd_cache);
+    rm_fd_cache_free(tag.dir_cache);
+
     g_mutex_clear(&tag.hash_mem_mtx);
     rm_log_debug_line("Remaining %" LLU " bytes in %" LLU " files",
                       session->shred_bytes_remaining, session->shred_files_remaining);
@@ -35,6 +35,7 @@
 #include "file.h"
 #include "formats.h"
 #include "md-scheduler.h"
+#include "metrics.h"
 #include "preprocess.h"
 #include "utilities.h"
 #include "xattr.h"
@@ -45,19 +46,48 @@
 // TRAVERSE SESSION //
 //////////////////////
 
+/* A file whose lint type is found by the classify pool */
+typedef struct RmTravClassifyJob {
+    RmStat stat_buf;
+    char *path;
+    unsigned long path_index;
+    short depth;
+    bool is_prefd : 1;
+    bool is_symlink : 1;
+    bool is_hidden : 1;
+    bool is_on_subvol_fs : 1;
+} RmTravClassifyJob;
+
 typedef struct RmTravSession {
     RmUserList *userlist;
     RmSession *session;
+
+    /* Pool for the lint checks that need more than the stat(2) data
+     * (--perms, bad uid/gid, nonstripped); NULL if none is requested */
+    GThreadPool *classify_pool;
 } RmTravSession;
 
+static void rm_traverse_classify(RmTravClassifyJob *job, RmTravSession *trav_session);
+
 static RmTravSession *rm_traverse_session_new(RmSession *session) {
+    RmCfg *cfg = session->cfg;
     RmTravSession *self = g_new0(RmTravSession, 1);
     self->session = session;
     self->userlist = rm_userlist_new();
+
+    if(cfg->permissions || cfg->find_badids || cfg->find_nonstripped) {
+        self->classify_pool = rm_util_thread_pool_new(
+            (GFunc)rm_traverse_classify, self, MAX(1, cfg->threads));
+    }
     return self;
 }
 
 static void rm_traverse_session_free(RmTravSession *trav_session) {
+    if(trav_session->classify_pool) {
+        /* wait for the last files to be classified */
+        g_thread_pool_free(trav_session->classify_pool, FALSE, TRUE);
+    }
+
     rm_log_debug_line("Found %d files, ignored %d hidden files and %d hidden folders",
                       trav_session->session->total_files,
                       trav_session->session->ignored_files,
@@ -129,18 +159,13 @@ static char *rm_traverse_rel_realpath(char *link_path, char *pointing_to) {
     return clean_path;
 }
 
-static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *path,
-                             bool is_prefd, unsigned long path_index,
-                             RmLintType file_type, bool is_symlink, bool is_hidden,
-                             bool is_on_subvol_fs, short depth) {
+static void rm_traverse_add_file(RmTravSession *trav_session, RmStat *statp,
+                                 char *path, bool is_prefd, unsigned long path_index,
+                                 RmLintType file_type, bool is_symlink, bool is_hidden,
+                                 bool is_on_subvol_fs, short depth) {
     RmSession *session = trav_session->session;
     RmCfg *cfg = session->cfg;
 
-    if(rm_fmt_is_a_output(session->formats, path)) {
-        /* ignore files which are rmlint outputs */
-        return;
-    }
-
     /* Try to autodetect the type of the lint */
     if(file_type == RM_LINT_TYPE_UNKNOWN) {
         RmLintType gid_check;
@@ -149,7 +174,7 @@ static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *p
             file_type = RM_LINT_TYPE_EMPTY_FILE;
         } else if(cfg->permissions && access(path, cfg->permissions) == -1) {
             /* bad permissions; ignore file */
-            trav_session->session->ignored_files++;
+            g_atomic_int_inc(&trav_session->session->ignored_files);
             return;
         } else if(cfg->find_badids &&
                   (gid_check = rm_util_uid_gid_check(statp, trav_session->userlist))) {
@@ -165,7 +190,7 @@ static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *p
                     file_type = RM_LINT_TYPE_DUPE_CANDIDATE;
                 } else {
                     /* A file in an evil fs. Ignore. */
-                    trav_session->session->ignored_files++;
+                    g_atomic_int_inc(&trav_session->session->ignored_files);
                     return;
                 }
             } else {
@@ -210,16 +235,57 @@ static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *p
         rm_fmt_set_state(session->formats, RM_PROGRESS_STATE_TRAVERSE);
 
         if(file->lint_type == RM_LINT_TYPE_DUPE_CANDIDATE) {
+            /* cached checksums are read in bulk by the shredder once the
+             * size groups are known */
             if(cfg->clear_xattr_fields) {
                 rm_xattr_clear_hash(file, session);
             }
-            if(cfg->read_cksum_from_xattr) {
-                rm_xattr_read_hash(file, session);
-            }
         }
     }
 }
 
+static void rm_traverse_classify(RmTravClassifyJob *job, RmTravSession *trav_session) {
+    rm_traverse_add_file(trav_session, &job->stat_buf, job->path, job->is_prefd,
+                         job->path_index, RM_LINT_TYPE_UNKNOWN, job->is_symlink,
+                         job->is_hidden, job->is_on_subvol_fs, job->depth);
+    g_free(job->path);
+    g_slice_free(RmTravClassifyJob, job);
+}
+
+static void rm_traverse_file(RmTravSession *trav_session, RmStat *statp, char *path,
+                             bool is_prefd, unsigned long path_index,
+                             RmLintType file_type, bool is_symlink, bool is_hidden,
+                             bool is_on_subvol_fs, short depth) {
+    RmSession *session = trav_session->session;
+
+    if(rm_fmt_is_a_output(session->formats, path)) {
+        /* ignore files which are rmlint outputs */
+        return;
+    }
+
+    bool is_emptyfile = statp->st_size == 0 && session->cfg->find_emptyfiles;
+    if(file_type != RM_LINT_TYPE_UNKNOWN || is_emptyfile ||
+       trav_session->classify_pool == NULL) {
+        /* nothing expensive to find out; keep the walker going */
+        rm_traverse_add_file(trav_session, statp, path, is_prefd, path_index, file_type,
+                             is_symlink, is_hidden, is_on_subvol_fs, depth);
+        return;
+    }
+
+    /* access(2), the uid/gid lookup and parsing ELF headers would stall
+     * the walker, so hand the file to the classify pool */
+    RmTravClassifyJob *job = g_slice_new(RmTravClassifyJob);
+    job->stat_buf = *statp;
+    job->path = g_strdup(path);
+    job->path_index = path_index;
+    job->depth = depth;
+    job->is_prefd = is_prefd;
+    job->is_symlink = is_symlink;
+    job->is_hidden = is_hidden;
+    job->is_on_subvol_fs = is_on_subvol_fs;
+    rm_util_thread_pool_push(trav_session->classify_pool, job);
+}
+
 static bool rm_traverse_is_hidden(RmCfg *cfg, const char *basename, char *hierarchy,
                                   size_t hierarchy_len) {
     if(cfg->partial_hidden == false) {
@@ -231,6 +297,44 @@ static bool rm_traverse_is_hidden(RmCfg *cfg, const char *basename, char *hierar
     }
 }
 
+/* Add a file of the given size to the -D count of its directory; follows the
+ * rules treemerge used when it still walked the tree itself */
+static void rm_traverse_count_file(RmCfg *cfg, gint *dir_count, RmOff size) {
+    if(*dir_count != -1 && (!cfg->find_emptyfiles || size > 0)) {
+        *dir_count += 1;
+    }
+}
+
+/* Fold the count of a finished subdirectory into its parent */
+static void rm_traverse_count_subdir(gint *dir_count, gint subdir_count) {
+    if(*dir_count != -1) {
+        *dir_count = (subdir_count == -1) ? -1 : *dir_count + subdir_count;
+    }
+}
+
+/* Count an entry that traversal ignores (--no-hidden); directories are not
+ * descended, so the parent's count becomes unknown */
+static void rm_traverse_count_ignored(RmCfg *cfg, gint *dir_count, FTSENT *p) {
+    switch(p->fts_info) {
+    case FTS_SL:
+        if(cfg->follow_symlinks) {
+            break;
+        }
+    /* fallthrough */
+    case FTS_F:
+    case FTS_SLNONE:
+    case FTS_DEFAULT:
+        rm_traverse_count_file(cfg, dir_count, p->fts_statp->st_size);
+        break;
+    case FTS_DP:
+    case FTS_W:
+        break;
+    default:
+        *dir_count = -1;
+        break;
+    }
+}
+
 /* Macro for rm_traverse_directory() for easy file adding */
 #define _ADD_FILE(lint_type, is_symlink, stat_buf)                                      \
     rm_traverse_file(                                                                   \
@@ -278,6 +382,17 @@ static void rm_traverse_convert_small_stat_buf(struct stat *fts_statp, RmStat *b
 
 #endif
 
+/* fts_read() reads the directories and stat(2)s their entries */
+static FTSENT *rm_traverse_read(FTS *ftsp) {
+    gint64 start = rm_metrics_now();
+    FTSENT *p = fts_read(ftsp);
+    if(p != NULL) {
+        rm_metrics_count(RM_METRICS_TRAVERSE_ENTRIES, 1);
+        rm_metrics_time(RM_METRICS_TRAVERSE_STAT, start);
+    }
+    return p;
+}
+
 static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_session) {
     RmSession *session = trav_session->session;
     RmCfg *cfg = session->cfg;
@@ -314,10 +429,15 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
     bool clear_emptydir_flags = false;
     bool next_is_symlink = false;
 
+    /* dir_count[level] counts the files below the open directory that
+     * contains the entries of that level; recorded for -D at FTS_DP */
+    gint dir_count[PATH_MAX / 2 + 2];
+
     memset(is_emptydir, 0, sizeof(is_emptydir) - 1);
     memset(is_hidden, 0, sizeof(is_hidden) - 1);
+    memset(dir_count, 0, sizeof(dir_count));
 
-    while(!rm_session_was_aborted() && (p = fts_read(ftsp)) != NULL) {
+    while(!rm_session_was_aborted() && (p = rm_traverse_read(ftsp)) != NULL) {
         /* check for hidden file or folder */
         if(cfg->ignore_hidden && p->fts_level > 0 && p->fts_name[0] == '.') {
             /* ignoring hidden folders*/
@@ -328,6 +448,7 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
             } else {
                 g_atomic_int_inc(&trav_session->session->ignored_files);
             }
+            rm_traverse_count_ignored(cfg, &dir_count[p->fts_level], p);
 
             clear_emptydir_flags = true; /* flag current dir as not empty */
             is_emptydir[p->fts_level] = 0;
@@ -338,12 +459,14 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
                     /* continuing into folder would exceed maxdepth*/
                     fts_set(ftsp, p, FTS_SKIP);  /* do not recurse */
                     clear_emptydir_flags = true; /* flag current dir as not empty */
+                    dir_count[p->fts_level] = -1;
                     rm_log_debug_line("Not descending into %s because max depth reached",
                                       p->fts_path);
                 } else if(!(cfg->crossdev) && p->fts_dev != chp->fts_dev) {
                     /* continuing into folder would cross file systems*/
                     fts_set(ftsp, p, FTS_SKIP);  /* do not recurse */
                     clear_emptydir_flags = true; /*flag current dir as not empty*/
+                    dir_count[p->fts_level] = -1;
                     rm_log_info(
                         "Not descending into %s because it is a different filesystem\n",
                         p->fts_path);
@@ -353,17 +476,26 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
                     is_hidden[p->fts_level + 1] =
                         is_hidden[p->fts_level] | (p->fts_name[0] == '.');
                     have_open_emptydirs = true;
+                    dir_count[p->fts_level + 1] = 0;
+                    rm_metrics_count(RM_METRICS_TRAVERSE_DIRS, 1);
+
+                    /* remember what it is, so path doubles need no stat(2) */
+                    rm_file_tables_add_dir_id(
+                        session->tables, rm_trie_get_node(&cfg->file_trie, p->fts_path),
+                        p->fts_statp->st_dev, p->fts_statp->st_ino);
                 }
                 break;
             case FTS_DC: /* directory that causes cycles */
                 rm_log_warning_line(_("filesystem loop detected at %s (skipping)"),
                                     p->fts_path);
                 clear_emptydir_flags = true; /* current dir not empty */
+                dir_count[p->fts_level] = -1;
                 break;
             case FTS_DNR: /* unreadable directory */
                 rm_log_warning_line(_("cannot read directory %s: %s"), p->fts_path,
                                     g_strerror(p->fts_errno));
                 clear_emptydir_flags = true; /* current dir not empty */
+                dir_count[p->fts_level] = -1;
                 break;
             case FTS_DOT: /* dot or dot-dot */
                 break;
@@ -372,11 +504,18 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
                     ADD_FILE(RM_LINT_TYPE_EMPTY_DIR, false);
                 }
                 is_hidden[p->fts_level + 1] = 0;
+                if(cfg->merge_directories) {
+                    rm_trie_insert(&session->tables->dir_counts, p->fts_path,
+                                   GINT_TO_POINTER(dir_count[p->fts_level + 1]));
+                }
+                rm_traverse_count_subdir(&dir_count[p->fts_level],
+                                         dir_count[p->fts_level + 1]);
                 break;
             case FTS_ERR: /* error; errno is set */
                 rm_log_warning_line(_("error %d in fts_read for %s (skipping)"), errno,
                                     p->fts_path);
                 clear_emptydir_flags = true; /*current dir not empty*/
+                dir_count[p->fts_level] = -1;
                 break;
             case FTS_INIT: /* initialized only */
                 break;
@@ -385,6 +524,8 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
                     ADD_FILE(RM_LINT_TYPE_BADLINK, false);
                 }
                 clear_emptydir_flags = true; /*current dir not empty*/
+                rm_traverse_count_file(cfg, &dir_count[p->fts_level],
+                                       p->fts_statp->st_size);
                 break;
             case FTS_W:                      /* whiteout object */
                 clear_emptydir_flags = true; /*current dir not empty*/
@@ -404,6 +545,8 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
                                                            p->fts_level + 1),
                                      rmpath->treat_as_single_vol, p->fts_level);
                     rm_log_warning_line(_("Added big file %s"), p->fts_path);
+                    rm_traverse_count_file(cfg, &dir_count[p->fts_level],
+                                           stat_buf.st_size);
                 } else {
                     rm_log_warning_line(_("cannot stat file %s (skipping)"), p->fts_path);
                 }
@@ -411,6 +554,9 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
             case FTS_SL:                     /* symbolic link */
                 clear_emptydir_flags = true; /* current dir not empty */
                 if(!cfg->follow_symlinks) {
+                    rm_traverse_count_file(cfg, &dir_count[p->fts_level],
+                                           p->fts_statp->st_size);
+
                     bool is_badlink = false;
                     if(access(p->fts_path, R_OK) == -1 && errno == ENOENT) {
                         is_badlink = true;
@@ -436,6 +582,10 @@ static void rm_traverse_directory(RmTravBuffer *buffer, RmTravSession *trav_sess
             case FTS_DEFAULT: /* any file type not explicitly described by one of the
                                  above*/
                 clear_emptydir_flags = true; /* current dir not empty*/
+                if(!next_is_symlink) {
+                    rm_traverse_count_file(cfg, &dir_count[p->fts_level],
+                                           p->fts_statp->st_size);
+                }
                 ADD_FILE(RM_LINT_TYPE_UNKNOWN, next_is_symlink);
                 next_is_symlink = false;
                 break;
@@ -485,6 +635,9 @@ void rm_traverse_tree(RmSession *session) {
     RmCfg *cfg = session->cfg;
     RmTravSession *trav_session = rm_traverse_session_new(session);
 
+    /* treemerge takes the directory counts from the traversal */
+    session->tables->have_dir_counts = cfg->merge_directories;
+
     RmMDS *mds = session->mds;
     rm_mds_configure(mds,
                      (RmMDSFunc)rm_traverse_directory,
@@ -88,21 +88,27 @@
 
 typedef struct RmDirectory {
     char *dirname;       /* Path to this directory without trailing slash              */
+    RmNode *node;        /* Node of this directory in cfg->file_trie                   */
     GQueue known_files;  /* RmFiles in this directory                                  */
     GQueue children;     /* Children for directories with subdirectories               */
     gint64 prefd_files;  /* Files in this directory that are tagged as original        */
     gint64 dupe_count;   /* Count of RmFiles actually in this directory                */
     gint64 file_count;   /* Count of files actually in this directory (or -1 on error) */
+    RmOff file_size;     /* Summed size of the RmFiles below this directory            */
     gint64 mergeups;     /* number of times this directory was merged up
                             This is used to find the highest ranking directory. */
     bool finished : 1;   /* Was this dir or one of his parents already printed?        */
     bool was_merged : 1; /* true if this directory was merged up already (only once)   */
     bool was_inserted : 1; /* true if this directory was added to results (only once)  */
     bool was_dupe_extracted : 1;
+    bool was_selected : 1; /* true if this directory is reported in its result group  */
     unsigned short depth; /* path depth (i.e. count of / in path, no trailing /)       */
-    GHashTable *hash_set; /* Set of hashes, used for true equality check               */
     RmDigest *digest;     /* Common XOR digest of all RmFiles in this directory.
                              note that this is only used as fast hash comparison.      */
+    guint64 fingerprint[2]; /* Sum of the file keys below this directory (see
+                               rm_tm_file_key); equal files do not cancel out.     */
+    GArray *sorted_keys;  /* RmTmFileKeys below this directory, sorted; built by the
+                             first rm_directory_equal() that needs them (or NULL)  */
 
     struct {
         gdouble dir_mtime; /* Directory Metadata: Modification Time */
@@ -118,13 +124,13 @@ const char *rm_directory_get_dirname(RmDirectory *self) {
 struct RmTreeMerger {
     RmSession *session;              /* Session state variables / Settings                  */
     RmTrie dir_tree;                 /* Path-Trie with all RmFiles as value                 */
+    GHashTable *node_dirs;           /* {RmNode => RmDirectory} for entries of dir_tree     */
     RmTrie count_tree;               /* Path-Trie with all file's count as value            */
     GHashTable *result_table;        /* {hash => [RmDirectory]} mapping                     */
     GHashTable *file_groups;         /* Group files by hash                                 */
     GHashTable *file_checks;         /* Set of files that were handled already.             */
     GHashTable *known_hashs;         /* Set of known hashes, only used for cleanup.         */
     GHashTable *free_map;            /* Map of file pointer to RmFile (used to cleanup) */
-    GQueue valid_dirs;               /* Directories consisting of RmFiles only              */
     RmTreeMergeOutputFunc callback;  /* Callback for finished directories or leftover files */
     gpointer callback_data;
 };
@@ -290,6 +296,43 @@ static bool rm_tm_count_files(RmTrie *count_tree, const RmCfg *const cfg) {
         return false;
 }
 
+static int rm_tm_copy_count(_UNUSED RmTrie *self, RmNode *node, _UNUSED int level,
+                            void *user_data) {
+    char path[PATH_MAX];
+    memset(path, 0, sizeof(path));
+    rm_trie_build_path_unlocked(node, path, sizeof(path));
+
+    rm_trie_insert(user_data, path, node->data);
+    return 0;
+}
+
+static void rm_tm_take_counts(RmTrie *count_tree, RmFileTables *tables,
+                              const RmCfg *const cfg) {
+    /* The traversal already counted each directory's files while it was
+     * walking them; only copy those over instead of walking again */
+    rm_trie_iter(&tables->dir_counts, NULL, true, false, rm_tm_copy_count, count_tree);
+    rm_trie_destroy(&tables->dir_counts);
+    rm_trie_init(&tables->dir_counts);
+
+    /* Flag everything above the given paths as a no-go (see rm_tm_count_files) */
+    for(const GSList *paths = cfg->paths; paths; paths = paths->next) {
+        char *dirname = g_path_get_dirname(((RmPath *)paths->data)->path);
+
+        while(true) {
+            rm_trie_insert(count_tree, dirname, GINT_TO_POINTER(-1));
+            if(strcmp(dirname, "/") == 0 || strcmp(dirname, ".") == 0) {
+                break;
+            }
+
+            char *parent = g_path_get_dirname(dirname);
+            g_free(dirname);
+            dirname = parent;
+        }
+
+        g_free(dirname);
+    }
+}
+
 ///////////////////////////////
 // DIRECTORY STRUCT HANDLING //
 ///////////////////////////////
@@ -331,44 +374,31 @@ static RmDirectory *rm_directory_new(char *dirname) {
     g_queue_init(&self->known_files);
     g_queue_init(&self->children);
 
-    self->hash_set =
-        g_hash_table_new((GHashFunc)rm_digest_hash, (GEqualFunc)rm_digest_equal);
-
     return self;
 }
 
 static void rm_directory_free(RmDirectory *self) {
+    if(self->sorted_keys) {
+        g_array_free(self->sorted_keys, TRUE);
+    }
     rm_digest_free(self->digest);
-    g_hash_table_unref(self->hash_set);
     g_queue_clear(&self->known_files);
     g_queue_clear(&self->children);
     g_free(self->dirname);
     g_free(self);
 }
 
-static RmOff rm_tm_calc_file_size(const RmDirectory *directory) {
-    RmOff acc = 0;
-
-    for(GList *iter = directory->known_files.head; iter; iter = iter->next) {
-        RmFile *file = iter->data;
-        acc += file->actual_file_size;
-    }
-
-    /* Recursively propagate to children */
-    for(GList *iter = directory->children.head; iter; iter = iter->next) {
-        acc += rm_tm_calc_file_size((RmDirectory *)iter->data);
-    }
-
-    return acc;
-}
-
 static void rm_directory_to_file(RmTreeMerger *merger, const RmDirectory *self,
                                  RmFile *file) {
     memset(file, 0, sizeof(RmFile));
 
-    /* Need to set session first, since set_path expects that */
     file->session = merger->session;
-    rm_file_set_path(file, self->dirname);
+    if(self->node->parent != NULL) {
+        file->folder = self->node;
+    } else {
+        /* The trie root has no name; set_path expects the session set */
+        rm_file_set_path(file, self->dirname);
+    }
 
     file->lint_type = RM_LINT_TYPE_DUPE_DIR_CANDIDATE;
     file->digest = self->digest;
@@ -379,8 +409,7 @@ static void rm_directory_to_file(RmTreeMerger *merger, const RmDirectory *self,
     file->dev = self->metadata.dir_dev;
     file->depth = rm_util_path_depth(self->dirname);
 
-    /* Recursively calculate the file size */
-    file->file_size = rm_tm_calc_file_size(self);
+    file->file_size = self->file_size;
     file->actual_file_size = file->file_size;
     file->is_prefd = (self->prefd_files >= self->dupe_count);
     file->parent_dir = (RmDirectory *)self;
@@ -394,31 +423,117 @@ static RmFile *rm_directory_as_new_file(RmTreeMerger *merger, const RmDirectory
     return file;
 }
 
+////////////////////////////
+// DIRECTORY FINGERPRINTS //
+////////////////////////////
+
+/* A file's digest, reduced to 128 bits so that it can be summed up */
+typedef struct RmTmFileKey {
+    guint64 key[2];
+    RmDigest *digest;
+} RmTmFileKey;
+
+static guint64 rm_tm_mix64(guint64 x) {
+    /* splitmix64 finalizer */
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static void rm_tm_file_key(const guint8 *digest_bytes, RmOff digest_len, guint64 key[2]) {
+    guint64 a = digest_len, b = ~(guint64)digest_len;
+
+    for(RmOff i = 0; i < digest_len; i += sizeof(guint64)) {
+        guint64 chunk = 0;
+        memcpy(&chunk, digest_bytes + i, MIN(sizeof(guint64), digest_len - i));
+        a = rm_tm_mix64(a ^ chunk);
+        b = rm_tm_mix64(b + chunk);
+    }
+
+    key[0] = a;
+    key[1] = b;
+}
+
+static void rm_directory_collect_keys(RmDirectory *self, GArray *keys) {
+    for(GList *iter = self->known_files.head; iter; iter = iter->next) {
+        RmFile *file = iter->data;
+        RmTmFileKey entry;
+
+        guint8 *digest_bytes = rm_digest_steal(file->digest);
+        rm_tm_file_key(digest_bytes, file->digest->bytes, entry.key);
+        g_slice_free1(file->digest->bytes, digest_bytes);
+
+        entry.digest = file->digest;
+        g_array_append_val(keys, entry);
+    }
+
+    for(GList *iter = self->children.head; iter; iter = iter->next) {
+        RmDirectory *child = iter->data;
+        if(child->sorted_keys) {
+            /* already gathered for an earlier comparison */
+            g_array_append_vals(keys, child->sorted_keys->data, child->sorted_keys->len);
+        } else {
+            rm_directory_collect_keys(child, keys);
+        }
+    }
+}
+
+static gint rm_tm_file_key_cmp(const RmTmFileKey *a, const RmTmFileKey *b) {
+    for(int i = 0; i < 2; i++) {
+        if(a->key[i] != b->key[i]) {
+            return (a->key[i] < b->key[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static GArray *rm_directory_sorted_keys(RmDirectory *self) {
+    if(self->sorted_keys == NULL) {
+        GArray *keys =
+            g_array_sized_new(FALSE, FALSE, sizeof(RmTmFileKey), self->dupe_count);
+        rm_directory_collect_keys(self, keys);
+        g_array_sort(keys, (GCompareFunc)rm_tm_file_key_cmp);
+        self->sorted_keys = keys;
+    }
+    return self->sorted_keys;
+}
+
+/* forget the sorted keys of self after its contents changed */
+static void rm_directory_drop_keys(RmDirectory *self) {
+    if(self->sorted_keys) {
+        g_array_free(self->sorted_keys, TRUE);
+        self->sorted_keys = NULL;
+    }
+}
+
 static bool rm_directory_equal(RmDirectory *d1, RmDirectory *d2) {
     if(d1->dupe_count != d2->dupe_count) {
         return false;
     }
 
-    if(rm_digest_equal(d1->digest, d2->digest) == false) {
+    if(d1->fingerprint[0] != d2->fingerprint[0] ||
+       d1->fingerprint[1] != d2->fingerprint[1]) {
         return false;
     }
 
-    if(g_hash_table_size(d1->hash_set) != g_hash_table_size(d2->hash_set)) {
+    if(rm_digest_equal(d1->digest, d2->digest) == false) {
         return false;
     }
 
-    /* Compare the exact contents of the hash sets */
-    gpointer digest_key;
-    GHashTableIter iter;
-
-    g_hash_table_iter_init(&iter, d1->hash_set);
-    while(g_hash_table_iter_next(&iter, &digest_key, NULL)) {
-        if(g_hash_table_contains(d2->hash_set, digest_key) == false) {
-            return false;
-        }
+    /* The fingerprints match; compare the exact multisets of digests below
+     * both directories. They are only gathered once a directory gets here,
+     * so most directories never keep copies of their children's digests. */
+    GArray *keys1 = rm_directory_sorted_keys(d1);
+    GArray *keys2 = rm_directory_sorted_keys(d2);
+
+    bool result = keys1->len == keys2->len;
+    for(guint i = 0; result && i < keys1->len; i++) {
+        RmTmFileKey *k1 = &g_array_index(keys1, RmTmFileKey, i);
+        RmTmFileKey *k2 = &g_array_index(keys2, RmTmFileKey, i);
+        result = rm_tm_file_key_cmp(k1, k2) == 0 && rm_digest_equal(k1->digest, k2->digest);
     }
 
-    return true;
+    return result;
 }
 
 static guint rm_directory_hash(const RmDirectory *d) {
@@ -427,7 +542,7 @@ static guint rm_directory_hash(const RmDirectory *d) {
      * To prevent this case, rm_directory_equal really compares
      * all the file's hashes with each other.
      */
-    return rm_digest_hash(d->digest) ^ d->dupe_count;
+    return rm_digest_hash(d->digest) ^ (guint)d->fingerprint[0] ^ d->dupe_count;
 }
 
 static void rm_directory_add(RmTreeMerger *self, RmDirectory *directory, RmFile *file) {
@@ -441,6 +556,11 @@ static void rm_directory_add(RmTreeMerger *self, RmDirectory *directory, RmFile
     file_digest = rm_digest_steal(file->digest);
     digest_bytes = file->digest->bytes;
 
+    guint64 key[2];
+    rm_tm_file_key(file_digest, digest_bytes, key);
+    directory->fingerprint[0] += key[0];
+    directory->fingerprint[1] += key[1];
+
     /* Update the directorie's hash with the file's hash
        Since we cannot be sure in which order the files come in
        we have to add the hash cummulatively.
@@ -463,11 +583,10 @@ static void rm_directory_add(RmTreeMerger *self, RmDirectory *directory, RmFile
 
     g_slice_free1(digest_bytes, file_digest);
 
-    /* The file value is not really used, but we need some non-null value */
-    g_hash_table_add(directory->hash_set, file->digest);
-
+    rm_directory_drop_keys(directory);
     directory->dupe_count += 1;
     directory->prefd_files += file->is_prefd;
+    directory->file_size += file->actual_file_size;
 }
 
 static void rm_directory_add_subdir(RmTreeMerger *self, RmDirectory *parent, RmDirectory *subdir) {
@@ -475,8 +594,10 @@ static void rm_directory_add_subdir(RmTreeMerger *self, RmDirectory *parent, RmD
         return;
     }
 
+    rm_directory_drop_keys(parent);
     parent->mergeups = subdir->mergeups + parent->mergeups + 1;
     parent->dupe_count += subdir->dupe_count;
+    parent->file_size += subdir->file_size;
     g_queue_push_head(&parent->children, subdir);
     parent->prefd_files += subdir->prefd_files;
 
@@ -486,11 +607,10 @@ static void rm_directory_add_subdir(RmTreeMerger *self, RmDirectory *parent, RmD
                subdir->dupe_count, subdir->file_count);
 #endif
 
-    /* Take over the child's digests */
-    for(GList *iter = subdir->known_files.head; iter; iter = iter->next) {
-        RmFile *file = iter->data;
-        g_hash_table_add(parent->hash_set, file->digest);
-    }
+    /* Take over the child's fingerprint; its files are reachable through
+     * parent->children for the exact check in rm_directory_equal() */
+    parent->fingerprint[0] += subdir->fingerprint[0];
+    parent->fingerprint[1] += subdir->fingerprint[1];
 
     /* Inherit the child's checksum */
     unsigned char *subdir_cksum = rm_digest_steal(subdir->digest);
@@ -525,7 +645,7 @@ RmTreeMerger *rm_tm_new(RmSession *session) {
     self->callback = NULL;
     self->callback_data = NULL;
     self->free_map = g_hash_table_new(NULL, NULL);
-    g_queue_init(&self->valid_dirs);
+    self->node_dirs = g_hash_table_new(NULL, NULL);
 
     self->result_table = g_hash_table_new_full((GHashFunc)rm_directory_hash,
                                                (GEqualFunc)rm_directory_equal, NULL,
@@ -540,7 +660,10 @@ RmTreeMerger *rm_tm_new(RmSession *session) {
     rm_trie_init(&self->dir_tree);
     rm_trie_init(&self->count_tree);
 
-    if(!rm_tm_count_files(&self->count_tree, session->cfg)) {
+    if(session->tables->have_dir_counts) {
+        rm_tm_take_counts(&self->count_tree, session->tables, session->cfg);
+    } else if(!rm_tm_count_files(&self->count_tree, session->cfg)) {
+        /* --replay has no traversal, so it still needs to count on its own */
         return 0;
     }
 
@@ -571,34 +694,68 @@ static void rm_tm_insert_dir(RmTreeMerger *self, RmDirectory *directory) {
     directory->was_inserted = true;
 }
 
-void rm_tm_feed(RmTreeMerger *self, RmFile *file) {
-    g_assert(self);
-    g_assert(file);
+static RmDirectory *rm_tm_get_directory(RmTreeMerger *self, RmNode *node,
+                                        bool *created) {
+    /* See if we know that directory already */
+    RmDirectory *directory = g_hash_table_lookup(self->node_dirs, node);
+    *created = (directory == NULL);
+    if(directory != NULL) {
+        return directory;
+    }
 
-    RM_DEFINE_PATH(file);
-    char *dirname = g_path_get_dirname(file_path);
+    /* Only directories that were not seen yet need their path */
+    char dirname[PATH_MAX];
+    if(rm_trie_build_path(&self->session->cfg->file_trie, node, dirname,
+                          sizeof(dirname)) == NULL) {
+        strcpy(dirname, "/");
+    }
 
-    /* See if we know that directory already */
-    RmDirectory *directory = rm_trie_search(&self->dir_tree, dirname);
-
-    if(directory == NULL) {
-        /* Get the actual file count */
-        int file_count = GPOINTER_TO_INT(rm_trie_search(&self->count_tree, dirname));
-        if(file_count == 0) {
-            rm_log_error(
-                RED "Empty directory or weird RmFile encountered; rejecting.\n" RESET);
-            file_count = -1;
-        }
+    directory = rm_directory_new(g_strdup(dirname));
+    directory->node = node;
 
-        directory = rm_directory_new(dirname);
-        directory->file_count = file_count;
+    /* Get the actual file count */
+    directory->file_count = GPOINTER_TO_INT(rm_trie_search(&self->count_tree, dirname));
 
-        /* Make the new directory known */
-        rm_trie_insert(&self->dir_tree, dirname, directory);
+    /* Make the new directory known */
+    rm_trie_insert(&self->dir_tree, dirname, directory);
+    g_hash_table_insert(self->node_dirs, node, directory);
+    return directory;
+}
 
-        g_queue_push_head(&self->valid_dirs, directory);
-    } else {
-        g_free(dirname);
+static void rm_tm_cluster_up(RmTreeMerger *self, RmDirectory *directory) {
+    /* Called once the directory is complete; merge it into its parent
+     * and continue upwards as long as that completes parents too */
+    RmNode *parent_node = directory->node->parent;
+    if(parent_node == NULL) {
+        /* Nothing is above root */
+        return;
+    }
+
+    bool is_root = parent_node->parent == NULL;
+
+    bool created = false;
+    RmDirectory *parent = rm_tm_get_directory(self, parent_node, &created);
+
+    rm_directory_add_subdir(self, parent, directory);
+
+    if(parent->dupe_count == parent->file_count && parent->file_count > 0) {
+        rm_tm_insert_dir(self, parent);
+        if(!is_root) {
+            rm_tm_cluster_up(self, parent);
+        }
+    }
+}
+
+void rm_tm_feed(RmTreeMerger *self, RmFile *file) {
+    g_assert(self);
+    g_assert(file);
+    g_assert(file->folder);
+
+    bool created = false;
+    RmDirectory *directory = rm_tm_get_directory(self, file->folder->parent, &created);
+    if(created && directory->file_count == 0) {
+        rm_log_error(RED "Empty directory or weird RmFile encountered; rejecting.\n" RESET);
+        directory->file_count = -1;
     }
 
     g_hash_table_insert(self->free_map, file, file);
@@ -610,9 +767,11 @@ void rm_tm_feed(RmTreeMerger *self, RmFile *file) {
     /* Remember the digest (if only to free it later...) */
     g_hash_table_replace(self->known_hashs, file->digest, NULL);
 
-    /* Check if the directory reached the number of actual files in it */
+    /* Check if the directory reached the number of actual files in it;
+     * if so, merge it up right away instead of waiting for rm_tm_finish() */
     if(directory->dupe_count == directory->file_count && directory->file_count > 0) {
         rm_tm_insert_dir(self, directory);
+        rm_tm_cluster_up(self, directory);
     }
 }
 
@@ -682,11 +841,6 @@ static int rm_tm_sort_paths(const RmDirectory *da, const RmDirectory *db,
     return da->depth - db->depth;
 }
 
-static int rm_tm_sort_paths_reverse(const RmDirectory *da, const RmDirectory *db,
-                                    _UNUSED RmTreeMerger *self) {
-    return -rm_tm_sort_paths(da, db, self);
-}
-
 static int rm_tm_sort_orig_criteria(const RmDirectory *da, const RmDirectory *db,
                                     RmTreeMerger *self) {
     RmCfg *cfg = self->session->cfg;
@@ -831,6 +985,49 @@ static void rm_tm_output_group(RmTreeMerger *self, GQueue *group) {
     }
 }
 
+/* A group of equal directories from result_table, prepared for extraction */
+typedef struct RmTmResultGroup {
+    GQueue *dir_list; /* the group itself, sorted by path depth          */
+    GQueue by_orig;   /* same directories, sorted by the original criteria */
+    guint n_found;    /* length of dir_list before hidden ones were removed */
+} RmTmResultGroup;
+
+static void rm_tm_prepare_group(RmTmResultGroup *group, RmTreeMerger *self) {
+    /* Only reads the directories, so groups can be prepared concurrently */
+    GQueue *dir_list = group->dir_list;
+
+    /* Sort the RmDirectory list by their path depth, lowest depth first */
+    g_queue_sort(dir_list, (GCompareDataFunc)rm_tm_sort_paths, self);
+
+    /* If no --hidden is given, do not display top-level directories
+     * that are hidden. If needed, filter them beforehand. */
+    if(self->session->cfg->partial_hidden) {
+        rm_tm_filter_hidden_directories(dir_list);
+    }
+
+    /* Which of them are reported depends on the groups before this one;
+     * rank all of them now and pick the selected ones in rm_tm_extract() */
+    for(GList *iter = dir_list->head; iter; iter = iter->next) {
+        g_queue_push_head(&group->by_orig, iter->data);
+    }
+    g_queue_sort(&group->by_orig, (GCompareDataFunc)rm_tm_sort_orig_criteria, self);
+}
+
+static void rm_tm_prepare_groups(RmTreeMerger *self, RmTmResultGroup *groups,
+                                 guint n_groups) {
+    GThreadPool *pool = rm_util_thread_pool_new((GFunc)rm_tm_prepare_group, self,
+                                                MAX(1, self->session->cfg->threads));
+
+    for(guint i = 0; i < n_groups; i++) {
+        /* Needs at least two directories to be duplicate... */
+        if(groups[i].n_found >= 2) {
+            rm_util_thread_pool_push(pool, &groups[i]);
+        }
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
 static void rm_tm_extract(RmTreeMerger *self) {
     /* Iterate over all directories per hash (which are same therefore) */
     RmCfg *cfg = self->session->cfg;
@@ -838,9 +1035,20 @@ static void rm_tm_extract(RmTreeMerger *self) {
     result_table_values =
         g_list_sort(result_table_values, (GCompareFunc)rm_tm_cmp_directory_groups);
 
+    guint n_groups = g_list_length(result_table_values);
+    RmTmResultGroup *groups = g_new0(RmTmResultGroup, n_groups);
+
+    guint group_idx = 0;
     for(GList *iter = result_table_values; iter; iter = iter->next) {
-        /* Needs at least two directories to be duplicate... */
-        GQueue *dir_list = iter->data;
+        groups[group_idx].dir_list = iter->data;
+        groups[group_idx].n_found = groups[group_idx].dir_list->length;
+        group_idx++;
+    }
+
+    rm_tm_prepare_groups(self, groups, n_groups);
+
+    for(group_idx = 0; group_idx < n_groups; group_idx++) {
+        GQueue *dir_list = groups[group_idx].dir_list;
 
 #ifdef _RM_TREEMERGE_DEBUG
         for(GList *i = dir_list->head; i; i = i->next) {
@@ -852,7 +1060,7 @@ static void rm_tm_extract(RmTreeMerger *self) {
         }
         g_printerr("---\n");
 #endif
-        if(dir_list->length < 2) {
+        if(groups[group_idx].n_found < 2) {
             continue;
         }
 
@@ -863,15 +1071,6 @@ static void rm_tm_extract(RmTreeMerger *self) {
         /* List of result directories */
         GQueue result_dirs = G_QUEUE_INIT;
 
-        /* Sort the RmDirectory list by their path depth, lowest depth first */
-        g_queue_sort(dir_list, (GCompareDataFunc)rm_tm_sort_paths, self);
-
-        /* If no --hidden is given, do not display top-level directories
-         * that are hidden. If needed, filter them beforehand. */
-        if(cfg->partial_hidden) {
-            rm_tm_filter_hidden_directories(dir_list);
-        }
-
         /* Output the directories and mark their children to prevent
          * duplicate directory reports in lower levels.
          */
@@ -879,15 +1078,21 @@ static void rm_tm_extract(RmTreeMerger *self) {
             RmDirectory *directory = iter->data;
             if(directory->finished == false) {
                 rm_tm_mark_finished(self, directory);
-                g_queue_push_head(&result_dirs, directory);
+                directory->was_selected = true;
             }
         }
 
         /* Make sure the original directory lands as first
-         * in the result_dirs queue. Also convert it from RmDirectory
-         * to a fake RmFile, so the output module can handle it.
+         * in the result_dirs queue (by_orig is already sorted that way).
+         * Also convert it from RmDirectory to a fake RmFile, so the output
+         * module can handle it.
          */
-        g_queue_sort(&result_dirs, (GCompareDataFunc)rm_tm_sort_orig_criteria, self);
+        for(GList *iter = groups[group_idx].by_orig.head; iter; iter = iter->next) {
+            RmDirectory *directory = iter->data;
+            if(directory->was_selected) {
+                g_queue_push_tail(&result_dirs, directory);
+            }
+        }
 
         GQueue file_adaptor_group = G_QUEUE_INIT;
 
@@ -925,6 +1130,11 @@ static void rm_tm_extract(RmTreeMerger *self) {
         g_queue_clear(&result_dirs);
     }
 
+    for(group_idx = 0; group_idx < n_groups; group_idx++) {
+        g_queue_clear(&groups[group_idx].by_orig);
+    }
+
+    g_free(groups);
     g_list_free(result_table_values);
 
     /* Iterate over all non-finished dirs in the tree,
@@ -974,51 +1184,11 @@ static void rm_tm_extract(RmTreeMerger *self) {
     }
 }
 
-static void rm_tm_cluster_up(RmTreeMerger *self, RmDirectory *directory) {
-    char *parent_dir = g_path_get_dirname(directory->dirname);
-    bool is_root = strcmp(parent_dir, "/") == 0;
-
-    /* Lookup if we already found this parent before (if yes, merge with it) */
-    RmDirectory *parent = rm_trie_search(&self->dir_tree, parent_dir);
-
-    if(parent == NULL) {
-        /* none yet, basically copy child */
-        parent = rm_directory_new(parent_dir);
-        rm_trie_insert(&self->dir_tree, parent_dir, parent);
-
-        /* Get the actual file count */
-        parent->file_count =
-            GPOINTER_TO_UINT(rm_trie_search(&self->count_tree, parent_dir));
-
-    } else {
-        g_free(parent_dir);
-    }
-
-    rm_directory_add_subdir(self, parent, directory);
-
-    if(parent->dupe_count == parent->file_count && parent->file_count > 0) {
-        rm_tm_insert_dir(self, parent);
-        if(!is_root) {
-            rm_tm_cluster_up(self, parent);
-        }
-    }
-}
-
 void rm_tm_finish(RmTreeMerger *self) {
     g_assert(self);
     g_assert(self->callback);
 
-    /* Iterate over all valid directories and try to level them all layers up.
-     */
-    g_queue_sort(&self->valid_dirs, (GCompareDataFunc)rm_tm_sort_paths_reverse, self);
-    for(GList *iter = self->valid_dirs.head; iter; iter = iter->next) {
-        RmDirectory *directory = iter->data;
-        rm_tm_cluster_up(self, directory);
-#ifdef _RM_TREEMERGE_DEBUG
-        g_printerr("###\n");
-#endif
-    }
-
+    /* Directories were already merged up while files were fed */
     if(!rm_session_was_aborted()) {
         /* Recursively call self to march on */
         rm_tm_extract(self);
@@ -1030,7 +1200,7 @@ void rm_tm_destroy(RmTreeMerger *self) {
     g_hash_table_unref(self->file_groups);
     g_hash_table_unref(self->known_hashs);
 
-    g_queue_clear(&self->valid_dirs);
+    g_hash_table_unref(self->node_dirs);
 
     /* Kill all RmDirectories stored in the tree */
     rm_trie_iter(&self->dir_tree, NULL, true, false,
@@ -24,6 +24,7 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -388,8 +389,25 @@ void rm_util_size_to_human_readable(RmOff num, char *in, gsize len) {
 //   UID/GID VALIDITY CHECKING     //
 /////////////////////////////////////
 
-static int rm_userlist_cmp_ids(gconstpointer a, gconstpointer b, _UNUSED gpointer ud) {
-    return GPOINTER_TO_UINT(a) - GPOINTER_TO_UINT(b);
+static gint rm_userlist_cmp_ids(const guint32 *a, const guint32 *b) {
+    return (*a > *b) - (*a < *b);
+}
+
+static void rm_userlist_add_id(RmUserIds *ids, guint32 id) {
+    if(id < RM_USERLIST_MAP_IDS) {
+        ids->map[id / 8] |= 1 << (id % 8);
+    } else {
+        g_array_append_val(ids->large, id);
+    }
+}
+
+static bool rm_userlist_has_id(const RmUserIds *ids, guint32 id) {
+    if(id < RM_USERLIST_MAP_IDS) {
+        return ids->map[id / 8] & (1 << (id % 8));
+    }
+
+    return bsearch(&id, ids->large->data, ids->large->len, sizeof(guint32),
+                   (GCompareFunc)rm_userlist_cmp_ids) != NULL;
 }
 
 RmUserList *rm_userlist_new(void) {
@@ -397,43 +415,32 @@ RmUserList *rm_userlist_new(void) {
     struct group *grp = NULL;
 
     RmUserList *self = g_malloc0(sizeof(RmUserList));
-    self->users = g_sequence_new(NULL);
-    self->groups = g_sequence_new(NULL);
+    self->users.large = g_array_new(FALSE, FALSE, sizeof(guint32));
+    self->groups.large = g_array_new(FALSE, FALSE, sizeof(guint32));
 
     setpwent();
     while((node = getpwent()) != NULL) {
-        g_sequence_insert_sorted(self->users, GUINT_TO_POINTER(node->pw_uid),
-                                 rm_userlist_cmp_ids, NULL);
-        g_sequence_insert_sorted(self->groups, GUINT_TO_POINTER(node->pw_gid),
-                                 rm_userlist_cmp_ids, NULL);
+        rm_userlist_add_id(&self->users, node->pw_uid);
+        rm_userlist_add_id(&self->groups, node->pw_gid);
     }
     endpwent();
 
     /* add all groups, not just those that are user primary gid's */
     while((grp = getgrent()) != NULL) {
-        g_sequence_insert_sorted(self->groups, GUINT_TO_POINTER(grp->gr_gid),
-                                 rm_userlist_cmp_ids, NULL);
+        rm_userlist_add_id(&self->groups, grp->gr_gid);
     }
-
     endgrent();
-    g_mutex_init(&self->lock);
+
+    g_array_sort(self->users.large, (GCompareFunc)rm_userlist_cmp_ids);
+    g_array_sort(self->groups.large, (GCompareFunc)rm_userlist_cmp_ids);
     return self;
 }
 
 bool rm_userlist_contains(RmUserList *self, unsigned long uid, unsigned gid,
                           bool *valid_uid, bool *valid_gid) {
     g_assert(self);
-    bool gid_found = FALSE;
-    bool uid_found = FALSE;
-
-    g_mutex_lock(&self->lock);
-    {
-        gid_found = g_sequence_lookup(self->groups, GUINT_TO_POINTER(gid),
-                                      rm_userlist_cmp_ids, NULL);
-        uid_found = g_sequence_lookup(self->users, GUINT_TO_POINTER(uid),
-                                      rm_userlist_cmp_ids, NULL);
-    }
-    g_mutex_unlock(&self->lock);
+    bool gid_found = rm_userlist_has_id(&self->groups, gid);
+    bool uid_found = rm_userlist_has_id(&self->users, uid);
 
     if(valid_uid != NULL) {
         *valid_uid = uid_found;
@@ -449,9 +456,8 @@ bool rm_userlist_contains(RmUserList *self, unsigned long uid, unsigned gid,
 void rm_userlist_destroy(RmUserList *self) {
     g_assert(self);
 
-    g_sequence_free(self->users);
-    g_sequence_free(self->groups);
-    g_mutex_clear(&self->lock);
+    g_array_free(self->users.large, TRUE);
+    g_array_free(self->groups.large, TRUE);
     g_free(self);
 }
 
@@ -539,6 +545,7 @@ typedef struct RmMountEntry {
     char *fsname; /* name of mounted file system */
     char *dir;    /* file system path prefix     */
     char *type;   /* Type of fs: ufs, nfs, etc   */
+    char *options; /* mount options or NULL     */
 } RmMountEntry;
 
 typedef struct RmMountEntries {
@@ -555,6 +562,7 @@ static void rm_mount_list_close(RmMountEntries *self) {
         g_free(entry->fsname);
         g_free(entry->dir);
         g_free(entry->type);
+        g_free(entry->options);
         g_slice_free(RmMountEntry, entry);
     }
 
@@ -596,6 +604,68 @@ static bool fs_supports_reflinks(char *fstype, char *mountpoint) {
     return false;
 }
 
+typedef struct RmOverlayInfo {
+    char *dir;
+    /* upperdir (if any) followed by the lowerdirs, topmost first */
+    GPtrArray *layers;
+} RmOverlayInfo;
+
+/* Append the layers of a lowerdir option; they are separated by ':' and
+ * an escaped '\:' is part of the path */
+static void rm_overlay_info_add_lowers(RmOverlayInfo *self, const char *value) {
+    GString *layer = g_string_new(NULL);
+    for(const char *c = value;; ++c) {
+        if(*c == '\\' && c[1] != 0) {
+            g_string_append_c(layer, *c);
+            g_string_append_c(layer, *++c);
+        } else if(*c == ':' || *c == 0) {
+            if(layer->len > 0) {
+                g_ptr_array_add(self->layers, g_strcompress(layer->str));
+            }
+            g_string_truncate(layer, 0);
+            if(*c == 0) {
+                break;
+            }
+        } else {
+            g_string_append_c(layer, *c);
+        }
+    }
+    g_string_free(layer, TRUE);
+}
+
+static RmOverlayInfo *rm_overlay_info_new(const char *dir, const char *options) {
+    RmOverlayInfo *self = g_new0(RmOverlayInfo, 1);
+    self->dir = g_strdup(dir);
+    self->layers = g_ptr_array_new_with_free_func(g_free);
+
+    char **opts = g_strsplit(options, ",", -1);
+    for(char **opt = opts; *opt; ++opt) {
+        if(g_str_has_prefix(*opt, "upperdir=")) {
+            g_ptr_array_add(self->layers, g_strcompress(*opt + strlen("upperdir=")));
+        }
+    }
+    for(char **opt = opts; *opt; ++opt) {
+        if(g_str_has_prefix(*opt, "lowerdir=")) {
+            rm_overlay_info_add_lowers(self, *opt + strlen("lowerdir="));
+        } else if(g_str_has_prefix(*opt, "lowerdir+=")) {
+            g_ptr_array_add(self->layers, g_strcompress(*opt + strlen("lowerdir+=")));
+        }
+    }
+    g_strfreev(opts);
+
+    return self;
+}
+
+static void rm_overlay_info_free(RmOverlayInfo *self) {
+    g_free(self->dir);
+    g_ptr_array_free(self->layers, TRUE);
+    g_free(self);
+}
+
+static gint rm_overlay_info_cmp_depth(const RmOverlayInfo *a, const RmOverlayInfo *b) {
+    return (gint)strlen(b->dir) - (gint)strlen(a->dir);
+}
+
 static RmMountEntries *rm_mount_list_open(RmMountTable *table) {
     RmMountEntries *self = g_slice_new(RmMountEntries);
 
@@ -610,6 +680,11 @@ static RmMountEntries *rm_mount_list_open(RmMountTable *table) {
         wrap_entry->fsname = g_strdup(g_unix_mount_get_device_path(entry));
         wrap_entry->dir = g_strdup(g_unix_mount_get_mount_path(entry));
         wrap_entry->type = g_strdup(g_unix_mount_get_fs_type(entry));
+#if GLIB_CHECK_VERSION(2,58,0)
+        wrap_entry->options = g_strdup(g_unix_mount_get_options(entry));
+#else
+        wrap_entry->options = NULL;
+#endif
 
         self->entries = g_list_prepend(self->entries, wrap_entry);
     }
@@ -675,6 +750,19 @@ static RmMountEntries *rm_mount_list_open(RmMountTable *table) {
                   evilfs_found->name, wrap_entry->dir, (unsigned)dir_stat.st_dev);
         }
 
+        if(strcmp(wrap_entry->type, "overlay") == 0 && wrap_entry->options) {
+            RmOverlayInfo *info = rm_overlay_info_new(wrap_entry->dir, wrap_entry->options);
+            if(info->layers->len > 0) {
+                table->overlays = g_list_insert_sorted(
+                    table->overlays, info, (GCompareFunc)rm_overlay_info_cmp_depth);
+                rm_log_debug_line("Filesystem %s: overlay of %u layers", wrap_entry->dir,
+                                  info->layers->len);
+            } else {
+                rm_overlay_info_free(info);
+            }
+            continue;
+        }
+
         if(fs_supports_reflinks(wrap_entry->type, wrap_entry->dir)) {
             RmStat dir_stat;
             if(rm_sys_stat(wrap_entry->dir, &dir_stat) == 0) {
@@ -712,6 +800,7 @@ static bool rm_mounts_create_tables(RmMountTable *self, bool force_fiemap) {
     /* Mapping dev_t => true (used as set) */
     self->evilfs_table = g_hash_table_new(NULL, NULL);
     self->reflinkfs_table = g_hash_table_new(NULL, NULL);
+    self->overlays = NULL;
 
     RmMountEntry *entry = NULL;
     RmMountEntries *mnt_entries = rm_mount_list_open(self);
@@ -838,6 +927,7 @@ void rm_mounts_table_destroy(RmMountTable *self) {
     g_hash_table_unref(self->nfs_table);
     g_hash_table_unref(self->evilfs_table);
     g_hash_table_unref(self->reflinkfs_table);
+    g_list_free_full(self->overlays, (GDestroyNotify)rm_overlay_info_free);
     g_slice_free(RmMountTable, self);
 }
 
@@ -958,6 +1048,14 @@ bool rm_mounts_is_evil(RmMountTable *self, dev_t to_check) {
     return g_hash_table_contains(self->evilfs_table, GUINT_TO_POINTER(to_check));
 }
 
+bool rm_mounts_has_partition(RmMountTable *self, dev_t dev) {
+    if(self == NULL) {
+        return false;
+    }
+
+    return g_hash_table_contains(self->part_table, GINT_TO_POINTER(dev));
+}
+
 bool rm_mounts_can_reflink(RmMountTable *self, dev_t source, dev_t dest) {
     g_assert(self);
     if(g_hash_table_contains(self->reflinkfs_table, GUINT_TO_POINTER(source))) {
@@ -977,6 +1075,49 @@ bool rm_mounts_can_reflink(RmMountTable *self, dev_t source, dev_t dest) {
     }
 }
 
+char *rm_mounts_get_overlay_backing(RmMountTable *self, const char *path,
+                                    RmStat *backing) {
+    if(self == NULL) {
+        return NULL;
+    }
+
+#if RM_MOUNTTABLE_IS_USABLE
+    for(GList *iter = self->overlays; iter; iter = iter->next) {
+        RmOverlayInfo *info = iter->data;
+        /* an overlay on / keeps the leading slash of path */
+        size_t dir_len = strcmp(info->dir, "/") == 0 ? 0 : strlen(info->dir);
+        if(strncmp(path, info->dir, dir_len) != 0 || path[dir_len] != '/') {
+            continue;
+        }
+
+        /* The topmost layer that has the path provides the file; the file
+         * would not be visible if that entry were a whiteout */
+        const char *rel_path = path + dir_len;
+        for(guint i = 0; i < info->layers->len; ++i) {
+            char *layer_path = g_build_filename(info->layers->pdata[i], rel_path, NULL);
+            if(rm_sys_lstat(layer_path, backing) == 0) {
+                if(S_ISREG(backing->st_mode)) {
+                    return layer_path;
+                }
+                g_free(layer_path);
+                return NULL;
+            }
+            g_free(layer_path);
+
+            if(errno != ENOENT && errno != ENOTDIR) {
+                return NULL;
+            }
+        }
+        return NULL;
+    }
+    return NULL;
+#else
+    (void)path;
+    (void)backing;
+    return NULL;
+#endif
+}
+
 /////////////////////////////////
 //    FIEMAP IMPLEMENTATION     //
 /////////////////////////////////
@@ -121,6 +121,16 @@ static inline int rm_sys_open(const char *path, int mode) {
     return open(path, mode, (S_IRUSR | S_IWUSR));
 }
 
+static inline int rm_sys_openat(int dirfd, const char *path, int mode) {
+#if HAVE_STAT64
+#ifdef O_LARGEFILE
+    mode |= O_LARGEFILE;
+#endif
+#endif
+
+    return openat(dirfd, path, mode, (S_IRUSR | S_IWUSR));
+}
+
 static inline void rm_sys_close(int fd) {
     if(close(fd) == -1) {
         rm_log_perror("close(2) failed");
@@ -150,10 +160,18 @@ static inline gint64 rm_sys_preadv(int fd, const struct iovec *iov, int iovcnt,
 //   UID/GID VALIDITY CHECKING     //
 /////////////////////////////////////
 
+/* ids below this are kept in a bitmap, larger ones in a sorted array */
+#define RM_USERLIST_MAP_IDS 65536
+
+typedef struct RmUserIds {
+    guint8 map[RM_USERLIST_MAP_IDS / 8];
+    GArray *large;
+} RmUserIds;
+
 typedef struct RmUserList {
-    GSequence *users;
-    GSequence *groups;
-    GMutex lock;
+    /* only written by rm_userlist_new(), so lookups need no lock */
+    RmUserIds users;
+    RmUserIds groups;
 } RmUserList;
 
 /**
@@ -350,6 +368,8 @@ typedef struct RmMountTable {
     GHashTable *nfs_table;
     GHashTable *evilfs_table;
     GHashTable *reflinkfs_table;
+    /* RmOverlayInfo of each overlayfs mount, longest mount dir first */
+    GList *overlays;
 } RmMountTable;
 
 /**
@@ -401,12 +421,31 @@ dev_t rm_mounts_get_disk_id_by_path(RmMountTable *self, const char *path);
  */
 bool rm_mounts_is_evil(RmMountTable *self, dev_t to_check);
 
+/**
+ * @brief Indicates true if dev_t is a known partition (or a btrfs subvolume
+ * that was already looked up by rm_mounts_get_disk_id).
+ */
+bool rm_mounts_has_partition(RmMountTable *self, dev_t dev);
+
 /**
  * @brief Indicates true if source and dest are on same partition, and the
  * partition supports reflink copies (cp --reflink).
  */
 bool rm_mounts_can_reflink(RmMountTable *self, dev_t source, dev_t dest);
 
+/**
+ * @brief Find the file in an upper or lower directory that an overlayfs path
+ * shows.
+ *
+ * @param path absolute path of a regular file, maybe below an overlay mount.
+ * @param backing stat of the returned file.
+ *
+ * @return the path of the layer file (free with g_free) or NULL if path is
+ * not on an overlay mount or the lookup failed.
+ */
+char *rm_mounts_get_overlay_backing(RmMountTable *self, const char *path,
+                                    RmStat *backing);
+
 /////////////////////////////////
 //    FIEMAP IMPLEMENTATION     //
 /////////////////////////////////
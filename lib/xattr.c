@@ -25,6 +25,7 @@
 
 #include "xattr.h"
 #include "config.h"
+#include "md-scheduler.h"
 
 #include <errno.h>
 #include <string.h>
@@ -38,6 +39,19 @@
 #define ENODATA ENOMSG
 #endif
 
+/* Everything rmlint caches about a file lives in one attribute,
+ * user.rmlint.<digest>.cache = "<cksum> <mtime> <size>",
+ * so a lookup is a single getxattr(2) */
+#define RM_XATTR_CACHE_SUBKEY "cache"
+
+/* Room for the longest hex checksum plus mtime and size */
+#define RM_XATTR_CACHE_VALUE_LEN (512 + G_ASCII_DTOSTR_BUF_SIZE + 32)
+
+/* Older versions kept the checksum and mtime in separate attributes; those
+ * are still read, and replaced by a cache attribute when they are current */
+#define RM_XATTR_LEGACY_CKSUM_SUBKEY "cksum"
+#define RM_XATTR_LEGACY_MTIME_SUBKEY "mtime"
+
 ////////////////////////////
 //    UTILITY FUNCTIONS   //
 ////////////////////////////
@@ -160,6 +174,26 @@ static int rm_xattr_build_cksum(RmFile *file, char *buf, size_t buf_size) {
     return rm_digest_hexstring(file->digest, buf);
 }
 
+/* Split a cache value into its fields (in place); returns false if malformed */
+static bool rm_xattr_parse_cache(char *value, char **cksum, gdouble *mtime, RmOff *size) {
+    char *mtime_str = strchr(value, ' ');
+    if(mtime_str == NULL || mtime_str == value) {
+        return false;
+    }
+    *mtime_str++ = 0;
+
+    char *size_str = strchr(mtime_str, ' ');
+    if(size_str == NULL) {
+        return false;
+    }
+    *size_str++ = 0;
+
+    *cksum = value;
+    *mtime = g_ascii_strtod(mtime_str, NULL);
+    *size = g_ascii_strtoull(size_str, NULL, 10);
+    return true;
+}
+
 static int rm_xattr_is_fail(const char *name, char *path, int rc) {
     if(rc != -1) {
         return 0;
@@ -201,6 +235,68 @@ static int rm_xattr_del(RmFile *file, const char *key, bool follow_link) {
             rm_sys_removexattr(file_path, key, follow_link));
 }
 
+/* Replace the legacy attributes <base>.cksum and <base>.mtime of path by
+ * <base>.cache; they are only removed once the new one is written */
+static void rm_xattr_upgrade_legacy(const char *path, const char *base, const char *cksum,
+                                    gdouble mtime, RmOff size, bool follow_link) {
+    char key[128] = {0}, timestamp[G_ASCII_DTOSTR_BUF_SIZE] = {0},
+         value[RM_XATTR_CACHE_VALUE_LEN] = {0};
+
+    g_ascii_dtostr(timestamp, sizeof(timestamp), mtime);
+    int len = snprintf(value, sizeof(value), "%s %s %" LLU, cksum, timestamp, size);
+    if(len < 0 || (size_t)len >= sizeof(value)) {
+        return;
+    }
+
+    snprintf(key, sizeof(key), "%s.%s", base, RM_XATTR_CACHE_SUBKEY);
+    int rc = rm_sys_setxattr(path, key, value, len, 0, follow_link);
+    if(rc == -1) {
+        rm_xattr_is_fail("setxattr", (char *)path, rc);
+        return;
+    }
+
+    const char *legacy[] = {RM_XATTR_LEGACY_CKSUM_SUBKEY, RM_XATTR_LEGACY_MTIME_SUBKEY};
+    for(gsize i = 0; i < G_N_ELEMENTS(legacy); ++i) {
+        snprintf(key, sizeof(key), "%s.%s", base, legacy[i]);
+        rm_xattr_is_fail("removexattr", (char *)path,
+                         rm_sys_removexattr(path, key, follow_link));
+    }
+}
+
+/* Fill value (like a cache attribute) from the legacy cksum and mtime
+ * attributes of file, upgrading them if they are current; false if missing */
+static bool rm_xattr_read_legacy(RmFile *file, RmSession *session, char *value,
+                                 size_t value_size) {
+    char base[64] = {0}, cksum_key[64] = {0}, mtime_key[64] = {0}, cksum[512] = {0},
+         mtime_buf[G_ASCII_DTOSTR_BUF_SIZE] = {0};
+
+    bool follow = session->cfg->follow_symlinks;
+    if(rm_xattr_build_key(session, RM_XATTR_LEGACY_CKSUM_SUBKEY, cksum_key,
+                          sizeof(cksum_key)) ||
+       rm_xattr_build_key(session, RM_XATTR_LEGACY_MTIME_SUBKEY, mtime_key,
+                          sizeof(mtime_key)) ||
+       rm_xattr_get(file, cksum_key, cksum, sizeof(cksum) - 1, follow) ||
+       rm_xattr_get(file, mtime_key, mtime_buf, sizeof(mtime_buf) - 1, follow)) {
+        return false;
+    }
+
+    if(cksum[0] == 0 || mtime_buf[0] == 0) {
+        return false;
+    }
+
+    /* the old format had no size; trust the mtime like it did */
+    gdouble mtime = g_ascii_strtod(mtime_buf, NULL);
+    snprintf(value, value_size, "%s %s %" LLU, cksum, mtime_buf, file->actual_file_size);
+
+    if(FLOAT_SIGN_DIFF(mtime, file->mtime, MTIME_TOL) == 0) {
+        RM_DEFINE_PATH(file);
+        g_strlcpy(base, cksum_key, strlen(cksum_key) - strlen(RM_XATTR_LEGACY_CKSUM_SUBKEY));
+        rm_xattr_upgrade_legacy(file_path, base, cksum, mtime, file->actual_file_size,
+                                follow);
+    }
+    return true;
+}
+
 #endif
 
 ////////////////////////////
@@ -217,17 +313,24 @@ int rm_xattr_write_hash(RmFile *file, RmSession *session) {
         return EINVAL;
     }
 
-    char cksum_key[64], mtime_key[64],
-        cksum_hex_str[rm_digest_get_bytes(file->digest) * 2 + 1], timestamp[64] = {0};
+    char cache_key[64], cksum_hex_str[rm_digest_get_bytes(file->digest) * 2 + 1],
+        timestamp[G_ASCII_DTOSTR_BUF_SIZE] = {0}, value[RM_XATTR_CACHE_VALUE_LEN] = {0};
 
     bool follow = session->cfg->follow_symlinks;
     g_ascii_dtostr(timestamp, sizeof(timestamp), file->mtime);
 
-    if(rm_xattr_build_key(session, "cksum", cksum_key, sizeof(cksum_key)) ||
-       rm_xattr_build_key(session, "mtime", mtime_key, sizeof(mtime_key)) ||
-       rm_xattr_build_cksum(file, cksum_hex_str, sizeof(cksum_hex_str)) <= 0 ||
-       rm_xattr_set(file, cksum_key, cksum_hex_str, sizeof(cksum_hex_str), follow) ||
-       rm_xattr_set(file, mtime_key, timestamp, strlen(timestamp), follow)) {
+    if(rm_xattr_build_key(session, RM_XATTR_CACHE_SUBKEY, cache_key, sizeof(cache_key)) ||
+       rm_xattr_build_cksum(file, cksum_hex_str, sizeof(cksum_hex_str)) <= 0) {
+        return EINVAL;
+    }
+
+    int len = snprintf(value, sizeof(value), "%s %s %" LLU, cksum_hex_str, timestamp,
+                       file->actual_file_size);
+    if(len < 0 || (size_t)len >= sizeof(value)) {
+        return EINVAL;
+    }
+
+    if(rm_xattr_set(file, cache_key, value, len, follow)) {
         return errno;
     }
 #endif
@@ -243,55 +346,108 @@ gboolean rm_xattr_read_hash(RmFile *file, RmSession *session) {
         return FALSE;
     }
 
-    char cksum_key[64] = {0},
-         mtime_key[64] = {0},
-         mtime_buf[64] = {0},
-         cksum_hex_str[512] = {0};
-
-    memset(cksum_hex_str, 0, sizeof(cksum_hex_str));
-    cksum_hex_str[sizeof(cksum_hex_str) - 1] = 0;
+    char cache_key[64] = {0}, value[RM_XATTR_CACHE_VALUE_LEN] = {0};
 
     bool follow = session->cfg->follow_symlinks;
-    if(rm_xattr_build_key(session, "cksum", cksum_key, sizeof(cksum_key)) ||
-       rm_xattr_get(file, cksum_key, cksum_hex_str, sizeof(cksum_hex_str) - 1, follow) ||
-       rm_xattr_build_key(session, "mtime", mtime_key, sizeof(mtime_key)) ||
-       rm_xattr_get(file, mtime_key, mtime_buf, sizeof(mtime_buf) - 1, follow)) {
+    if(rm_xattr_build_key(session, RM_XATTR_CACHE_SUBKEY, cache_key, sizeof(cache_key)) ||
+       rm_xattr_get(file, cache_key, value, sizeof(value) - 1, follow)) {
+        return FALSE;
+    }
+
+    if(value[0] == 0 && !rm_xattr_read_legacy(file, session, value, sizeof(value))) {
         return FALSE;
     }
 
-    if(cksum_hex_str[0] == 0 || mtime_buf[0] == 0) {
+    char *cksum = NULL;
+    gdouble xattr_mtime = 0;
+    RmOff xattr_size = 0;
+    if(!rm_xattr_parse_cache(value, &cksum, &xattr_mtime, &xattr_size)) {
         return FALSE;
     }
 
-    gdouble xattr_mtime = g_strtod(mtime_buf, NULL);
-    if(FLOAT_SIGN_DIFF(xattr_mtime, file->mtime, MTIME_TOL) != 0) {
-        /* Data is too old and not useful, autoclean it */
+    if(FLOAT_SIGN_DIFF(xattr_mtime, file->mtime, MTIME_TOL) != 0 ||
+       xattr_size != file->actual_file_size) {
+        /* Data is too old and not useful; the next --xattr-write replaces it */
         RM_DEFINE_PATH(file);
         rm_log_debug_line(
-            "mtime differs too much for %s, %f (xattr) != %f (actual) (diff: %f)\n",
-            file_path,
-            xattr_mtime,
-            file->mtime,
-            file->mtime-xattr_mtime
-        );
-        rm_xattr_clear_hash(file, session);
+            "stale xattr cache for %s, %f (xattr) != %f (actual) or %" LLU " != %" LLU,
+            file_path, xattr_mtime, file->mtime, xattr_size, file->actual_file_size);
         return FALSE;
     }
 
-    file->ext_cksum = g_strdup(cksum_hex_str);
+    file->ext_cksum = g_strdup(cksum);
     return TRUE;
 #else
     return FALSE;
 #endif
 }
 
+#if HAVE_XATTR
+
+/* RmMDSFunc for rm_xattr_read_hashes() */
+static gint rm_xattr_read_hash_task(RmFile *file, RmSession *session) {
+    rm_xattr_read_hash(file, session);
+
+    rm_mds_device_ref(file->disk, -1);
+    file->disk = NULL;
+    return 1;
+}
+
+#endif
+
+void rm_xattr_read_hashes(RmSession *session, GSList *size_groups) {
+    g_assert(session);
+
+#if HAVE_XATTR
+    RmCfg *cfg = session->cfg;
+    if(cfg->read_cksum_from_xattr == false) {
+        return;
+    }
+
+    RmMDS *mds = session->mds;
+    rm_mds_configure(mds,
+                     (RmMDSFunc)rm_xattr_read_hash_task,
+                     session,
+                     0,
+                     cfg->threads_per_disk,
+                     (RmMDSSortFunc)rm_mds_elevator_cmp);
+
+    for(GSList *group = size_groups; group; group = group->next) {
+        GSList *files = group->data;
+        if(files == NULL || files->next == NULL) {
+            /* a file with a unique size is never hashed; don't ask for its cksum */
+            continue;
+        }
+
+        for(GSList *iter = files; iter; iter = iter->next) {
+            RmFile *file = iter->data;
+            RM_DEFINE_PATH(file);
+
+            file->disk = rm_mds_device_get(mds, file_path, (cfg->fake_pathindex_as_disk)
+                                                               ? file->path_index + 1
+                                                               : file->dev);
+            rm_mds_device_ref(file->disk, 1);
+
+            /* inode order is as good as it gets for metadata */
+            rm_mds_push_task(file->disk, file->dev, file->inode, NULL, file);
+        }
+    }
+
+    rm_mds_start(mds);
+    rm_mds_finish(mds);
+#else
+    (void)size_groups;
+#endif
+}
+
 int rm_xattr_clear_hash(RmFile *file, RmSession *session) {
     g_assert(file);
     g_assert(session);
 
 #if HAVE_XATTR
     int error = 0;
-    const char *keys[] = {"cksum", "mtime", NULL};
+    const char *keys[] = {RM_XATTR_CACHE_SUBKEY, RM_XATTR_LEGACY_CKSUM_SUBKEY,
+                          RM_XATTR_LEGACY_MTIME_SUBKEY, NULL};
 
     for(int i = 0; keys[i]; ++i) {
         char key[64] = {0};
@@ -381,63 +537,103 @@ GHashTable *rm_xattr_list(const char *path, bool follow_symlinks) {
     return map;
 }
 
-static void rm_xattr_change_subkey(char *key, char *sub_key) {
-    size_t key_len = strlen(key);
-    size_t sub_key_len = strlen(sub_key);
+/* Like rm_xattr_find_current_cksum(), but for the cksum and mtime attributes
+ * of older versions; matches are upgraded to a cache attribute on the way */
+static char *rm_xattr_find_legacy_cksum(GHashTable *map, const char *path,
+                                        RmStat *stat_buf, bool follow_symlinks,
+                                        char **dedup_key) {
+    const char suffix[] = "." RM_XATTR_LEGACY_MTIME_SUBKEY;
+    char *key = NULL, *value = NULL;
+    GHashTableIter iter;
 
-    // This method is only thought to be used for our xattr keys.
-    // They happen to have all 5 byte long sub keys by chance.
-    // So take the chance to save some allocations.
-    if(sub_key_len != 5) {
-        return;
-    }
+    g_hash_table_iter_init(&iter, map);
+    while(g_hash_table_iter_next(&iter, (gpointer)&key, (gpointer)&value)) {
+        if(!g_str_has_suffix(key, suffix)) {
+            continue;
+        }
 
-    strcpy(&key[key_len - sub_key_len], sub_key);
-}
+        gdouble mtime = g_ascii_strtod(value, NULL);
+        if(FLOAT_SIGN_DIFF(mtime, stat_buf->st_mtime, MTIME_TOL) != 0) {
+            continue;
+        }
 
-bool rm_xattr_is_deduplicated(const char *path, bool follow_symlinks) {
-    g_assert(path);
+        char *base = g_strndup(key, strlen(key) - strlen(suffix));
+        char *cksum_key = g_strdup_printf("%s.%s", base, RM_XATTR_LEGACY_CKSUM_SUBKEY);
+        char *cksum = g_hash_table_lookup(map, cksum_key);
+        g_free(cksum_key);
 
-    RmStat stat_buf;
-    if(rm_sys_stat(path, &stat_buf) < 0) {
-        rm_log_warning_line("failed to check dedupe state of %s: %s", path, g_strerror(errno));
-        return EXIT_FAILURE;
+        if(cksum == NULL || *cksum == 0) {
+            g_free(base);
+            continue;
+        }
+
+        rm_xattr_upgrade_legacy(path, base, cksum, mtime, stat_buf->st_size,
+                                follow_symlinks);
+        *dedup_key = g_strdup_printf("%s.dedup", base);
+        g_free(base);
+        return cksum;
     }
 
-    bool result = false;
+    return NULL;
+}
+
+/* Find the checksum of the cache entry in map which matches the current
+ * mtime of path; on success *dedup_key is the key of the matching dedup marker
+ * (free with g_free) and the returned checksum points into map */
+static char *rm_xattr_find_current_cksum(GHashTable *map, const char *path,
+                                         RmStat *stat_buf, bool follow_symlinks,
+                                         char **dedup_key) {
+    const char suffix[] = "." RM_XATTR_CACHE_SUBKEY;
     char *key = NULL, *value = NULL;
-    GHashTable *map = rm_xattr_list(path, follow_symlinks);
     GHashTableIter iter;
 
     g_hash_table_iter_init(&iter, map);
     while(g_hash_table_iter_next(&iter, (gpointer)&key, (gpointer)&value)) {
-        if(!g_str_has_suffix(key, ".mtime")) {
+        if(!g_str_has_suffix(key, suffix)) {
             continue;
         }
 
-        gdouble mtime = g_ascii_strtod(value, NULL);
-        if(FLOAT_SIGN_DIFF(mtime, stat_buf.st_mtime, MTIME_TOL) != 0) {
+        char *cksum = NULL;
+        gdouble mtime = 0;
+        RmOff size = 0;
+        if(!rm_xattr_parse_cache(value, &cksum, &mtime, &size)) {
             continue;
         }
 
-        rm_xattr_change_subkey(key, "cksum");
-        char *cksum = g_hash_table_lookup(map, key);
-        if(cksum == NULL) {
+        if(FLOAT_SIGN_DIFF(mtime, stat_buf->st_mtime, MTIME_TOL) != 0) {
             continue;
         }
 
-        rm_xattr_change_subkey(key, "dedup");
-        char *dedup = g_hash_table_lookup(map, key);
-        if(dedup == NULL) {
-            continue;
-        }
+        *dedup_key = g_strdup_printf("%.*s.dedup", (int)(strlen(key) - strlen(suffix)),
+                                     key);
+        return cksum;
+    }
 
-        if(g_strcmp0(cksum, dedup) != 0) {
-            continue;
-        }
+    /* dedup markers have not changed, so they still match legacy checksums */
+    return rm_xattr_find_legacy_cksum(map, path, stat_buf, follow_symlinks, dedup_key);
+}
+
+bool rm_xattr_is_deduplicated(const char *path, bool follow_symlinks) {
+    g_assert(path);
+
+    RmStat stat_buf;
+    if(rm_sys_stat(path, &stat_buf) < 0) {
+        rm_log_warning_line("failed to check dedupe state of %s: %s", path, g_strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    GHashTable *map = rm_xattr_list(path, follow_symlinks);
+    if(map == NULL) {
+        return false;
+    }
 
-        result = true;
-        break;
+    bool result = false;
+    char *dedup_key = NULL;
+    char *cksum =
+        rm_xattr_find_current_cksum(map, path, &stat_buf, follow_symlinks, &dedup_key);
+    if(cksum) {
+        result = (g_strcmp0(cksum, g_hash_table_lookup(map, dedup_key)) == 0);
+        g_free(dedup_key);
     }
 
     g_hash_table_destroy(map);
@@ -453,30 +649,18 @@ int rm_xattr_mark_deduplicated(const char *path, bool follow_symlinks) {
         return EXIT_FAILURE;
     }
 
-    int result = EXIT_FAILURE;
-    char *key = NULL, *value = NULL;
     GHashTable *map = rm_xattr_list(path, follow_symlinks);
-    GHashTableIter iter;
-
-    g_hash_table_iter_init(&iter, map);
-    while(g_hash_table_iter_next(&iter, (gpointer)&key, (gpointer)&value)) {
-        if(!g_str_has_suffix(key, ".mtime")) {
-            continue;
-        }
-
-        gdouble mtime = g_ascii_strtod(value, NULL);
-        if(FLOAT_SIGN_DIFF(mtime, stat_buf.st_mtime, MTIME_TOL) != 0) {
-            continue;
-        }
-
-        rm_xattr_change_subkey(key, "cksum");
-        char *cksum = g_hash_table_lookup(map, key);
-        if(cksum == NULL) {
-            continue;
-        }
+    if(map == NULL) {
+        return EXIT_FAILURE;
+    }
 
-        rm_xattr_change_subkey(key, "dedup");
-        result = rm_sys_setxattr(path, key, cksum, strlen(cksum), 0, follow_symlinks);
+    int result = EXIT_FAILURE;
+    char *dedup_key = NULL;
+    char *cksum =
+        rm_xattr_find_current_cksum(map, path, &stat_buf, follow_symlinks, &dedup_key);
+    if(cksum) {
+        result = rm_sys_setxattr(path, dedup_key, cksum, strlen(cksum), 0, follow_symlinks);
+        g_free(dedup_key);
     }
 
     g_hash_table_destroy(map);
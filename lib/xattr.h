@@ -52,6 +52,18 @@ int rm_xattr_write_hash(RmFile *file, RmSession *session);
  */
 gboolean rm_xattr_read_hash(RmFile *file, RmSession *session);
 
+/**
+ * @brief Read the cached checksums of all dupe candidates in size_groups.
+ *
+ * Groups with a single file are skipped since those files are never hashed.
+ * The reads run on session->mds (threads_per_disk readers per disk), so this
+ * must be called between two scheduler phases.
+ *
+ * @param session Session to validate cfg against.
+ * @param size_groups List of GSLists of RmFiles (session->tables->size_groups).
+ */
+void rm_xattr_read_hashes(RmSession *session, GSList *size_groups);
+
 /**
  * @brief Clear all data that may have been written to file.
  *
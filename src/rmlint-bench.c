@@ -0,0 +1,502 @@
+/**
+*  This file is part of rmlint.
+*
+*  rmlint is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  rmlint is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with rmlint.  If not, see <http://www.gnu.org/licenses/>.
+*
+** Authors:
+ *
+ *  - Christopher <sahib> Pahl 2010-2020 (https://github.com/sahib)
+ *  - Daniel <SeeSpotRun> T.   2014-2020 (https://github.com/SeeSpotRun)
+ *
+** Hosted on http://github.com/sahib/rmlint
+*
+**/
+
+/*
+ * Micro benchmarks for the digest and hasher layers; built by `scons bench`.
+ *
+ * Unlike tests/test_speed/benchmark.py this does not run the rmlint binary,
+ * it times the library calls directly:
+ *
+ *   - every digest type via rm_digest_update() for several buffer sizes, plus
+ *     the cost of rm_digest_copy() and rm_digest_steal() (progressive hashing);
+ *   - RmHasher end-to-end over a set of generated files, for each directory
+ *     (e.g. a tmpfs and a disk backed page cache), thread count and read
+ *     buffer length.
+ *
+ * Each measurement is repeated and the best run is reported, so results are
+ * reasonably stable between runs on an otherwise idle machine.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/checksum.h"
+#include "../lib/cmdline.h"
+#include "../lib/config.h"
+#include "../lib/hasher.h"
+#include "../lib/utilities.h"
+
+typedef struct RmBench {
+    /* options */
+    gchar *algorithms;
+    gchar *digest_buf_sizes;
+    gchar *digest_bytes;
+    gchar *hasher_algorithm;
+    gchar *hasher_threads;
+    gchar *hasher_buf_sizes;
+    gchar *file_size;
+    gchar **dirs;
+    gint n_files;
+    gint repeat;
+    gboolean buffered_read;
+    gboolean no_sse;
+    gboolean skip_digests;
+    gboolean skip_hasher;
+
+    /* hasher run state */
+    GMutex lock;
+    guint64 bytes_hashed;
+} RmBench;
+
+//////////////////////////////
+//         HELPERS          //
+//////////////////////////////
+
+/* parse a size like rmlint's own options do ("16K", "1M", ...) */
+static gboolean rm_bench_parse_size(const char *spec, guint64 *result) {
+    GError *error = NULL;
+    *result = rm_cmd_size_string_to_bytes(spec, &error);
+    if(error != NULL) {
+        g_error_free(error);
+        return FALSE;
+    }
+    return *result > 0;
+}
+
+/* parse a positive plain number */
+static gboolean rm_bench_parse_count(const char *spec, guint64 *result) {
+    gchar *end = NULL;
+    *result = g_ascii_strtoull(spec, &end, 10);
+    return end != spec && *end == 0 && *result > 0;
+}
+
+/* parse a comma separated list of sizes (or counts); exits on error */
+static GArray *rm_bench_parse_list(const char *spec, const char *option, gboolean counts) {
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(guint64));
+    gchar **parts = g_strsplit(spec, ",", -1);
+    for(gint i = 0; parts[i]; i++) {
+        guint64 value = 0;
+        const char *part = g_strstrip(parts[i]);
+        if(counts ? !rm_bench_parse_count(part, &value)
+                  : !rm_bench_parse_size(part, &value)) {
+            rm_log_error_line("Invalid %s `%s' for --%s", counts ? "number" : "size",
+                              part, option);
+            exit(EXIT_FAILURE);
+        }
+        g_array_append_val(values, value);
+    }
+    g_strfreev(parts);
+    return values;
+}
+
+static RmDigestType rm_bench_parse_digest_type(const char *name) {
+    RmDigestType type = rm_string_to_digest_type(name);
+    if(type == RM_DIGEST_UNKNOWN) {
+        rm_log_error_line("Unknown digest type `%s'", name);
+        exit(EXIT_FAILURE);
+    }
+    return type;
+}
+
+/* seconds elapsed since start (a g_get_monotonic_time() value) */
+static gdouble rm_bench_seconds_since(gint64 start) {
+    return MAX(g_get_monotonic_time() - start, 1) / (gdouble)G_USEC_PER_SEC;
+}
+
+static gdouble rm_bench_mb_per_sec(guint64 bytes, gdouble seconds) {
+    return bytes / seconds / (1024 * 1024);
+}
+
+//////////////////////////////
+//      DIGEST BENCHMARK    //
+//////////////////////////////
+
+static gboolean rm_bench_digest_is_plain(RmDigestType type) {
+    /* the special kids can't be driven by rm_digest_update() alone */
+    return type != RM_DIGEST_CUMULATIVE && type != RM_DIGEST_EXT &&
+           type != RM_DIGEST_PARANOID;
+}
+
+static GArray *rm_bench_digest_types(RmBench *bench) {
+    GArray *types = g_array_new(FALSE, FALSE, sizeof(RmDigestType));
+
+    if(bench->algorithms) {
+        gchar **names = g_strsplit(bench->algorithms, ",", -1);
+        for(gint i = 0; names[i]; i++) {
+            RmDigestType type = rm_bench_parse_digest_type(g_strstrip(names[i]));
+            if(!rm_bench_digest_is_plain(type)) {
+                rm_log_error_line("Digest type `%s' can't be benchmarked", names[i]);
+                exit(EXIT_FAILURE);
+            }
+            g_array_append_val(types, type);
+        }
+        g_strfreev(names);
+    } else {
+        for(RmDigestType type = RM_DIGEST_UNKNOWN + 1; type < RM_DIGEST_SENTINEL; type++) {
+            if(rm_bench_digest_is_plain(type)) {
+                g_array_append_val(types, type);
+            }
+        }
+    }
+    return types;
+}
+
+/* time copy+free and steal+free of digest; returns ns per operation */
+static void rm_bench_digest_copy_steal(RmDigest *digest, gint repeat, gdouble *copy_ns,
+                                       gdouble *steal_ns) {
+    const gint ops = 1000;
+    *copy_ns = *steal_ns = G_MAXDOUBLE;
+
+    for(gint r = 0; r < repeat; r++) {
+        gint64 start = g_get_monotonic_time();
+        for(gint i = 0; i < ops; i++) {
+            rm_digest_free(rm_digest_copy(digest));
+        }
+        *copy_ns = MIN(*copy_ns, rm_bench_seconds_since(start) * 1e9 / ops);
+
+        start = g_get_monotonic_time();
+        for(gint i = 0; i < ops; i++) {
+            g_slice_free1(rm_digest_get_bytes(digest), rm_digest_steal(digest));
+        }
+        *steal_ns = MIN(*steal_ns, rm_bench_seconds_since(start) * 1e9 / ops);
+    }
+}
+
+static void rm_bench_digests(RmBench *bench) {
+    GArray *types = rm_bench_digest_types(bench);
+    GArray *buf_sizes = rm_bench_parse_list(bench->digest_buf_sizes, "digest-buf", FALSE);
+
+    guint64 total_bytes = 0;
+    if(!rm_bench_parse_size(bench->digest_bytes, &total_bytes)) {
+        rm_log_error_line("Invalid size `%s' for --digest-bytes", bench->digest_bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    guint64 max_buf_size = 0;
+    for(guint i = 0; i < buf_sizes->len; i++) {
+        max_buf_size = MAX(max_buf_size, g_array_index(buf_sizes, guint64, i));
+    }
+
+    /* random-ish but reproducible input */
+    guint8 *data = g_malloc(max_buf_size);
+    GRand *rand = g_rand_new_with_seed(42);
+    for(guint64 i = 0; i < max_buf_size; i++) {
+        data[i] = g_rand_int(rand);
+    }
+    g_rand_free(rand);
+
+    printf("%-12s %10s %12s %12s %12s\n", "digest", "buf_size", "MB/s", "copy_ns",
+           "steal_ns");
+
+    for(guint t = 0; t < types->len; t++) {
+        RmDigestType type = g_array_index(types, RmDigestType, t);
+        for(guint b = 0; b < buf_sizes->len; b++) {
+            guint64 buf_size = g_array_index(buf_sizes, guint64, b);
+            guint64 n_updates = MAX(total_bytes / buf_size, 1);
+            gdouble best = G_MAXDOUBLE;
+
+            RmDigest *digest = NULL;
+            for(gint r = 0; r < bench->repeat; r++) {
+                if(digest) {
+                    rm_digest_free(digest);
+                }
+                digest = rm_digest_new(type, 0);
+
+                gint64 start = g_get_monotonic_time();
+                for(guint64 i = 0; i < n_updates; i++) {
+                    rm_digest_update(digest, data, buf_size);
+                }
+                best = MIN(best, rm_bench_seconds_since(start));
+            }
+
+            /* leave a partial block so steal has some work to do */
+            rm_digest_update(digest, data, MIN(buf_size, 100));
+
+            gdouble copy_ns = 0, steal_ns = 0;
+            rm_bench_digest_copy_steal(digest, bench->repeat, &copy_ns, &steal_ns);
+            rm_digest_free(digest);
+
+            printf("%-12s %10" G_GUINT64_FORMAT " %12.1f %12.0f %12.0f\n",
+                   rm_digest_type_to_string(type), buf_size,
+                   rm_bench_mb_per_sec(n_updates * buf_size, best), copy_ns, steal_ns);
+            fflush(stdout);
+        }
+    }
+
+    g_free(data);
+    g_array_free(buf_sizes, TRUE);
+    g_array_free(types, TRUE);
+}
+
+//////////////////////////////
+//      HASHER BENCHMARK    //
+//////////////////////////////
+
+static int rm_bench_hasher_callback(_UNUSED RmHasher *hasher, RmDigest *digest,
+                                    RmBench *bench, gpointer file_size) {
+    g_mutex_lock(&bench->lock);
+    { bench->bytes_hashed += GPOINTER_TO_SIZE(file_size); }
+    g_mutex_unlock(&bench->lock);
+
+    rm_digest_free(digest);
+    return 0;
+}
+
+/* write n_files files of file_size bytes to dir; returns their paths */
+static gchar **rm_bench_create_files(const char *dir, gint n_files, guint64 file_size) {
+    gchar **paths = g_new0(gchar *, n_files + 1);
+    const gsize chunk_size = 1024 * 1024;
+    guint8 *chunk = g_malloc(chunk_size);
+    GRand *rand = g_rand_new_with_seed(23);
+
+    for(gint i = 0; i < n_files; i++) {
+        paths[i] = g_strdup_printf("%s/rmlint-bench.%d.%d", dir, (int)getpid(), i);
+        int fd = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if(fd == -1) {
+            rm_log_perrorf("Can't create %s", paths[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        for(guint64 written = 0; written < file_size;) {
+            for(gsize j = 0; j < chunk_size; j++) {
+                chunk[j] = g_rand_int(rand);
+            }
+            gsize len = MIN(chunk_size, file_size - written);
+            if(write(fd, chunk, len) != (ssize_t)len) {
+                rm_log_perrorf("Can't write %s", paths[i]);
+                exit(EXIT_FAILURE);
+            }
+            written += len;
+        }
+        close(fd);
+    }
+
+    g_rand_free(rand);
+    g_free(chunk);
+    return paths;
+}
+
+static void rm_bench_remove_files(gchar **paths) {
+    for(gint i = 0; paths[i]; i++) {
+        unlink(paths[i]);
+    }
+    g_strfreev(paths);
+}
+
+/* hash all files once; returns the time taken in seconds */
+static gdouble rm_bench_hasher_run(RmBench *bench, RmDigestType type, gchar **paths,
+                                   guint64 file_size, guint threads, guint64 buf_size) {
+    bench->bytes_hashed = 0;
+
+    gint64 start = g_get_monotonic_time();
+    RmHasher *hasher = rm_hasher_new(type, threads, bench->buffered_read, buf_size,
+                                     256 * 1024 * 1024,
+                                     (RmHasherCallback)rm_bench_hasher_callback, bench);
+
+    for(gint i = 0; paths[i]; i++) {
+        RmHasherTask *task = rm_hasher_task_new(hasher, NULL, GSIZE_TO_POINTER(file_size));
+        if(!rm_hasher_task_hash(task, paths[i], 0, file_size, FALSE, FALSE, NULL)) {
+            rm_log_error_line("Read error on %s", paths[i]);
+        }
+        rm_hasher_task_finish(task);
+    }
+
+    rm_hasher_free(hasher, TRUE);
+    gdouble seconds = rm_bench_seconds_since(start);
+
+    if(bench->bytes_hashed != file_size * g_strv_length(paths)) {
+        rm_log_error_line("Hasher only hashed %" G_GUINT64_FORMAT " bytes",
+                          bench->bytes_hashed);
+    }
+    return seconds;
+}
+
+static void rm_bench_hasher(RmBench *bench) {
+    RmDigestType type = rm_bench_parse_digest_type(bench->hasher_algorithm);
+    GArray *threads = rm_bench_parse_list(bench->hasher_threads, "hasher-threads", TRUE);
+    GArray *buf_sizes = rm_bench_parse_list(bench->hasher_buf_sizes, "hasher-buf", FALSE);
+
+    guint64 file_size = 0;
+    if(!rm_bench_parse_size(bench->file_size, &file_size)) {
+        rm_log_error_line("Invalid size `%s' for --file-size", bench->file_size);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-24s %-12s %8s %10s %12s\n", "dir", "digest", "threads", "buf_size",
+           "MB/s");
+
+    for(gint d = 0; bench->dirs[d]; d++) {
+        const char *dir = bench->dirs[d];
+        if(!g_file_test(dir, G_FILE_TEST_IS_DIR)) {
+            rm_log_warning_line("Skipping %s: not a directory", dir);
+            continue;
+        }
+
+        gchar **paths = rm_bench_create_files(dir, bench->n_files, file_size);
+
+        /* make sure everything is in the page cache before timing */
+        rm_bench_hasher_run(bench, type, paths, file_size, 1,
+                            g_array_index(buf_sizes, guint64, 0));
+
+        for(guint t = 0; t < threads->len; t++) {
+            guint n_threads = g_array_index(threads, guint64, t);
+            for(guint b = 0; b < buf_sizes->len; b++) {
+                guint64 buf_size = g_array_index(buf_sizes, guint64, b);
+                gdouble best = G_MAXDOUBLE;
+                for(gint r = 0; r < bench->repeat; r++) {
+                    best = MIN(best, rm_bench_hasher_run(bench, type, paths, file_size,
+                                                         n_threads, buf_size));
+                }
+
+                printf("%-24s %-12s %8u %10" G_GUINT64_FORMAT " %12.1f\n", dir,
+                       rm_digest_type_to_string(type), n_threads, buf_size,
+                       rm_bench_mb_per_sec(file_size * bench->n_files, best));
+                fflush(stdout);
+            }
+        }
+
+        rm_bench_remove_files(paths);
+    }
+
+    g_array_free(buf_sizes, TRUE);
+    g_array_free(threads, TRUE);
+}
+
+//////////////////////////////
+//           MAIN           //
+//////////////////////////////
+
+int main(int argc, const char **argv) {
+    RM_LOG_INIT;
+
+    RmBench bench;
+    memset(&bench, 0, sizeof(bench));
+    g_mutex_init(&bench.lock);
+
+    bench.n_files = 8;
+    bench.repeat = 3;
+
+    /* clang-format off */
+
+    const GOptionEntry entries[] = {
+        {"algorithms"    , 'a' , 0 , G_OPTION_ARG_STRING         , &bench.algorithms       , "Comma separated digest types to benchmark [all]"       , "TYPES"} ,
+        {"digest-buf"    , 'b' , 0 , G_OPTION_ARG_STRING         , &bench.digest_buf_sizes , "Buffer sizes passed to rm_digest_update() [4K,64K,1M]" , "SIZES"} ,
+        {"digest-bytes"  , 'n' , 0 , G_OPTION_ARG_STRING         , &bench.digest_bytes     , "Bytes to hash per digest and buffer size [256M]"       , "SIZE"}  ,
+        {"hasher-algo"   , 'A' , 0 , G_OPTION_ARG_STRING         , &bench.hasher_algorithm , "Digest type used by the hasher benchmark [blake2b]"    , "TYPE"}  ,
+        {"hasher-threads", 't' , 0 , G_OPTION_ARG_STRING         , &bench.hasher_threads   , "Hasher thread counts [1,2,4,8]"                        , "LIST"}  ,
+        {"hasher-buf"    , 'B' , 0 , G_OPTION_ARG_STRING         , &bench.hasher_buf_sizes , "Hasher read buffer lengths [16K,64K,1M]"               , "SIZES"} ,
+        {"dir"           , 'd' , 0 , G_OPTION_ARG_FILENAME_ARRAY , &bench.dirs             , "Directory for the test files; repeatable [/dev/shm and $TMPDIR]" , "DIR"} ,
+        {"files"         , 'f' , 0 , G_OPTION_ARG_INT            , &bench.n_files          , "Number of test files [8]"                              , "N"}     ,
+        {"file-size"     , 's' , 0 , G_OPTION_ARG_STRING         , &bench.file_size        , "Size of each test file [64M]"                          , "SIZE"}  ,
+        {"repeat"        , 'r' , 0 , G_OPTION_ARG_INT            , &bench.repeat           , "Runs per measurement; the best one is reported [3]"    , "N"}     ,
+        {"buffered-read" , 0   , 0 , G_OPTION_ARG_NONE           , &bench.buffered_read    , "Hasher reads with fread() instead of preadv()"          , NULL}    ,
+        {"no-sse"        , 0   , 0 , G_OPTION_ARG_NONE           , &bench.no_sse           , "Don't use SIMD digest implementations"                 , NULL}    ,
+        {"no-digests"    , 0   , 0 , G_OPTION_ARG_NONE           , &bench.skip_digests     , "Skip the digest benchmark"                             , NULL}    ,
+        {"no-hasher"     , 0   , 0 , G_OPTION_ARG_NONE           , &bench.skip_hasher      , "Skip the hasher benchmark"                             , NULL}    ,
+        {NULL            , 0   , 0 , 0                           , NULL                    , NULL                                                    , NULL}};
+
+    /* clang-format on */
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- benchmark rmlint's digests and hasher");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if(!g_option_context_parse(context, &argc, (char ***)&argv, &error)) {
+        rm_log_error_line("%s", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    /* defaults go in only now; GOption would not free them when overridden */
+    if(!bench.digest_buf_sizes) {
+        bench.digest_buf_sizes = g_strdup("4K,64K,1M");
+    }
+    if(!bench.digest_bytes) {
+        bench.digest_bytes = g_strdup("256M");
+    }
+    if(!bench.hasher_algorithm) {
+        bench.hasher_algorithm = g_strdup(rm_digest_type_to_string(RM_DEFAULT_DIGEST));
+    }
+    if(!bench.hasher_threads) {
+        bench.hasher_threads = g_strdup("1,2,4,8");
+    }
+    if(!bench.hasher_buf_sizes) {
+        bench.hasher_buf_sizes = g_strdup("16K,64K,1M");
+    }
+    if(!bench.file_size) {
+        bench.file_size = g_strdup("64M");
+    }
+
+    if(bench.repeat < 1 || bench.n_files < 1) {
+        rm_log_error_line("--repeat and --files must be at least 1");
+        return EXIT_FAILURE;
+    }
+
+    if(!bench.dirs) {
+        GPtrArray *dirs = g_ptr_array_new();
+        if(g_file_test("/dev/shm", G_FILE_TEST_IS_DIR)) {
+            g_ptr_array_add(dirs, g_strdup("/dev/shm"));
+        }
+        g_ptr_array_add(dirs, g_strdup(g_get_tmp_dir()));
+        g_ptr_array_add(dirs, NULL);
+        bench.dirs = (gchar **)g_ptr_array_free(dirs, FALSE);
+    }
+
+#if HAVE_BUILTIN_CPU_SUPPORTS && HAVE_MM_CRC32_U64
+    rm_digest_enable_sse(!bench.no_sse && __builtin_cpu_supports("sse4.2"));
+#else
+    if(bench.no_sse) {
+        rm_digest_enable_sse(FALSE);
+    }
+#endif
+
+    if(!bench.skip_digests) {
+        rm_bench_digests(&bench);
+        if(!bench.skip_hasher) {
+            printf("\n");
+        }
+    }
+
+    if(!bench.skip_hasher) {
+        rm_bench_hasher(&bench);
+    }
+
+    g_free(bench.algorithms);
+    g_free(bench.digest_buf_sizes);
+    g_free(bench.digest_bytes);
+    g_free(bench.hasher_algorithm);
+    g_free(bench.hasher_threads);
+    g_free(bench.hasher_buf_sizes);
+    g_free(bench.file_size);
+    g_strfreev(bench.dirs);
+    g_mutex_clear(&bench.lock);
+
+    return EXIT_SUCCESS;
+}
@@ -139,7 +139,9 @@ int main(int argc, const char **argv) {
         } else if(cfg.is_reflink) {
             exit_state = rm_session_is_reflink_main(&cfg);
         } else {
+            rm_metrics_start(&session);
             exit_state = rm_cmd_main(&session);
+            rm_metrics_stop(&session);
         }
     }
 
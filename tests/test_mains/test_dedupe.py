@@ -225,3 +225,38 @@ def test_clone_handler():
     counts = pattern_count(sh_path, ["^clone *'", "^skip_reflink *'"])
     assert counts[0] == 0
     assert counts[1] == 1
+
+
+@needs_reflink_fs
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_partial_clone_does_not_split_clones():
+    # a partial clone shares the first extent with the full clones, so it
+    # must not keep the full clones that sort after it from clustering
+    size = 256 * 1024
+    path_a = create_file('1' * size, 'a')
+    os.sync()
+    for name in ('b', 'c', 'p'):
+        subprocess.check_call(
+            ['cp', '--reflink=always', path_a, os.path.join(TESTDIR_NAME, name)]
+        )
+
+    path_p = os.path.join(TESTDIR_NAME, 'p')
+    with open(path_p, 'r+b') as handle:
+        handle.seek(size - 4096)
+        handle.write(b'2' * 4096)
+    os.sync()
+
+    metrics_path = os.path.join(TESTDIR_NAME, '.metrics.json')
+    head, *data, footer = run_rmlint(
+        '-S a --metrics {}'.format(metrics_path),
+        force_no_pendantic=True
+    )
+    with open(metrics_path, 'r') as handle:
+        bytes_read = json.load(handle)['shredder']['bytes_read']
+    os.remove(metrics_path)
+
+    assert footer['duplicate_sets'] == 1
+    assert sorted(os.path.basename(p['path']) for p in data) == ['a', 'b', 'c']
+
+    # the full clones are read once, the partial clone once
+    assert bytes_read <= 2 * size
@@ -44,3 +44,73 @@ def test_hash_function(*pat):
     else:
         streaming_compliance_check(pat[1:])
 
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_blake3_large_file():
+    # big enough to be hashed in several threaded batches plus a remainder
+    data = bytes(i % 251 for i in range(3 * 1024 * 1024 + 17))
+    path = os.path.join(TESTDIR_NAME, 'a')
+    with open(path, 'wb') as handle:
+        handle.write(data)
+
+    for increment in [16384, 1048576, 4 * 1048576]:
+        command = './rmlint --hash --increment {} --algorithm blake3 {}'.format(increment, path)
+        output = subprocess.check_output(command.split()).decode('utf-8')
+        assert output.split()[0] == \
+            '26003c63117013de5d02be76e5e32a2f75bfbc075f17180fd5f9f0b4752d2bfe'
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_sha_matches_hashlib():
+    import hashlib
+
+    for size in [0, 55, 56, 64, 1000, 100003]:
+        data = bytes((i * 7 + 3) % 256 for i in range(size))
+        path = os.path.join(TESTDIR_NAME, 'size_{}'.format(size))
+        with open(path, 'wb') as handle:
+            handle.write(data)
+
+        for algo in ['sha1', 'sha256']:
+            command = './rmlint --hash --algorithm {} {}'.format(algo, path)
+            output = subprocess.check_output(command.split()).decode('utf-8')
+            assert output.split()[0] == hashlib.new(algo, data).hexdigest()
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_many_files_in_order():
+    import hashlib
+
+    paths, expected = [], []
+    for idx in range(300):
+        data = bytes((idx + i) % 256 for i in range(idx * 37))
+        path = os.path.join(TESTDIR_NAME, 'file_{}'.format(idx))
+        with open(path, 'wb') as handle:
+            handle.write(data)
+        paths.append(path)
+        expected.append(hashlib.sha256(data).hexdigest())
+
+    command = ['./rmlint', '--hash', '--algorithm', 'sha256', '--readers', '8'] + paths
+    output = subprocess.check_output(command).decode('utf-8').splitlines()
+    assert [line.split()[0] for line in output] == expected
+    assert [line.split()[1] for line in output] == paths
+
+    # same from stdin, where paths come in one by one
+    process = subprocess.run(
+        ['./rmlint', '--hash', '--algorithm', 'sha256'],
+        input='\n'.join(paths).encode('utf-8'), stdout=subprocess.PIPE, check=True
+    )
+    output = process.stdout.decode('utf-8').splitlines()
+    assert [line.split()[0] for line in output] == expected
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_only_invalid_paths():
+    missing = os.path.join(TESTDIR_NAME, 'does_not_exist')
+    for args in ([missing, TESTDIR_NAME], []):
+        process = subprocess.run(
+            ['./rmlint', '--hash'] + args, input=missing.encode('utf-8'),
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE
+        )
+        assert process.returncode != 0
+        assert b'No valid paths given' in process.stderr
@@ -72,6 +72,11 @@ def test_xattr_basic():
         head, *data, footer = run_rmlint('-D -S pa --xattr-clear')
 
 
+def cached_cksum(attrs):
+    # user.rmlint.<digest>.cache holds "<cksum> <mtime> <size>"
+    return attrs["user.rmlint.blake2b.cache"].split(b' ')[0]
+
+
 @parameterized([("", ), ("-D", )])
 @with_setup(usual_setup_func, usual_teardown_func)
 def test_xattr_detail(extra_opts):
@@ -101,8 +106,8 @@ def test_xattr_detail(extra_opts):
         xattr_1 = must_read_xattr(path_1)
         xattr_2 = must_read_xattr(path_2)
         xattr_3 = must_read_xattr(path_3)
-        assert xattr_1["user.rmlint.blake2b.cksum"] == \
-                b'ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d17d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923\x00'
+        assert cached_cksum(xattr_1) == \
+                b'ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d17d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923'
         assert xattr_1 == xattr_2
 
         # no --write-unfinished given.
@@ -117,14 +122,14 @@ def test_xattr_detail(extra_opts):
             xattr_1 = must_read_xattr(path_1)
             xattr_2 = must_read_xattr(path_2)
             xattr_3 = must_read_xattr(path_3)
-            assert xattr_1["user.rmlint.blake2b.cksum"] == \
-                    b'ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d17d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923\x00'
+            assert cached_cksum(xattr_1) == \
+                    b'ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d17d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923'
             assert xattr_1 == xattr_2
 
             # --write-unfinished will also write the unfinished one.
             xattr_3 = must_read_xattr(path_3)
-            assert xattr_3["user.rmlint.blake2b.cksum"] == \
-                    b'36badf2227521b798b78d1bd43c62520a35b9b541547ff223f35f74b1168da2cd3c8d102aaee1a0cc217b601258d80151067cdee3a6352517b8fc7f7106902d3\x00'
+            assert cached_cksum(xattr_3) == \
+                    b'36badf2227521b798b78d1bd43c62520a35b9b541547ff223f35f74b1168da2cd3c8d102aaee1a0cc217b601258d80151067cdee3a6352517b8fc7f7106902d3'
 
             # unique file which was not hashed -> does not need to be touched.
             xattr_4 = must_read_xattr(path_4)
@@ -137,3 +142,83 @@ def test_xattr_detail(extra_opts):
         assert must_read_xattr(path_2) == {}
         assert must_read_xattr(path_3) == {}
         assert must_read_xattr(path_4) == {}
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_xattr_read_uses_cache():
+    if not runs_as_root():
+        # needs a non-tmpfs filesystem for user xattrs, see above.
+        return
+
+    with create_special_fs("this-is-not-tmpfs") as ext4_path:
+        base_options = "-T df -S pa -a blake2b "
+
+        path_1 = os.path.join(ext4_path, "1")
+        path_2 = os.path.join(ext4_path, "2")
+        create_file("abc", path_1)
+        create_file("abc", path_2)
+
+        head, *data, footer = run_rmlint(base_options + ' --xattr-write')
+        assert len(data) == 2
+
+        # Change the data behind rmlint's back; size and mtime still match
+        # the cache, so only a re-read would notice.
+        mtime_ns = os.stat(path_2).st_mtime_ns
+        with open(path_2, 'w') as handle:
+            handle.write("xyz")
+        os.utime(path_2, ns=(mtime_ns, mtime_ns))
+
+        # other algorithms (as in pedantic runs) have no cached digest
+        head, *data, footer = run_rmlint(
+            base_options + ' --xattr-read', force_no_pendantic=True
+        )
+        assert len(data) == 2
+        assert [p['path'] for p in data] == [path_1, path_2]
+        assert all(p['type'] == 'duplicate_file' for p in data)
+
+        head, *data, footer = run_rmlint(base_options + '--xattr-clear')
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_xattr_read_legacy():
+    if not runs_as_root():
+        # needs a non-tmpfs filesystem for user xattrs, see above.
+        return
+
+    with create_special_fs("this-is-not-tmpfs") as ext4_path:
+        base_options = "-T df -S pa -a blake2b "
+
+        path_1 = os.path.join(ext4_path, "1")
+        path_2 = os.path.join(ext4_path, "2")
+        create_file("abc", path_1)
+        create_file("abc", path_2)
+
+        head, *data, footer = run_rmlint(base_options + ' --xattr-write')
+        assert len(data) == 2
+
+        # Turn the caches into the cksum/mtime pairs older versions wrote
+        # (the checksum including its nul byte, as they did).
+        for path in path_1, path_2:
+            attrs = xattr.xattr(os.path.join(TESTDIR_NAME, path))
+            cksum, mtime, _ = attrs["user.rmlint.blake2b.cache"].split(b' ')
+            del attrs["user.rmlint.blake2b.cache"]
+            attrs["user.rmlint.blake2b.cksum"] = cksum + b'\0'
+            attrs["user.rmlint.blake2b.mtime"] = mtime
+
+        mtime_ns = os.stat(path_2).st_mtime_ns
+        with open(path_2, 'w') as handle:
+            handle.write("xyz")
+        os.utime(path_2, ns=(mtime_ns, mtime_ns))
+
+        # the legacy checksums are used, so the change goes unnoticed
+        head, *data, footer = run_rmlint(
+            base_options + ' --xattr-read', force_no_pendantic=True
+        )
+        assert [p['path'] for p in data] == [path_1, path_2]
+        assert all(p['type'] == 'duplicate_file' for p in data)
+
+        # ...and they were rewritten in the current format
+        for path in path_1, path_2:
+            assert list(must_read_xattr(path).keys()) == ["user.rmlint.blake2b.cache"]
+
+        head, *data, footer = run_rmlint(base_options + '--xattr-clear')
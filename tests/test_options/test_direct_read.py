@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+from nose import with_setup
+from tests.utils import *
+
+
+def create_big_files(base=''):
+    # big enough to take the O_DIRECT path; differ only in the middle
+    data = ['x'] * (1024 * 1024 + 123)
+    for name, mid in [('a1', 'a'), ('a2', 'a'), ('b', 'b')]:
+        data[len(data) // 2] = mid
+        create_file(''.join(data), os.path.join(base, name))
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_all_devices():
+    create_big_files()
+    create_file('small', 's1')
+    create_file('small', 's2')
+
+    for algo in ['blake2b', 'paranoid']:
+        head, *data, footer = run_rmlint('--direct-read -a {} -S a'.format(algo))
+        assert footer['duplicate_sets'] == 2
+        assert [os.path.basename(f['path']) for f in data] == ['a1', 'a2', 's1', 's2']
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_selected_device():
+    create_big_files()
+
+    head, *data, footer = run_rmlint('--direct-read={} -S a'.format(TESTDIR_NAME))
+    assert footer['duplicate_sets'] == 1
+    assert [os.path.basename(f['path']) for f in data] == ['a1', 'a2']
+
+    # clamped reads start at unaligned offsets
+    head, *data, footer = run_rmlint('--direct-read -q 4097 -S a')
+    assert footer['duplicate_sets'] == 1
+
+
+def check_paranoid_clamped(path):
+    # unaligned start offset; the buffers compared by paranoid digests must be
+    # cut the same way as without O_DIRECT
+    options = '-p -q 4097 -S a --read-buffer-len 16K'
+    results = []
+    for extra in ['', '--direct-read']:
+        head, *data, footer = run_rmlint(
+            options, extra, dir_suffix=path, force_no_pendantic=True
+        )
+        results.append(([f['path'] for f in data], footer['duplicate_sets']))
+
+    assert results[0] == results[1]
+    assert [os.path.basename(p) for p in results[0][0]] == ['a1', 'a2']
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_paranoid_clamped():
+    create_big_files()
+    check_paranoid_clamped(None)
+
+    if not runs_as_root():
+        # tmpfs does not do O_DIRECT; a real filesystem needs a mount
+        return
+
+    with create_special_fs("this-is-not-tmpfs") as ext4_path:
+        create_big_files(ext4_path)
+        check_paranoid_clamped(ext4_path)
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_bad_path():
+    create_file('xxx', 'a')
+    try:
+        run_rmlint('--direct-read=/this/path/does/not/exist')
+        assert False
+    except subprocess.CalledProcessError:
+        pass
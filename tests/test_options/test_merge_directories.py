@@ -61,6 +61,23 @@ def test_same_but_not_dupe():
     assert 0 == sum(find['type'] == 'duplicate_dir' for find in data)
     assert 3 == sum(find['type'] == 'duplicate_file' for find in data)
 
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_hidden_content_is_counted():
+    create_file('xxx', '1/a')
+    create_file('xxx', '2/a')
+    create_file('yyy', '2/.hidden/b')
+    head, *data, footer = run_rmlint('-p -D --rank-by A')
+    data = filter_part_of_directory(data)
+
+    # 2 has content that was not traversed, so it may not be a duplicate of 1
+    assert 0 == sum(find['type'] == 'duplicate_dir' for find in data)
+    assert 2 == sum(find['type'] == 'duplicate_file' for find in data)
+
+    head, *data, footer = run_rmlint('-p -D --rank-by A --hidden')
+    data = filter_part_of_directory(data)
+    assert 0 == sum(find['type'] == 'duplicate_dir' for find in data)
+
+
 @with_setup(usual_setup_func, usual_teardown_func)
 def test_hardlinks():
     create_file('xxx', '1/a')
@@ -98,6 +115,52 @@ def test_hardlinks():
     assert data[1]['path'].endswith('a')
 
 
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_snapshots():
+    create_file('xxx', 'snap1/dir/x')
+    create_file('yyyy', 'snap1/dir/y')
+    create_dirs('snap2/dir')
+    create_link('snap1/dir/x', 'snap2/dir/x')
+    create_link('snap1/dir/y', 'snap2/dir/y')
+
+    for options in ('', ' --snapshots'):
+        head, *data, footer = run_rmlint('-D -S a' + options)
+        data = filter_part_of_directory(data)
+
+        dirs = [p for p in data if p['type'] == 'duplicate_dir']
+        assert len(dirs) == 2
+        assert dirs[0]['path'].endswith('snap1')
+        assert dirs[1]['path'].endswith('snap2')
+
+        # With --snapshots the lone inodes are not read at all
+        metrics_path = os.path.join(TESTDIR_NAME, '.metrics.json')
+        head, *data, footer = run_rmlint(
+            '-D -S a --metrics {}'.format(metrics_path) + options,
+            force_no_pendantic=True
+        )
+        with open(metrics_path, 'r') as handle:
+            bytes_read = json.load(handle)['shredder']['bytes_read']
+        os.remove(metrics_path)
+
+        files = [p for p in data if p['type'] == 'part_of_directory']
+        assert len(files) == 4
+        if options:
+            assert bytes_read == 0
+            assert not any('checksum' in p for p in files)
+        else:
+            assert bytes_read > 0
+            assert all('checksum' in p for p in files)
+
+        # The inode digests must not make unrelated content look equal
+        create_file('yyyy', 'snap3/dir/y')
+        create_file('zzz', 'snap3/dir/x')
+        head, *data, footer = run_rmlint('-D -S a' + options)
+        data = filter_part_of_directory(data)
+        dirs = [p for p in data if p['type'] == 'duplicate_dir']
+        assert not any(p['path'].endswith('snap3') for p in dirs)
+        shutil.rmtree(os.path.join(TESTDIR_NAME, 'snap3'))
+
+
 @with_setup(usual_setup_func, usual_teardown_func)
 def test_deep_simple():
     create_file('xxx', 'deep/a/b/c/d/1')
@@ -452,6 +515,28 @@ def test_equal_content_different_layout():
         assert point["type"] == "duplicate_file"
 
 
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_equal_content_deeper_layout():
+    create_file('xxx', "tree-a/sub1/sub2/x")
+    create_file('yyy', "tree-a/y")
+    create_file('xxx', "tree-b/x")
+    create_file('yyy', "tree-b/y")
+
+    # Same digests twice must not look like another pair of equal files.
+    create_file('xxx', "tree-c/x1")
+    create_file('xxx', "tree-c/x2")
+    create_file('zzz', "tree-d/z1")
+    create_file('zzz', "tree-d/z2")
+
+    head, *data, footer = run_rmlint('-p -D --rank-by a')
+    data = filter_part_of_directory(data)
+
+    dirs = [p["path"] for p in data if p["type"] == "duplicate_dir"]
+    assert len(dirs) == 2
+    assert dirs[0].endswith("tree-a")
+    assert dirs[1].endswith("tree-b")
+
+
 @with_setup(usual_setup_func, usual_teardown_func)
 def test_nested_content_with_same_layout():
     create_nested('deep', 'xyzabc')
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+from nose import with_setup
+from tests.utils import *
+
+import json
+import socket
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_metrics_file():
+    create_file('xxx', 'a')
+    create_file('xxx', 'b')
+    create_file('yyy', 'sub/c')
+
+    metrics_path = os.path.join(TESTDIR_NAME, '.metrics.json')
+    head, *data, footer = run_rmlint('--metrics {}'.format(metrics_path))
+    assert footer['duplicate_sets'] == 1
+
+    with open(metrics_path, 'r') as handle:
+        metrics = json.load(handle)
+
+    assert not os.path.exists(metrics_path + '.tmp')
+    for phase in ['traverse', 'preprocess', 'shredder']:
+        assert phase in metrics['phases']
+
+    assert metrics['traverse']['files'] == 3
+    assert metrics['counters']['traverse_dirs'] >= 1
+    assert metrics['counters']['output_files'] >= 2
+    assert metrics['shredder']['bytes_read'] > 0
+    assert metrics['timings']['traverse_stat']['count'] > 0
+    assert all('disk' in device for device in metrics['devices'])
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_metrics_stream():
+    create_file('xxx', 'a')
+    create_file('xxx', 'b')
+
+    socket_path = os.path.join(TESTDIR_NAME, '.metrics.sock')
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(socket_path)
+    server.listen(1)
+
+    try:
+        # the final line fits into the socket buffer, so accept afterwards
+        head, *data, footer = run_rmlint(
+            '--metrics-stream unix:{} --metrics-interval 0'.format(socket_path),
+            force_no_pendantic=True
+        )
+        assert footer['duplicate_sets'] == 1
+
+        conn, _ = server.accept()
+        with conn.makefile('r') as stream:
+            lines = [json.loads(line) for line in stream]
+        conn.close()
+    finally:
+        server.close()
+
+    assert len(lines) == 1
+    line = lines[0]
+    assert line['done'] is True
+    assert line['shredder']['eta'] == 0
+    assert line['files'] == 2
+    assert line['shredder']['bytes_read'] > 0
+    assert line['memory']['max_rss'] > 0
+    assert all('idle' in device for device in line['devices'])
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_metrics_digest_states():
+    # several generations of progressive hashing, so that the digests of
+    # one generation are recycled for the next one
+    for idx in range(6):
+        create_file('x' * (2 * 1024 * 1024), str(idx))
+
+    metrics_path = os.path.join(TESTDIR_NAME, '.metrics.json')
+    for options in ('', ' -pp'):
+        head, *data, footer = run_rmlint(
+            '--metrics {}'.format(metrics_path) + options,
+            force_no_pendantic=True
+        )
+        assert footer['duplicate_sets'] == 1
+
+        with open(metrics_path, 'r') as handle:
+            counters = json.load(handle)['counters']
+        os.remove(metrics_path)
+
+        assert counters['digest_states'] > 6
+        assert counters['digest_states_reused'] > 0
+        assert counters['digest_states_reused'] < counters['digest_states']
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_metrics_stream_bad_target():
+    create_file('xxx', 'a')
+    for target in ['unix:/this/path/does/not/exist', 'stdout', '-1']:
+        try:
+            run_rmlint('--metrics-stream={}'.format(target))
+            assert False
+        except subprocess.CalledProcessError:
+            pass
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_metrics_stream_stalled_reader():
+    create_file('xxx', 'a')
+    create_file('xxx', 'b')
+
+    # a reader that never reads: the pipe behind the fifo is already full
+    fifo_path = os.path.join(TESTDIR_NAME, '.metrics.fifo')
+    os.mkfifo(fifo_path)
+    reader = os.open(fifo_path, os.O_RDONLY | os.O_NONBLOCK)
+    writer = os.open(fifo_path, os.O_WRONLY | os.O_NONBLOCK)
+    try:
+        while True:
+            os.write(writer, b'x' * 4096)
+    except BlockingIOError:
+        pass
+
+    try:
+        start = time.time()
+        head, *data, footer = run_rmlint(
+            '--metrics-stream 3 --metrics-interval 0 3>{}'.format(fifo_path),
+            use_shell=True, force_no_pendantic=True
+        )
+        took = time.time() - start
+    finally:
+        os.close(writer)
+        os.close(reader)
+
+    # the last line is dropped after a short wait instead of blocking the exit
+    assert footer['duplicate_sets'] == 1
+    assert took < 10
@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+from nose import with_setup
+from tests.utils import *
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_split_groups():
+    # same size, same start; differ only in the last block
+    data = ['x'] * (256 * 1024)
+    for name, last in [('a1', 'a'), ('a2', 'a'), ('b1', 'b'), ('b2', 'b'), ('c', 'c')]:
+        data[-1] = last
+        create_file(''.join(data), name)
+
+    head, *data, footer = run_rmlint('-p --paranoid-lockstep -S a')
+    assert footer['duplicate_sets'] == 2
+    assert len(data) == 4
+    assert sorted(os.path.basename(f['path']) for f in data) == ['a1', 'a2', 'b1', 'b2']
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_clamped():
+    # files only differ in the part that is skipped by -q
+    create_file('x' + 'y' * 2047, 'a')
+    create_file('z' + 'y' * 2047, 'b')
+
+    head, *data, footer = run_rmlint('-p --paranoid-lockstep')
+    assert len(data) == 0
+
+    head, *data, footer = run_rmlint('-p --paranoid-lockstep -q 1 -S a')
+    assert len(data) == 2
+    assert data[0]['path'].endswith('a')
+    assert data[1]['path'].endswith('b')
+
+
+@with_setup(usual_setup_func, usual_teardown_func)
+def test_split_hash_collisions():
+    # permutations of aligned blocks have the same (weak) candidate hash, so
+    # only the lockstep comparison can tell them apart
+    blocks = {name: name * (64 * 1024) for name in 'xyz'}
+    for name, order in [('a1', 'xyz'), ('a2', 'xyz'), ('b1', 'yxz'), ('b2', 'yxz'), ('c', 'zyx')]:
+        create_file(''.join(blocks[b] for b in order), name)
+
+    head, *data, footer = run_rmlint('-p --paranoid-lockstep --fake-lockstep-collisions -S a')
+    assert footer['duplicate_sets'] == 2
+    assert sorted(os.path.basename(f['path']) for f in data) == ['a1', 'a2', 'b1', 'b2']
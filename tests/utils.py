@@ -34,6 +34,7 @@ CKSUM_TYPES = [
     'blake2b',
     'blake2sp',
     'blake2bp',
+    'blake3',
     'xxhash',
     'highway64',
     'highway128',
@@ -240,6 +241,7 @@ def run_rmlint_pedantic(*args, **kwargs):
         '-P',
         '-PP',
         '--limit-mem 1M --algorithm=paranoid',
+        '--algorithm=paranoid --paranoid-lockstep',
         '--buffered-read',
         '--threads=1',
         '--shred-never-wait',